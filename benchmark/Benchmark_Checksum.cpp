@@ -0,0 +1,467 @@
+/***************************************************************
+ *
+ * Conformance and throughput of the checksums used to validate
+ * OpenCL_Array transfers (SHA-512, CRC32C and XXH64).
+ *
+ * Every host implementation is first checked against the NIST
+ * SHA-512 vectors and against reference implementations on
+ * randomized lengths; every device kernel is checked against the
+ * host through OpenCL_Array::Validate_Data(). Any failure stops the program.
+ * Throughputs are then reported in GB/s for sizes from 1 KB up to
+ * the given size, on the host and for a full Validate_Data() on
+ * the best device of the first platform.
+ *
+ * Usage: OclUtilsBenchmarkChecksum [log2 of the largest size (default 30)]
+ *
+ * Copyright 2011 Nicolas Bigaouette <nbigaouette@gmail.com>
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * https://github.com/nbigaouette/oclutils
+ ***************************************************************/
+
+#include <OclUtils.hpp>
+
+#include <sys/time.h>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+const double min_duration       = 0.2;          // Seconds per timing
+const uint64_t leaf_size        = 64 * 1024;    // OpenCL_Array's default
+const int nb_random_messages    = 300;
+
+enum Host_Checksum
+{
+    HOST_SHA512,
+    HOST_SHA512_TREE,
+    HOST_CRC32C,
+    HOST_CRC32C_LEAVES,
+    HOST_XXH64,
+    HOST_XXH64_TREE,
+    NB_HOST_CHECKSUMS
+};
+const char *host_checksum_names[NB_HOST_CHECKSUMS] =
+    {"sha512", "sha512 tree", "crc32c", "crc32c leaves", "xxh64", "xxh64 tree"};
+
+// **************************************************************
+double Wall_Time()
+{
+    timeval t;
+    gettimeofday(&t, NULL);
+    return double(t.tv_sec) + 1.0e-6 * double(t.tv_usec);
+}
+
+// **************************************************************
+void Check(const bool ok, const char *what, const uint64_t size)
+{
+    if (!ok)
+    {
+        std_cout << "ERROR: " << what << " gave a wrong result for " << size << " bytes! Aborting.\n" << std::flush;
+        abort();
+    }
+}
+
+// **************************************************************
+uint64_t Random_64()
+{
+    return (uint64_t(rand()) << 40) ^ (uint64_t(rand()) << 20) ^ uint64_t(rand());
+}
+
+// **************************************************************
+void Fill_Random(uint8_t *data, const uint64_t size)
+{
+    uint64_t x = Random_64() | 1;
+    for (uint64_t i = 0 ; i < size ; i++)
+    {
+        // xorshift64
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        data[i] = uint8_t(x >> 32);
+    }
+}
+
+// **************************************************************
+uint32_t CRC32C_Reference(const uint8_t *data, const uint64_t size)
+/**
+ * Bit at a time, for the table and SSE4.2 implementations.
+ */
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint64_t i = 0 ; i < size ; i++)
+    {
+        crc ^= data[i];
+        for (int k = 0 ; k < 8 ; k++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+    }
+    return ~crc;
+}
+
+// **************************************************************
+char *Padded_Copy(const uint8_t *data, const uint64_t size, uint64_t &size_bits)
+/**
+ * Padded copy of a message, as needed by OpenCL_SHA512::Calculate_Checksum*().
+ * Release with free().
+ */
+{
+    char *copy = (char *) calloc(size + 1, 1);
+    memcpy(copy, data, size);
+    size_bits = size * CHAR_BIT;
+    OpenCL_SHA512::Prepare_Array_for_Checksuming((void **) &copy, sizeof(char), size_bits);
+    return copy;
+}
+
+// **************************************************************
+void Check_SHA512_Vectors()
+/**
+ * Examples of FIPS 180-2 (appendix C) and the empty message, with every
+ * supported implementation. The multi-buffer ones get full groups plus
+ * a remainder.
+ */
+{
+    std::string a_million(1000000, 'a');
+    const char *messages[] = {"", "abc",
+                              "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+                              a_million.c_str()};
+    const char *digests[] = {"cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e",
+                             "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f",
+                             "8e959b75dae313da8cf4f72814fc143f8f7779c6eb9f7fa17299aeadb6889018501d289e4900f7e4331b99dec4b5433ac7d329eeb6dd26545e96e55b874be909",
+                             "e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973ebde0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b"};
+
+    for (int v = 0 ; v < 4 ; v++)
+    {
+        const uint64_t size = strlen(messages[v]);
+        uint8_t digest[64];
+        OpenCL_SHA512::Calculate_Message_Checksum(messages[v], size, digest);
+        Check(OpenCL_SHA512::Checksum_to_String(digest) == digests[v], "OpenCL_SHA512::Calculate_Message_Checksum()", size);
+
+        uint64_t size_bits;
+        char *padded = Padded_Copy((const uint8_t *) messages[v], size, size_bits);
+        for (int i = 0 ; i < OpenCL_SHA512::NB_IMPLEMENTATIONS ; i++)
+        {
+            const OpenCL_SHA512::Implementation implementation = OpenCL_SHA512::Implementation(i);
+            if (!OpenCL_SHA512::Implementation_Is_Supported(implementation))
+                continue;
+            const int nb = 2 * OpenCL_SHA512::Nb_Lanes(implementation) + 1;
+            std::vector<const void *> group(nb, padded);
+            std::vector<uint64_t> lengths(nb, size_bits);
+            std::vector<uint8_t> group_digests(64 * nb);
+            OpenCL_SHA512::Calculate_Checksums(nb, &group[0], &lengths[0], &group_digests[0], implementation);
+            for (int m = 0 ; m < nb ; m++)
+                Check(OpenCL_SHA512::Checksum_to_String(&group_digests[64 * m]) == digests[v],
+                      OpenCL_SHA512::Implementation_Name(implementation), size);
+        }
+        free(padded);
+    }
+}
+
+// **************************************************************
+void Check_Random_Lengths()
+/**
+ * Random messages of random lengths, clustered around block sizes, against
+ * the reference implementations.
+ */
+{
+    std::vector<uint8_t> data(8192);
+    for (int m = 0 ; m < nb_random_messages ; m++)
+    {
+        const uint64_t size = (m % 3 == 0 ? uint64_t(128 * (rand() % 40) + rand() % 5 - 2) % data.size()
+                                          : uint64_t(rand()) % data.size());
+        Fill_Random(&data[0], size);
+
+        // SHA-512: every implementation, streamed in random parts and in tree mode.
+        uint64_t size_bits;
+        char *padded = Padded_Copy(&data[0], size, size_bits);
+        uint8_t expected[64], digest[64];
+        OpenCL_SHA512::Calculate_Checksum_Reference(padded, size_bits, expected);
+        for (int i = 0 ; i < OpenCL_SHA512::NB_IMPLEMENTATIONS ; i++)
+        {
+            const OpenCL_SHA512::Implementation implementation = OpenCL_SHA512::Implementation(i);
+            if (!OpenCL_SHA512::Implementation_Is_Supported(implementation))
+                continue;
+            const int nb = OpenCL_SHA512::Nb_Lanes(implementation);
+            std::vector<const void *> group(nb, padded);
+            std::vector<uint64_t> lengths(nb, size_bits);
+            std::vector<uint8_t> group_digests(64 * nb);
+            OpenCL_SHA512::Calculate_Checksums(nb, &group[0], &lengths[0], &group_digests[0], implementation);
+            for (int l = 0 ; l < nb ; l++)
+                Check(memcmp(&group_digests[64 * l], expected, 64) == 0, OpenCL_SHA512::Implementation_Name(implementation), size);
+        }
+        free(padded);
+
+        OpenCL_SHA512::Context context;
+        const uint64_t split = (size > 0 ? uint64_t(rand()) % size : 0);
+        context.Update(&data[0], split);
+        context.Update(&data[split], size - split);
+        context.Finalize(digest);
+        Check(memcmp(digest, expected, 64) == 0, "OpenCL_SHA512::Context", size);
+
+        const uint64_t leaf = 128 * (1 + rand() % 8);
+        const uint64_t nb_leaves = OpenCL_SHA512::Nb_Leaves(size, leaf);
+        std::vector<uint8_t> leaf_digests(64 * nb_leaves);
+        for (uint64_t l = 0 ; l < nb_leaves ; l++)
+            OpenCL_SHA512::Calculate_Message_Checksum(&data[l * leaf], std::min(leaf, size - l * leaf), &leaf_digests[64 * l]);
+        OpenCL_SHA512::Calculate_Message_Checksum(&leaf_digests[0], leaf_digests.size(), expected);
+        OpenCL_SHA512::Calculate_Tree_Checksum(&data[0], size, leaf, digest);
+        Check(memcmp(digest, expected, 64) == 0, "OpenCL_SHA512::Calculate_Tree_Checksum()", size);
+
+        // CRC32C: whole, continued, combined and in leaves.
+        const uint32_t crc = CRC32C_Reference(&data[0], size);
+        Check(OpenCL_CRC32C::Calculate(&data[0], size) == crc, "OpenCL_CRC32C::Calculate()", size);
+        Check(OpenCL_CRC32C::Calculate(&data[split], size - split, OpenCL_CRC32C::Calculate(&data[0], split)) == crc,
+              "OpenCL_CRC32C::Calculate() (continued)", size);
+        Check(OpenCL_CRC32C::Combine(CRC32C_Reference(&data[0], split), CRC32C_Reference(&data[split], size - split), size - split) == crc,
+              "OpenCL_CRC32C::Combine()", size);
+        std::vector<uint32_t> leaf_crcs(nb_leaves);
+        OpenCL_CRC32C::Calculate_Leaf_Checksums(&data[0], size, leaf, &leaf_crcs[0]);
+        Check(OpenCL_CRC32C::Combine_Leaf_Checksums(&leaf_crcs[0], size, leaf) == crc, "OpenCL_CRC32C::Combine_Leaf_Checksums()", size);
+
+        // XXH64: leaves are the XXH64 of their bytes.
+        std::vector<uint64_t> leaf_hashes(nb_leaves);
+        OpenCL_XXH64::Calculate_Leaf_Checksums(&data[0], size, leaf, &leaf_hashes[0]);
+        for (uint64_t l = 0 ; l < nb_leaves ; l++)
+            Check(leaf_hashes[l] == OpenCL_XXH64::Calculate(&data[l * leaf], std::min(leaf, size - l * leaf)),
+                  "OpenCL_XXH64::Calculate_Leaf_Checksums()", size);
+    }
+}
+
+// **************************************************************
+void Check_Device(cl_context &context, const std::string &platform, cl_command_queue &queue, cl_device_id &device)
+/**
+ * Device kernels of every algorithm and mode against the host (checked
+ * above): Validate_Data() throws on a mismatch.
+ */
+{
+    const int nb_sizes = 12;
+    for (int algorithm = OPENCL_CHECKSUM_SHA512 ; algorithm <= OPENCL_CHECKSUM_XXH64 ; algorithm++)
+    {
+        for (int mode = OPENCL_CHECKSUM_FLAT ; mode <= OPENCL_CHECKSUM_TREE ; mode++)
+        {
+            for (int s = 0 ; s < nb_sizes ; s++)
+            {
+                const int N = 1 + (s < nb_sizes / 2 ? rand() % 1000 : rand() % 300000);
+                char *host = new char[N];
+                Fill_Random((uint8_t *) host, N);
+
+                OpenCL_Array<char> array;
+                array.Set_Checksum_Algorithm(OpenCL_Checksum_Algorithm(algorithm));
+                array.Set_Checksum_Mode(OpenCL_Checksum_Mode(mode), 128 * (1 + rand() % 64));
+                array.Set_Validation_Policy(OPENCL_VALIDATE_OFF);
+                array.Initialize(N, sizeof(char), host, context, CL_MEM_READ_WRITE, platform, queue, device, false);
+                array.Validate_Data();
+                array.Release_Memory();
+                delete[] host;
+            }
+        }
+    }
+}
+
+// **************************************************************
+void Host_Checksum(const int checksum, const uint8_t *data, const uint64_t size)
+{
+    const uint64_t nb_leaves = OpenCL_SHA512::Nb_Leaves(size, leaf_size);
+    uint8_t digest[64];
+    std::vector<uint32_t> leaf_crcs;
+    std::vector<uint64_t> leaf_hashes;
+    switch (checksum)
+    {
+        case HOST_SHA512:
+            OpenCL_SHA512::Calculate_Message_Checksum(data, size, digest);
+            break;
+        case HOST_SHA512_TREE:
+            OpenCL_SHA512::Calculate_Tree_Checksum(data, size, leaf_size, digest);
+            break;
+        case HOST_CRC32C:
+            OpenCL_CRC32C::Calculate(data, size);
+            break;
+        case HOST_CRC32C_LEAVES:
+            leaf_crcs.resize(nb_leaves);
+            OpenCL_CRC32C::Calculate_Leaf_Checksums(data, size, leaf_size, &leaf_crcs[0]);
+            OpenCL_CRC32C::Combine_Leaf_Checksums(&leaf_crcs[0], size, leaf_size);
+            break;
+        case HOST_XXH64:
+            OpenCL_XXH64::Calculate(data, size);
+            break;
+        case HOST_XXH64_TREE:
+            leaf_hashes.resize(nb_leaves);
+            OpenCL_XXH64::Calculate_Leaf_Checksums(data, size, leaf_size, &leaf_hashes[0]);
+            OpenCL_XXH64::Calculate_Tree_Checksum(&leaf_hashes[0], nb_leaves);
+            break;
+    }
+}
+
+// **************************************************************
+double Benchmark_Host(const int checksum, const uint8_t *data, const uint64_t size)
+/**
+ * @return GB/s, repeating for at least min_duration seconds.
+ */
+{
+    int nb_repeats = 0;
+    const double start = Wall_Time();
+    double duration;
+    do
+    {
+        Host_Checksum(checksum, data, size);
+        nb_repeats++;
+        duration = Wall_Time() - start;
+    } while (duration < min_duration);
+
+    return 1.0e-9 * double(size) * nb_repeats / duration;
+}
+
+// **************************************************************
+double Benchmark_SHA512_Implementation(const OpenCL_SHA512::Implementation implementation)
+/**
+ * @return GB/s of Calculate_Checksums() on one group of 1 MiB messages.
+ */
+{
+    const uint64_t size = 1024 * 1024;
+    const int nb = OpenCL_SHA512::Nb_Lanes(implementation);
+    std::vector<uint8_t> data(size);
+    Fill_Random(&data[0], size);
+    uint64_t size_bits;
+    char *padded = Padded_Copy(&data[0], size, size_bits);
+    std::vector<const void *> group(nb, padded);
+    std::vector<uint64_t> lengths(nb, size_bits);
+    std::vector<uint8_t> digests(64 * nb);
+
+    int nb_repeats = 0;
+    const double start = Wall_Time();
+    double duration;
+    do
+    {
+        OpenCL_SHA512::Calculate_Checksums(nb, &group[0], &lengths[0], &digests[0], implementation);
+        nb_repeats++;
+        duration = Wall_Time() - start;
+    } while (duration < min_duration);
+    free(padded);
+
+    return 1.0e-9 * double(size) * nb * nb_repeats / duration;
+}
+
+// **************************************************************
+double Benchmark_Device(const int algorithm, uint8_t *data, const uint64_t size, cl_context &context,
+                        const std::string &platform, cl_command_queue &queue, cl_device_id &device)
+/**
+ * @return GB/s of Validate_Data() in tree mode (both sides hashed and
+ *         compared), or of Host_to_Device() if "algorithm" is negative.
+ */
+{
+    cl_ulong *host = (cl_ulong *) data;
+    OpenCL_Array<cl_ulong> array;
+    if (algorithm >= 0)
+        array.Set_Checksum_Algorithm(OpenCL_Checksum_Algorithm(algorithm));
+    array.Set_Validation_Policy(OPENCL_VALIDATE_OFF);
+    array.Initialize(int(size / sizeof(cl_ulong)), sizeof(cl_ulong), host, context, CL_MEM_READ_WRITE, platform, queue, device, false);
+    if (algorithm >= 0)
+        array.Validate_Data();  // Builds the kernel
+
+    int nb_repeats = 0;
+    const double start = Wall_Time();
+    double duration;
+    do
+    {
+        if (algorithm >= 0)
+            array.Validate_Data();
+        else
+        {
+            array.Host_to_Device();
+            clFinish(queue);
+        }
+        nb_repeats++;
+        duration = Wall_Time() - start;
+    } while (duration < min_duration);
+    array.Release_Memory();
+
+    return 1.0e-9 * double(size) * nb_repeats / duration;
+}
+
+// **************************************************************
+int main(int argc, char *argv[])
+{
+    const int max_log2 = (argc > 1 ? atoi(argv[1]) : 30);
+    const uint64_t max_size = uint64_t(1) << max_log2;
+
+    OpenCL_platforms_list platforms_list;
+    platforms_list.Initialize("-1");
+    const std::string platform = platforms_list.Get_Running_Platform();
+    platforms_list[platform].Lock_Best_Device();
+    platforms_list[platform].Print_Preferred();
+
+    cl_context context  = platforms_list[platform].Preferred_OpenCL_Device_Context()();
+    cl_device_id device = platforms_list[platform].Preferred_OpenCL_Device();
+    cl_int err;
+    cl_command_queue queue = clCreateCommandQueue(context, device, 0, &err);
+    OpenCL_Test_Success(err, "clCreateCommandQueue()");
+    cl_ulong max_alloc;
+    err = clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+    OpenCL_Test_Success(err, "clGetDeviceInfo()");
+
+    // Conformance
+    OpenCL_SHA512::Validation();
+    OpenCL_CRC32C::Validation();
+    OpenCL_XXH64::Validation();
+    Check_SHA512_Vectors();
+    Check_Random_Lengths();
+    printf("Host implementations: conform (NIST vectors, %d random messages)\n", nb_random_messages);
+    Check_Device(context, platform, queue, device);
+    printf("Device kernels: conform\n\n");
+
+    // Throughput
+    printf("SHA-512 multi-buffer implementations, GB/s (one group of 1 MiB messages, one thread)\n");
+    for (int i = 0 ; i < OpenCL_SHA512::NB_IMPLEMENTATIONS ; i++)
+    {
+        const OpenCL_SHA512::Implementation implementation = OpenCL_SHA512::Implementation(i);
+        if (OpenCL_SHA512::Implementation_Is_Supported(implementation))
+            printf("%12s %8.2f\n", OpenCL_SHA512::Implementation_Name(implementation), Benchmark_SHA512_Implementation(implementation));
+    }
+    printf("\n");
+
+    std::vector<uint8_t> data(max_size);
+    Fill_Random(&data[0], max_size);
+
+    printf("Host, GB/s (%d threads, leaves of %llu bytes)\n", OpenCL_Host_Backend::Nb_Threads(), (unsigned long long) leaf_size);
+    printf("%14s", "bytes");
+    for (int c = 0 ; c < NB_HOST_CHECKSUMS ; c++)
+        printf(" %14s", host_checksum_names[c]);
+    printf("\n");
+    for (int log2 = 10 ; log2 <= max_log2 ; log2 += 2)
+    {
+        const uint64_t size = uint64_t(1) << log2;
+        printf("%14llu", (unsigned long long) size);
+        for (int c = 0 ; c < NB_HOST_CHECKSUMS ; c++)
+            printf(" %14.2f", Benchmark_Host(c, &data[0], size));
+        printf("\n");
+        fflush(stdout);
+    }
+    printf("\n");
+
+    printf("Device, GB/s (upload, and Validate_Data() in tree mode: device and host hashing, comparison)\n");
+    printf("%14s %14s %14s %14s %14s\n", "bytes", "upload", "sha512", "crc32c", "xxh64");
+    for (int log2 = 10 ; log2 <= max_log2 && (uint64_t(1) << log2) <= max_alloc ; log2 += 2)
+    {
+        const uint64_t size = uint64_t(1) << log2;
+        printf("%14llu", (unsigned long long) size);
+        printf(" %14.2f", Benchmark_Device(-1, &data[0], size, context, platform, queue, device));
+        for (int algorithm = OPENCL_CHECKSUM_SHA512 ; algorithm <= OPENCL_CHECKSUM_XXH64 ; algorithm++)
+            printf(" %14.2f", Benchmark_Device(algorithm, &data[0], size, context, platform, queue, device));
+        printf("\n");
+        fflush(stdout);
+    }
+
+    clReleaseCommandQueue(queue);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,261 @@
+/***************************************************************
+ *
+ * Conformance and throughput of OpenCL_Host_Backend, the threaded
+ * host side of the array operations.
+ *
+ * The chunking of Parallel_For() is first checked to cover every
+ * element exactly once, and every operation is checked against a
+ * plain loop, for small and odd sizes (fewer elements than chunks,
+ * partial last chunk). Any failure stops the program. Throughputs
+ * are then reported in GB/s (bytes written and read) for sizes
+ * from 1 KB up to the given size. No OpenCL device is used.
+ *
+ * Usage: OclUtilsBenchmarkHostBackend [log2 of the largest size (default 26)] [number of threads]
+ *
+ * Copyright 2011 Nicolas Bigaouette <nbigaouette@gmail.com>
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * https://github.com/nbigaouette/oclutils
+ ***************************************************************/
+
+#include <OclUtils.hpp>
+
+#include <sys/time.h>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+const double min_duration = 0.2;        // Seconds per timing
+
+// Sizes below the number of chunks, around the chunk boundaries, and odd.
+const uint64_t check_sizes[]        = { 0, 1, 2, 3, 7, 17, 63, 1000, 4097, 65537, 1000003 };
+const uint64_t check_min_chunks[]   = { 1, 3, 1000 };
+
+// **************************************************************
+double Wall_Time()
+{
+    timeval t;
+    gettimeofday(&t, NULL);
+    return double(t.tv_sec) + 1.0e-6 * double(t.tv_usec);
+}
+
+// **************************************************************
+void Check(const bool ok, const char *what, const uint64_t n)
+{
+    if (!ok)
+    {
+        std_cout << "ERROR: " << what << " gave a wrong result for n = " << n << "! Aborting.\n" << std::flush;
+        abort();
+    }
+}
+
+// **************************************************************
+struct Coverage
+{
+    uint64_t n;
+    int nb_chunks;
+    std::vector<int> visits;            // Per element
+    std::vector<int> calls;             // Per chunk
+    volatile bool ok;
+};
+
+// **************************************************************
+void Cover_Chunk(void *_coverage, const int chunk, const uint64_t begin, const uint64_t end)
+{
+    Coverage *coverage = (Coverage *) _coverage;
+    if (chunk < 0 || chunk >= coverage->nb_chunks || begin > end || end > coverage->n ||
+        (begin == end && coverage->n > 0))
+    {
+        coverage->ok = false;
+        return;
+    }
+    // Chunks are disjoint: no two threads touch the same counter.
+    coverage->calls[chunk]++;
+    for (uint64_t i = begin ; i < end ; i++)
+        coverage->visits[i]++;
+}
+
+// **************************************************************
+void Check_Parallel_For()
+{
+    for (uint64_t n = 0 ; n <= 300 ; n++)
+    {
+        for (size_t m = 0 ; m < sizeof(check_min_chunks) / sizeof(check_min_chunks[0]) ; m++)
+        {
+            Coverage coverage;
+            coverage.n          = n;
+            coverage.nb_chunks  = OpenCL_Host_Backend::Nb_Chunks(n, check_min_chunks[m]);
+            coverage.visits.assign(n, 0);
+            coverage.calls.assign(coverage.nb_chunks, 0);
+            coverage.ok         = true;
+            OpenCL_Host_Backend::Parallel_For(n, check_min_chunks[m], Cover_Chunk, &coverage);
+
+            Check(coverage.ok, "OpenCL_Host_Backend::Parallel_For() (chunk bounds)", n);
+            Check(std::count(coverage.calls.begin(), coverage.calls.end(), 1) == coverage.nb_chunks,
+                  "OpenCL_Host_Backend::Parallel_For() (chunks)", n);
+            Check(uint64_t(std::count(coverage.visits.begin(), coverage.visits.end(), 1)) == n,
+                  "OpenCL_Host_Backend::Parallel_For() (elements)", n);
+        }
+    }
+}
+
+// **************************************************************
+double Reference_Reduce(const OpenCL_Reduction_Operation operation, const std::vector<double> &a,
+                        const std::vector<double> &b)
+{
+    double value = (operation == OPENCL_REDUCTION_MIN ? HUGE_VAL : (operation == OPENCL_REDUCTION_MAX ? -HUGE_VAL : 0.0));
+    for (size_t i = 0 ; i < a.size() ; i++)
+    {
+        switch (operation)
+        {
+            case OPENCL_REDUCTION_SUM:  value += a[i];                  break;
+            case OPENCL_REDUCTION_MIN:  value = std::min(value, a[i]);  break;
+            case OPENCL_REDUCTION_MAX:  value = std::max(value, a[i]);  break;
+            case OPENCL_REDUCTION_DOT:  value += a[i] * b[i];           break;
+            case OPENCL_REDUCTION_NORM: value += a[i] * a[i];           break;
+        }
+    }
+    return (operation == OPENCL_REDUCTION_NORM ? std::sqrt(value) : value);
+}
+
+// **************************************************************
+double Reference_Elementwise(const OpenCL_Elementwise_Operation operation, const double a, const double b,
+                             const double alpha)
+{
+    switch (operation)
+    {
+        case OPENCL_ELEMENTWISE_ADD:    return a + b;
+        case OPENCL_ELEMENTWISE_SUB:    return a - b;
+        case OPENCL_ELEMENTWISE_MUL:    return a * b;
+        case OPENCL_ELEMENTWISE_DIV:    return a / b;
+        case OPENCL_ELEMENTWISE_MIN:    return std::min(a, b);
+        case OPENCL_ELEMENTWISE_MAX:    return std::max(a, b);
+        default:                        return alpha * a + b;
+    }
+}
+
+// **************************************************************
+void Check_Operations()
+/**
+ * Small integers keep every sum and product exact, whatever the order.
+ * The values are positive so that a missing chunk shows in MIN as well.
+ */
+{
+    for (size_t s = 0 ; s < sizeof(check_sizes) / sizeof(check_sizes[0]) ; s++)
+    {
+        const uint64_t n = check_sizes[s];
+        std::vector<double> a(n), b(n), out(n + 1, -1.0);
+        for (uint64_t i = 0 ; i < n ; i++)
+        {
+            a[i] = double(1 + rand() % 100);
+            b[i] = double(1 + rand() % 100);
+        }
+        // The extra element catches writes past n.
+        double *out_pointer = &out[0];
+
+        OpenCL_Host_Backend::Fill(out_pointer, n, 3.0);
+        Check(std::count(out.begin(), out.end() - 1, 3.0) == int64_t(n) && out[n] == -1.0,
+              "OpenCL_Host_Backend::Fill()", n);
+
+        if (n > 0)
+        {
+            OpenCL_Host_Backend::Copy(out_pointer, &a[0], n);
+            Check(std::equal(a.begin(), a.end(), out.begin()) && out[n] == -1.0, "OpenCL_Host_Backend::Copy()", n);
+        }
+
+        for (int operation = OPENCL_REDUCTION_SUM ; operation <= OPENCL_REDUCTION_NORM ; operation++)
+        {
+            const OpenCL_Reduction_Operation reduction = OpenCL_Reduction_Operation(operation);
+            if (n == 0 && (reduction == OPENCL_REDUCTION_MIN || reduction == OPENCL_REDUCTION_MAX))
+                continue;   // No element to compare with the identity
+            const double value = OpenCL_Host_Backend::Reduce(reduction, (n > 0 ? &a[0] : (const double *) NULL),
+                                                             (n > 0 ? &b[0] : (const double *) NULL), n);
+            Check(value == Reference_Reduce(reduction, a, b), "OpenCL_Host_Backend::Reduce()", n);
+        }
+
+        if (n == 0)
+            continue;
+        for (int operation = OPENCL_ELEMENTWISE_ADD ; operation <= OPENCL_ELEMENTWISE_AXPY ; operation++)
+        {
+            const OpenCL_Elementwise_Operation elementwise = OpenCL_Elementwise_Operation(operation);
+            out[n] = -1.0;
+            OpenCL_Host_Backend::Elementwise(elementwise, out_pointer, &a[0], &b[0], 2.0, n);
+            bool ok = (out[n] == -1.0);
+            for (uint64_t i = 0 ; i < n && ok ; i++)
+                ok = (out[i] == Reference_Elementwise(elementwise, a[i], b[i], 2.0));
+            Check(ok, "OpenCL_Host_Backend::Elementwise()", n);
+        }
+    }
+}
+
+// **************************************************************
+double Benchmark(const int operation, double *out, const double *a, const double *b, const uint64_t n)
+/**
+ * @return GB/s (bytes written and read), repeating for at least min_duration seconds.
+ */
+{
+    const int nb_arrays[] = { 1, 2, 1, 3 };     // Fill, copy, sum, add
+
+    int nb_repeats = 0;
+    const double start = Wall_Time();
+    double duration;
+    volatile double sink = 0.0;
+    do
+    {
+        switch (operation)
+        {
+            case 0:     OpenCL_Host_Backend::Fill(out, n, 1.0);                                             break;
+            case 1:     OpenCL_Host_Backend::Copy(out, a, n);                                               break;
+            case 2:     sink = OpenCL_Host_Backend::Reduce(OPENCL_REDUCTION_SUM, a, b, n);                  break;
+            default:    OpenCL_Host_Backend::Elementwise(OPENCL_ELEMENTWISE_ADD, out, a, b, 0.0, n);        break;
+        }
+        nb_repeats++;
+        duration = Wall_Time() - start;
+    } while (duration < min_duration);
+    (void) sink;
+
+    return 1.0e-9 * double(nb_arrays[operation] * n * sizeof(double)) * nb_repeats / duration;
+}
+
+// **************************************************************
+int main(int argc, char *argv[])
+{
+    const int max_log2 = (argc > 1 ? atoi(argv[1]) : 26);
+    if (argc > 2)
+        OpenCL_Host_Backend::Set_Nb_Threads(atoi(argv[2]));
+
+    // Conformance
+    Check_Parallel_For();
+    Check_Operations();
+    printf("Host backend: conform (%d threads)\n\n", OpenCL_Host_Backend::Nb_Threads());
+
+    // Throughput
+    const uint64_t max_n = (uint64_t(1) << max_log2) / sizeof(double);
+    std::vector<double> a(max_n, 1.0), b(max_n, 2.0), out(max_n);
+
+    printf("GB/s, double (%d threads)\n", OpenCL_Host_Backend::Nb_Threads());
+    printf("%14s %14s %14s %14s %14s\n", "bytes", "fill", "copy", "sum", "add");
+    for (int log2 = 10 ; log2 <= max_log2 ; log2 += 2)
+    {
+        const uint64_t n = (uint64_t(1) << log2) / sizeof(double);
+        printf("%14llu", (unsigned long long) (n * sizeof(double)));
+        for (int operation = 0 ; operation < 4 ; operation++)
+            printf(" %14.2f", Benchmark(operation, &out[0], &a[0], &b[0], n));
+        printf("\n");
+        fflush(stdout);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,230 @@
+/***************************************************************
+ *
+ * Throughput of the scan and radix sort primitives on the best
+ * device of the first platform, for growing array sizes. Results
+ * are checked against the host before being timed, and first for
+ * small and odd sizes (partial and single blocks, remainders).
+ *
+ * Usage: OclUtilsBenchmarkScanSort [log2 of the largest size (default 24)]
+ *
+ * Copyright 2011 Nicolas Bigaouette <nbigaouette@gmail.com>
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * https://github.com/nbigaouette/oclutils
+ ***************************************************************/
+
+#include <OclUtils.hpp>
+
+#include <sys/time.h>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <limits>
+
+const int nb_repeats = 10;
+
+// **************************************************************
+double Wall_Time()
+{
+    timeval t;
+    gettimeofday(&t, NULL);
+    return double(t.tv_sec) + 1.0e-6 * double(t.tv_usec);
+}
+
+// **************************************************************
+void Wait_and_Release(cl_event event)
+{
+    clWaitForEvents(1, &event);
+    clReleaseEvent(event);
+}
+
+// **************************************************************
+void Check(const bool ok, const char *what, const int N)
+{
+    if (!ok)
+    {
+        std_cout << "ERROR: " << what << " gave a wrong result for N = " << N << "! Aborting.\n" << std::flush;
+        abort();
+    }
+}
+
+// **************************************************************
+double Benchmark_Scan(OpenCL_Scan<int> &scan, const int N, cl_context &context, const std::string &platform,
+                      cl_command_queue &queue, cl_device_id &device, const bool timed = true)
+/**
+ * @return Millions of elements scanned per second (exclusive scan, in place),
+ *         0 if not timed (result checked only).
+ */
+{
+    int *host = new int[N];
+    std::vector<int> input(N);
+    for (int i = 0 ; i < N ; i++)
+        input[i] = host[i] = rand() % 16;
+
+    OpenCL_Array<int> array;
+    array.Initialize(N, sizeof(int), host, context, CL_MEM_READ_WRITE, platform, queue, device, false);
+    array.Host_to_Device();
+
+    Wait_and_Release(scan.Exclusive(array));
+    array.Device_to_Host();
+    clFinish(queue);
+    int sum = 0;
+    for (int i = 0 ; i < N ; i++)
+    {
+        Check(host[i] == sum, "OpenCL_Scan<int>::Exclusive()", N);
+        sum += input[i];
+    }
+
+    double rate = 0.0;
+    if (timed)
+    {
+        const double start = Wall_Time();
+        for (int r = 0 ; r < nb_repeats ; r++)
+            Wait_and_Release(scan.Exclusive(array));
+        rate = 1.0e-6 * double(N) * nb_repeats / (Wall_Time() - start);
+    }
+
+    array.Release_Memory();
+    delete[] host;
+
+    return rate;
+}
+
+// **************************************************************
+template <class K>
+double Benchmark_Sort(OpenCL_Radix_Sort<K> &sort, const bool with_values, const int N, cl_context &context,
+                      const std::string &platform, cl_command_queue &queue, cl_device_id &device,
+                      const bool timed = true)
+/**
+ * @return Millions of keys sorted per second, 0 if not timed (result
+ *         checked only). The timed sorts run on already sorted keys: an
+ *         LSD radix sort does the same work.
+ */
+{
+    K *keys_host = new K[N];
+    unsigned int *values_host = new unsigned int[N];
+    std::vector<K> input(N);
+    for (int i = 0 ; i < N ; i++)
+    {
+        if (std::numeric_limits<K>::is_signed)
+            input[i] = keys_host[i] = K((double(rand()) - double(RAND_MAX / 2)) / 7.0);
+        else
+            input[i] = keys_host[i] = K(K(rand()) * K(rand()));
+        values_host[i] = i;
+    }
+
+    OpenCL_Array<K> keys;
+    OpenCL_Array<unsigned int> values;
+    keys.Initialize(N, sizeof(K), keys_host, context, CL_MEM_READ_WRITE, platform, queue, device, false);
+    keys.Host_to_Device();
+    if (with_values)
+    {
+        values.Initialize(N, sizeof(unsigned int), values_host, context, CL_MEM_READ_WRITE, platform, queue, device, false);
+        values.Host_to_Device();
+    }
+
+    Wait_and_Release(with_values ? sort.Sort(keys, values) : sort.Sort(keys));
+    keys.Device_to_Host();
+    if (with_values)
+        values.Device_to_Host();
+    clFinish(queue);
+    std::vector<K> expected(input);
+    std::stable_sort(expected.begin(), expected.end());
+    for (int i = 0 ; i < N ; i++)
+    {
+        Check(keys_host[i] == expected[i], "OpenCL_Radix_Sort::Sort()", N);
+        if (with_values)
+            Check(input[values_host[i]] == keys_host[i] && (i == 0 || keys_host[i - 1] != keys_host[i] || values_host[i - 1] < values_host[i]),
+                  "OpenCL_Radix_Sort::Sort() (values)", N);
+    }
+
+    double rate = 0.0;
+    if (timed)
+    {
+        const double start = Wall_Time();
+        for (int r = 0 ; r < nb_repeats ; r++)
+            Wait_and_Release(with_values ? sort.Sort(keys, values) : sort.Sort(keys));
+        rate = 1.0e-6 * double(N) * nb_repeats / (Wall_Time() - start);
+    }
+
+    keys.Release_Memory();
+    if (with_values)
+        values.Release_Memory();
+    delete[] keys_host;
+    delete[] values_host;
+
+    return rate;
+}
+
+// **************************************************************
+int main(int argc, char *argv[])
+{
+    const int max_log2 = (argc > 1 ? atoi(argv[1]) : 24);
+
+    OpenCL_platforms_list platforms_list;
+    platforms_list.Initialize("-1");
+    const std::string platform = platforms_list.Get_Running_Platform();
+    platforms_list[platform].Lock_Best_Device();
+    platforms_list[platform].Print_Preferred();
+
+    cl_context context  = platforms_list[platform].Preferred_OpenCL_Device_Context()();
+    cl_device_id device = platforms_list[platform].Preferred_OpenCL_Device();
+    cl_int err;
+    cl_command_queue queue = clCreateCommandQueue(context, device, 0, &err);
+    OpenCL_Test_Success(err, "clCreateCommandQueue()");
+
+    OpenCL_Scan<int> scan;
+    OpenCL_Radix_Sort<unsigned int> sort_uint;
+    OpenCL_Radix_Sort<float> sort_float;
+    OpenCL_Radix_Sort<cl_ulong> sort_ulong;
+    scan.Initialize(context, queue, device);
+    sort_uint.Initialize(context, queue, device);
+    sort_float.Initialize(context, queue, device);
+    sort_ulong.Initialize(context, queue, device);
+
+    // Sizes below a work-group, a single block, a partial last block and a
+    // one element tail past full blocks (scan add phase, sort remainder chunk).
+    const int check_sizes[] = { 1, 7, 1000, 65537 };
+    for (size_t i = 0 ; i < sizeof(check_sizes) / sizeof(check_sizes[0]) ; i++)
+    {
+        const int N = check_sizes[i];
+        Benchmark_Scan(scan, N, context, platform, queue, device, false);
+        Benchmark_Sort(sort_uint,  false, N, context, platform, queue, device, false);
+        Benchmark_Sort(sort_float, true,  N, context, platform, queue, device, false);
+        Benchmark_Sort(sort_ulong, false, N, context, platform, queue, device, false);
+    }
+    printf("Results checked for N = 1, 7, 1000 and 65537\n");
+
+    printf("Millions of elements per second (average of %d runs)\n", nb_repeats);
+    printf("%12s %14s %14s %20s %14s\n", "N", "scan int", "sort uint", "sort float+uint", "sort ulong");
+    for (int log2 = 16 ; log2 <= max_log2 ; log2 += 2)
+    {
+        const int N = 1 << log2;
+        printf("%12d", N);
+        printf(" %14.1f", Benchmark_Scan(scan, N, context, platform, queue, device));
+        printf(" %14.1f", Benchmark_Sort(sort_uint,  false, N, context, platform, queue, device));
+        printf(" %20.1f", Benchmark_Sort(sort_float, true,  N, context, platform, queue, device));
+        printf(" %14.1f", Benchmark_Sort(sort_ulong, false, N, context, platform, queue, device));
+        printf("\n");
+        fflush(stdout);
+    }
+
+    scan.Release_Memory();
+    sort_uint.Release_Memory();
+    sort_float.Release_Memory();
+    sort_ulong.Release_Memory();
+    clReleaseCommandQueue(queue);
+
+    return EXIT_SUCCESS;
+}
@@ -20,15 +20,30 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/mman.h>   // mmap()
 
+#include <cassert>
 #include <cerrno>       // errno, EWOULDBLOCK
 #include <cstring>      // strlen()
 #include <cmath>
 #include <algorithm>    // std::ostringstream
+#include <limits>       // std::numeric_limits
 #include <sstream>
 #include <unistd.h>     // getpid()
 
 #include <sys/time.h> // timeval
+#include <time.h>     // clock_gettime()
+#include <sys/uio.h>  // struct iovec
+#include <pthread.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif // #ifdef __SSE2__
+
+#ifdef OCLUTILS_HAVE_IO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif // #ifdef OCLUTILS_HAVE_IO_URING
 
 #include "OclUtils.hpp"
 
@@ -42,21 +57,14 @@
 #define QUOTEME(x) _QUOTEME(x)
 #endif // #ifndef QUOTEME
 
-#define assert(x)                                       \
-    if (!(x)) {                                         \
-        std_cout                                        \
-            << "##########################"             \
-            << "##########################"             \
-            << "##########################\n"           \
-            << "Assertion failed in \"" << __FILE__     \
-            << "\", line " << __LINE__ << ": "          \
-            << "!(" << QUOTEME(x) << ")\n"              \
-            << "##########################"             \
-            << "##########################"             \
-            << "##########################\n"           \
-            << std::flush;                              \
-        abort();                                        \
-    }
+// Checks of arguments and state, thrown like any other error (see
+// OpenCL_Exception) whatever NDEBUG. Internal invariants use assert().
+#define OpenCL_Assert(x)                                            \
+    do {                                                            \
+        if (!(x))                                                   \
+            OpenCL_Throw(CL_INVALID_VALUE, "OpenCL_Assert",         \
+                         "Assertion failed: !(" QUOTEME(x) ")");    \
+    } while (0)
 
 // *****************************************************************************
 const double B_to_KiB   = 9.76562500000000e-04;
@@ -75,6 +83,9 @@ const double GiB_to_MiB = 1024.0;
 // *****************************************************************************
 // **************** Local functions prototypes *********************************
 void Print_N_Times(const std::string x, const int N, const bool newline = true);
+std::string Exception_Message(const cl_int error, const std::string &call, const std::string &message,
+                              const char *file, const int line);
+void Report_Exception_in_Destructor(const OpenCL_Exception &exception);
 std::string Get_Lock_Filename(const int device_id, const int platform_id_offset,
                               const std::string &platform_name, const std::string &device_name);
 int Lock_File(const char *path, const bool quiet = false);
@@ -83,6 +94,706 @@ void Wait(const double duration_sec);
 
 void * calloc_and_check(uint64_t nb, size_t s, std::string msg = "");
 
+void Coherence_Bind(cl_kernel kernel, const int order, OpenCL_Resident *array, const bool kernel_writes);
+void Coherence_Unbind(cl_kernel kernel, const int order);
+void Coherence_Forget(OpenCL_Resident *array);
+void Coherence_Prepare_Launch(cl_kernel kernel);
+
+cl_event Completed_Event(cl_context context);
+inline bool Use_Host_Backend(const OpenCL_Backend backend, const bool host_is_preferred);
+
+class OpenCL_Pin_Guard
+/**
+ * Arrays pinned (see OpenCL_Resident::Pin()) until the guard is destroyed,
+ * even through an exception.
+ */
+{
+private:
+    std::vector<OpenCL_Resident *> pinned;
+
+    OpenCL_Pin_Guard(const OpenCL_Pin_Guard &);             // Not copyable
+    OpenCL_Pin_Guard & operator=(const OpenCL_Pin_Guard &);
+
+public:
+    OpenCL_Pin_Guard()                      {}
+    ~OpenCL_Pin_Guard()                     { Unpin_All(); }
+    void Pin(OpenCL_Resident &array)        { pinned.push_back(&array); array.Pin(); }
+    void Unpin_All()                        { while (!pinned.empty()) { pinned.back()->Unpin(); pinned.pop_back(); } }
+};
+
+// *****************************************************************************
+// Trace recording (see OpenCL_Trace)
+uint64_t Trace_Now_ns();
+void Trace_Device_Span(const cl_command_queue command_queue, const cl_event event, const char *category,
+                       const std::string &name, const uint64_t bytes, const uint64_t enqueue_ns);
+
+class OpenCL_Trace_Scope
+/**
+ * Host span of the calling thread, from construction to destruction (even
+ * through an exception). Its name is "name" followed by "suffix". Both are C
+ * strings, only copied when tracing: callers must not build a std::string
+ * for it, so that the span costs nothing more than a test when not tracing.
+ */
+{
+private:
+    const char *category;
+    char        name[64];
+    uint64_t    start_ns;               // 0 when not traced
+    uint64_t    bytes;
+
+public:
+    OpenCL_Trace_Scope(const char *_category, const char *_name, const char *_suffix = "", const uint64_t _bytes = 0);
+    ~OpenCL_Trace_Scope();
+    void Close();                       // End the span before the destruction
+};
+
+// **************************************************************
+template <class Info>
+Info Get_Device_Info(const cl_device_id device, const cl_device_info param, const char *param_name)
+/**
+ * Query a single (scalar) information about a device.
+ * Useful for classes that only get a cl_device_id instead of an OpenCL_device.
+ */
+{
+    Info value;
+    cl_int err = clGetDeviceInfo(device, param, sizeof(Info), &value, NULL);
+    OpenCL_Test_Success(err, param_name);
+    return value;
+}
+
+// **************************************************************
+// Size of the chunks in which file backed arrays are streamed to the device.
+const uint64_t File_Streaming_Chunk_Size = 64 * 1024 * 1024;
+
+// **************************************************************
+void Advise_Mapped_Pages(void *address, const uint64_t length, const int advice)
+/**
+ * madvise() on a range of a mapping that might not start on a page boundary.
+ * Advices are only hints: errors are ignored.
+ */
+{
+    const uintptr_t page_size   = uintptr_t(sysconf(_SC_PAGESIZE));
+    const uintptr_t start       = uintptr_t(address) & ~(page_size - 1);
+    const uintptr_t end         = uintptr_t(address) + length;
+    madvise((void *) start, end - start, advice);
+}
+
+// **************************************************************
+std::map<cl_device_id, bool> device_supports_opencl_1_2;
+pthread_mutex_t device_supports_opencl_1_2_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// **************************************************************
+bool Device_Supports_OpenCL_1_2(const cl_device_id device)
+/**
+ * CL_DEVICE_VERSION is formatted as "OpenCL <major>.<minor> <vendor specific>".
+ * Returns false if either the headers or the device predate OpenCL 1.2.
+ * The answer is cached per device: it is asked on every OpenCL_Array::Fill().
+ */
+{
+#ifdef CL_VERSION_1_2
+    pthread_mutex_lock(&device_supports_opencl_1_2_mutex);
+    std::map<cl_device_id, bool>::const_iterator cached = device_supports_opencl_1_2.find(device);
+    const bool found = (cached != device_supports_opencl_1_2.end());
+    const bool cached_supports = (found ? cached->second : false);
+    pthread_mutex_unlock(&device_supports_opencl_1_2_mutex);
+    if (found)
+        return cached_supports;
+
+    char version[4096];
+    cl_int err = clGetDeviceInfo(device, CL_DEVICE_VERSION, sizeof(version), &version, NULL);
+    OpenCL_Test_Success(err, "clGetDeviceInfo (CL_DEVICE_VERSION)");
+    int major = 0, minor = 0;
+    const bool supports = (sscanf(version, "OpenCL %d.%d", &major, &minor) == 2 &&
+                           (major > 1 || (major == 1 && minor >= 2)));
+
+    pthread_mutex_lock(&device_supports_opencl_1_2_mutex);
+    device_supports_opencl_1_2[device] = supports;
+    pthread_mutex_unlock(&device_supports_opencl_1_2_mutex);
+    return supports;
+#else
+    return false;
+#endif // #ifdef CL_VERSION_1_2
+}
+
+// **************************************************************
+// Kernel used by OpenCL_Array::Fill() when clEnqueueFillBuffer() is not available.
+// The pattern is passed by value so its bytes are copied as is.
+const char kernel_Fill_source[] =
+    "__kernel void OclUtils_Fill(__global uchar *buffer, const ulong pattern,\n"
+    "                            const uint pattern_size, const ulong offset_bytes,\n"
+    "                            const ulong nb_elements)\n"
+    "{\n"
+    "    const ulong i = get_global_id(0);\n"
+    "    if (i >= nb_elements)\n"
+    "        return;\n"
+    "    const uchar *bytes = (const uchar *) &pattern;\n"
+    "    __global uchar *element = buffer + offset_bytes + i * pattern_size;\n"
+    "    for (uint b = 0 ; b < pattern_size ; b++)\n"
+    "        element[b] = bytes[b];\n"
+    "}\n";
+
+// **************************************************************
+// Kernel used by OpenCL_Reducer. Compiled with:
+//   -DT=<type> -DW=<vector width> -DIDENTITY=<value> -DOP_<operation>
+//   [-DCONTIGUOUS] (single pass variant, one work item per work-group)
+//   [-DOCLUTILS_FP64] (T is double)
+const char kernel_Reduce_source[] =
+    "#ifdef OCLUTILS_FP64\n"
+    "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n"
+    "#endif\n"
+    "#define CONCAT_(a, b) a##b\n"
+    "#define CONCAT(a, b) CONCAT_(a, b)\n"
+    "#if defined(OP_MIN)\n"
+    "#define OP(x, y) min((x), (y))\n"
+    "#elif defined(OP_MAX)\n"
+    "#define OP(x, y) max((x), (y))\n"
+    "#else\n"
+    "#define OP(x, y) ((x) + (y))\n"
+    "#endif\n"
+    "#if defined(OP_DOT)\n"
+    "#define F(x, y) ((x) * (y))\n"
+    "#elif defined(OP_NORM)\n"
+    "#define F(x, y) ((x) * (x))\n"
+    "#else\n"
+    "#define F(x, y) (x)\n"
+    "#endif\n"
+    "#if W == 1\n"
+    "#define VT T\n"
+    "#define VLOAD(i, p) ((p)[i])\n"
+    "#else\n"
+    "#define VT CONCAT(T, W)\n"
+    "#define VLOAD(i, p) CONCAT(vload, W)((i), (p))\n"
+    "#endif\n"
+    "\n"
+    "__kernel void OclUtils_Reduce(__global const T *a, __global const T *b, const ulong n,\n"
+    "                              __global T *partials, __local T *scratch)\n"
+    "{\n"
+    "    const ulong nb_vectors  = n / W;\n"
+    "    const ulong gid         = get_global_id(0);\n"
+    "    const ulong gsize       = get_global_size(0);\n"
+    "    VT vacc = (VT) (IDENTITY);\n"
+    "#ifdef CONTIGUOUS\n"
+    "    const ulong per_item = (nb_vectors + gsize - 1) / gsize;\n"
+    "    const ulong begin    = min(gid * per_item, nb_vectors);\n"
+    "    const ulong end      = min(begin + per_item, nb_vectors);\n"
+    "    for (ulong i = begin ; i < end ; i++)\n"
+    "#else\n"
+    "    for (ulong i = gid ; i < nb_vectors ; i += gsize)\n"
+    "#endif\n"
+    "    {\n"
+    "        const VT x = VLOAD(i, a);\n"
+    "#ifdef OP_DOT\n"
+    "        const VT y = VLOAD(i, b);\n"
+    "#endif\n"
+    "        vacc = OP(vacc, F(x, y));\n"
+    "    }\n"
+    "\n"
+    "    // Horizontal reduction of the vector accumulator\n"
+    "#if W == 16\n"
+    "    CONCAT(T, 8) v8 = OP(vacc.lo, vacc.hi);\n"
+    "#elif W == 8\n"
+    "    CONCAT(T, 8) v8 = vacc;\n"
+    "#endif\n"
+    "#if W >= 8\n"
+    "    CONCAT(T, 4) v4 = OP(v8.lo, v8.hi);\n"
+    "#elif W == 4\n"
+    "    CONCAT(T, 4) v4 = vacc;\n"
+    "#endif\n"
+    "#if W >= 4\n"
+    "    CONCAT(T, 2) v2 = OP(v4.lo, v4.hi);\n"
+    "#elif W == 2\n"
+    "    CONCAT(T, 2) v2 = vacc;\n"
+    "#endif\n"
+    "#if W >= 2\n"
+    "    T acc = OP(v2.lo, v2.hi);\n"
+    "#else\n"
+    "    T acc = vacc;\n"
+    "#endif\n"
+    "\n"
+    "    // Elements past the last complete vector\n"
+    "    for (ulong i = nb_vectors * W + gid ; i < n ; i += gsize)\n"
+    "    {\n"
+    "        const T x = a[i];\n"
+    "#ifdef OP_DOT\n"
+    "        const T y = b[i];\n"
+    "#endif\n"
+    "        acc = OP(acc, F(x, y));\n"
+    "    }\n"
+    "\n"
+    "#ifdef CONTIGUOUS\n"
+    "    partials[get_group_id(0)] = acc;\n"
+    "#else\n"
+    "    // Tree reduction in local memory (the work-group size is a power of two)\n"
+    "    const uint lid = get_local_id(0);\n"
+    "    scratch[lid] = acc;\n"
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "    for (uint s = get_local_size(0) / 2 ; s > 0 ; s >>= 1)\n"
+    "    {\n"
+    "        if (lid < s)\n"
+    "            scratch[lid] = OP(scratch[lid], scratch[lid + s]);\n"
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "    }\n"
+    "    if (lid == 0)\n"
+    "        partials[get_group_id(0)] = scratch[0];\n"
+    "#endif\n"
+    "}\n";
+
+// **************************************************************
+// Kernels used by OpenCL_Scan. Compiled with:
+//   -DT=<type>
+//   [-DLOG_NB_BANKS=<n>] (pad the local memory against bank conflicts)
+//   [-DCONTIGUOUS] (one work item per chunk instead of per element)
+//   [-DOCLUTILS_FP64] (T is double)
+const char kernel_Scan_source[] =
+    "#ifdef OCLUTILS_FP64\n"
+    "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n"
+    "#endif\n"
+    "#ifdef LOG_NB_BANKS\n"
+    "#define PAD(i) ((i) + ((i) >> LOG_NB_BANKS))\n"
+    "#else\n"
+    "#define PAD(i) (i)\n"
+    "#endif\n"
+    "\n"
+    "// Work-efficient scan of blocks of 2 x get_local_size(0) elements.\n"
+    "__kernel void OclUtils_Scan_Blocks(__global const T *in, __global T *out, __global T *block_sums,\n"
+    "                                   const ulong n, const uint inclusive, __local T *scratch)\n"
+    "{\n"
+    "    const uint  lid     = get_local_id(0);\n"
+    "    const uint  L       = get_local_size(0);\n"
+    "    const ulong base    = (ulong) get_group_id(0) * 2 * L;\n"
+    "    const uint  ai      = lid;\n"
+    "    const uint  bi      = lid + L;\n"
+    "    const T     a       = (base + ai < n ? in[base + ai] : (T) 0);\n"
+    "    const T     b       = (base + bi < n ? in[base + bi] : (T) 0);\n"
+    "    scratch[PAD(ai)] = a;\n"
+    "    scratch[PAD(bi)] = b;\n"
+    "\n"
+    "    // Up-sweep: partial sums of growing subtrees\n"
+    "    uint offset = 1;\n"
+    "    for (uint d = L ; d > 0 ; d >>= 1)\n"
+    "    {\n"
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "        if (lid < d)\n"
+    "        {\n"
+    "            const uint i = offset * (2 * lid + 1) - 1;\n"
+    "            const uint j = offset * (2 * lid + 2) - 1;\n"
+    "            scratch[PAD(j)] += scratch[PAD(i)];\n"
+    "        }\n"
+    "        offset <<= 1;\n"
+    "    }\n"
+    "\n"
+    "    // The root holds the block total (written by work item 0 itself)\n"
+    "    if (lid == 0)\n"
+    "    {\n"
+    "        block_sums[get_group_id(0)] = scratch[PAD(2 * L - 1)];\n"
+    "        scratch[PAD(2 * L - 1)] = (T) 0;\n"
+    "    }\n"
+    "\n"
+    "    // Down-sweep: distribute the prefixes back down the tree\n"
+    "    for (uint d = 1 ; d < 2 * L ; d <<= 1)\n"
+    "    {\n"
+    "        offset >>= 1;\n"
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "        if (lid < d)\n"
+    "        {\n"
+    "            const uint i = offset * (2 * lid + 1) - 1;\n"
+    "            const uint j = offset * (2 * lid + 2) - 1;\n"
+    "            const T    t = scratch[PAD(i)];\n"
+    "            scratch[PAD(i)]  = scratch[PAD(j)];\n"
+    "            scratch[PAD(j)] += t;\n"
+    "        }\n"
+    "    }\n"
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "\n"
+    "    if (base + ai < n)\n"
+    "        out[base + ai] = (inclusive ? scratch[PAD(ai)] + a : scratch[PAD(ai)]);\n"
+    "    if (base + bi < n)\n"
+    "        out[base + bi] = (inclusive ? scratch[PAD(bi)] + b : scratch[PAD(bi)]);\n"
+    "}\n"
+    "\n"
+    "// Sequential scan of one chunk of \"chunk\" elements per work item.\n"
+    "__kernel void OclUtils_Scan_Chunks(__global const T *in, __global T *out, __global T *block_sums,\n"
+    "                                   const ulong n, const uint inclusive, const ulong chunk)\n"
+    "{\n"
+    "    const ulong g       = get_global_id(0);\n"
+    "    const ulong begin   = min(g * chunk, n);\n"
+    "    const ulong end     = min(begin + chunk, n);\n"
+    "    T sum = (T) 0;\n"
+    "    for (ulong i = begin ; i < end ; i++)\n"
+    "    {\n"
+    "        const T x = in[i];\n"
+    "        out[i] = (inclusive ? sum + x : sum);\n"
+    "        sum += x;\n"
+    "    }\n"
+    "    block_sums[g] = sum;\n"
+    "}\n"
+    "\n"
+    "// Add to each block the (exclusive) scan of the block totals.\n"
+    "__kernel void OclUtils_Scan_Add(__global T *out, __global const T *block_offsets,\n"
+    "                                const ulong n, const ulong block_size)\n"
+    "{\n"
+    "#ifdef CONTIGUOUS\n"
+    "    const ulong g       = get_global_id(0);\n"
+    "    const ulong begin   = min(g * block_size, n);\n"
+    "    const ulong end     = min(begin + block_size, n);\n"
+    "    const T offset      = block_offsets[g];\n"
+    "    for (ulong i = begin ; i < end ; i++)\n"
+    "        out[i] += offset;\n"
+    "#else\n"
+    "    const ulong i = get_global_id(0);\n"
+    "    if (i < n)\n"
+    "        out[i] += block_offsets[i / block_size];\n"
+    "#endif\n"
+    "}\n";
+
+// **************************************************************
+// Kernels used by OpenCL_Radix_Sort. Compiled with:
+//   -DKEY_BITS=<32 or 64> -DRADIX_BITS=<bits per digit>
+//   [-DKEY_SIGNED | -DKEY_FLOAT] (map the keys to order-preserving unsigned integers)
+//   [-DVALUE=<uint, ulong or uint4>] (move values along with the keys)
+// Each work item handles the same contiguous chunk in both kernels.
+const char kernel_Radix_Sort_source[] =
+    "#if KEY_BITS == 64\n"
+    "#define KEY ulong\n"
+    "#define SIGN_BIT 0x8000000000000000UL\n"
+    "#else\n"
+    "#define KEY uint\n"
+    "#define SIGN_BIT 0x80000000U\n"
+    "#endif\n"
+    "#if defined(KEY_FLOAT)\n"
+    "#define ORDERED(k) (((k) & SIGN_BIT) ? ~(k) : ((k) | SIGN_BIT))\n"
+    "#elif defined(KEY_SIGNED)\n"
+    "#define ORDERED(k) ((k) ^ SIGN_BIT)\n"
+    "#else\n"
+    "#define ORDERED(k) (k)\n"
+    "#endif\n"
+    "#define RADIX (1 << RADIX_BITS)\n"
+    "#define DIGIT(k, shift) ((uint) (ORDERED(k) >> (shift)) & (RADIX - 1))\n"
+    "#ifndef VALUE\n"
+    "#define VALUE_TYPE uint\n"
+    "#else\n"
+    "#define VALUE_TYPE VALUE\n"
+    "#endif\n"
+    "\n"
+    "#define CHUNK_RANGE                                             \\\n"
+    "    const ulong w           = get_global_id(0);                 \\\n"
+    "    const ulong nw          = get_global_size(0);               \\\n"
+    "    const ulong per_item    = (n + nw - 1) / nw;                \\\n"
+    "    const ulong begin       = min(w * per_item, n);             \\\n"
+    "    const ulong end         = min(begin + per_item, n);\n"
+    "\n"
+    "__kernel void OclUtils_Radix_Histogram(__global const KEY *keys, const ulong n, const uint shift,\n"
+    "                                       __global uint *histogram)\n"
+    "{\n"
+    "    CHUNK_RANGE\n"
+    "    uint counts[RADIX];\n"
+    "    for (uint d = 0 ; d < RADIX ; d++)\n"
+    "        counts[d] = 0;\n"
+    "    for (ulong i = begin ; i < end ; i++)\n"
+    "        counts[DIGIT(keys[i], shift)]++;\n"
+    "    // Digit major: an exclusive scan gives each chunk its first position for each digit.\n"
+    "    for (uint d = 0 ; d < RADIX ; d++)\n"
+    "        histogram[d * nw + w] = counts[d];\n"
+    "}\n"
+    "\n"
+    "__kernel void OclUtils_Radix_Scatter(__global const KEY *keys_in, __global KEY *keys_out,\n"
+    "                                     __global const VALUE_TYPE *values_in, __global VALUE_TYPE *values_out,\n"
+    "                                     const ulong n, const uint shift, __global const uint *offsets)\n"
+    "{\n"
+    "    CHUNK_RANGE\n"
+    "    uint positions[RADIX];\n"
+    "    for (uint d = 0 ; d < RADIX ; d++)\n"
+    "        positions[d] = offsets[d * nw + w];\n"
+    "    for (ulong i = begin ; i < end ; i++)\n"
+    "    {\n"
+    "        const KEY  k = keys_in[i];\n"
+    "        const uint p = positions[DIGIT(k, shift)]++;\n"
+    "        keys_out[p] = k;\n"
+    "#ifdef VALUE\n"
+    "        values_out[p] = values_in[i];\n"
+    "#endif\n"
+    "    }\n"
+    "}\n";
+
+// **************************************************************
+// Kernel used by OpenCL_Elementwise. Compiled with:
+//   -DT=<type> -DOP_<operation> [-DOCLUTILS_FP64] (T is double)
+const char kernel_Elementwise_source[] =
+    "#ifdef OCLUTILS_FP64\n"
+    "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n"
+    "#endif\n"
+    "#if defined(OP_ADD)\n"
+    "#define OP(x, y) ((x) + (y))\n"
+    "#elif defined(OP_SUB)\n"
+    "#define OP(x, y) ((x) - (y))\n"
+    "#elif defined(OP_MUL)\n"
+    "#define OP(x, y) ((x) * (y))\n"
+    "#elif defined(OP_DIV)\n"
+    "#define OP(x, y) ((x) / (y))\n"
+    "#elif defined(OP_MIN)\n"
+    "#define OP(x, y) min((x), (y))\n"
+    "#elif defined(OP_MAX)\n"
+    "#define OP(x, y) max((x), (y))\n"
+    "#else\n"
+    "#define OP(x, y) (alpha * (x) + (y))\n"
+    "#endif\n"
+    "\n"
+    "__kernel void OclUtils_Elementwise(__global T *out, __global const T *a, __global const T *b,\n"
+    "                                   const T alpha, const ulong n)\n"
+    "{\n"
+    "    const ulong i = get_global_id(0);\n"
+    "    if (i < n)\n"
+    "        out[i] = OP(a[i], b[i]);\n"
+    "}\n";
+
+// **************************************************************
+// Kernel used by OpenCL_Array checksums: one work item per leaf (see
+// OpenCL_SHA512::Calculate_Leaf_Checksums()), the whole array being a
+// single leaf in flat mode. Leaves are padded on the fly, block by block.
+const char kernel_SHA512_source[] =
+    "#ifdef __ENDIAN_LITTLE__\n"
+    "#define BIG_ENDIAN_64(x) as_ulong(as_uchar8(x).s76543210)\n"
+    "#else\n"
+    "#define BIG_ENDIAN_64(x) (x)\n"
+    "#endif\n"
+    "#define ROTR(x, n)   rotate((x), (ulong) (64 - (n)))\n"
+    "#define SIGMA0(x)    (ROTR((x), 28) ^ ROTR((x), 34) ^ ROTR((x), 39))\n"
+    "#define SIGMA1(x)    (ROTR((x), 14) ^ ROTR((x), 18) ^ ROTR((x), 41))\n"
+    "#define sigma0(x)    (ROTR((x),  1) ^ ROTR((x),  8) ^ ((x) >> 7))\n"
+    "#define sigma1(x)    (ROTR((x), 19) ^ ROTR((x), 61) ^ ((x) >> 6))\n"
+    "#define CH(x, y, z)  bitselect((z), (y), (x))\n"
+    "#define MAJ(x, y, z) bitselect((x), (y), (x) ^ (z))\n"
+    "\n"
+    "__constant ulong K[80] =\n"
+    "{\n"
+    "    0x428A2F98D728AE22UL, 0x7137449123EF65CDUL, 0xB5C0FBCFEC4D3B2FUL,\n"
+    "    0xE9B5DBA58189DBBCUL, 0x3956C25BF348B538UL, 0x59F111F1B605D019UL,\n"
+    "    0x923F82A4AF194F9BUL, 0xAB1C5ED5DA6D8118UL, 0xD807AA98A3030242UL,\n"
+    "    0x12835B0145706FBEUL, 0x243185BE4EE4B28CUL, 0x550C7DC3D5FFB4E2UL,\n"
+    "    0x72BE5D74F27B896FUL, 0x80DEB1FE3B1696B1UL, 0x9BDC06A725C71235UL,\n"
+    "    0xC19BF174CF692694UL, 0xE49B69C19EF14AD2UL, 0xEFBE4786384F25E3UL,\n"
+    "    0x0FC19DC68B8CD5B5UL, 0x240CA1CC77AC9C65UL, 0x2DE92C6F592B0275UL,\n"
+    "    0x4A7484AA6EA6E483UL, 0x5CB0A9DCBD41FBD4UL, 0x76F988DA831153B5UL,\n"
+    "    0x983E5152EE66DFABUL, 0xA831C66D2DB43210UL, 0xB00327C898FB213FUL,\n"
+    "    0xBF597FC7BEEF0EE4UL, 0xC6E00BF33DA88FC2UL, 0xD5A79147930AA725UL,\n"
+    "    0x06CA6351E003826FUL, 0x142929670A0E6E70UL, 0x27B70A8546D22FFCUL,\n"
+    "    0x2E1B21385C26C926UL, 0x4D2C6DFC5AC42AEDUL, 0x53380D139D95B3DFUL,\n"
+    "    0x650A73548BAF63DEUL, 0x766A0ABB3C77B2A8UL, 0x81C2C92E47EDAEE6UL,\n"
+    "    0x92722C851482353BUL, 0xA2BFE8A14CF10364UL, 0xA81A664BBC423001UL,\n"
+    "    0xC24B8B70D0F89791UL, 0xC76C51A30654BE30UL, 0xD192E819D6EF5218UL,\n"
+    "    0xD69906245565A910UL, 0xF40E35855771202AUL, 0x106AA07032BBD1B8UL,\n"
+    "    0x19A4C116B8D2D0C8UL, 0x1E376C085141AB53UL, 0x2748774CDF8EEB99UL,\n"
+    "    0x34B0BCB5E19B48A8UL, 0x391C0CB3C5C95A63UL, 0x4ED8AA4AE3418ACBUL,\n"
+    "    0x5B9CCA4F7763E373UL, 0x682E6FF3D6B2B8A3UL, 0x748F82EE5DEFB2FCUL,\n"
+    "    0x78A5636F43172F60UL, 0x84C87814A1F0AB72UL, 0x8CC702081A6439ECUL,\n"
+    "    0x90BEFFFA23631E28UL, 0xA4506CEBDE82BDE9UL, 0xBEF9A3F7B2C67915UL,\n"
+    "    0xC67178F2E372532BUL, 0xCA273ECEEA26619CUL, 0xD186B8C721C0C207UL,\n"
+    "    0xEADA7DD6CDE0EB1EUL, 0xF57D4F7FEE6ED178UL, 0x06F067AA72176FBAUL,\n"
+    "    0x0A637DC5A2C898A6UL, 0x113F9804BEF90DAEUL, 0x1B710B35131C471BUL,\n"
+    "    0x28DB77F523047D84UL, 0x32CAAB7B40C72493UL, 0x3C9EBE0A15C9BEBCUL,\n"
+    "    0x431D67C49C100D4CUL, 0x4CC5D4BECB3E42B6UL, 0x597F299CFC657E2AUL,\n"
+    "    0x5FCB6FAB3AD6FAECUL, 0x6C44198C4A475817UL\n"
+    "};\n"
+    "\n"
+    "// Word of the padded message at byte 'start' (a multiple of 8).\n"
+    "ulong Message_Word(__global const uchar *message, const ulong start, const ulong size)\n"
+    "{\n"
+    "    if (start + 8 <= size)\n"
+    "        return BIG_ENDIAN_64(*(__global const ulong *) (message + start));\n"
+    "    ulong word = 0;\n"
+    "    for (int j = 0 ; j < 8 ; j++)\n"
+    "    {\n"
+    "        const ulong p = start + j;\n"
+    "        word = (word << 8) | (p < size ? (ulong) message[p] : (p == size ? 0x80UL : 0UL));\n"
+    "    }\n"
+    "    return word;\n"
+    "}\n"
+    "\n"
+    "__kernel void OclUtils_SHA512_Leaves(__global const uchar *data, const ulong size, const ulong leaf_size,\n"
+    "                                     const ulong nb_leaves, __global ulong *leaf_digests)\n"
+    "{\n"
+    "    const ulong leaf = get_global_id(0);\n"
+    "    if (leaf >= nb_leaves)\n"
+    "        return;\n"
+    "\n"
+    "    __global const uchar *message = data + leaf * leaf_size;\n"
+    "    const ulong length    = min(leaf_size, size - leaf * leaf_size);\n"
+    "    const ulong nb_blocks = (length + 1 + 16 + 127) / 128;\n"
+    "\n"
+    "    ulong H[8] = {0x6A09E667F3BCC908UL, 0xBB67AE8584CAA73BUL, 0x3C6EF372FE94F82BUL, 0xA54FF53A5F1D36F1UL,\n"
+    "                  0x510E527FADE682D1UL, 0x9B05688C2B3E6C1FUL, 0x1F83D9ABFB41BD6BUL, 0x5BE0CD19137E2179UL};\n"
+    "    for (ulong block = 0 ; block < nb_blocks ; block++)\n"
+    "    {\n"
+    "        ulong W[16];\n"
+    "        for (int t = 0 ; t < 16 ; t++)\n"
+    "            W[t] = Message_Word(message, block * 128 + 8 * t, length);\n"
+    "        if (block == nb_blocks - 1)\n"
+    "            W[15] = length << 3;\n"
+    "\n"
+    "        ulong a = H[0], b = H[1], c = H[2], d = H[3], e = H[4], f = H[5], g = H[6], h = H[7];\n"
+    "        for (int t = 0 ; t < 80 ; t++)\n"
+    "        {\n"
+    "            if (t >= 16)\n"
+    "                W[t & 15] += sigma1(W[(t - 2) & 15]) + W[(t - 7) & 15] + sigma0(W[(t - 15) & 15]);\n"
+    "            const ulong T1 = h + SIGMA1(e) + CH(e, f, g) + K[t] + W[t & 15];\n"
+    "            const ulong T2 = SIGMA0(a) + MAJ(a, b, c);\n"
+    "            h = g; g = f; f = e; e = d + T1;\n"
+    "            d = c; c = b; b = a; a = T1 + T2;\n"
+    "        }\n"
+    "        H[0] += a; H[1] += b; H[2] += c; H[3] += d;\n"
+    "        H[4] += e; H[5] += f; H[6] += g; H[7] += h;\n"
+    "    }\n"
+    "\n"
+    "    // Digest bytes in big-endian order, as on the host.\n"
+    "    for (int i = 0 ; i < 8 ; i++)\n"
+    "        leaf_digests[8 * leaf + i] = BIG_ENDIAN_64(H[i]);\n"
+    "}\n";
+
+// **************************************************************
+// CRC32C of the leaves of an OpenCL_Array (see OpenCL_CRC32C::Calculate()),
+// one work item per leaf, slicing by 8 with tables built in local memory by
+// each work group. All work items must reach the barriers.
+const char kernel_CRC32C_source[] =
+    "#define CRC32C_POLYNOMIAL 0x82F63B78u\n"
+    "\n"
+    "__kernel void OclUtils_CRC32C_Leaves(__global const uchar *data, const ulong size, const ulong leaf_size,\n"
+    "                                     const ulong nb_leaves, __global uint *leaf_crcs)\n"
+    "{\n"
+    "    __local uint T[8][256];\n"
+    "    for (uint i = get_local_id(0) ; i < 256 ; i += get_local_size(0))\n"
+    "    {\n"
+    "        uint c = i;\n"
+    "        for (int k = 0 ; k < 8 ; k++)\n"
+    "            c = (c >> 1) ^ ((c & 1u) ? CRC32C_POLYNOMIAL : 0u);\n"
+    "        T[0][i] = c;\n"
+    "    }\n"
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "    for (int t = 1 ; t < 8 ; t++)\n"
+    "    {\n"
+    "        for (uint i = get_local_id(0) ; i < 256 ; i += get_local_size(0))\n"
+    "            T[t][i] = (T[t - 1][i] >> 8) ^ T[0][T[t - 1][i] & 0xFFu];\n"
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "    }\n"
+    "\n"
+    "    const ulong leaf = get_global_id(0);\n"
+    "    if (leaf >= nb_leaves)\n"
+    "        return;\n"
+    "\n"
+    "    __global const uchar *message = data + leaf * leaf_size;\n"
+    "    const ulong length = min(leaf_size, size - leaf * leaf_size);\n"
+    "    uint crc = 0xFFFFFFFFu;\n"
+    "    ulong i = 0;\n"
+    "#ifdef __ENDIAN_LITTLE__\n"
+    "    // Leaves start on 128 bytes boundaries.\n"
+    "    for ( ; i + 8 <= length ; i += 8)\n"
+    "    {\n"
+    "        const ulong word = *(__global const ulong *) (message + i);\n"
+    "        const uint lo = ((uint) word) ^ crc;\n"
+    "        const uint hi = (uint) (word >> 32);\n"
+    "        crc = T[7][lo & 0xFFu] ^ T[6][(lo >> 8) & 0xFFu] ^ T[5][(lo >> 16) & 0xFFu] ^ T[4][lo >> 24] ^\n"
+    "              T[3][hi & 0xFFu] ^ T[2][(hi >> 8) & 0xFFu] ^ T[1][(hi >> 16) & 0xFFu] ^ T[0][hi >> 24];\n"
+    "    }\n"
+    "#endif\n"
+    "    for ( ; i < length ; i++)\n"
+    "        crc = (crc >> 8) ^ T[0][(crc ^ message[i]) & 0xFFu];\n"
+    "    leaf_crcs[leaf] = ~crc;\n"
+    "}\n";
+
+// **************************************************************
+// XXH64 (seed 0) of the leaves of an OpenCL_Array (see OpenCL_XXH64::Calculate()),
+// one work item per leaf.
+const char kernel_XXH64_source[] =
+    "#define PRIME64_1 0x9E3779B185EBCA87UL\n"
+    "#define PRIME64_2 0xC2B2AE3D27D4EB4FUL\n"
+    "#define PRIME64_3 0x165667B19E3779F9UL\n"
+    "#define PRIME64_4 0x85EBCA77C2B2AE63UL\n"
+    "#define PRIME64_5 0x27D4EB2F165667C5UL\n"
+    "#define ROTL(x, n) rotate((x), (ulong) (n))\n"
+    "\n"
+    "// Little-endian words at offsets multiple of their size from the leaf start.\n"
+    "ulong Read_64(__global const uchar *p)\n"
+    "{\n"
+    "#ifdef __ENDIAN_LITTLE__\n"
+    "    return *(__global const ulong *) p;\n"
+    "#else\n"
+    "    ulong word = 0;\n"
+    "    for (int j = 7 ; j >= 0 ; j--)\n"
+    "        word = (word << 8) | (ulong) p[j];\n"
+    "    return word;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "ulong Read_32(__global const uchar *p)\n"
+    "{\n"
+    "#ifdef __ENDIAN_LITTLE__\n"
+    "    return (ulong) *(__global const uint *) p;\n"
+    "#else\n"
+    "    return (ulong) p[0] | ((ulong) p[1] << 8) | ((ulong) p[2] << 16) | ((ulong) p[3] << 24);\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "ulong XXH64_Round(ulong accumulator, const ulong input)\n"
+    "{\n"
+    "    accumulator += input * PRIME64_2;\n"
+    "    return ROTL(accumulator, 31) * PRIME64_1;\n"
+    "}\n"
+    "\n"
+    "ulong XXH64_Merge_Round(ulong hash, const ulong accumulator)\n"
+    "{\n"
+    "    hash ^= XXH64_Round(0, accumulator);\n"
+    "    return hash * PRIME64_1 + PRIME64_4;\n"
+    "}\n"
+    "\n"
+    "__kernel void OclUtils_XXH64_Leaves(__global const uchar *data, const ulong size, const ulong leaf_size,\n"
+    "                                    const ulong nb_leaves, __global ulong *leaf_hashes)\n"
+    "{\n"
+    "    const ulong leaf = get_global_id(0);\n"
+    "    if (leaf >= nb_leaves)\n"
+    "        return;\n"
+    "\n"
+    "    __global const uchar *p = data + leaf * leaf_size;\n"
+    "    const ulong length = min(leaf_size, size - leaf * leaf_size);\n"
+    "    ulong remaining = length;\n"
+    "    ulong h;\n"
+    "    if (length >= 32)\n"
+    "    {\n"
+    "        ulong v1 = PRIME64_1 + PRIME64_2, v2 = PRIME64_2, v3 = 0, v4 = 0 - PRIME64_1;\n"
+    "        for ( ; remaining >= 32 ; remaining -= 32, p += 32)\n"
+    "        {\n"
+    "            v1 = XXH64_Round(v1, Read_64(p));\n"
+    "            v2 = XXH64_Round(v2, Read_64(p + 8));\n"
+    "            v3 = XXH64_Round(v3, Read_64(p + 16));\n"
+    "            v4 = XXH64_Round(v4, Read_64(p + 24));\n"
+    "        }\n"
+    "        h = ROTL(v1, 1) + ROTL(v2, 7) + ROTL(v3, 12) + ROTL(v4, 18);\n"
+    "        h = XXH64_Merge_Round(h, v1);\n"
+    "        h = XXH64_Merge_Round(h, v2);\n"
+    "        h = XXH64_Merge_Round(h, v3);\n"
+    "        h = XXH64_Merge_Round(h, v4);\n"
+    "    }\n"
+    "    else\n"
+    "        h = PRIME64_5;\n"
+    "    h += length;\n"
+    "\n"
+    "    for ( ; remaining >= 8 ; remaining -= 8, p += 8)\n"
+    "        h = ROTL(h ^ XXH64_Round(0, Read_64(p)), 27) * PRIME64_1 + PRIME64_4;\n"
+    "    if (remaining >= 4)\n"
+    "    {\n"
+    "        h = ROTL(h ^ (Read_32(p) * PRIME64_1), 23) * PRIME64_2 + PRIME64_3;\n"
+    "        remaining -= 4;\n"
+    "        p += 4;\n"
+    "    }\n"
+    "    for ( ; remaining > 0 ; remaining--, p++)\n"
+    "        h = ROTL(h ^ ((ulong) *p * PRIME64_5), 11) * PRIME64_1;\n"
+    "\n"
+    "    h ^= h >> 33;\n"
+    "    h *= PRIME64_2;\n"
+    "    h ^= h >> 29;\n"
+    "    h *= PRIME64_3;\n"
+    "    h ^= h >> 32;\n"
+    "    leaf_hashes[leaf] = h;\n"
+    "}\n";
+
 // **************************************************************
 void * calloc_and_check(uint64_t nb, size_t s, std::string msg)
 {
@@ -91,21 +802,15 @@ void * calloc_and_check(uint64_t nb, size_t s, std::string msg)
     p = calloc(nb, s);
     if (p == NULL)
     {
-        std_cout << "ERROR!!!\n";
-        std_cout << "    Allocation of ";
-        std_cout << nb << " x " << s << " bytes = " << nb_s << " bytes\n";
-        std_cout << "                                               (";
-        std_cout
+        std::ostringstream message;
+        message
+            << "Allocation of " << nb << " x " << s << " bytes = " << nb_s << " bytes ("
             << nb_s * B_to_KiB << " KiB, "
-            << nb_s * B_to_KiB << " MiB, "
-            << nb_s * B_to_GiB << " GiB)\n"
-            << "    FAILED!!!\n";
+            << nb_s * B_to_MiB << " MiB, "
+            << nb_s * B_to_GiB << " GiB) failed";
         if (msg != "")
-        {
-            std_cout << "Comment: " << msg << std::endl;
-        }
-        std_cout << "Aborting.\n" << std::flush;
-        abort();
+            message << " (" << msg << ")";
+        OpenCL_Throw(CL_OUT_OF_HOST_MEMORY, "calloc", message.str());
     }
 
     return p;
@@ -165,15 +870,18 @@ int Lock_File(const char *path, const bool quiet)
  * @return      file handle if locked, or -1 if failed
  */
 {
+    const char *basename = strrchr(path, '/');
+    OpenCL_Trace_Scope trace("lock", "Lock ", (basename != NULL ? basename + 1 : path));
+
     if (not quiet)
-        std_cout << "OpenCL: Attempt to acquire lock on file " << path << "..." << std::flush;
+        OpenCL_Log_Debug("OpenCL: Attempt to acquire lock on file " << path << "...");
 
     // Open file
     int f = open(path, O_CREAT | O_TRUNC, 0666);
     if (f == -1)
     {
         if (not quiet)
-            std_cout << "Could not open lock file!\n" << std::flush;
+            OpenCL_Log_Warning("OpenCL: WARNING: Could not open lock file " << path << " (" << strerror(errno) << ")");
         return -1; // Open failed
     }
 
@@ -205,14 +913,10 @@ int Lock_File(const char *path, const bool quiet)
         const double delay = ((double(rand()) / double(RAND_MAX)) * 9.0) + 1.0;
         char delay_string[64];
         sprintf(delay_string, "%.4f", delay);
-        std_cout
-            << "\nOpenCL: WARNING: Failed to acquire a lock on file '" << path << "'.\n"
-            << "                 Waiting " << delay_string << " seconds before retrying (" << i+1 << "/" << max_retry << ")...\n" << std::flush;
+        OpenCL_Log_Warning(
+            "OpenCL: WARNING: Failed to acquire a lock on file '" << path << "'.\n"
+            << "                 Waiting " << delay_string << " seconds before retrying (" << i+1 << "/" << max_retry << ")...");
         Wait(delay);
-        std_cout << "                 Done waiting.";
-        if (i+1 < max_retry)
-            std_cout << " Retrying.";
-        std_cout << "\n";
     }
 
     if (err == -1)
@@ -221,19 +925,19 @@ int Lock_File(const char *path, const bool quiet)
         {
             close(f);
             if (not quiet)
-                std_cout << "Lock file is already locked!\n";
+                OpenCL_Log_Debug("OpenCL: Lock file " << path << " is already locked");
             return -1; // File is locked
         }
         else
         {
-            std_cout << "File lock operation failed!\n";
+            OpenCL_Log_Warning("OpenCL: WARNING: Lock operation on file " << path << " failed (" << strerror(errno) << ")");
             close(f);
             return -1; // Another error occurred
         }
     }
 
     if (not quiet)
-        std_cout << "Success!\n" << std::flush;
+        OpenCL_Log_Debug("OpenCL: Acquired lock on file " << path);
 
     return f;
 }
@@ -245,7 +949,7 @@ void Unlock_File(int f, const bool quiet)
  */
 {
     if (not quiet)
-        std_cout << "Closing lock file.\n";
+        OpenCL_Log_Debug("OpenCL: Closing lock file.");
     close(f); // Close file automatically unlocks file
 }
 
@@ -289,8 +993,7 @@ char *read_opencl_kernel(const std::string filename, int *length)
 
     if (!f)
     {
-        std_cout << "OpenCL: Unable to open " << filename << " for reading\n";
-        abort();
+        OpenCL_Throw(CL_INVALID_VALUE, "fopen", "Unable to open " + filename + " for reading");
     }
 
     fseek(f, 0, SEEK_END);
@@ -397,28 +1100,26 @@ void OpenCL_platform::Print() const
 // *****************************************************************************
 void OpenCL_platforms_list::Initialize(const std::string &_preferred_platform, const bool _use_locking)
 {
+    OpenCL_Trace_Scope trace("init", "Platforms initialization");
+
     preferred_platform = _preferred_platform;
     use_locking = _use_locking;
     if (use_locking)
-        std_cout << "OpenCL: File locking mechanism enabled. Will probably fail if run under a queueing system.\n" << std::flush;
+        OpenCL_Log_Info("OpenCL: File locking mechanism enabled. Will probably fail if run under a queueing system.");
     else
-        std_cout << "OpenCL: File locking mechanism disabled. Must be disabled when using queueing system.\n" << std::flush;
+        OpenCL_Log_Info("OpenCL: File locking mechanism disabled. Must be disabled when using queueing system.");
 
     cl_int err;
     cl_uint nb_platforms;
 
-    Print_N_Times("-", 109);
-    std_cout << "OpenCL: Getting a list of platform(s)..." << std::flush;
+    OpenCL_Log_Debug("OpenCL: Getting a list of platform(s)...");
 
     // Get number of platforms available
     err = clGetPlatformIDs(0, NULL, &nb_platforms);
     OpenCL_Test_Success(err, "clGetPlatformIDs");
 
     if (nb_platforms == 0)
-    {
-        std_cout << "\nERROR: No OpenCL platform found! Exiting.\n";
-        abort();
-    }
+        OpenCL_Throw(CL_INVALID_PLATFORM, "clGetPlatformIDs", "No OpenCL platform found");
 
     // Get a list of the OpenCL platforms available.
     cl_platform_id *tmp_platforms;
@@ -426,12 +1127,10 @@ void OpenCL_platforms_list::Initialize(const std::string &_preferred_platform, c
     err = clGetPlatformIDs(nb_platforms, tmp_platforms, NULL);
     OpenCL_Test_Success(err, "clGetPlatformIDs");
 
-    std_cout << " done.\n";
-
     if (nb_platforms == 1)
-        std_cout << "OpenCL: Initializing the available platform...\n";
+        OpenCL_Log_Info("OpenCL: Initializing the available platform...");
     else
-        std_cout << "OpenCL: Initializing the " << nb_platforms << " available platforms...\n";
+        OpenCL_Log_Info("OpenCL: Initializing the " << nb_platforms << " available platforms...");
 
     char tmp_string[4096];
 
@@ -443,7 +1142,7 @@ void OpenCL_platforms_list::Initialize(const std::string &_preferred_platform, c
         err = clGetPlatformInfo(tmp_platform_id, CL_PLATFORM_VENDOR, sizeof(tmp_string), &tmp_string, NULL);
         OpenCL_Test_Success(err, "clGetPlatformInfo (CL_PLATFORM_VENDOR)");
 
-        std_cout << "        (" << i+1 << "/" << nb_platforms << ") " << tmp_string << "\n";
+        OpenCL_Log_Info("        (" << i+1 << "/" << nb_platforms << ") " << tmp_string);
     }
 
     // This offset allows distinguishing in LOCK_FILE the devices that can appear in different platforms.
@@ -470,8 +1169,7 @@ void OpenCL_platforms_list::Initialize(const std::string &_preferred_platform, c
             key = OPENCL_PLATFORMS_APPLE;
         else
         {
-            std_cout << "ERROR: Unknown OpenCL platform \"" << platform_vendor << "\"! Exiting.\n" << std::flush;
-            abort();
+            OpenCL_Throw(CL_INVALID_PLATFORM, "OpenCL_platforms_list::Initialize", "Unknown OpenCL platform \"" + platform_vendor + "\"");
         }
 
         OpenCL_platform &platform = platforms[key];
@@ -525,10 +1223,9 @@ void OpenCL_platforms_list::Print_Preferred() const
     it = platforms.find(preferred_platform);
     if (it == platforms.end())
     {
-        std_cout << "ERROR: Cannot find platform '" << preferred_platform << "'. Aborting.\n" << std::flush;
-        abort();
+        OpenCL_Throw(CL_INVALID_PLATFORM, "OpenCL_platforms_list::Print_Preferred", "Cannot find platform '" + preferred_platform + "'");
     }
-    assert(it->second.devices_list.preferred_device != NULL);
+    OpenCL_Assert(it->second.devices_list.preferred_device != NULL);
 
     it->second.Print_Preferred();
 }
@@ -542,8 +1239,7 @@ OpenCL_platform & OpenCL_platforms_list::operator[](const std::string key)
     {
         if (platforms.size() == 0)
         {
-            std_cout << "ERROR: Trying to access a platform but the list is uninitialized! Aborting.\n" << std::flush;
-            abort();
+            OpenCL_Throw(CL_INVALID_PLATFORM, "OpenCL_platforms_list::operator[]", "Trying to access a platform but the list is uninitialized");
         }
         // Just take the first one.
         it = platforms.begin();
@@ -555,8 +1251,7 @@ OpenCL_platform & OpenCL_platforms_list::operator[](const std::string key)
         if (it == platforms.end())
         {
             Print();
-            std_cout << "Cannot find platform \"" << key << "\"! Aborting.\n" << std::flush;
-            abort();
+            OpenCL_Throw(CL_INVALID_PLATFORM, "OpenCL_platforms_list::operator[]", "Cannot find platform \"" + key + "\"");
         }
     }
     return it->second;
@@ -714,8 +1409,9 @@ void OpenCL_device::Set_Information(const int _id, cl_device_id _device,
         type_string = "CL_DEVICE_TYPE_DEFAULT";
     else
     {
-        std_cout << "ERROR: Unknown OpenCL type \"" << type << "\". Exiting.\n";
-        abort();
+        std::ostringstream message;
+        message << "Unknown OpenCL type \"" << type << "\"";
+        OpenCL_Throw(CL_INVALID_DEVICE_TYPE, "OpenCL_device::Set_Information", message.str());
     }
 
     queue_properties_string = "";
@@ -738,8 +1434,8 @@ void OpenCL_device::Set_Information(const int _id, cl_device_id _device,
     if (single_fp_config & CL_FP_FMA)
         single_fp_config_string += "CL_FP_FMA, ";
 
-    assert(parent_platform                  != NULL);
-    assert(parent_platform->Platform_List() != NULL);
+    OpenCL_Assert(parent_platform                  != NULL);
+    OpenCL_Assert(parent_platform->Platform_List() != NULL);
     if (parent_platform->Platform_List()->Use_Locking())
     {
         device_is_in_use = Verify_if_Device_is_Used(device_id, platform_id_offset, platform_name, name);
@@ -755,6 +1451,8 @@ void OpenCL_device::Set_Information(const int _id, cl_device_id _device,
 // *****************************************************************************
 cl_int OpenCL_device::Set_Context()
 {
+    OpenCL_Trace_Scope trace("context", "Context on ", name.c_str());
+
     cl_int err = CL_SUCCESS+1;
     pid_t pid = getpid();
     const int max_retry = 5;
@@ -773,14 +1471,10 @@ cl_int OpenCL_device::Set_Context()
         const double delay = ((double(rand()) / double(RAND_MAX)) * 9.0) + 1.0;
         char delay_string[64];
         sprintf(delay_string, "%.4f", delay);
-        std_cout
-            << "\nOpenCL: WARNING: Failed to set an OpenCL context on the device.\n"
-            << "                 Waiting " << delay_string << " seconds before retrying (" << i+1 << "/" << max_retry << ")...\n" << std::flush;
+        OpenCL_Log_Warning(
+            "OpenCL: WARNING: Failed to set an OpenCL context on the device (" << OpenCL_Error_to_String(err) << ").\n"
+            << "                 Waiting " << delay_string << " seconds before retrying (" << i+1 << "/" << max_retry << ")...");
         Wait(delay);
-        std_cout << "                 Done waiting.";
-        if (i+1 < max_retry)
-            std_cout << " Retrying.";
-        std_cout << "\n";
     }
     return err;
 }
@@ -877,6 +1571,12 @@ void OpenCL_device::Print() const
 
     // Avialable constant memory on device
     std_cout << "        Available memory (constant): " << Bytes_in_String(max_constant_buffer_size) << "\n";
+
+    // Memory allocated on device by this process
+    const OpenCL_Memory_Statistics statistics = OpenCL_Memory::Device_Statistics(device);
+    std_cout << "        Allocated memory (live):     " << Bytes_in_String(statistics.live_bytes) << "\n";
+    std_cout << "        Allocated memory (peak):     " << Bytes_in_String(statistics.peak_bytes) << "\n";
+    std_cout << "        Allocations:                 " << statistics.nb_allocations << " (" << statistics.nb_releases << " released)\n";
 }
 
 // *****************************************************************************
@@ -885,8 +1585,7 @@ void OpenCL_device::Lock()
     lock_file = Lock_File(Get_Lock_Filename(device_id, parent_platform->Id_Offset(), parent_platform->Name(), name).c_str());
     if (lock_file == -1)
     {
-        std_cout << "An error occurred locking the file!\n" << std::flush;
-        abort();
+        OpenCL_Throw(CL_DEVICE_NOT_AVAILABLE, "OpenCL_device::Lock", "An error occurred locking the file");
     }
     file_locked = true; // File is now locked
 }
@@ -948,9 +1647,9 @@ OpenCL_device & OpenCL_devices_list::Preferred_OpenCL()
 {
     if (preferred_device == NULL)
     {
-        std_cout << "ERROR: No OpenCL device is present!\n"
-        << "Make sure you call OpenCL_platforms.platforms[<WANTED PLATFORM>] with a valid (i.e. created) platform!\n" << std::flush;
-        abort();
+        OpenCL_Throw(CL_DEVICE_NOT_FOUND, "OpenCL_devices_list::Preferred_OpenCL",
+                     "No OpenCL device is present! Make sure you call OpenCL_platforms.platforms[<WANTED PLATFORM>] "
+                     "with a valid (i.e. created) platform");
     }
 
     return *preferred_device;
@@ -983,7 +1682,8 @@ void OpenCL_devices_list::Print() const
 void OpenCL_devices_list::Initialize(const OpenCL_platform &_platform,
                                      const std::string &preferred_platform)
 {
-    std_cout << "OpenCL: Initialize platform \"" << _platform.Name() << "\"'s device(s)\n";
+    OpenCL_Trace_Scope trace("init", "Devices of ", _platform.Name().c_str());
+    OpenCL_Log_Info("OpenCL: Initialize platform \"" << _platform.Name() << "\"'s device(s)");
 
     platform            = &_platform;
 
@@ -992,7 +1692,7 @@ void OpenCL_devices_list::Initialize(const OpenCL_platform &_platform,
     err = clGetDeviceIDs(platform->Id(), CL_DEVICE_TYPE_GPU, 0, NULL, &nb_gpu);
     if (err == CL_DEVICE_NOT_FOUND)
     {
-        std_cout << "OpenCL: WARNING: Can't find a usable GPU!\n";
+        OpenCL_Log_Info("OpenCL: No usable GPU on this platform.");
         err = CL_SUCCESS;
     }
     OpenCL_Test_Success(err, "clGetDeviceIDs()");
@@ -1001,11 +1701,11 @@ void OpenCL_devices_list::Initialize(const OpenCL_platform &_platform,
     err = clGetDeviceIDs(platform->Id(), CL_DEVICE_TYPE_CPU, 0, NULL, &nb_cpu);
     if (err == CL_DEVICE_NOT_FOUND)
     {
-        std_cout << "OpenCL: WARNING: Can't find a usable CPU!\n";
+        OpenCL_Log_Info("OpenCL: No usable CPU on this platform.");
         err = CL_SUCCESS;
     }
     OpenCL_Test_Success(err, "clGetDeviceIDs()");
-    assert(nb_devices() >= 1);
+    OpenCL_Assert(nb_devices() >= 1);
 
     // Create the device list
     device_list.resize(nb_devices());
@@ -1054,11 +1754,10 @@ void OpenCL_devices_list::Initialize(const OpenCL_platform &_platform,
 
     assert(it == device_list.end());
 
-    // When all devices are in use we abort the program
+    // When all devices are in use there is nothing to lock
     if (are_all_devices_in_use == true)
     {
-        std_cout << "All devices on platform '" << _platform.Name() << "' are in use!\n" << std::flush;
-        abort();
+        OpenCL_Throw(CL_DEVICE_NOT_AVAILABLE, "OpenCL_devices_list::Initialize", "All devices on platform '" + _platform.Name() + "' are in use");
     }
 
     preferred_device = NULL;    // The preferred device is unknown for now.
@@ -1078,17 +1777,17 @@ void OpenCL_devices_list::Set_Preferred_OpenCL(const int _preferred_device)
         // Initialize context on a device
         for (it = device_list.begin() ; it != device_list.end() ; ++it)
         {
-            std_cout << "OpenCL: Trying to set a context on " << it->Get_Name() << " (id = " << it->Get_ID() << ")...";
+            OpenCL_Log_Debug("OpenCL: Trying to set a context on " << it->Get_Name() << " (id = " << it->Get_ID() << ")...");
             if (it->Set_Context() == CL_SUCCESS)
             {
-                std_cout << " Success!\n";
+                OpenCL_Log_Info("OpenCL: Context set on " << it->Get_Name() << " (id = " << it->Get_ID() << ").");
                 preferred_device = &(*it);
 
                 break;
             }
             else
             {
-                std_cout << " Failed. Maybe next one will work?\n";
+                OpenCL_Log_Warning("OpenCL: WARNING: Failed to set a context on " << it->Get_Name() << " (id = " << it->Get_ID() << "). Maybe next one will work?");
             }
         }
     }
@@ -1096,8 +1795,7 @@ void OpenCL_devices_list::Set_Preferred_OpenCL(const int _preferred_device)
     {
         if (_preferred_device >= int(device_list.size()))
         {
-            std_cout << "OpenCL: ERROR: the device requested is out of range. Exiting.\n";
-            abort();
+            OpenCL_Throw(CL_INVALID_DEVICE, "OpenCL_devices_list::Set_Preferred_OpenCL", "The device requested is out of range");
         }
 
         // Release any allocated context
@@ -1110,10 +1808,10 @@ void OpenCL_devices_list::Set_Preferred_OpenCL(const int _preferred_device)
         {
             if (_preferred_device == it->Get_ID())
             {
-                std_cout << "OpenCL: Found preferred device (" << it->Get_Parent_Platform()->Name() << ", " << it->Get_Name() << ", id = " << it->Get_ID() << "). Trying to set an context on it...\n";
+                OpenCL_Log_Debug("OpenCL: Found preferred device (" << it->Get_Parent_Platform()->Name() << ", " << it->Get_Name() << ", id = " << it->Get_ID() << "). Trying to set an context on it...");
                 if (it->Set_Context() == CL_SUCCESS)
                 {
-                    std_cout << " Success!\n";
+                    OpenCL_Log_Info("OpenCL: Context set on " << it->Get_Name() << " (id = " << it->Get_ID() << ").");
                     preferred_device = &(*it);
 
                     break;
@@ -1124,8 +1822,7 @@ void OpenCL_devices_list::Set_Preferred_OpenCL(const int _preferred_device)
 
     if (preferred_device == NULL)
     {
-        std_cout << "ERROR: Cannot set an OpenCL context on any of the available devices!\nExiting" << std::flush;
-        abort();
+        OpenCL_Throw(CL_DEVICE_NOT_AVAILABLE, "OpenCL_devices_list::Set_Preferred_OpenCL", "Cannot set an OpenCL context on any of the available devices");
     }
 }
 
@@ -1144,8 +1841,10 @@ OpenCL_Kernel::OpenCL_Kernel()
     kernel          = NULL;
     global_work_size= NULL;
     local_work_size = NULL;
+    max_work_group_size = 0;
     err             = 0;
     event           = NULL;
+    profile         = NULL;
 }
 
 // *****************************************************************************
@@ -1165,6 +1864,8 @@ void OpenCL_Kernel::Initialize(std::string _filename, const cl_context &_context
     kernel          = NULL;
     program         = NULL;
     compiler_options= "";
+    profile         = NULL;
+    max_work_group_size = 0;
 
     dimension = 2; // Always use two dimensions.
 
@@ -1192,6 +1893,7 @@ OpenCL_Kernel::~OpenCL_Kernel()
 void OpenCL_Kernel::Build(std::string _kernel_name)
 {
     kernel_name      = _kernel_name;
+    OpenCL_Trace_Scope trace("build", "Build ", kernel_name.c_str());
 
     // **********************************************************
     // Load and build the kernel
@@ -1203,9 +1905,8 @@ void OpenCL_Kernel::Build(std::string _kernel_name)
 
     // **********************************************************
     // Get the maximum work group size
-    //err = clGetKernelWorkGroupInfo(kernel_md, list.Preferred_OpenCL_Device(), CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &maxWorkSize, NULL);
-    //std_cout << "Maximum kernel work group size: " << maxWorkSize << "\n";
-    //OpenCL_Test_Success(err, "clGetKernelWorkGroupInfo");
+    err = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_work_group_size, NULL);
+    OpenCL_Test_Success(err, "clGetKernelWorkGroupInfo");
 }
 
 // *****************************************************************************
@@ -1217,11 +1918,11 @@ void OpenCL_Kernel::Compute_Work_Size(size_t _global_x, size_t _global_y, size_t
  * @param _local_y : The local  work size in dimension y.
  */
 {
-    assert(_global_x >= _local_x);
-    assert(_global_y >= _local_y);
+    OpenCL_Assert(_global_x >= _local_x);
+    OpenCL_Assert(_global_y >= _local_y);
 
-    assert(_global_x % _local_x == 0);
-    assert(_global_y % _local_y == 0);
+    OpenCL_Assert(_global_x % _local_x == 0);
+    OpenCL_Assert(_global_y % _local_y == 0);
 
     global_work_size[0] = _global_x;
     global_work_size[1] = _global_y;
@@ -1249,6 +1950,13 @@ size_t *OpenCL_Kernel::Get_Local_Work_Size() const
     return local_work_size;
 }
 
+// *****************************************************************************
+size_t OpenCL_Kernel::Get_Max_Work_Group_Size() const
+{
+    OpenCL_Assert(kernel != NULL);
+    return max_work_group_size;
+}
+
 // *****************************************************************************
 int OpenCL_Kernel::Get_Dimension() const
 {
@@ -1264,139 +1972,1249 @@ void OpenCL_Kernel::Append_Compiler_Option(const std::string option)
 }
 
 // *****************************************************************************
-void OpenCL_Kernel::Launch(const cl_command_queue &command_queue)
+void OpenCL_Kernel::Launch(const cl_command_queue &command_queue, cl_event *event)
+/**
+ * @param event: If not NULL, will contain an event identifying this launch.
+ *               The caller is responsible for releasing it.
+ */
 {
-    err = clEnqueueNDRangeKernel(command_queue, Get_Kernel(), Get_Dimension(), NULL,
-                                 Get_Global_Work_Size(), Get_Local_Work_Size(),
-                                 0, NULL, NULL);
-    OpenCL_Test_Success(err, "clEnqueueNDRangeKernel");
+    // Fault in any evicted array bound to the kernel
+    OpenCL_Residency_Manager::Prepare_Launch_All(kernel);
+    // Upload coherent arrays modified on the host
+    Coherence_Prepare_Launch(kernel);
+
+    const bool profiled = OpenCL_Profiler::Is_Enabled();
+    const bool traced   = OpenCL_Trace::Is_Enabled();
+    if (!profiled && !traced)
+    {
+        err = clEnqueueNDRangeKernel(command_queue, Get_Kernel(), Get_Dimension(), NULL,
+                                     Get_Global_Work_Size(), Get_Local_Work_Size(),
+                                     0, NULL, event);
+        OpenCL_Test_Success(err, "clEnqueueNDRangeKernel");
+        return;
+    }
+
+    if (profiled && profile == NULL)
+        profile = OpenCL_Profiler::Entry(kernel_name, device_id);
+    cl_event profiled_event;
+    uint64_t enqueue_ns = 0;
+    {
+        OpenCL_Trace_Scope trace("launch", kernel_name.c_str());
+        enqueue_ns = (traced ? Trace_Now_ns() : 0);
+        err = clEnqueueNDRangeKernel(command_queue, Get_Kernel(), Get_Dimension(), NULL,
+                                     Get_Global_Work_Size(), Get_Local_Work_Size(),
+                                     0, NULL, &profiled_event);
+        OpenCL_Test_Success(err, "clEnqueueNDRangeKernel");
+    }
+    if (event != NULL)
+    {
+        *event = profiled_event;
+        err = clRetainEvent(profiled_event);
+        OpenCL_Test_Success(err, "clRetainEvent");
+    }
+    if (traced)
+        Trace_Device_Span(command_queue, profiled_event, "kernel", kernel_name, 0, enqueue_ns);
+    // Takes over our reference to the event.
+    if (profiled)
+        OpenCL_Profiler::Profile_Launch(profile, command_queue, &profiled_event);
+    else
+        clReleaseEvent(profiled_event);
 }
 
 // *****************************************************************************
-int OpenCL_Kernel::Get_Multiple(int n, int base)
+// Histograms of the profiler: values below 8 ns have their own bucket, then
+// 8 buckets per power of two.
+const int profile_nb_buckets = 8 + 61 * 8;
+
+struct OpenCL_Profile_Entry
+/**
+ * Statistics of one kernel name, updated by completion callbacks with atomic
+ * operations only. Entries live as long as the process, so callbacks of
+ * launches outliving their OpenCL_Kernel are harmless.
+ */
 {
-    int multipleOfWorkSize = 0;
+    std::string name;
+    uint64_t    count;
+    uint64_t    total_ns;
+    uint64_t    max_ns;
+    uint64_t    total_submit_delay_ns;
+    uint64_t    total_queue_delay_ns;
+    uint64_t    resolution_ns;
+    int         nb_unprofiled_queues;       // Launches on queues without profiling (warned once)
+    uint64_t    execution_histogram[profile_nb_buckets];
+    uint64_t    queue_delay_histogram[profile_nb_buckets];
+
+    OpenCL_Profile_Entry(const std::string &_name)
+        : name(_name), count(0), total_ns(0), max_ns(0), total_submit_delay_ns(0), total_queue_delay_ns(0),
+          resolution_ns(0), nb_unprofiled_queues(0)
+    {
+        memset(execution_histogram,   0, sizeof(execution_histogram));
+        memset(queue_delay_histogram, 0, sizeof(queue_delay_histogram));
+    }
+};
 
-    if (n < base)
+int OpenCL_Profiler::enabled = -1;
+std::map<std::string, OpenCL_Profile_Entry *> profile_entries;
+pthread_mutex_t profile_entries_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t profiler_environment_once = PTHREAD_ONCE_INIT;
+
+// *****************************************************************************
+inline int Profile_Bucket(const uint64_t ns)
+{
+    if (ns < 8)
+        return int(ns);
+    const int exponent = 63 - __builtin_clzll(ns);          // >= 3
+    return 8 + (exponent - 3) * 8 + int((ns >> (exponent - 3)) & 7);
+}
+
+// *****************************************************************************
+inline uint64_t Profile_Bucket_Value(const int bucket)
+/**
+ * Middle of the bucket's range.
+ */
+{
+    if (bucket < 8)
+        return uint64_t(bucket);
+    const int exponent  = (bucket - 8) / 8 + 3;
+    const uint64_t step = uint64_t(1) << (exponent - 3);
+    return (uint64_t(8 + (bucket - 8) % 8) * step) + step / 2;
+}
+
+// *****************************************************************************
+uint64_t Profile_Percentile(const uint64_t *histogram, const uint64_t count, const double percentile,
+                            const uint64_t resolution_ns)
+{
+    if (count == 0)
+        return 0;
+    const uint64_t rank = std::max(uint64_t(1), uint64_t(std::ceil(percentile * double(count))));
+    uint64_t sum = 0;
+    for (int b = 0 ; b < profile_nb_buckets ; b++)
     {
-        multipleOfWorkSize = base;
+        sum += histogram[b];
+        if (sum >= rank)
+            return std::max(Profile_Bucket_Value(b), resolution_ns);
     }
-    else if (n % base == 0)
+    return std::max(Profile_Bucket_Value(profile_nb_buckets - 1), resolution_ns);
+}
+
+// *****************************************************************************
+inline void Atomic_Max(uint64_t *value, const uint64_t candidate)
+{
+    uint64_t current = *value;
+    while (candidate > current)
     {
-        multipleOfWorkSize = n;
+        const uint64_t previous = __sync_val_compare_and_swap(value, current, candidate);
+        if (previous == current)
+            break;
+        current = previous;
     }
-    else
+}
+
+// *****************************************************************************
+void CL_CALLBACK Profile_Completion(cl_event event, cl_int status, void *_entry)
+/**
+ * Called by the OpenCL runtime, possibly from its own thread: must not throw.
+ */
+{
+    OpenCL_Profile_Entry *entry = (OpenCL_Profile_Entry *) _entry;
+
+    cl_ulong queued = 0, submit = 0, start = 0, end = 0;
+    cl_int err = CL_SUCCESS;
+    if (status == CL_COMPLETE)
     {
-        multipleOfWorkSize = base*(int)std::floor(n/base) + base;
+        err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL);
+        err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &submit, NULL);
+        err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START,  sizeof(cl_ulong), &start,  NULL);
+        err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END,    sizeof(cl_ulong), &end,    NULL);
     }
+    clReleaseEvent(event);
 
-    return multipleOfWorkSize;
+    // Failed launches and inconsistent timestamps are not recorded.
+    if (status != CL_COMPLETE || err != CL_SUCCESS || queued > submit || submit > start || start > end)
+        return;
+
+    const uint64_t execution_ns     = uint64_t(end - start);
+    const uint64_t queue_delay_ns   = uint64_t(start - queued);
+    __sync_fetch_and_add(&entry->count, 1);
+    __sync_fetch_and_add(&entry->total_ns, execution_ns);
+    __sync_fetch_and_add(&entry->total_submit_delay_ns, uint64_t(submit - queued));
+    __sync_fetch_and_add(&entry->total_queue_delay_ns, queue_delay_ns);
+    __sync_fetch_and_add(&entry->execution_histogram[Profile_Bucket(execution_ns)], 1);
+    __sync_fetch_and_add(&entry->queue_delay_histogram[Profile_Bucket(queue_delay_ns)], 1);
+    Atomic_Max(&entry->max_ns, execution_ns);
 }
 
 // *****************************************************************************
-void OpenCL_Kernel::Load_Program_From_File()
+bool Longer_Total_Time(const OpenCL_Kernel_Statistics &a, const OpenCL_Kernel_Statistics &b)
 {
-    // Program Setup
-    int pl;
-    size_t program_length;
-    char* cSourceCL;
+    return a.total_ns > b.total_ns;
+}
 
-    // Test of file exists
-    std::ifstream input_file(filename.c_str());
-    if (input_file.is_open())
-    {
-        std_cout << "Loading OpenCL program from \"" << filename << "\"...\n";
+// *****************************************************************************
+void OpenCL_Profiler::Read_Environment()
+{
+    // Enable() was called first.
+    if (enabled != -1)
+        return;
 
-        // Loads the contents of the file at the given path
-        cSourceCL = read_opencl_kernel(filename, &pl);
-        program_length = (size_t) pl;
+    const char *value = getenv("OCLUTILS_PROFILE");
+    enabled = (value != NULL && std::string(value) == "1") ? 1 : 0;
+}
 
-        input_file.close();
+// *****************************************************************************
+bool OpenCL_Profiler::Is_Enabled()
+{
+    pthread_once(&profiler_environment_once, Read_Environment);
+    return enabled == 1;
+}
+
+// *****************************************************************************
+void OpenCL_Profiler::Enable(const bool _enabled)
+{
+    enabled = (_enabled ? 1 : 0);
+}
+
+// *****************************************************************************
+OpenCL_Profile_Entry *OpenCL_Profiler::Entry(const std::string &kernel_name, const cl_device_id device)
+/**
+ * Entry of "kernel_name", created on first use. Kernels of the same name share
+ * it: their resolution is the coarsest of their devices.
+ */
+{
+    const uint64_t resolution_ns = Get_Device_Info<size_t>(device, CL_DEVICE_PROFILING_TIMER_RESOLUTION,
+                                                           "clGetDeviceInfo (CL_DEVICE_PROFILING_TIMER_RESOLUTION)");
+
+    pthread_mutex_lock(&profile_entries_mutex);
+    OpenCL_Profile_Entry *&entry = profile_entries[kernel_name];
+    if (entry == NULL)
+        entry = new OpenCL_Profile_Entry(kernel_name);
+    pthread_mutex_unlock(&profile_entries_mutex);
+
+    Atomic_Max(&entry->resolution_ns, resolution_ns);
+    return entry;
+}
+
+// *****************************************************************************
+void OpenCL_Profiler::Profile_Launch(OpenCL_Profile_Entry *entry, const cl_command_queue command_queue, cl_event *event)
+/**
+ * Record the launch of "*event" on completion. Releases the event.
+ */
+{
+    cl_command_queue_properties properties = 0;
+    cl_int err = clGetCommandQueueInfo(command_queue, CL_QUEUE_PROPERTIES, sizeof(properties), &properties, NULL);
+    OpenCL_Test_Success(err, "clGetCommandQueueInfo");
+    if ((properties & CL_QUEUE_PROFILING_ENABLE) == 0)
+    {
+        if (__sync_fetch_and_add(&entry->nb_unprofiled_queues, 1) == 0)
+            OpenCL_Log_Warning("OpenCL: WARNING: Kernel '" << entry->name << "' launched on a queue without "
+                               "CL_QUEUE_PROFILING_ENABLE: its launches there are not profiled.");
+        err = clReleaseEvent(*event);
+        OpenCL_Test_Success(err, "clReleaseEvent");
+        return;
     }
-    else
+
+    err = clSetEventCallback(*event, CL_COMPLETE, Profile_Completion, entry);
+    if (err != CL_SUCCESS)
     {
-        cSourceCL = (char *)filename.c_str();
-        program_length = filename.size();
+        clReleaseEvent(*event);
+        OpenCL_Test_Success(err, "clSetEventCallback");
     }
+}
 
-    // create the program
-    program = clCreateProgramWithSource(context, 1, (const char **) &cSourceCL, &program_length, &err);
-    OpenCL_Test_Success(err, "clCreateProgramWithSource");
+// *****************************************************************************
+std::vector<OpenCL_Kernel_Statistics> OpenCL_Profiler::Kernel_Statistics()
+{
+    std::vector<OpenCL_Kernel_Statistics> all;
 
-    Build_Executable(true);
+    pthread_mutex_lock(&profile_entries_mutex);
+    std::map<std::string, OpenCL_Profile_Entry *>::const_iterator it;
+    for (it = profile_entries.begin() ; it != profile_entries.end() ; ++it)
+    {
+        const OpenCL_Profile_Entry *entry = it->second;
+        OpenCL_Kernel_Statistics statistics;
+        statistics.name                 = entry->name;
+        statistics.count                = entry->count;
+        statistics.total_ns             = entry->total_ns;
+        statistics.max_ns               = entry->max_ns;
+        statistics.resolution_ns        = entry->resolution_ns;
+        const uint64_t count            = std::max(statistics.count, uint64_t(1));
+        statistics.mean_ns              = statistics.total_ns / count;
+        statistics.submit_delay_mean_ns = entry->total_submit_delay_ns / count;
+        statistics.queue_delay_mean_ns  = entry->total_queue_delay_ns / count;
+        statistics.p50_ns               = Profile_Percentile(entry->execution_histogram,   statistics.count, 0.50, statistics.resolution_ns);
+        statistics.p99_ns               = Profile_Percentile(entry->execution_histogram,   statistics.count, 0.99, statistics.resolution_ns);
+        statistics.queue_delay_p99_ns   = Profile_Percentile(entry->queue_delay_histogram, statistics.count, 0.99, statistics.resolution_ns);
+        all.push_back(statistics);
+    }
+    pthread_mutex_unlock(&profile_entries_mutex);
+
+    std::stable_sort(all.begin(), all.end(), Longer_Total_Time);
+    return all;
 }
 
 // *****************************************************************************
-void OpenCL_Kernel::Build_Executable(const bool verbose)
+void OpenCL_Profiler::Reset()
+{
+    pthread_mutex_lock(&profile_entries_mutex);
+    std::map<std::string, OpenCL_Profile_Entry *>::iterator it;
+    for (it = profile_entries.begin() ; it != profile_entries.end() ; ++it)
+    {
+        OpenCL_Profile_Entry *entry = it->second;
+        entry->count                    = 0;
+        entry->total_ns                 = 0;
+        entry->max_ns                   = 0;
+        entry->total_submit_delay_ns    = 0;
+        entry->total_queue_delay_ns     = 0;
+        memset(entry->execution_histogram,   0, sizeof(entry->execution_histogram));
+        memset(entry->queue_delay_histogram, 0, sizeof(entry->queue_delay_histogram));
+    }
+    pthread_mutex_unlock(&profile_entries_mutex);
+}
+
+// *****************************************************************************
+struct OpenCL_Transfer_Counters
 /**
- * Build the program executable
+ * Updated by completion callbacks with atomic operations only. Rates are
+ * kept in MB/s (bytes per millisecond).
  */
 {
-    if (verbose)
+    uint64_t    count;
+    uint64_t    bytes;
+    uint64_t    total_ns;
+    uint64_t    last_mbps;
+    uint64_t    best_mbps;
+    uint64_t    nb_slow;
+};
+
+struct OpenCL_Transfer_Device_Entry
+/**
+ * Transfers of all arrays of a device. Entries live as long as the process.
+ */
+{
+    cl_device_id                device;
+    std::string                 name;
+    uint64_t                    peak_mbps[2];           // Per OpenCL_Transfer_Direction, 0 if unknown
+    int                         nb_unprofiled_queues;   // Transfers on queues without profiling (warned once)
+    OpenCL_Transfer_Counters    counters[2];
+
+    OpenCL_Transfer_Device_Entry(const cl_device_id _device, const std::string &_name)
+        : device(_device), name(_name), nb_unprofiled_queues(0)
     {
-        std_cout << "Building the program..." << std::flush;
-        std_cout << "\nOpenCL Compiler Options: " << compiler_options << "\n" << std::flush;
+        memset(peak_mbps, 0, sizeof(peak_mbps));
+        memset(counters,  0, sizeof(counters));
     }
+};
 
-    err = clBuildProgram(program, 0, NULL, compiler_options.c_str(), NULL, NULL);
+struct OpenCL_Transfer_Record
+/**
+ * Transfers of one array. Shared by the array and the callbacks of its
+ * transfers still running: the last one to let go deletes it.
+ */
+{
+    int                             references;
+    OpenCL_Transfer_Device_Entry   *device_entry;
+    OpenCL_Transfer_Counters        counters[2];
 
-    char *build_log;
-    size_t ret_val_size;
-    err = clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &ret_val_size);
-    build_log = new char[ret_val_size+1];
-    err = clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, ret_val_size, build_log, NULL);
-    build_log[ret_val_size] = '\0';
-    OpenCL_Test_Success(err, "1. clGetProgramBuildInfo");
-    if (verbose)
-        std_cout << "OpenCL kernels file compilation log: \n" << build_log << "\n";
+    OpenCL_Transfer_Record(OpenCL_Transfer_Device_Entry *_device_entry)
+        : references(1), device_entry(_device_entry)
+    {
+        memset(counters, 0, sizeof(counters));
+    }
+};
 
-    if (err != CL_SUCCESS)
+struct OpenCL_Pending_Transfer
+{
+    OpenCL_Transfer_Record     *record;
+    OpenCL_Transfer_Direction   direction;
+    uint64_t                    size_bytes;
+};
+
+std::map<cl_device_id, OpenCL_Transfer_Device_Entry *> transfer_device_entries;
+pthread_mutex_t transfer_device_entries_mutex = PTHREAD_MUTEX_INITIALIZER;
+double   slow_transfer_fraction         = 0.5;
+uint64_t slow_transfer_min_size_bytes   = 1024 * 1024;
+
+const char *transfer_direction_names[2] = {"host to device", "device to host"};
+
+// *****************************************************************************
+OpenCL_Transfer_Device_Entry *Transfer_Device_Entry(const cl_device_id device)
+{
+    pthread_mutex_lock(&transfer_device_entries_mutex);
+    OpenCL_Transfer_Device_Entry *&entry = transfer_device_entries[device];
+    if (entry == NULL)
     {
-        cl_build_status build_status;
-        err = clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_STATUS, sizeof(cl_build_status), &build_status, NULL);
-        OpenCL_Test_Success(err, "0. clGetProgramBuildInfo");
+        char name[1024] = "";
+        if (clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL) != CL_SUCCESS)
+            name[0] = '\0';
+        entry = new OpenCL_Transfer_Device_Entry(device, name);
+    }
+    pthread_mutex_unlock(&transfer_device_entries_mutex);
+    return entry;
+}
 
-        //char *build_log;
-        //size_t ret_val_size;
-        err = clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &ret_val_size);
-        OpenCL_Test_Success(err, "1. clGetProgramBuildInfo");
-        //build_log = new char[ret_val_size+1];
-        err = clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, ret_val_size, build_log, NULL);
-        build_log[ret_val_size] = '\0';
+// *****************************************************************************
+void Release_Transfer_Record(OpenCL_Transfer_Record *record)
+{
+    if (record != NULL && __sync_sub_and_fetch(&record->references, 1) == 0)
+        delete record;
+}
 
-        OpenCL_Test_Success(err, "2. clGetProgramBuildInfo");
-        std_cout << "Build log: \n" << build_log << "\n";
-        std_cout << "Kernel did not built correctly. Exiting.\n";
+// *****************************************************************************
+inline void Count_Transfer(OpenCL_Transfer_Counters &counters, const uint64_t size_bytes, const uint64_t duration_ns,
+                           const uint64_t mbps, const bool slow)
+{
+    __sync_fetch_and_add(&counters.count, 1);
+    __sync_fetch_and_add(&counters.bytes, size_bytes);
+    __sync_fetch_and_add(&counters.total_ns, duration_ns);
+    __sync_lock_test_and_set(&counters.last_mbps, mbps);
+    Atomic_Max(&counters.best_mbps, mbps);
+    if (slow)
+        __sync_fetch_and_add(&counters.nb_slow, 1);
+}
 
-        std_cout << std::flush;
-        abort();
+// *****************************************************************************
+OpenCL_Transfer_Statistics Transfer_Counters_Statistics(const OpenCL_Transfer_Counters &counters, const uint64_t peak_mbps)
+{
+    OpenCL_Transfer_Statistics statistics;
+    statistics.count        = counters.count;
+    statistics.bytes        = counters.bytes;
+    statistics.total_ns     = counters.total_ns;
+    statistics.mean_gbps    = (statistics.total_ns == 0 ? 0.0 : double(statistics.bytes) / double(statistics.total_ns));
+    statistics.last_gbps    = 1.0e-3 * double(counters.last_mbps);
+    statistics.best_gbps    = 1.0e-3 * double(counters.best_mbps);
+    statistics.peak_gbps    = 1.0e-3 * double(peak_mbps);
+    statistics.nb_slow      = counters.nb_slow;
+    return statistics;
+}
+
+// *****************************************************************************
+void CL_CALLBACK Transfer_Completion(cl_event event, cl_int status, void *_pending)
+/**
+ * Called by the OpenCL runtime, possibly from its own thread: must not throw.
+ */
+{
+    OpenCL_Pending_Transfer *pending = (OpenCL_Pending_Transfer *) _pending;
+    OpenCL_Transfer_Record *record   = pending->record;
+    const int direction              = int(pending->direction);
+    const uint64_t size_bytes        = pending->size_bytes;
+    delete pending;
+
+    cl_ulong start = 0, end = 0;
+    cl_int err = CL_SUCCESS;
+    if (status == CL_COMPLETE)
+    {
+        err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+        err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END,   sizeof(cl_ulong), &end,   NULL);
     }
+    clReleaseEvent(event);
 
-    delete[] build_log;
+    // Failed transfers and inconsistent timestamps are not recorded.
+    if (status == CL_COMPLETE && err == CL_SUCCESS && start <= end)
+    {
+        OpenCL_Transfer_Device_Entry *device_entry = record->device_entry;
+        const uint64_t duration_ns  = std::max(uint64_t(end - start), uint64_t(1));
+        const uint64_t mbps         = size_bytes * 1000 / duration_ns;
+        const uint64_t peak_mbps    = device_entry->peak_mbps[direction];
+        const bool slow = (peak_mbps != 0 && size_bytes >= slow_transfer_min_size_bytes &&
+                           double(mbps) < slow_transfer_fraction * double(peak_mbps));
+        Count_Transfer(record->counters[direction], size_bytes, duration_ns, mbps, slow);
+        Count_Transfer(device_entry->counters[direction], size_bytes, duration_ns, mbps, slow);
+
+        if (slow)
+        {
+            try
+            {
+                // Warn on an array's first slow transfer in each direction.
+                if (record->counters[direction].nb_slow == 1)
+                    OpenCL_Log_Warning("OpenCL: WARNING: Slow " << transfer_direction_names[direction] << " transfer of "
+                                       << size_bytes << " bytes on '" << device_entry->name << "': "
+                                       << 1.0e-3 * double(mbps) << " GB/s, below " << slow_transfer_fraction
+                                       << " of the peak (" << 1.0e-3 * double(peak_mbps) << " GB/s). Pageable host memory?");
+                else
+                    OpenCL_Log_Debug("OpenCL: Slow " << transfer_direction_names[direction] << " transfer of "
+                                     << size_bytes << " bytes: " << 1.0e-3 * double(mbps) << " GB/s");
+            }
+            catch (...)
+            {
+            }
+        }
+    }
 
-    if (verbose)
-        std_cout << "done.\n";
+    Release_Transfer_Record(record);
 }
 
 // *****************************************************************************
-std::string OpenCL_Error_to_String(cl_int error)
+void Profile_Transfer(OpenCL_Transfer_Record *&record, const cl_device_id device, const cl_command_queue command_queue,
+                      const OpenCL_Transfer_Direction direction, const uint64_t size_bytes, cl_event event)
 /**
- * Helper function to get OpenCL error string from constant
+ * Record the transfer of "event" on completion, in "record" (created if
+ * NULL) and its device's counters. Releases the event.
  */
 {
-    const std::string errorString[] = {
-        "CL_SUCCESS",
-        "CL_DEVICE_NOT_FOUND",
-        "CL_DEVICE_NOT_AVAILABLE",
-        "CL_COMPILER_NOT_AVAILABLE",
-        "CL_MEM_OBJECT_ALLOCATION_FAILURE",
-        "CL_OUT_OF_RESOURCES",
-        "CL_OUT_OF_HOST_MEMORY",
-        "CL_PROFILING_INFO_NOT_AVAILABLE",
-        "CL_MEM_COPY_OVERLAP",
-        "CL_IMAGE_FORMAT_MISMATCH",
-        "CL_IMAGE_FORMAT_NOT_SUPPORTED",
-        "CL_BUILD_PROGRAM_FAILURE",
+    if (record == NULL)
+        record = new OpenCL_Transfer_Record(Transfer_Device_Entry(device));
+
+    cl_command_queue_properties properties = 0;
+    cl_int err = clGetCommandQueueInfo(command_queue, CL_QUEUE_PROPERTIES, sizeof(properties), &properties, NULL);
+    if (err != CL_SUCCESS || (properties & CL_QUEUE_PROFILING_ENABLE) == 0)
+    {
+        clReleaseEvent(event);
+        OpenCL_Test_Success(err, "clGetCommandQueueInfo");
+        if (__sync_fetch_and_add(&record->device_entry->nb_unprofiled_queues, 1) == 0)
+            OpenCL_Log_Warning("OpenCL: WARNING: Arrays transferred on a queue of '" << record->device_entry->name
+                               << "' without CL_QUEUE_PROFILING_ENABLE: these transfers are not profiled.");
+        return;
+    }
+
+    OpenCL_Pending_Transfer *pending = new OpenCL_Pending_Transfer;
+    pending->record     = record;
+    pending->direction  = direction;
+    pending->size_bytes = size_bytes;
+    __sync_fetch_and_add(&record->references, 1);
+    err = clSetEventCallback(event, CL_COMPLETE, Transfer_Completion, pending);
+    if (err != CL_SUCCESS)
+    {
+        __sync_fetch_and_sub(&record->references, 1);
+        delete pending;
+        clReleaseEvent(event);
+        OpenCL_Test_Success(err, "clSetEventCallback");
+    }
+}
+
+// *****************************************************************************
+OpenCL_Transfer_Statistics Transfer_Record_Statistics(const OpenCL_Transfer_Record *record,
+                                                      const OpenCL_Transfer_Direction direction)
+{
+    if (record == NULL)
+    {
+        const OpenCL_Transfer_Counters none = {0, 0, 0, 0, 0, 0};
+        return Transfer_Counters_Statistics(none, 0);
+    }
+    return Transfer_Counters_Statistics(record->counters[direction], record->device_entry->peak_mbps[direction]);
+}
+
+// *****************************************************************************
+double OpenCL_Profiler::Calibrate_Transfers(const cl_context context, const cl_device_id device,
+                                            const OpenCL_Transfer_Direction direction,
+                                            const uint64_t size_bytes, const int nb_repeats)
+/**
+ * Pinned host memory (CL_MEM_ALLOC_HOST_PTR) is transferred by DMA without
+ * an intermediate copy: the best rate the link gives.
+ */
+{
+    OpenCL_Assert(size_bytes > 0);
+    OpenCL_Assert(nb_repeats > 0);
+
+    cl_int err;
+    cl_command_queue queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err);
+    OpenCL_Test_Success(err, "clCreateCommandQueue()");
+    cl_mem pinned = OpenCL_Memory::Create_Buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size_bytes, NULL, &err);
+    cl_mem device_buffer = NULL;
+    void *host = NULL;
+    if (err == CL_SUCCESS)
+        device_buffer = OpenCL_Memory::Create_Buffer(context, CL_MEM_READ_WRITE, size_bytes, NULL, &err);
+    if (err == CL_SUCCESS)
+        host = clEnqueueMapBuffer(queue, pinned, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size_bytes, 0, NULL, NULL, &err);
+    if (err == CL_SUCCESS)
+        memset(host, 0, size_bytes);
+
+    uint64_t best_mbps = 0;
+    for (int r = 0 ; r < nb_repeats && err == CL_SUCCESS ; r++)
+    {
+        cl_event event;
+        if (direction == OPENCL_TRANSFER_HOST_TO_DEVICE)
+            err = clEnqueueWriteBuffer(queue, device_buffer, CL_TRUE, 0, size_bytes, host, 0, NULL, &event);
+        else
+            err = clEnqueueReadBuffer(queue, device_buffer, CL_TRUE, 0, size_bytes, host, 0, NULL, &event);
+        if (err != CL_SUCCESS)
+            break;
+        cl_ulong start = 0, end = 0;
+        err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+        err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END,   sizeof(cl_ulong), &end,   NULL);
+        clReleaseEvent(event);
+        if (err == CL_SUCCESS && start <= end)
+            best_mbps = std::max(best_mbps, size_bytes * 1000 / std::max(uint64_t(end - start), uint64_t(1)));
+    }
+
+    if (host != NULL)
+        clEnqueueUnmapMemObject(queue, pinned, host, 0, NULL, NULL);
+    clFinish(queue);
+    if (device_buffer != NULL)
+        OpenCL_Memory::Release(device_buffer);
+    if (pinned != NULL)
+        OpenCL_Memory::Release(pinned);
+    clReleaseCommandQueue(queue);
+    OpenCL_Test_Success(err, "OpenCL_Profiler::Calibrate_Transfers()");
+
+    Transfer_Device_Entry(device)->peak_mbps[direction] = best_mbps;
+    OpenCL_Log_Info("OpenCL: Peak " << transfer_direction_names[direction] << " transfer rate of '"
+                    << Transfer_Device_Entry(device)->name << "': " << 1.0e-3 * double(best_mbps) << " GB/s");
+    return 1.0e-3 * double(best_mbps);
+}
+
+// *****************************************************************************
+void OpenCL_Profiler::Set_Transfer_Peak(const cl_device_id device, const OpenCL_Transfer_Direction direction, const double gbps)
+{
+    Transfer_Device_Entry(device)->peak_mbps[direction] = uint64_t(std::max(gbps, 0.0) * 1.0e3);
+}
+
+// *****************************************************************************
+void OpenCL_Profiler::Set_Slow_Transfer_Threshold(const double fraction, const uint64_t min_size_bytes)
+{
+    slow_transfer_fraction          = fraction;
+    slow_transfer_min_size_bytes    = min_size_bytes;
+}
+
+// *****************************************************************************
+OpenCL_Transfer_Statistics OpenCL_Profiler::Transfer_Statistics(const cl_device_id device, const OpenCL_Transfer_Direction direction)
+{
+    const OpenCL_Transfer_Device_Entry *entry = Transfer_Device_Entry(device);
+    return Transfer_Counters_Statistics(entry->counters[direction], entry->peak_mbps[direction]);
+}
+
+// *****************************************************************************
+void OpenCL_Profiler::Reset_Transfers()
+{
+    pthread_mutex_lock(&transfer_device_entries_mutex);
+    std::map<cl_device_id, OpenCL_Transfer_Device_Entry *>::iterator it;
+    for (it = transfer_device_entries.begin() ; it != transfer_device_entries.end() ; ++it)
+        memset(it->second->counters, 0, sizeof(it->second->counters));
+    pthread_mutex_unlock(&transfer_device_entries_mutex);
+}
+
+// *****************************************************************************
+void OpenCL_Profiler::Print()
+{
+    const std::vector<OpenCL_Kernel_Statistics> all = Kernel_Statistics();
+    std_cout << "OpenCL: Kernel profile (microseconds, by total time):\n";
+    char line[512];
+    snprintf(line, sizeof(line), "        %-32s %10s %12s %10s %10s %10s %10s %12s %12s\n",
+             "kernel", "count", "total", "mean", "p50", "p99", "max", "queue mean", "queue p99");
+    std_cout << line;
+    for (size_t i = 0 ; i < all.size() ; i++)
+    {
+        const OpenCL_Kernel_Statistics &k = all[i];
+        snprintf(line, sizeof(line), "        %-32s %10llu %12.1f %10.2f %10.2f %10.2f %10.2f %12.2f %12.2f\n",
+                 k.name.c_str(), (unsigned long long) k.count, 1.0e-3 * double(k.total_ns), 1.0e-3 * double(k.mean_ns),
+                 1.0e-3 * double(k.p50_ns), 1.0e-3 * double(k.p99_ns), 1.0e-3 * double(k.max_ns),
+                 1.0e-3 * double(k.queue_delay_mean_ns), 1.0e-3 * double(k.queue_delay_p99_ns));
+        std_cout << line;
+    }
+
+    pthread_mutex_lock(&transfer_device_entries_mutex);
+    const std::map<cl_device_id, OpenCL_Transfer_Device_Entry *> entries(transfer_device_entries);
+    pthread_mutex_unlock(&transfer_device_entries_mutex);
+    if (!entries.empty())
+    {
+        std_cout << "OpenCL: Transfer profile (GB/s):\n";
+        snprintf(line, sizeof(line), "        %-32s %-14s %10s %14s %10s %10s %10s %10s %10s\n",
+                 "device", "direction", "count", "bytes", "mean", "last", "best", "peak", "slow");
+        std_cout << line;
+    }
+    std::map<cl_device_id, OpenCL_Transfer_Device_Entry *>::const_iterator it;
+    for (it = entries.begin() ; it != entries.end() ; ++it)
+    {
+        for (int direction = 0 ; direction < 2 ; direction++)
+        {
+            const OpenCL_Transfer_Statistics t = Transfer_Counters_Statistics(it->second->counters[direction],
+                                                                              it->second->peak_mbps[direction]);
+            snprintf(line, sizeof(line), "        %-32s %-14s %10llu %14llu %10.2f %10.2f %10.2f %10.2f %10llu\n",
+                     it->second->name.c_str(), transfer_direction_names[direction], (unsigned long long) t.count,
+                     (unsigned long long) t.bytes, t.mean_gbps, t.last_gbps, t.best_gbps, t.peak_gbps,
+                     (unsigned long long) t.nb_slow);
+            std_cout << line;
+        }
+    }
+    std_cout << std::flush;
+}
+
+// *****************************************************************************
+struct OpenCL_Trace_Event
+/**
+ * A span, on the host clock. Host spans are on the lane of their thread
+ * (pid 1), device spans on the lane of their queue (a pid per device).
+ */
+{
+    const char *category;               // Static string
+    char        name[64];               // Truncated
+    uint64_t    start_ns;               // Host clock
+    uint64_t    duration_ns;
+    uint64_t    bytes;                  // Transfers only
+    int         pid;
+    int         tid;
+};
+
+struct OpenCL_Trace_Buffer
+/**
+ * Ring buffer of one thread. Only the owning thread writes: "head" is
+ * published after the event it counts, so readers can tell which events
+ * are complete and which were overwritten while they copied them.
+ */
+{
+    int                     tid;            // Host lane, 0 until the thread records a host span
+    uint64_t                capacity;
+    OpenCL_Trace_Event     *events;
+    volatile uint64_t       head;           // Events ever recorded
+    volatile uint64_t       cleared;        // Events before this one were cleared
+};
+
+struct OpenCL_Trace_Queue_Lane
+{
+    int     pid;
+    int     tid;
+    bool    profiling;                      // Queue created with CL_QUEUE_PROFILING_ENABLE
+};
+
+struct OpenCL_Pending_Trace
+{
+    OpenCL_Trace_Event  event;              // Name, lane and bytes set at enqueue
+    uint64_t            enqueue_ns;
+};
+
+int OpenCL_Trace::enabled           = -1;
+size_t trace_buffer_size            = 64 * 1024;
+uint64_t trace_origin_ns            = 0;    // Timestamps are written relative to it
+std::string trace_filename;                 // OCLUTILS_TRACE, written at exit
+pthread_once_t trace_environment_once = PTHREAD_ONCE_INIT;
+pthread_once_t trace_key_once       = PTHREAD_ONCE_INIT;
+pthread_key_t trace_key;
+// Buffers live as long as the process: their thread might exit before Write().
+std::vector<OpenCL_Trace_Buffer *> trace_buffers;
+int trace_nb_host_lanes             = 0;
+std::map<cl_device_id, std::pair<int, std::string> > trace_devices;    // pid and name
+std::map<cl_command_queue, OpenCL_Trace_Queue_Lane> trace_queues;
+pthread_mutex_t trace_mutex         = PTHREAD_MUTEX_INITIALIZER;
+
+// *****************************************************************************
+uint64_t Trace_Now_ns()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1000000000 + uint64_t(now.tv_nsec);
+}
+
+// *****************************************************************************
+void Create_Trace_Key()
+{
+    pthread_key_create(&trace_key, NULL);
+}
+
+// *****************************************************************************
+OpenCL_Trace_Buffer *Trace_Buffer()
+/**
+ * Buffer of the calling thread, created on its first event.
+ */
+{
+    pthread_once(&trace_key_once, Create_Trace_Key);
+    OpenCL_Trace_Buffer *buffer = (OpenCL_Trace_Buffer *) pthread_getspecific(trace_key);
+    if (buffer != NULL)
+        return buffer;
+
+    buffer = new OpenCL_Trace_Buffer;
+    buffer->capacity    = std::max(trace_buffer_size, size_t(1));
+    buffer->events      = new OpenCL_Trace_Event[buffer->capacity];
+    buffer->head        = 0;
+    buffer->cleared     = 0;
+    buffer->tid         = 0;
+    pthread_mutex_lock(&trace_mutex);
+    trace_buffers.push_back(buffer);
+    pthread_mutex_unlock(&trace_mutex);
+    pthread_setspecific(trace_key, buffer);
+    return buffer;
+}
+
+// *****************************************************************************
+void Trace_Record(const OpenCL_Trace_Event &event)
+/**
+ * Append to the calling thread's buffer. Host spans take the thread's lane,
+ * created on its first host span: device spans recorded from the runtime's
+ * completion callbacks keep their queue's lane and create none.
+ */
+{
+    OpenCL_Trace_Buffer *buffer = Trace_Buffer();
+    if (event.pid == 1 && buffer->tid == 0)
+    {
+        pthread_mutex_lock(&trace_mutex);
+        buffer->tid = ++trace_nb_host_lanes;
+        pthread_mutex_unlock(&trace_mutex);
+    }
+    const uint64_t head = buffer->head;
+    OpenCL_Trace_Event &slot = buffer->events[head % buffer->capacity];
+    slot = event;
+    if (slot.pid == 1)
+        slot.tid = buffer->tid;
+    __sync_synchronize();
+    buffer->head = head + 1;
+}
+
+// *****************************************************************************
+void Trace_Set_Name(OpenCL_Trace_Event &event, const std::string &name)
+{
+    const size_t length = std::min(name.size(), sizeof(event.name) - 1);
+    memcpy(event.name, name.data(), length);
+    event.name[length] = '\0';
+}
+
+// *****************************************************************************
+OpenCL_Trace_Scope::OpenCL_Trace_Scope(const char *_category, const char *_name, const char *_suffix,
+                                       const uint64_t _bytes)
+{
+    start_ns = 0;
+    if (!OpenCL_Trace::Is_Enabled())
+        return;
+
+    category = _category;
+    bytes    = _bytes;
+    const size_t length = std::min(strlen(_name), sizeof(name) - 1);
+    memcpy(name, _name, length);
+    const size_t suffix_length = std::min(strlen(_suffix), sizeof(name) - 1 - length);
+    memcpy(name + length, _suffix, suffix_length);
+    name[length + suffix_length] = '\0';
+    start_ns = Trace_Now_ns();
+}
+
+// *****************************************************************************
+OpenCL_Trace_Scope::~OpenCL_Trace_Scope()
+{
+    Close();
+}
+
+// *****************************************************************************
+void OpenCL_Trace_Scope::Close()
+{
+    if (start_ns == 0)
+        return;
+
+    try
+    {
+        OpenCL_Trace_Event event;
+        event.category      = category;
+        memcpy(event.name, name, sizeof(name));
+        event.start_ns      = start_ns;
+        event.duration_ns   = Trace_Now_ns() - start_ns;
+        event.bytes         = bytes;
+        event.pid           = 1;
+        event.tid           = 0;
+        Trace_Record(event);
+    }
+    catch (...)
+    {
+        // Out of memory for the thread's buffer: the span is lost.
+    }
+    start_ns = 0;
+}
+
+// *****************************************************************************
+OpenCL_Trace_Queue_Lane Trace_Queue_Lane(const cl_command_queue command_queue)
+/**
+ * Lane of "command_queue", found on its first traced command.
+ */
+{
+    pthread_mutex_lock(&trace_mutex);
+    std::map<cl_command_queue, OpenCL_Trace_Queue_Lane>::iterator it = trace_queues.find(command_queue);
+    if (it != trace_queues.end())
+    {
+        const OpenCL_Trace_Queue_Lane lane = it->second;
+        pthread_mutex_unlock(&trace_mutex);
+        return lane;
+    }
+    pthread_mutex_unlock(&trace_mutex);
+
+    cl_device_id device = NULL;
+    cl_command_queue_properties properties = 0;
+    cl_int err = clGetCommandQueueInfo(command_queue, CL_QUEUE_DEVICE, sizeof(device), &device, NULL);
+    err |= clGetCommandQueueInfo(command_queue, CL_QUEUE_PROPERTIES, sizeof(properties), &properties, NULL);
+    char device_name[1024] = "";
+    if (err != CL_SUCCESS || clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(device_name), device_name, NULL) != CL_SUCCESS)
+        device_name[0] = '\0';
+
+    pthread_mutex_lock(&trace_mutex);
+    std::map<cl_device_id, std::pair<int, std::string> >::iterator device_it = trace_devices.find(device);
+    if (device_it == trace_devices.end())
+        device_it = trace_devices.insert(std::make_pair(device, std::make_pair(int(trace_devices.size()) + 2,
+                                                                             std::string(device_name)))).first;
+    OpenCL_Trace_Queue_Lane lane;
+    lane.pid        = device_it->second.first;
+    lane.tid        = int(trace_queues.size()) + 1;
+    lane.profiling  = (err == CL_SUCCESS && (properties & CL_QUEUE_PROFILING_ENABLE) != 0);
+    lane = trace_queues.insert(std::make_pair(command_queue, lane)).first->second;
+    pthread_mutex_unlock(&trace_mutex);
+    return lane;
+}
+
+// *****************************************************************************
+void CL_CALLBACK Trace_Completion(cl_event event, cl_int status, void *_pending)
+/**
+ * Called by the OpenCL runtime, possibly from its own thread: must not throw.
+ * The device span is placed on the host clock by its distance to the
+ * command's queued timestamp, taken as the enqueue time.
+ */
+{
+    OpenCL_Pending_Trace *pending = (OpenCL_Pending_Trace *) _pending;
+
+    cl_ulong queued = 0, start = 0, end = 0;
+    cl_int err = CL_SUCCESS;
+    if (status == CL_COMPLETE)
+    {
+        err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL);
+        err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START,  sizeof(cl_ulong), &start,  NULL);
+        err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END,    sizeof(cl_ulong), &end,    NULL);
+    }
+    clReleaseEvent(event);
+
+    if (status == CL_COMPLETE && err == CL_SUCCESS && queued <= start && start <= end)
+    {
+        pending->event.start_ns     = pending->enqueue_ns + uint64_t(start - queued);
+        pending->event.duration_ns  = uint64_t(end - start);
+        try
+        {
+            Trace_Record(pending->event);
+        }
+        catch (...)
+        {
+        }
+    }
+    delete pending;
+}
+
+// *****************************************************************************
+void Trace_Device_Span(const cl_command_queue command_queue, const cl_event event, const char *category,
+                       const std::string &name, const uint64_t bytes, const uint64_t enqueue_ns)
+/**
+ * Record the device span of "event" on completion, if its queue is profiled.
+ * The caller keeps its reference to the event.
+ */
+{
+    const OpenCL_Trace_Queue_Lane lane = Trace_Queue_Lane(command_queue);
+    if (!lane.profiling)
+        return;
+
+    OpenCL_Pending_Trace *pending = new OpenCL_Pending_Trace;
+    pending->event.category = category;
+    Trace_Set_Name(pending->event, name);
+    pending->event.bytes    = bytes;
+    pending->event.pid      = lane.pid;
+    pending->event.tid      = lane.tid;
+    pending->enqueue_ns     = enqueue_ns;
+
+    cl_int err = clRetainEvent(event);
+    OpenCL_Test_Success(err, "clRetainEvent");
+    err = clSetEventCallback(event, CL_COMPLETE, Trace_Completion, pending);
+    if (err != CL_SUCCESS)
+    {
+        delete pending;
+        clReleaseEvent(event);
+        OpenCL_Test_Success(err, "clSetEventCallback");
+    }
+}
+
+// *****************************************************************************
+void Write_Trace_at_Exit()
+{
+    try
+    {
+        OpenCL_Trace::Write(trace_filename);
+    }
+    catch (const OpenCL_Exception &exception)
+    {
+        Report_Exception_in_Destructor(exception);
+    }
+}
+
+// *****************************************************************************
+void OpenCL_Trace::Read_Environment()
+{
+    const char *value = getenv("OCLUTILS_TRACE");
+    if (value != NULL && value[0] != '\0')
+    {
+        trace_filename = value;
+        atexit(Write_Trace_at_Exit);
+    }
+
+    // Enable() was called first.
+    if (enabled != -1)
+        return;
+
+    enabled = (trace_filename.empty() ? 0 : 1);
+    if (enabled == 1)
+        trace_origin_ns = Trace_Now_ns();
+}
+
+// *****************************************************************************
+bool OpenCL_Trace::Is_Enabled()
+{
+    pthread_once(&trace_environment_once, Read_Environment);
+    return enabled == 1;
+}
+
+// *****************************************************************************
+void OpenCL_Trace::Enable(const bool _enabled, const size_t events_per_thread)
+{
+    if (trace_origin_ns == 0)
+        trace_origin_ns = Trace_Now_ns();
+    trace_buffer_size   = events_per_thread;
+    enabled             = (_enabled ? 1 : 0);
+}
+
+// *****************************************************************************
+std::string Trace_JSON_String(const std::string &value)
+{
+    std::string quoted = "\"";
+    for (size_t i = 0 ; i < value.size() ; i++)
+    {
+        const unsigned char c = (unsigned char) value[i];
+        if (c == '"' || c == '\\')
+        {
+            quoted += '\\';
+            quoted += char(c);
+        }
+        else if (c < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        }
+        else
+            quoted += char(c);
+    }
+    return quoted + "\"";
+}
+
+// *****************************************************************************
+void OpenCL_Trace::Write(const std::string &filename)
+/**
+ * Write the events recorded so far (except cleared or overwritten ones).
+ */
+{
+    FILE *file = fopen(filename.c_str(), "w");
+    if (file == NULL)
+        OpenCL_Throw(CL_INVALID_VALUE, "fopen", "Unable to open trace file '" + filename + "' for writing (" + strerror(errno) + ")");
+
+    pthread_mutex_lock(&trace_mutex);
+    const std::vector<OpenCL_Trace_Buffer *> buffers(trace_buffers);
+    const int nb_host_lanes = trace_nb_host_lanes;
+    const std::map<cl_device_id, std::pair<int, std::string> > devices(trace_devices);
+    const std::map<cl_command_queue, OpenCL_Trace_Queue_Lane> queues(trace_queues);
+    pthread_mutex_unlock(&trace_mutex);
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Host\"}}");
+    for (int tid = 1 ; tid <= nb_host_lanes ; tid++)
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Thread %d\"}}",
+                tid, tid);
+    std::map<cl_device_id, std::pair<int, std::string> >::const_iterator device_it;
+    for (device_it = devices.begin() ; device_it != devices.end() ; ++device_it)
+        fprintf(file, ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":%s}}",
+                device_it->second.first, Trace_JSON_String("Device " + device_it->second.second).c_str());
+    std::map<cl_command_queue, OpenCL_Trace_Queue_Lane>::const_iterator queue_it;
+    for (queue_it = queues.begin() ; queue_it != queues.end() ; ++queue_it)
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"Queue %d%s\"}}",
+                queue_it->second.pid, queue_it->second.tid, queue_it->second.tid,
+                queue_it->second.profiling ? "" : " (not profiled)");
+
+    std::vector<OpenCL_Trace_Event> events;
+    for (size_t b = 0 ; b < buffers.size() ; b++)
+    {
+        OpenCL_Trace_Buffer *buffer = buffers[b];
+        const uint64_t head = buffer->head;
+        __sync_synchronize();
+        const uint64_t first = std::max(uint64_t(buffer->cleared), head - std::min(head, buffer->capacity));
+        events.resize(size_t(head - first));
+        for (uint64_t i = first ; i < head ; i++)
+            events[size_t(i - first)] = buffer->events[i % buffer->capacity];
+        __sync_synchronize();
+        // Events overwritten while they were copied are dropped.
+        const uint64_t head_after = buffer->head;
+        const uint64_t first_valid = std::max(first, head_after - std::min(head_after, buffer->capacity));
+
+        for (uint64_t i = first_valid ; i < head ; i++)
+        {
+            const OpenCL_Trace_Event &event = events[size_t(i - first)];
+            const double start_us = 1.0e-3 * (double(event.start_ns) - double(trace_origin_ns));
+            fprintf(file, ",\n{\"name\":%s,\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+                    Trace_JSON_String(event.name).c_str(), event.category, start_us, 1.0e-3 * double(event.duration_ns),
+                    event.pid, event.tid);
+            // Host spans of non-blocking transfers only cover their enqueue: no rate.
+            if (event.bytes != 0 && event.pid == 1)
+                fprintf(file, ",\"args\":{\"bytes\":%llu}", (unsigned long long) event.bytes);
+            else if (event.bytes != 0)
+                fprintf(file, ",\"args\":{\"bytes\":%llu,\"GB/s\":%.3f}", (unsigned long long) event.bytes,
+                        double(event.bytes) / double(std::max(event.duration_ns, uint64_t(1))));
+            fprintf(file, "}");
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    const bool failed = (ferror(file) != 0);
+    if (fclose(file) != 0 || failed)
+        OpenCL_Throw(CL_INVALID_VALUE, "fwrite", "Unable to write trace file '" + filename + "'");
+    OpenCL_Log_Info("OpenCL: Trace written to '" << filename << "'.");
+}
+
+// *****************************************************************************
+void OpenCL_Trace::Clear()
+{
+    pthread_mutex_lock(&trace_mutex);
+    for (size_t b = 0 ; b < trace_buffers.size() ; b++)
+        trace_buffers[b]->cleared = trace_buffers[b]->head;
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+// *****************************************************************************
+class OpenCL_Transfer_Probe
+/**
+ * Event of an array transfer, requested only when transfers are profiled
+ * or traced. Record() is called once the transfer is enqueued.
+ */
+{
+private:
+    const OpenCL_Transfer_Direction direction;
+    const uint64_t      size_bytes;
+    const bool          profiled;
+    const bool          traced;
+    OpenCL_Trace_Scope  trace;          // Host span, up to Record()
+    uint64_t            enqueue_ns;
+    cl_event            event;
+
+public:
+    OpenCL_Transfer_Probe(const OpenCL_Transfer_Direction _direction, const uint64_t _size_bytes)
+        : direction(_direction), size_bytes(_size_bytes),
+          profiled(OpenCL_Profiler::Is_Enabled()), traced(OpenCL_Trace::Is_Enabled()),
+          trace("transfer", transfer_direction_names[_direction], "", _size_bytes),
+          enqueue_ns(traced ? Trace_Now_ns() : 0), event(NULL)
+    {
+    }
+
+    cl_event *Event()                   { return (profiled || traced) ? &event : NULL; }
+
+    void Record(OpenCL_Transfer_Record *&record, const cl_device_id device, const cl_command_queue command_queue)
+    {
+        trace.Close();
+        if (event == NULL)
+            return;
+        const cl_event recorded = event;
+        event = NULL;
+        if (traced)
+            Trace_Device_Span(command_queue, recorded, "transfer", transfer_direction_names[direction], size_bytes, enqueue_ns);
+        // Takes over our reference to the event.
+        if (profiled)
+            Profile_Transfer(record, device, command_queue, direction, size_bytes, recorded);
+        else
+            clReleaseEvent(recorded);
+    }
+};
+
+// *****************************************************************************
+int OpenCL_Kernel::Get_Multiple(int n, int base)
+{
+    int multipleOfWorkSize = 0;
+
+    if (n < base)
+    {
+        multipleOfWorkSize = base;
+    }
+    else if (n % base == 0)
+    {
+        multipleOfWorkSize = n;
+    }
+    else
+    {
+        multipleOfWorkSize = base*(int)std::floor(n/base) + base;
+    }
+
+    return multipleOfWorkSize;
+}
+
+// *****************************************************************************
+void OpenCL_Kernel::Load_Program_From_File()
+{
+    // Program Setup
+    int pl;
+    size_t program_length;
+    char* cSourceCL;
+
+    // Test of file exists
+    std::ifstream input_file(filename.c_str());
+    if (input_file.is_open())
+    {
+        OpenCL_Log_Debug("OpenCL: Loading OpenCL program from \"" << filename << "\"...");
+
+        // Loads the contents of the file at the given path
+        cSourceCL = read_opencl_kernel(filename, &pl);
+        program_length = (size_t) pl;
+
+        input_file.close();
+    }
+    else
+    {
+        cSourceCL = (char *)filename.c_str();
+        program_length = filename.size();
+    }
+
+    // create the program
+    program = clCreateProgramWithSource(context, 1, (const char **) &cSourceCL, &program_length, &err);
+    OpenCL_Test_Success(err, "clCreateProgramWithSource");
+
+    Build_Executable(true);
+}
+
+// *****************************************************************************
+void OpenCL_Kernel::Build_Executable(const bool verbose)
+/**
+ * Build the program executable
+ */
+{
+    if (verbose)
+        OpenCL_Log_Debug("OpenCL: Building the program (compiler options: \"" << compiler_options << "\")...");
+
+    cl_int build_err;
+    {
+        OpenCL_Trace_Scope trace("build", "clBuildProgram ", kernel_name.c_str());
+        build_err = clBuildProgram(program, 0, NULL, compiler_options.c_str(), NULL, NULL);
+    }
+
+    // The build log is only fetched to report an error or when debugging.
+    const bool log_debug = (verbose && OPENCL_LOG_DEBUG >= OCLUTILS_LOG_MIN_LEVEL && OpenCL_Log::Is_Enabled(OPENCL_LOG_DEBUG));
+    if (build_err == CL_SUCCESS && !log_debug)
+        return;
+
+    char *build_log;
+    size_t ret_val_size;
+    err = clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &ret_val_size);
+    OpenCL_Test_Success(err, "1. clGetProgramBuildInfo");
+    build_log = new char[ret_val_size+1];
+    err = clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, ret_val_size, build_log, NULL);
+    build_log[ret_val_size] = '\0';
+    const std::string log(build_log);
+    delete[] build_log;
+    OpenCL_Test_Success(err, "2. clGetProgramBuildInfo");
+
+    // The program is released by the destructor.
+    if (build_err != CL_SUCCESS)
+        OpenCL_Throw(build_err, "clBuildProgram", "Kernel did not built correctly. Build log:\n" + log);
+
+    OpenCL_Log_Debug("OpenCL: Program built. Compilation log:\n" << log);
+}
+
+// *****************************************************************************
+std::string OpenCL_Error_to_String(cl_int error)
+/**
+ * Helper function to get OpenCL error string from constant
+ */
+{
+    const std::string errorString[] = {
+        "CL_SUCCESS",
+        "CL_DEVICE_NOT_FOUND",
+        "CL_DEVICE_NOT_AVAILABLE",
+        "CL_COMPILER_NOT_AVAILABLE",
+        "CL_MEM_OBJECT_ALLOCATION_FAILURE",
+        "CL_OUT_OF_RESOURCES",
+        "CL_OUT_OF_HOST_MEMORY",
+        "CL_PROFILING_INFO_NOT_AVAILABLE",
+        "CL_MEM_COPY_OVERLAP",
+        "CL_IMAGE_FORMAT_MISMATCH",
+        "CL_IMAGE_FORMAT_NOT_SUPPORTED",
+        "CL_BUILD_PROGRAM_FAILURE",
         "CL_MAP_FAILURE",
         "",
         "",
@@ -1451,245 +3269,5051 @@ std::string OpenCL_Error_to_String(cl_int error)
         "CL_INVALID_GLOBAL_WORK_SIZE",
     };
 
-    const int errorCount = sizeof(errorString) / sizeof(errorString[0]);
+    const int errorCount = sizeof(errorString) / sizeof(errorString[0]);
+
+    const int index = -error;
+
+    return (index >= 0 && index < errorCount) ? errorString[index] : "Unspecified Error";
+}
+
+// *****************************************************************************
+OpenCL_Log_Level OpenCL_Log::level          = OPENCL_LOG_DEFAULT;
+OpenCL_Log::Sink OpenCL_Log::sink           = NULL;
+void *           OpenCL_Log::sink_argument  = NULL;
+pthread_once_t log_environment_once = PTHREAD_ONCE_INIT;
+pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// *****************************************************************************
+void OpenCL_Log::Read_Environment()
+{
+    // Set_Level() was called first.
+    if (level != OPENCL_LOG_DEFAULT)
+        return;
+
+    level = OPENCL_LOG_INFO;
+    const char *value = getenv("OCLUTILS_LOG");
+    if (value == NULL || value[0] == '\0')
+        return;
+
+    const std::string setting(value);
+    if      (setting == "debug")    level = OPENCL_LOG_DEBUG;
+    else if (setting == "info")     level = OPENCL_LOG_INFO;
+    else if (setting == "warning")  level = OPENCL_LOG_WARNING;
+    else if (setting == "error")    level = OPENCL_LOG_ERROR;
+    else if (setting == "none")     level = OPENCL_LOG_NONE;
+    else
+        Write(OPENCL_LOG_WARNING, "OpenCL: WARNING: Unknown OCLUTILS_LOG value '" + setting + "', using 'info'.");
+}
+
+// *****************************************************************************
+OpenCL_Log_Level OpenCL_Log::Level()
+{
+    pthread_once(&log_environment_once, Read_Environment);
+    return level;
+}
+
+// *****************************************************************************
+void OpenCL_Log::Set_Level(const OpenCL_Log_Level _level)
+{
+    level = _level;
+}
+
+// *****************************************************************************
+void OpenCL_Log::Set_Sink(Sink _sink, void *_argument)
+/**
+ * Not synchronized with Write(): set the sink before using the library.
+ */
+{
+    sink            = _sink;
+    sink_argument   = _argument;
+}
+
+// *****************************************************************************
+void OpenCL_Log::Write(const OpenCL_Log_Level _level, const std::string &message)
+{
+    if (sink != NULL)
+    {
+        sink(_level, message, sink_argument);
+        return;
+    }
+
+    // One message at a time, so that messages from different threads don't mix.
+    pthread_mutex_lock(&log_mutex);
+    std_cout << message << "\n";
+    if (_level >= OPENCL_LOG_WARNING)
+        std_cout << std::flush;
+    pthread_mutex_unlock(&log_mutex);
+}
+
+// *****************************************************************************
+std::string Exception_Message(const cl_int error, const std::string &call, const std::string &message,
+                              const char *file, const int line)
+{
+    std::ostringstream what;
+    what << "ERROR calling " << call << "() (" << file << " line " << line << "): " << OpenCL_Error_to_String(error);
+    if (message != "")
+        what << "\n" << message;
+    return what.str();
+}
+
+// *****************************************************************************
+OpenCL_Exception::OpenCL_Exception(const cl_int _error, const std::string &_call, const std::string &message,
+                                   const char *_file, const int _line)
+    : std::runtime_error(Exception_Message(_error, _call, message, _file, _line)),
+      error(_error), call(_call), file(_file), line(_line)
+{
+    // What was printed before the error must not be lost if it terminates the program.
+    std_cout << std::flush;
+}
+
+// *****************************************************************************
+void Report_Exception_in_Destructor(const OpenCL_Exception &exception)
+/**
+ * Destructors must not throw: the error is reported and the object is
+ * destroyed anyway (possibly leaking the OpenCL objects it held).
+ */
+{
+    OpenCL_Log_Error(exception.what() << " (in a destructor, ignored)");
+}
+
+// *****************************************************************************
+namespace OpenCL_Memory
+{
+    // Allocations are recorded per memory object so releases can be
+    // attributed to the right context and device.
+    struct Allocation
+    {
+        uint64_t        size;
+        cl_context      context;
+        cl_device_id    device;
+    };
+
+    pthread_mutex_t                                 mutex = PTHREAD_MUTEX_INITIALIZER;
+    std::map<cl_mem, Allocation>                    allocations;
+    std::map<cl_device_id, OpenCL_Memory_Statistics> device_statistics;
+    std::map<cl_context, OpenCL_Memory_Statistics>  context_statistics;
+
+    // *************************************************************************
+    void Add(OpenCL_Memory_Statistics &statistics, const uint64_t size)
+    {
+        statistics.live_bytes += size;
+        statistics.nb_allocations++;
+        if (statistics.live_bytes > statistics.peak_bytes)
+            statistics.peak_bytes = statistics.live_bytes;
+    }
+
+    // *************************************************************************
+    void Remove(OpenCL_Memory_Statistics &statistics, const uint64_t size)
+    {
+        statistics.live_bytes -= size;
+        statistics.nb_releases++;
+    }
+
+    // *************************************************************************
+    cl_mem Create_Buffer(cl_context context, cl_mem_flags flags, size_t size,
+                         void *host_ptr, cl_int *err)
+    {
+        cl_mem memory = clCreateBuffer(context, flags, size, host_ptr, err);
+        if (memory != NULL)
+            Track(memory);
+        return memory;
+    }
+
+    // *************************************************************************
+    void Track(cl_mem memory)
+    {
+        Allocation allocation;
+        size_t size;
+        cl_int err;
+        err  = clGetMemObjectInfo(memory, CL_MEM_SIZE,    sizeof(size),               &size,                  NULL);
+        err |= clGetMemObjectInfo(memory, CL_MEM_CONTEXT, sizeof(allocation.context), &allocation.context,    NULL);
+        // Contexts created by the library contain a single device.
+        err |= clGetContextInfo(allocation.context, CL_CONTEXT_DEVICES, sizeof(allocation.device), &allocation.device, NULL);
+        OpenCL_Test_Success(err, "OpenCL_Memory::Track()");
+        allocation.size = size;
+
+        pthread_mutex_lock(&mutex);
+        allocations[memory] = allocation;
+        Add(device_statistics[allocation.device],   allocation.size);
+        Add(context_statistics[allocation.context], allocation.size);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    // *************************************************************************
+    cl_int Release(cl_mem memory)
+    {
+        pthread_mutex_lock(&mutex);
+        std::map<cl_mem, Allocation>::iterator it = allocations.find(memory);
+        if (it != allocations.end())
+        {
+            Remove(device_statistics[it->second.device],   it->second.size);
+            Remove(context_statistics[it->second.context], it->second.size);
+            allocations.erase(it);
+        }
+        pthread_mutex_unlock(&mutex);
+
+        return clReleaseMemObject(memory);
+    }
+
+    // *************************************************************************
+    OpenCL_Memory_Statistics Device_Statistics(const cl_device_id device)
+    {
+        pthread_mutex_lock(&mutex);
+        OpenCL_Memory_Statistics statistics;
+        std::map<cl_device_id, OpenCL_Memory_Statistics>::const_iterator it = device_statistics.find(device);
+        if (it != device_statistics.end())
+            statistics = it->second;
+        pthread_mutex_unlock(&mutex);
+        return statistics;
+    }
+
+    // *************************************************************************
+    OpenCL_Memory_Statistics Context_Statistics(const cl_context context)
+    {
+        pthread_mutex_lock(&mutex);
+        OpenCL_Memory_Statistics statistics;
+        std::map<cl_context, OpenCL_Memory_Statistics>::const_iterator it = context_statistics.find(context);
+        if (it != context_statistics.end())
+            statistics = it->second;
+        pthread_mutex_unlock(&mutex);
+        return statistics;
+    }
+
+    // *************************************************************************
+    void Print_Statistics()
+    {
+        pthread_mutex_lock(&mutex);
+        std_cout << "OpenCL: Device memory allocated by this process:\n";
+        std::map<cl_device_id, OpenCL_Memory_Statistics>::const_iterator it;
+        for (it = device_statistics.begin() ; it != device_statistics.end() ; ++it)
+        {
+            std_cout
+                << "        device " << it->first << ":\n"
+                << "            live:           " << Bytes_in_String(it->second.live_bytes) << "\n"
+                << "            peak:           " << Bytes_in_String(it->second.peak_bytes) << "\n"
+                << "            allocations:    " << it->second.nb_allocations << " (" << it->second.nb_releases << " released)\n";
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+}
+
+// *****************************************************************************
+std::list<OpenCL_Residency_Manager *> OpenCL_Residency_Manager::managers;
+
+// *****************************************************************************
+OpenCL_Residency_Manager::OpenCL_Residency_Manager()
+{
+    budget_bytes        = 0;
+    resident_bytes      = 0;
+    clock               = 0;
+    nb_evictions        = 0;
+    nb_faults           = 0;
+
+    managers.push_back(this);
+}
+
+// *****************************************************************************
+OpenCL_Residency_Manager::~OpenCL_Residency_Manager()
+{
+    // The arrays still registered must not unregister from a destroyed manager.
+    for (std::map<OpenCL_Resident *, Entry>::iterator it = entries.begin() ; it != entries.end() ; ++it)
+        it->first->residency_manager = NULL;
+
+    managers.remove(this);
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Initialize(const cl_device_id device, const double fraction)
+/**
+ * Set the budget to a fraction of the device's global memory. Some memory
+ * is better left for the OpenCL runtime, programs, private/local memory, etc.
+ */
+{
+    OpenCL_Assert(fraction > 0.0 && fraction <= 1.0);
+    const cl_ulong global_mem_size = Get_Device_Info<cl_ulong>(device, CL_DEVICE_GLOBAL_MEM_SIZE, "clGetDeviceInfo (CL_DEVICE_GLOBAL_MEM_SIZE)");
+    budget_bytes = uint64_t(fraction * double(global_mem_size));
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Register(OpenCL_Resident *array)
+{
+    Entry &entry    = entries[array];
+    entry.last_use  = ++clock;
+    entry.pin_count = 0;
+    entry.evicted   = false;
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Unregister(OpenCL_Resident *array)
+{
+    std::map<OpenCL_Resident *, Entry>::iterator it = entries.find(array);
+    if (it == entries.end())
+        return;
+
+    if (array->Is_Resident())
+        Released(array);
+    entries.erase(it);
+
+    // Forget the kernel arguments the array was bound to
+    std::map<cl_kernel, std::map<int, std::pair<OpenCL_Resident *, bool> > >::iterator kit;
+    for (kit = bindings.begin() ; kit != bindings.end() ; ++kit)
+    {
+        std::map<int, std::pair<OpenCL_Resident *, bool> >::iterator bit = kit->second.begin();
+        while (bit != kit->second.end())
+        {
+            if (bit->second.first == array)
+                kit->second.erase(bit++);
+            else
+                ++bit;
+        }
+    }
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Touch(OpenCL_Resident *array)
+{
+    std::map<OpenCL_Resident *, Entry>::iterator it = entries.find(array);
+    if (it != entries.end())
+        it->second.last_use = ++clock;
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Pin(OpenCL_Resident *array)
+{
+    std::map<OpenCL_Resident *, Entry>::iterator it = entries.find(array);
+    if (it != entries.end())
+        it->second.pin_count++;
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Unpin(OpenCL_Resident *array)
+{
+    std::map<OpenCL_Resident *, Entry>::iterator it = entries.find(array);
+    if (it != entries.end())
+    {
+        OpenCL_Assert(it->second.pin_count > 0);
+        it->second.pin_count--;
+    }
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Allocated(OpenCL_Resident *array)
+{
+    resident_bytes += array->Resident_Size_Bytes();
+
+    std::map<OpenCL_Resident *, Entry>::iterator it = entries.find(array);
+    if (it != entries.end() && it->second.evicted)
+    {
+        nb_faults++;
+        it->second.evicted = false;
+    }
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Released(OpenCL_Resident *array)
+{
+    assert(resident_bytes >= array->Resident_Size_Bytes());
+    resident_bytes -= array->Resident_Size_Bytes();
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Reserve(const uint64_t bytes, const OpenCL_Resident *requester)
+/**
+ * Evict arrays until "bytes" more can be allocated within the budget. If
+ * nothing is left to evict, the allocation is attempted anyway.
+ */
+{
+    while (resident_bytes + bytes > budget_bytes)
+    {
+        if (!Evict_Least_Recently_Used(requester))
+            break;
+    }
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Allocated_Auxiliary(const uint64_t bytes)
+/**
+ * Device memory an array uses besides its content (see Reserve() to make
+ * room for it first).
+ */
+{
+    resident_bytes += bytes;
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Released_Auxiliary(const uint64_t bytes)
+{
+    assert(resident_bytes >= bytes);
+    resident_bytes -= bytes;
+}
+
+// *****************************************************************************
+bool OpenCL_Residency_Manager::Evict_Least_Recently_Used(const OpenCL_Resident *requester)
+/**
+ * Evict the least recently used resident array, excluding pinned arrays and
+ * the array requesting memory.
+ * @return false if no array could be evicted.
+ */
+{
+    std::map<OpenCL_Resident *, Entry>::iterator lru = entries.end();
+    for (std::map<OpenCL_Resident *, Entry>::iterator it = entries.begin() ; it != entries.end() ; ++it)
+    {
+        if (it->first == requester || it->second.pin_count > 0 || !it->first->Is_Resident())
+            continue;
+        if (lru == entries.end() || it->second.last_use < lru->second.last_use)
+            lru = it;
+    }
+
+    if (lru == entries.end())
+        return false;
+
+    lru->first->Evict();
+    lru->second.evicted = true;
+    nb_evictions++;
+
+    return true;
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Bind(cl_kernel kernel, const int order, OpenCL_Resident *array, const bool kernel_writes)
+{
+    bindings[kernel][order] = std::make_pair(array, kernel_writes);
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Unbind(cl_kernel kernel, const int order)
+{
+    std::map<cl_kernel, std::map<int, std::pair<OpenCL_Resident *, bool> > >::iterator it = bindings.find(kernel);
+    if (it != bindings.end())
+        it->second.erase(order);
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Prepare_Launch(cl_kernel kernel)
+/**
+ * Make every array bound to "kernel" resident, update the kernel arguments
+ * (the device memory changes when an array is faulted back in) and mark the
+ * ones the kernel writes dirty.
+ */
+{
+    std::map<cl_kernel, std::map<int, std::pair<OpenCL_Resident *, bool> > >::iterator kit = bindings.find(kernel);
+    if (kit == bindings.end())
+        return;
+
+    std::map<int, std::pair<OpenCL_Resident *, bool> > &arguments = kit->second;
+    std::map<int, std::pair<OpenCL_Resident *, bool> >::iterator it;
+
+    // Pin them all first so faulting in one does not evict another one.
+    OpenCL_Pin_Guard pins;
+    for (it = arguments.begin() ; it != arguments.end() ; ++it)
+        pins.Pin(*it->second.first);
+
+    for (it = arguments.begin() ; it != arguments.end() ; ++it)
+    {
+        it->second.first->Make_Resident();
+        cl_mem memory = it->second.first->Resident_Device_Memory();
+        cl_int err = clSetKernelArg(kernel, it->first, sizeof(cl_mem), &memory);
+        OpenCL_Test_Success(err, "clSetKernelArg()");
+        if (it->second.second)
+            it->second.first->Mark_Device_Dirty();
+    }
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Print() const
+{
+    std_cout
+        << "OpenCL: Residency manager:\n"
+        << "        budget:             " << Bytes_in_String(budget_bytes) << "\n"
+        << "        resident:           " << Bytes_in_String(resident_bytes) << "\n"
+        << "        managed arrays:     " << entries.size() << "\n"
+        << "        evictions:          " << nb_evictions << "\n"
+        << "        faults:             " << nb_faults << "\n";
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Prepare_Launch_All(cl_kernel kernel)
+{
+    for (std::list<OpenCL_Residency_Manager *>::iterator it = managers.begin() ; it != managers.end() ; ++it)
+        (*it)->Prepare_Launch(kernel);
+}
+
+// *****************************************************************************
+void OpenCL_Residency_Manager::Unbind_All(cl_kernel kernel, const int order)
+{
+    for (std::list<OpenCL_Residency_Manager *>::iterator it = managers.begin() ; it != managers.end() ; ++it)
+        (*it)->Unbind(kernel, order);
+}
+
+// *****************************************************************************
+void OpenCL_Resident::Pin()
+{
+    if (residency_manager != NULL)
+        residency_manager->Pin(this);
+}
+
+// *****************************************************************************
+void OpenCL_Resident::Unpin()
+{
+    if (residency_manager != NULL)
+        residency_manager->Unpin(this);
+}
+
+// *****************************************************************************
+// Kernel arguments bound to arrays in coherence mode (see OpenCL_Array::Set_Coherent()).
+// Coherent arrays bound to each kernel argument, and whether the kernel writes to them.
+std::map<cl_kernel, std::map<int, std::pair<OpenCL_Resident *, bool> > > coherent_bindings;
+
+// *****************************************************************************
+void Coherence_Bind(cl_kernel kernel, const int order, OpenCL_Resident *array, const bool kernel_writes)
+{
+    coherent_bindings[kernel][order] = std::make_pair(array, kernel_writes);
+}
+
+// *****************************************************************************
+void Coherence_Unbind(cl_kernel kernel, const int order)
+{
+    std::map<cl_kernel, std::map<int, std::pair<OpenCL_Resident *, bool> > >::iterator it = coherent_bindings.find(kernel);
+    if (it != coherent_bindings.end())
+        it->second.erase(order);
+}
+
+// *****************************************************************************
+void Coherence_Forget(OpenCL_Resident *array)
+{
+    std::map<cl_kernel, std::map<int, std::pair<OpenCL_Resident *, bool> > >::iterator kit;
+    for (kit = coherent_bindings.begin() ; kit != coherent_bindings.end() ; ++kit)
+    {
+        std::map<int, std::pair<OpenCL_Resident *, bool> >::iterator bit = kit->second.begin();
+        while (bit != kit->second.end())
+        {
+            if (bit->second.first == array)
+                kit->second.erase(bit++);
+            else
+                ++bit;
+        }
+    }
+}
+
+// *****************************************************************************
+void Coherence_Prepare_Launch(cl_kernel kernel)
+/**
+ * Upload the coherent arrays bound to "kernel" that were modified on the
+ * host and mark the ones it might write to dirty on the device (unless
+ * bound as inputs or CL_MEM_READ_ONLY).
+ */
+{
+    std::map<cl_kernel, std::map<int, std::pair<OpenCL_Resident *, bool> > >::iterator kit = coherent_bindings.find(kernel);
+    if (kit == coherent_bindings.end())
+        return;
+
+    std::map<int, std::pair<OpenCL_Resident *, bool> >::iterator it;
+    for (it = kit->second.begin() ; it != kit->second.end() ; ++it)
+    {
+        OpenCL_Resident *array = it->second.first;
+        array->Make_Resident();
+        cl_mem memory = array->Resident_Device_Memory();
+        cl_int err = clSetKernelArg(kernel, it->first, sizeof(cl_mem), &memory);
+        OpenCL_Test_Success(err, "clSetKernelArg()");
+        if (it->second.second)
+            array->Mark_Device_Dirty();
+    }
+}
+
+// *****************************************************************************
+int OpenCL_Checksum_Size(const OpenCL_Checksum_Algorithm algorithm)
+{
+    switch (algorithm)
+    {
+        case OPENCL_CHECKSUM_CRC32C:
+            return 4;
+        case OPENCL_CHECKSUM_XXH64:
+            return 8;
+        default:
+            return 64;
+    }
+}
+
+// *****************************************************************************
+OpenCL_Validation_Policy OpenCL_Validation::policy = OPENCL_VALIDATE_DEFAULT;
+uint64_t OpenCL_Validation::period = 1;
+
+pthread_once_t validation_environment_once = PTHREAD_ONCE_INIT;
+
+// *****************************************************************************
+void OpenCL_Validation::Read_Environment()
+{
+    // Set_Policy() was called first.
+    if (policy != OPENCL_VALIDATE_DEFAULT)
+        return;
+
+    policy = OPENCL_VALIDATE_OFF;
+    const char *value = getenv("OCLUTILS_VALIDATE");
+    if (value == NULL || value[0] == '\0')
+        return;
+
+    const std::string setting(value);
+    char *end = NULL;
+    const unsigned long long n = strtoull(value, &end, 10);
+    if (setting == "off")
+        policy = OPENCL_VALIDATE_OFF;
+    else if (setting == "initialize")
+        policy = OPENCL_VALIDATE_ON_INITIALIZE;
+    else if (setting == "transfer")
+        policy = OPENCL_VALIDATE_EVERY_TRANSFER;
+    else if (end != value && *end == '\0')
+    {
+        policy = (n == 0 ? OPENCL_VALIDATE_OFF : (n == 1 ? OPENCL_VALIDATE_EVERY_TRANSFER : OPENCL_VALIDATE_SAMPLED));
+        period = std::max(uint64_t(n), uint64_t(1));
+    }
+    else
+        OpenCL_Log_Warning("OpenCL: WARNING: Unknown OCLUTILS_VALIDATE value '" << setting << "', validation is off.");
+}
+
+// *****************************************************************************
+OpenCL_Validation_Policy OpenCL_Validation::Policy()
+{
+    pthread_once(&validation_environment_once, Read_Environment);
+    return policy;
+}
+
+// *****************************************************************************
+uint64_t OpenCL_Validation::Period()
+{
+    pthread_once(&validation_environment_once, Read_Environment);
+    return period;
+}
+
+// *****************************************************************************
+void OpenCL_Validation::Set_Policy(const OpenCL_Validation_Policy _policy, const uint64_t _period)
+/**
+ * Overrides OCLUTILS_VALIDATE. Call before initializing arrays.
+ */
+{
+    OpenCL_Assert(_policy != OPENCL_VALIDATE_DEFAULT);
+    OpenCL_Assert(_period > 0);
+    policy = _policy;
+    period = _period;
+}
+
+// *****************************************************************************
+void Calculate_Leaf_Checksums(const OpenCL_Checksum_Algorithm algorithm, const void *array,
+                              const uint64_t size_bytes, const uint64_t leaf_size, uint8_t *leaf_checksums)
+/**
+ * Host leaf checksums, laid out as the device writes them: SHA-512 digests
+ * as bytes, CRC32C and XXH64 as native integers.
+ */
+{
+    switch (algorithm)
+    {
+        case OPENCL_CHECKSUM_CRC32C:
+            OpenCL_CRC32C::Calculate_Leaf_Checksums(array, size_bytes, leaf_size, (uint32_t *) leaf_checksums);
+            break;
+        case OPENCL_CHECKSUM_XXH64:
+            OpenCL_XXH64::Calculate_Leaf_Checksums(array, size_bytes, leaf_size, (uint64_t *) leaf_checksums);
+            break;
+        default:
+            if (leaf_size >= size_bytes)
+                OpenCL_SHA512::Calculate_Message_Checksum(array, size_bytes, leaf_checksums);
+            else
+                OpenCL_SHA512::Calculate_Leaf_Checksums(array, size_bytes, leaf_size, leaf_checksums);
+            break;
+    }
+}
+
+// *****************************************************************************
+void Combine_Leaf_Checksums(const OpenCL_Checksum_Algorithm algorithm, const bool tree, const uint8_t *leaf_checksums,
+                            const uint64_t size_bytes, const uint64_t leaf_size, uint8_t checksum[64])
+/**
+ * Array checksum from its leaf checksums (see Calculate_Leaf_Checksums()),
+ * stored big-endian in the first OpenCL_Checksum_Size() bytes of "checksum".
+ * In tree mode, even a single leaf checksum is hashed again.
+ */
+{
+    const uint64_t nb_leaves = OpenCL_SHA512::Nb_Leaves(size_bytes, leaf_size);
+    uint64_t value;
+    memset(checksum, 0, 64);
+    switch (algorithm)
+    {
+        case OPENCL_CHECKSUM_CRC32C:
+            value = OpenCL_CRC32C::Combine_Leaf_Checksums((const uint32_t *) leaf_checksums, size_bytes, leaf_size);
+            for (int i = 0 ; i < 4 ; i++)
+                checksum[i] = uint8_t(value >> (24 - 8 * i));
+            break;
+        case OPENCL_CHECKSUM_XXH64:
+            value = (tree ? OpenCL_XXH64::Calculate_Tree_Checksum((const uint64_t *) leaf_checksums, nb_leaves)
+                          : *(const uint64_t *) leaf_checksums);
+            for (int i = 0 ; i < 8 ; i++)
+                checksum[i] = uint8_t(value >> (56 - 8 * i));
+            break;
+        default:
+            if (tree)
+                OpenCL_SHA512::Calculate_Message_Checksum(leaf_checksums, 64 * nb_leaves, checksum);
+            else
+                memcpy(checksum, leaf_checksums, 64);
+            break;
+    }
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Array<T>::OpenCL_Array()
+{
+    N                           = 0;
+    sizeof_element              = 0;
+    new_array_size_bytes        = 0;
+    host_array                  = NULL;
+    nb_1024bits_blocks          = 0;
+    device_array                = NULL;
+    context                     = NULL;
+    command_queue               = NULL;
+    device                      = NULL;
+    flags                       = 0;
+    cl_array_size_bit           = NULL;
+    cl_sha512sum                = NULL;
+    mapped_address              = NULL;
+    mapped_length               = 0;
+    mapped_write_back           = false;
+    coherent                    = false;
+    host_read_pending           = false;
+    transfer_record             = NULL;
+    checksum_mode               = OPENCL_CHECKSUM_TREE;
+    checksum_algorithm          = OPENCL_CHECKSUM_SHA512;
+    checksum_leaf_size          = 64 * 1024;
+    validation_policy           = OPENCL_VALIDATE_DEFAULT;
+    validation_period           = 1;
+    nb_transfers                = 0;
+    checksum_requested          = false;
+    mismatch_block_size         = 64 * 1024;
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Array<T>::~OpenCL_Array()
+/**
+ * Device memory is only released by Release_Memory(), but the residency
+ * manager and the coherence tracking must not keep pointers to a destroyed
+ * array (one going out of scope while an exception unwinds, for example).
+ * Copies were never registered: forgetting them does nothing.
+ */
+{
+    if (residency_manager != NULL)
+        residency_manager->Unregister(this);
+    if (coherent)
+        Coherence_Forget(this);
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Initialize(int _N, const size_t _sizeof_element,
+                                 T *&_host_array,
+                                 cl_context &_context, cl_mem_flags _flags,
+                                 std::string _platform,
+                                 cl_command_queue &_command_queue,
+                                 cl_device_id &_device,
+                                 const bool _checksum_array)
+{
+    OpenCL_Assert(_host_array != NULL);
+
+    N               = _N;
+    sizeof_element  = _sizeof_element;
+    context         = _context;
+    command_queue   = _command_queue;
+    device          = _device;
+    flags           = _flags;
+    host_array      = _host_array;
+    platform        = _platform;
+    new_array_size_bytes = N * sizeof_element;
+
+    device_is_read_only = ((flags & CL_MEM_READ_ONLY) != 0);
+
+    memset(host_checksum,   0, 64);
+    memset(device_checksum, 0, 64);
+
+    if (residency_manager != NULL)
+        residency_manager->Register(this);
+
+    // Allocate memory on the device
+    Allocate_Device_Memory();
+
+    // Transfer data from host to device (cpu to gpu). The policies
+    // validating transfers check this first one.
+    checksum_requested  = _checksum_array;
+    nb_transfers        = 0;
+    Host_to_Device();
+
+    if (Validation_Policy() == OPENCL_VALIDATE_ON_INITIALIZE)
+        Validate_Data();
+
+    err = clFinish(command_queue);
+    OpenCL_Test_Success(err, "clFinish");
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Initialize_From_File(const std::string &filename, const uint64_t offset, int _N,
+                                           const size_t _sizeof_element,
+                                           cl_context &_context, cl_mem_flags _flags,
+                                           std::string _platform,
+                                           cl_command_queue &_command_queue,
+                                           cl_device_id &_device,
+                                           const bool write_back)
+/**
+ * Use a memory mapped file as the host array instead of a malloc'd copy.
+ * The file is streamed to the device in chunks while the kernel reads
+ * ahead the next chunk, so the data is only ever in the page cache.
+ * @param offset:     Position (bytes) of the first element in the file.
+ *                    Should be a multiple of _sizeof_element.
+ * @param _N:         Number of elements. If negative, the array extends to
+ *                    the end of the file.
+ * @param write_back: If true, the mapping is shared and Device_to_Host()
+ *                    followed by Sync_to_File() writes the results to the
+ *                    file. Otherwise the mapping is private (copy-on-write)
+ *                    and the file is never modified.
+ */
+{
+    const int fd = open(filename.c_str(), (write_back ? O_RDWR : O_RDONLY));
+    if (fd == -1)
+        OpenCL_Throw(CL_INVALID_VALUE, "open", "Unable to open " + filename + " (" + strerror(errno) + ")");
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0)
+    {
+        const int stat_errno = errno;
+        close(fd);
+        OpenCL_Throw(CL_INVALID_VALUE, "fstat", "Unable to stat " + filename + " (" + strerror(stat_errno) + ")");
+    }
+    const uint64_t file_size = uint64_t(file_stat.st_size);
+
+    if (_N < 0 && offset <= file_size)
+        _N = int(std::min((file_size - offset) / _sizeof_element, uint64_t(INT_MAX)));
+    const uint64_t array_size_bytes = uint64_t(std::max(_N, 0)) * _sizeof_element;
+    if (_N <= 0 || offset > file_size || offset + array_size_bytes > file_size)
+    {
+        close(fd);
+        std::ostringstream message;
+        message
+            << "File " << filename << " is too small (" << Bytes_in_String(file_size) << ") for "
+            << _N << " elements at offset " << offset;
+        OpenCL_Throw(CL_INVALID_VALUE, "OpenCL_Array::Initialize_From_File", message.str());
+    }
+
+    // mmap() requires a page aligned offset.
+    const uint64_t page_size        = uint64_t(sysconf(_SC_PAGESIZE));
+    const uint64_t aligned_offset   = offset & ~(page_size - 1);
+    mapped_length       = size_t(offset - aligned_offset + array_size_bytes);
+    mapped_write_back   = write_back;
+
+    // The mapping is always writable since Device_to_Host() writes into it.
+    mapped_address = mmap(NULL, mapped_length, PROT_READ | PROT_WRITE,
+                          (write_back ? MAP_SHARED : MAP_PRIVATE), fd, off_t(aligned_offset));
+    const int mmap_errno = errno;
+    close(fd); // The mapping keeps a reference to the file
+    if (mapped_address == MAP_FAILED)
+    {
+        mapped_address = NULL;
+        OpenCL_Throw(CL_OUT_OF_HOST_MEMORY, "mmap", "Unable to map " + filename + " (" + strerror(mmap_errno) + ")");
+    }
+
+    // The file is read front to back: let the kernel read ahead aggressively
+    // and drop pages behind.
+    madvise(mapped_address, mapped_length, MADV_SEQUENTIAL);
+
+    T *mapped_array = (T *) ((char *) mapped_address + (offset - aligned_offset));
+    Initialize(_N, _sizeof_element, mapped_array, _context, _flags, _platform,
+               _command_queue, _device, false);
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Sync_to_File()
+/**
+ * Wait for pending transfers and flush the host array to the file.
+ * Only meaningful for arrays initialized with Initialize_From_File(..., write_back = true).
+ */
+{
+    OpenCL_Assert(mapped_address != NULL);
+    OpenCL_Assert(mapped_write_back);
+
+    if (coherent)
+        Host_Read();
+
+    err = clFinish(command_queue);
+    OpenCL_Test_Success(err, "clFinish()");
+
+    if (msync(mapped_address, mapped_length, MS_SYNC) != 0)
+    {
+        OpenCL_Throw(CL_OUT_OF_RESOURCES, "msync", strerror(errno));
+    }
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Set_Residency_Manager(OpenCL_Residency_Manager *manager)
+/**
+ * Let "manager" evict this array's device memory when needed. Must be called
+ * before Initialize().
+ */
+{
+    OpenCL_Assert(device_array == NULL && cl_sha512sum == NULL);
+    residency_manager = manager;
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Set_Coherent(const bool _coherent)
+/**
+ * In coherence mode the array tracks which of the host and device copies is
+ * current and transfers are done lazily, only when the stale copy is used:
+ *   - Host_Read()/Host_Write() copy the device array back if a kernel (or
+ *     Fill(), Copy_From(), ...) might have modified it;
+ *   - Host_Write()/Host_Overwrite() mark the host array dirty, so it is
+ *     uploaded by the next OpenCL_Kernel::Launch() using it;
+ *   - Host_to_Device()/Device_to_Host() do nothing if the destination is
+ *     already current.
+ * Kernels must be launched through OpenCL_Kernel::Launch(); after launching a
+ * kernel with clEnqueueNDRangeKernel(), call Mark_Device_Dirty().
+ * The host array must be accessed through the accessors: modifications made
+ * through Get_Host_Pointer() are not tracked and will not be uploaded.
+ * Can be enabled at any time: both copies are then assumed to be current.
+ */
+{
+    coherent = _coherent;
+    if (!coherent)
+    {
+        Coherence_Forget(this);
+        host_is_dirty = false;
+    }
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Set_Checksum_Mode(const OpenCL_Checksum_Mode mode, const uint64_t leaf_size)
+/**
+ * The flat mode is a plain hash of the array, computed by a single work
+ * item on the device. The tree mode (the default) hashes leaves of
+ * "leaf_size" bytes with one work item per leaf on the device and all
+ * cores on the host.
+ */
+{
+    OpenCL_Assert(cl_sha512sum == NULL);
+    OpenCL_Assert(leaf_size > 0 && leaf_size % 128 == 0);
+    checksum_mode       = mode;
+    checksum_leaf_size  = leaf_size;
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Set_Checksum_Algorithm(const OpenCL_Checksum_Algorithm algorithm)
+/**
+ * CRC32C and XXH64 are cheap enough to validate every transfer. SHA-512
+ * (the default) is only needed if the data could be tampered with.
+ */
+{
+    OpenCL_Assert(kernel_checksum.Get_Kernel() == NULL);
+    checksum_algorithm = algorithm;
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Set_Validation_Policy(const OpenCL_Validation_Policy policy, const uint64_t period)
+/**
+ * Overrides the process policy (see OpenCL_Validation) for this array, even
+ * if it was initialized without checksumming. OPENCL_VALIDATE_DEFAULT
+ * reverts to the process policy.
+ */
+{
+    OpenCL_Assert(period > 0);
+    validation_policy = policy;
+    validation_period = period;
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Set_Mismatch_Report(const uint64_t block_size, const std::string &dump_filename)
+/**
+ * When Validate_Data() finds a mismatch, blocks of "block_size" bytes are
+ * compared to report the corrupted ranges. If "dump_filename" is not empty,
+ * the bad blocks are written to it, host and device bytes side by side.
+ */
+{
+    OpenCL_Assert(block_size > 0 && block_size % 128 == 0);
+    mismatch_block_size     = block_size;
+    mismatch_dump_filename  = dump_filename;
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Validation_Policy OpenCL_Array<T>::Validation_Policy() const
+{
+    if (validation_policy != OPENCL_VALIDATE_DEFAULT)
+        return validation_policy;
+    if (!checksum_requested)
+        return OPENCL_VALIDATE_OFF;
+    return OpenCL_Validation::Policy();
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Initialize_Checksum()
+/**
+ * Build the checksum kernel and allocate the leaf checksums, on the first
+ * validation. The array is hashed in place: the host array is left as is.
+ */
+{
+    if (kernel_checksum.Get_Kernel() == NULL)
+    {
+        switch (checksum_algorithm)
+        {
+            case OPENCL_CHECKSUM_CRC32C:
+                kernel_checksum.Initialize(kernel_CRC32C_source, context, device);
+                kernel_checksum.Build("OclUtils_CRC32C_Leaves");
+                break;
+            case OPENCL_CHECKSUM_XXH64:
+                kernel_checksum.Initialize(kernel_XXH64_source, context, device);
+                kernel_checksum.Build("OclUtils_XXH64_Leaves");
+                break;
+            default:
+                kernel_checksum.Initialize(kernel_SHA512_source, context, device);
+                kernel_checksum.Build("OclUtils_SHA512_Leaves");
+                break;
+        }
+    }
+
+    const uint64_t nb_leaves = OpenCL_SHA512::Nb_Leaves(new_array_size_bytes, Checksum_Leaf_Size());
+    const uint64_t checksums_size = nb_leaves * OpenCL_Checksum_Size(checksum_algorithm);
+    if (residency_manager != NULL)
+        residency_manager->Reserve(checksums_size, this);
+    cl_sha512sum = OpenCL_Memory::Create_Buffer(context, CL_MEM_WRITE_ONLY, size_t(checksums_size), NULL, &err);
+    OpenCL_Test_Success(err, "clCreateBuffer()");
+    if (residency_manager != NULL)
+        residency_manager->Allocated_Auxiliary(checksums_size);
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Validate_Transfer()
+{
+    switch (Validation_Policy())
+    {
+        case OPENCL_VALIDATE_EVERY_TRANSFER:
+            Validate_Data();
+            break;
+        case OPENCL_VALIDATE_SAMPLED:
+            if (nb_transfers++ % (validation_policy == OPENCL_VALIDATE_SAMPLED ? validation_period : OpenCL_Validation::Period()) == 0)
+                Validate_Data();
+            break;
+        default:
+            break;
+    }
+}
+
+// *****************************************************************************
+template <class T>
+uint64_t OpenCL_Array<T>::Checksum_Leaf_Size() const
+/**
+ * In flat mode the whole array is a single leaf, except for CRC32C whose
+ * leaf checksums combine into the CRC32C of the whole array anyway.
+ */
+{
+    if (checksum_mode == OPENCL_CHECKSUM_TREE || checksum_algorithm == OPENCL_CHECKSUM_CRC32C)
+        return checksum_leaf_size;
+    return std::max(uint64_t(new_array_size_bytes), uint64_t(1));
+}
+
+// *****************************************************************************
+template <class T>
+T * OpenCL_Array<T>::Host_Read()
+{
+    if (coherent && device_is_dirty)
+        Device_to_Host();
+
+    if (host_read_pending)
+    {
+        err = clFinish(command_queue);
+        OpenCL_Test_Success(err, "clFinish()");
+        host_read_pending = false;
+    }
+
+    return host_array;
+}
+
+// *****************************************************************************
+template <class T>
+T * OpenCL_Array<T>::Host_Write()
+{
+    Host_Read();
+    host_is_dirty = true;
+
+    return host_array;
+}
+
+// *****************************************************************************
+template <class T>
+T * OpenCL_Array<T>::Host_Overwrite()
+{
+    // The device content is discarded, but a previous Device_to_Host() must
+    // not write over the new host content.
+    if (host_read_pending)
+    {
+        err = clFinish(command_queue);
+        OpenCL_Test_Success(err, "clFinish()");
+        host_read_pending = false;
+    }
+    device_is_dirty = false;
+    host_is_dirty   = true;
+
+    return host_array;
+}
+
+// *****************************************************************************
+template <class T>
+bool OpenCL_Array<T>::Host_Is_Preferred(const OpenCL_Backend_Operation operation) const
+/**
+ * The host copy must be current, which is only known for coherent (or
+ * evicted) arrays, and the array smaller than the device's threshold.
+ */
+{
+    const bool host_is_current = ((coherent || (residency_manager != NULL && !is_resident)) && !device_is_dirty);
+    return (host_is_current && new_array_size_bytes < OpenCL_Host_Backend::Threshold(device, operation));
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Allocate_Device_Memory()
+/**
+ * Allocate the device buffer. When managed, make room within the budget
+ * first and, if the allocation still fails, evict arrays until it succeeds.
+ */
+{
+    if (residency_manager != NULL)
+        residency_manager->Reserve(new_array_size_bytes, this);
+
+    device_array = OpenCL_Memory::Create_Buffer(context, flags, new_array_size_bytes, NULL, &err);
+    while ((err == CL_MEM_OBJECT_ALLOCATION_FAILURE || err == CL_OUT_OF_RESOURCES) &&
+           residency_manager != NULL && residency_manager->Evict_Least_Recently_Used(this))
+    {
+        device_array = OpenCL_Memory::Create_Buffer(context, flags, new_array_size_bytes, NULL, &err);
+    }
+    OpenCL_Test_Success(err, "clCreateBuffer()");
+
+    // A new allocation holds nothing: the host array is more recent.
+    is_resident     = true;
+    device_is_dirty = false;
+    host_is_dirty   = true;
+    if (residency_manager != NULL)
+        residency_manager->Allocated(this);
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Evict()
+/**
+ * Release the device memory, copying the device content back to the host
+ * array first if it was modified on the device.
+ */
+{
+    if (!is_resident)
+        return;
+
+    if (device_is_dirty)
+    {
+        OpenCL_Transfer_Probe probe(OPENCL_TRANSFER_DEVICE_TO_HOST, new_array_size_bytes);
+        err = clEnqueueReadBuffer(command_queue, device_array, CL_TRUE, 0, new_array_size_bytes,
+                                  host_array, 0, NULL, probe.Event());
+        OpenCL_Test_Success(err, "clEnqueueReadBuffer()");
+        probe.Record(transfer_record, device, command_queue);
+    }
+
+    err = OpenCL_Memory::Release(device_array);
+    OpenCL_Test_Success(err, "clReleaseMemObject()");
+    device_array    = NULL;
+    is_resident     = false;
+    device_is_dirty = false;
+
+    if (residency_manager != NULL)
+        residency_manager->Released(this);
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Make_Resident()
+{
+    if (residency_manager != NULL)
+        residency_manager->Touch(this);
+
+    if (!is_resident || (coherent && host_is_dirty))
+        Host_to_Device(); // Will allocate the device memory if needed
+}
+
+// *****************************************************************************
+template <class T>
+cl_event OpenCL_Array<T>::Fill(const T &value, const int offset, const int count,
+                               const OpenCL_Backend backend)
+/**
+ * Set elements [offset, offset+count) of the device array to "value", without
+ * any host to device transfer. A negative "count" fills up to the end of the array.
+ * The host array is NOT modified, unless the host backend is used: then
+ * only the host array is.
+ */
+{
+    const int nb_elements = (count < 0 ? N - offset : count);
+    OpenCL_Assert(offset >= 0 && nb_elements >= 0 && offset + nb_elements <= N);
+    OpenCL_Assert(sizeof_element % sizeof(T) == 0);
+
+    // Nothing to do (OpenCL rejects empty fills).
+    if (nb_elements == 0)
+        return Completed_Event(context);
+
+    if (Use_Host_Backend(backend, Host_Is_Preferred(OPENCL_OPERATION_FILL)))
+    {
+        const uint64_t per_element = sizeof_element / sizeof(T);
+        T *host = (offset == 0 && nb_elements == N ? Host_Overwrite() : Host_Write());
+        OpenCL_Host_Backend::Fill(host + uint64_t(offset) * per_element, uint64_t(nb_elements) * per_element, value);
+        return Completed_Event(context);
+    }
+
+    Make_Resident();
+    Mark_Device_Dirty();
+
+    cl_event event = NULL;
+
+    if (Device_Supports_OpenCL_1_2(device))
+    {
+#ifdef CL_VERSION_1_2
+        err = clEnqueueFillBuffer(command_queue, device_array, &value, sizeof(T),
+                                  size_t(offset) * sizeof_element, size_t(nb_elements) * sizeof_element,
+                                  0, NULL, &event);
+        OpenCL_Test_Success(err, "clEnqueueFillBuffer()");
+#endif // #ifdef CL_VERSION_1_2
+    }
+    else
+    {
+        // OpenCL 1.1: use a small kernel instead
+        if (kernel_fill.Get_Kernel() == NULL)
+        {
+            kernel_fill.Initialize(kernel_Fill_source, context, device);
+            kernel_fill.Build("OclUtils_Fill");
+        }
+
+        cl_ulong pattern = 0;
+        assert(sizeof(T) <= sizeof(pattern));
+        memcpy(&pattern, &value, sizeof(T));
+        const cl_uint  pattern_size     = sizeof(T);
+        const cl_ulong offset_bytes     = cl_ulong(offset) * sizeof_element;
+        const cl_ulong nb_patterns      = cl_ulong(nb_elements) * (sizeof_element / sizeof(T));
+
+        cl_kernel k = kernel_fill.Get_Kernel();
+        err  = clSetKernelArg(k, 0, sizeof(cl_mem),     &device_array);
+        err |= clSetKernelArg(k, 1, sizeof(cl_ulong),   &pattern);
+        err |= clSetKernelArg(k, 2, sizeof(cl_uint),    &pattern_size);
+        err |= clSetKernelArg(k, 3, sizeof(cl_ulong),   &offset_bytes);
+        err |= clSetKernelArg(k, 4, sizeof(cl_ulong),   &nb_patterns);
+        OpenCL_Test_Success(err, "clSetKernelArg()");
+
+        // Round up in 64 bits: the number of patterns can exceed an int.
+        const cl_ulong local_x = std::min<cl_ulong>(64, kernel_fill.Get_Max_Work_Group_Size());
+        kernel_fill.Compute_Work_Size(size_t((nb_patterns + local_x - 1) / local_x * local_x), 1, size_t(local_x), 1);
+        kernel_fill.Launch(command_queue, &event);
+    }
+
+    return event;
+}
+
+// *****************************************************************************
+template <class T>
+cl_event OpenCL_Array<T>::Copy_From(OpenCL_Array<T> &other, const int src_offset,
+                                    const int dst_offset, const int count,
+                                    const OpenCL_Backend backend)
+/**
+ * Copy elements from "other"'s device array into this array's device array.
+ * A negative "count" copies the whole "other" array starting at "src_offset".
+ * Both arrays must live in the same context. The host arrays are NOT modified,
+ * unless the host backend is used: then the host arrays are copied instead.
+ */
+{
+    const int nb_elements = (count < 0 ? other.N - src_offset : count);
+    OpenCL_Assert(other.context == context);
+    OpenCL_Assert(other.sizeof_element == sizeof_element);
+    OpenCL_Assert(src_offset >= 0 && nb_elements >= 0 && src_offset + nb_elements <= other.N);
+    OpenCL_Assert(dst_offset >= 0 && dst_offset + nb_elements <= N);
+
+    // Nothing to do (OpenCL rejects empty copies).
+    if (nb_elements == 0)
+        return Completed_Event(context);
+
+    if (Use_Host_Backend(backend, Host_Is_Preferred(OPENCL_OPERATION_COPY) && other.Host_Is_Preferred(OPENCL_OPERATION_COPY)))
+    {
+        const uint64_t per_element = sizeof_element / sizeof(T);
+        const T *source = other.Host_Read();
+        T *destination  = (dst_offset == 0 && nb_elements == N && &other != this ? Host_Overwrite() : Host_Write());
+        OpenCL_Host_Backend::Copy(destination + uint64_t(dst_offset) * per_element,
+                                  source + uint64_t(src_offset) * per_element,
+                                  uint64_t(nb_elements) * per_element);
+        return Completed_Event(context);
+    }
+
+    // Pin both arrays so faulting in one does not evict the other.
+    if (residency_manager != NULL)          residency_manager->Pin(this);
+    if (other.residency_manager != NULL)    other.residency_manager->Pin(&other);
+
+    cl_event event = NULL;
+    try
+    {
+        Make_Resident();
+        other.Make_Resident();
+        Mark_Device_Dirty();
+
+        err = clEnqueueCopyBuffer(command_queue, other.device_array, device_array,
+                                  size_t(src_offset) * sizeof_element,
+                                  size_t(dst_offset) * sizeof_element,
+                                  size_t(nb_elements) * sizeof_element,
+                                  0, NULL, &event);
+        OpenCL_Test_Success(err, "clEnqueueCopyBuffer()");
+    }
+    catch (...)
+    {
+        if (residency_manager != NULL)          residency_manager->Unpin(this);
+        if (other.residency_manager != NULL)    other.residency_manager->Unpin(&other);
+        throw;
+    }
+
+    if (residency_manager != NULL)          residency_manager->Unpin(this);
+    if (other.residency_manager != NULL)    other.residency_manager->Unpin(&other);
+
+    return event;
+}
+
+// *****************************************************************************
+template <class T>
+cl_event OpenCL_Array<T>::Copy_From(OpenCL_Array<T> &other, const std::vector<OpenCL_Copy_Range> &ranges,
+                                    const OpenCL_Backend backend)
+/**
+ * Copy multiple ranges from "other". The returned event completes when all
+ * the copies are done.
+ */
+{
+    // All the ranges are copied on the same side.
+    const OpenCL_Backend side = (Use_Host_Backend(backend, Host_Is_Preferred(OPENCL_OPERATION_COPY) &&
+                                                           other.Host_Is_Preferred(OPENCL_OPERATION_COPY))
+                                 ? OPENCL_BACKEND_HOST : OPENCL_BACKEND_DEVICE);
+    for (size_t i = 0 ; i < ranges.size() ; i++)
+    {
+        cl_event event = Copy_From(other, ranges[i].src_offset, ranges[i].dst_offset, ranges[i].count, side);
+        err = clReleaseEvent(event);
+        OpenCL_Test_Success(err, "clReleaseEvent()");
+    }
+    if (side == OPENCL_BACKEND_HOST)
+        return Completed_Event(context);
+
+    // A marker completes when all previously enqueued commands are done.
+    cl_event event = NULL;
+    err = clEnqueueMarker(command_queue, &event);
+    OpenCL_Test_Success(err, "clEnqueueMarker()");
+
+    return event;
+}
+
+// *****************************************************************************
+template <class T>
+cl_event OpenCL_Array<T>::Clone(OpenCL_Array<T> &clone, T *clone_host_array)
+/**
+ * Initialize "clone" as a copy of this array, on the same context and
+ * command queue. The device array is copied on the device; "clone_host_array"
+ * (at least N elements) is used as the clone's host array but its content is
+ * NOT set: call clone.Device_to_Host() if needed.
+ */
+{
+    OpenCL_Assert(clone_host_array != NULL);
+    OpenCL_Assert(clone.device_array == NULL);
+
+    clone.N                     = N;
+    clone.sizeof_element        = sizeof_element;
+    clone.host_array            = clone_host_array;
+    clone.platform              = platform;
+    clone.context               = context;
+    clone.command_queue         = command_queue;
+    clone.device                = device;
+    clone.flags                 = flags;
+    clone.device_is_read_only   = device_is_read_only;
+    // As in Initialize(): the device array holds exactly N elements.
+    clone.new_array_size_bytes  = size_t(N) * sizeof_element;
+
+    if (clone.residency_manager != NULL)
+        clone.residency_manager->Register(&clone);
+    clone.Allocate_Device_Memory();
+    // The device array is entirely overwritten by the copy, not by the host array.
+    clone.host_is_dirty         = false;
+
+    return clone.Copy_From(*this, 0, 0, -1, OPENCL_BACKEND_DEVICE);
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Set_as_Kernel_Argument(cl_kernel &kernel, const int order, const bool kernel_writes)
+/**
+ * @param kernel_writes: False if the kernel only reads the array: launches
+ *                       then leave the host copy current (coherence mode)
+ *                       and evictions skip the write back (managed arrays).
+ */
+{
+    if (residency_manager != NULL || coherent)
+        Make_Resident();
+
+    if (residency_manager != NULL)
+        residency_manager->Bind(kernel, order, this, kernel_writes);
+    else
+    {
+        // The argument does not refer to a managed array anymore
+        OpenCL_Residency_Manager::Unbind_All(kernel, order);
+    }
+
+    if (coherent)
+        Coherence_Bind(kernel, order, this, kernel_writes);
+    else
+        Coherence_Unbind(kernel, order);
+
+    err = clSetKernelArg(kernel, order, sizeof(cl_mem), &device_array);
+    OpenCL_Test_Success(err, "clSetKernelArg()");
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Release_Memory()
+{
+    if (residency_manager != NULL)
+        residency_manager->Unregister(this);
+    if (coherent)
+        Coherence_Forget(this);
+
+    if (device_array)
+        OpenCL_Memory::Release(device_array);
+    if (cl_sha512sum)
+    {
+        OpenCL_Memory::Release(cl_sha512sum);
+        if (residency_manager != NULL)
+            residency_manager->Released_Auxiliary(OpenCL_SHA512::Nb_Leaves(new_array_size_bytes, Checksum_Leaf_Size()) *
+                                                  OpenCL_Checksum_Size(checksum_algorithm));
+    }
+    device_array    = NULL;
+    cl_sha512sum    = NULL;
+    is_resident     = false;
+
+    // Callbacks of transfers still running keep the record alive.
+    Release_Transfer_Record(transfer_record);
+    transfer_record = NULL;
+
+    if (mapped_address != NULL)
+    {
+        // A non-blocking Device_to_Host() might still be writing to the mapping.
+        clFinish(command_queue);
+        munmap(mapped_address, mapped_length);
+        mapped_address  = NULL;
+        mapped_length   = 0;
+        host_array      = NULL;
+    }
+}
+
+// *****************************************************************************
+template <class T>
+std::string OpenCL_Array<T>::Host_Checksum()
+{
+    return OpenCL_SHA512::Checksum_to_String(host_checksum, OpenCL_Checksum_Size(checksum_algorithm));
+}
+
+// *****************************************************************************
+template <class T>
+std::string OpenCL_Array<T>::Device_Checksum()
+{
+    return OpenCL_SHA512::Checksum_to_String(device_checksum, OpenCL_Checksum_Size(checksum_algorithm));
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Validate_Data()
+/**
+ * Compare the device copy with the host copy; throw (CL_INVALID_MEM_OBJECT) if they differ. Called
+ * according to Validation_Policy(), or at any time.
+ */
+{
+    if (cl_sha512sum == NULL)
+        Initialize_Checksum();
+
+    // Wait for queue to finish
+    err = clFinish(command_queue);
+    OpenCL_Test_Success(err, "clFinish()");
+
+    const bool tree = (checksum_mode == OPENCL_CHECKSUM_TREE);
+    const cl_ulong size_bytes   = new_array_size_bytes;
+    const cl_ulong leaf_size    = Checksum_Leaf_Size();
+    const cl_ulong nb_leaves    = OpenCL_SHA512::Nb_Leaves(size_bytes, leaf_size);
+    const size_t leaf_checksums_size = size_t(nb_leaves) * OpenCL_Checksum_Size(checksum_algorithm);
+
+    // The device hashes its leaves while the host hashes its own.
+    Launch_Leaf_Checksums(leaf_size, cl_sha512sum);
+
+    // Calculate checksum of host memory
+    std::vector<uint8_t> host_leaf_checksums(leaf_checksums_size);
+    Calculate_Leaf_Checksums(checksum_algorithm, host_array, size_bytes, leaf_size, &host_leaf_checksums[0]);
+    Combine_Leaf_Checksums(checksum_algorithm, tree, &host_leaf_checksums[0], size_bytes, leaf_size, host_checksum);
+
+    // Transfer back checksum(s)
+    std::vector<uint8_t> device_leaf_checksums(leaf_checksums_size);
+    err = clEnqueueReadBuffer(command_queue, cl_sha512sum, CL_TRUE, 0, device_leaf_checksums.size(),
+                              &device_leaf_checksums[0], 0, NULL, NULL);
+    OpenCL_Test_Success(err, "clEnqueueReadBuffer");
+    Combine_Leaf_Checksums(checksum_algorithm, tree, &device_leaf_checksums[0], size_bytes, leaf_size, device_checksum);
+
+    if (Host_Checksum() != Device_Checksum())
+    {
+        OpenCL_Log_Error("ERROR: Checksums don't match!\n"
+                         << "Host_Checksum()   = " << Host_Checksum() << "\n"
+                         << "Device_Checksum() = " << Device_Checksum());
+        Report_Mismatch();
+        OpenCL_Throw(CL_INVALID_MEM_OBJECT, "OpenCL_Array::Validate_Data", "Checksums don't match");
+    }
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Launch_Leaf_Checksums(const cl_ulong leaf_size, cl_mem leaf_checksums)
+/**
+ * Enqueue the device checksums of the array's leaves of "leaf_size" bytes.
+ * The device memory changes if the array was evicted, so the arguments are
+ * set every time.
+ */
+{
+    const cl_ulong size_bytes   = new_array_size_bytes;
+    const cl_ulong nb_leaves    = OpenCL_SHA512::Nb_Leaves(size_bytes, leaf_size);
+    // Round up in 64 bits: the number of leaves can exceed an int.
+    const cl_ulong local_x = (nb_leaves > 1 ? std::min<cl_ulong>(64, kernel_checksum.Get_Max_Work_Group_Size()) : 1);
+    kernel_checksum.Compute_Work_Size(size_t((nb_leaves + local_x - 1) / local_x * local_x), 1, size_t(local_x), 1);
+
+    Make_Resident();
+    cl_kernel kernel = kernel_checksum.Get_Kernel();
+    err  = clSetKernelArg(kernel, 0, sizeof(cl_mem),    &device_array);
+    err |= clSetKernelArg(kernel, 1, sizeof(cl_ulong),  &size_bytes);
+    err |= clSetKernelArg(kernel, 2, sizeof(cl_ulong),  &leaf_size);
+    err |= clSetKernelArg(kernel, 3, sizeof(cl_ulong),  &nb_leaves);
+    err |= clSetKernelArg(kernel, 4, sizeof(cl_mem),    &leaf_checksums);
+    OpenCL_Test_Success(err, "clSetKernelArg()");
+    kernel_checksum.Launch(command_queue);
+    err = clFlush(command_queue);
+    OpenCL_Test_Success(err, "clFlush()");
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Report_Mismatch()
+/**
+ * Localize a mismatch found by Validate_Data(): both sides hash blocks of
+ * mismatch_block_size bytes in parallel, and only the ranges of mismatching
+ * blocks are reported, with their first differing bytes. Only the bad
+ * blocks are read back from the device.
+ */
+{
+    const uint64_t size_bytes       = new_array_size_bytes;
+    const uint64_t block_size       = mismatch_block_size;
+    const uint64_t nb_blocks        = OpenCL_SHA512::Nb_Leaves(size_bytes, block_size);
+    const int checksum_size         = OpenCL_Checksum_Size(checksum_algorithm);
+    const uint64_t max_nb_reported  = 16;
+    const uint64_t checksums_size   = nb_blocks * checksum_size;
+
+    if (residency_manager != NULL)
+        residency_manager->Reserve(checksums_size, this);
+    cl_mem device_block_checksums = OpenCL_Memory::Create_Buffer(context, CL_MEM_WRITE_ONLY,
+                                                                 size_t(checksums_size), NULL, &err);
+    OpenCL_Test_Success(err, "clCreateBuffer()");
+    if (residency_manager != NULL)
+        residency_manager->Allocated_Auxiliary(checksums_size);
+
+    std::vector<uint8_t> host_checksums((size_t) checksums_size);
+    std::vector<uint8_t> device_checksums(host_checksums.size());
+    try
+    {
+        Launch_Leaf_Checksums(block_size, device_block_checksums);
+        Calculate_Leaf_Checksums(checksum_algorithm, host_array, size_bytes, block_size, &host_checksums[0]);
+        err = clEnqueueReadBuffer(command_queue, device_block_checksums, CL_TRUE, 0, device_checksums.size(),
+                                  &device_checksums[0], 0, NULL, NULL);
+        OpenCL_Test_Success(err, "clEnqueueReadBuffer()");
+    }
+    catch (...)
+    {
+        OpenCL_Memory::Release(device_block_checksums);
+        if (residency_manager != NULL)
+            residency_manager->Released_Auxiliary(checksums_size);
+        throw;
+    }
+    OpenCL_Memory::Release(device_block_checksums);
+    if (residency_manager != NULL)
+        residency_manager->Released_Auxiliary(checksums_size);
+
+    FILE *dump = NULL;
+    if (!mismatch_dump_filename.empty())
+    {
+        dump = fopen(mismatch_dump_filename.c_str(), "w");
+        if (dump == NULL)
+            OpenCL_Log_Warning("OpenCL: WARNING: Can't open '" << mismatch_dump_filename << "' to dump the mismatching blocks.");
+        else
+            fprintf(dump, "# Mismatching blocks of %llu bytes: offset, host bytes, device bytes ('*' when they differ)\n",
+                    (unsigned long long) block_size);
+    }
+
+    const uint8_t *host_bytes = (const uint8_t *) host_array;
+    std::vector<uint8_t> device_bytes(size_t(std::min(block_size, size_bytes)));
+    uint64_t nb_bad_blocks = 0, nb_ranges = 0;
+    for (uint64_t block = 0 ; block < nb_blocks ; )
+    {
+        if (memcmp(&host_checksums[block * checksum_size], &device_checksums[block * checksum_size], checksum_size) == 0)
+        {
+            block++;
+            continue;
+        }
+
+        // Range of consecutive mismatching blocks [block, last)
+        uint64_t last = block + 1;
+        while (last < nb_blocks && memcmp(&host_checksums[last * checksum_size], &device_checksums[last * checksum_size], checksum_size) != 0)
+            last++;
+        nb_ranges++;
+        nb_bad_blocks += last - block;
+
+        uint64_t first_difference = size_bytes, nb_differences = 0;
+        uint8_t host_first[8], device_first[8];
+        int nb_first = 0;
+        for (uint64_t b = block ; b < last ; b++)
+        {
+            const uint64_t begin    = b * block_size;
+            const uint64_t length   = std::min(block_size, size_bytes - begin);
+            err = clEnqueueReadBuffer(command_queue, device_array, CL_TRUE, begin, length, &device_bytes[0], 0, NULL, NULL);
+            OpenCL_Test_Success(err, "clEnqueueReadBuffer()");
+
+            for (uint64_t i = 0 ; i < length ; i++)
+            {
+                if (host_bytes[begin + i] == device_bytes[i])
+                    continue;
+                nb_differences++;
+                if (first_difference == size_bytes)
+                {
+                    first_difference = begin + i;
+                    for (nb_first = 0 ; nb_first < 8 && i + nb_first < length ; nb_first++)
+                    {
+                        host_first[nb_first]    = host_bytes[begin + i + nb_first];
+                        device_first[nb_first]  = device_bytes[i + nb_first];
+                    }
+                }
+            }
+
+            if (dump != NULL)
+            {
+                fprintf(dump, "# Block %llu: bytes [%llu, %llu)\n", (unsigned long long) b,
+                        (unsigned long long) begin, (unsigned long long) (begin + length));
+                for (uint64_t line = 0 ; line < length ; line += 16)
+                {
+                    const uint64_t n = std::min(uint64_t(16), length - line);
+                    const bool differ = (memcmp(host_bytes + begin + line, &device_bytes[line], n) != 0);
+                    fprintf(dump, "%012llx ", (unsigned long long) (begin + line));
+                    for (uint64_t j = 0 ; j < 16 ; j++)
+                    {
+                        if (j < n)
+                            fprintf(dump, " %02x", host_bytes[begin + line + j]);
+                        else
+                            fprintf(dump, "   ");
+                    }
+                    fprintf(dump, "  ");
+                    for (uint64_t j = 0 ; j < n ; j++)
+                        fprintf(dump, " %02x", device_bytes[line + j]);
+                    fprintf(dump, differ ? " *\n" : "\n");
+                }
+            }
+        }
+
+        if (nb_ranges <= max_nb_reported)
+        {
+            std::ostringstream range;
+            range << "  Bytes [" << block * block_size << ", " << std::min(last * block_size, size_bytes)
+                  << ") (blocks " << block << " to " << last - 1 << "): ";
+            if (nb_differences == 0)
+                range << "no byte differs when read back (transient corruption?)";
+            else
+            {
+                std::ostringstream host_string, device_string;
+                for (int i = 0 ; i < nb_first ; i++)
+                {
+                    host_string     << OpenCL_SHA512::Checksum_to_String(&host_first[i], 1);
+                    device_string   << OpenCL_SHA512::Checksum_to_String(&device_first[i], 1);
+                }
+                range << nb_differences << " bytes differ, first at byte " << first_difference
+                      << ": host " << host_string.str() << ", device " << device_string.str();
+            }
+            OpenCL_Log_Error(range.str());
+        }
+        block = last;
+    }
+
+    if (nb_ranges > max_nb_reported)
+        OpenCL_Log_Error("  (" << nb_ranges - max_nb_reported << " more ranges not shown)");
+    if (nb_bad_blocks == 0)
+        OpenCL_Log_Error("  No block mismatches when hashed again (transient corruption?)");
+    else
+        OpenCL_Log_Error("  " << nb_bad_blocks << " of " << nb_blocks << " blocks of " << block_size
+                         << " bytes mismatch, in " << nb_ranges << " ranges.");
+    if (dump != NULL)
+    {
+        fclose(dump);
+        OpenCL_Log_Error("  Mismatching blocks written to '" << mismatch_dump_filename << "'.");
+    }
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Host_to_Device()
+{
+    if (residency_manager != NULL)
+    {
+        residency_manager->Touch(this);
+        if (!is_resident)
+            Allocate_Device_Memory();
+    }
+
+    // The device array is already current.
+    if (coherent && !host_is_dirty)
+        return;
+
+    if (mapped_address != NULL)
+    {
+        // Stream the file in chunks, asking the kernel to read ahead the
+        // next chunk while the current one is transferred.
+        for (uint64_t offset = 0 ; offset < new_array_size_bytes ; offset += File_Streaming_Chunk_Size)
+        {
+            const uint64_t size = std::min(File_Streaming_Chunk_Size, new_array_size_bytes - offset);
+            const uint64_t next = offset + size;
+            if (next < new_array_size_bytes)
+                Advise_Mapped_Pages((char *) host_array + next, std::min(File_Streaming_Chunk_Size, new_array_size_bytes - next), MADV_WILLNEED);
+
+            OpenCL_Transfer_Probe probe(OPENCL_TRANSFER_HOST_TO_DEVICE, size);
+            err = clEnqueueWriteBuffer(command_queue, device_array, CL_FALSE, offset, size,
+                                       (char *) host_array + offset, 0, NULL, probe.Event());
+            OpenCL_Test_Success(err, "clEnqueueWriteBuffer()");
+            probe.Record(transfer_record, device, command_queue);
+        }
+        err = clFinish(command_queue);
+        OpenCL_Test_Success(err, "clFinish()");
+        device_is_dirty = false;
+        host_is_dirty   = false;
+        Validate_Transfer();
+        return;
+    }
+
+    OpenCL_Transfer_Probe probe(OPENCL_TRANSFER_HOST_TO_DEVICE, new_array_size_bytes);
+    err = clEnqueueWriteBuffer(command_queue,       // Command queue
+                               device_array,        // Memory buffer to write to
+                               CL_TRUE,             // Non-Blocking read
+                               0,                   // Offset in the buffer object to read from
+                               new_array_size_bytes,// Size in bytes of data being read
+                               host_array,          // Pointer to buffer on device to store write data
+                               0,                   // Number of event in the event list
+                               NULL,                // List of events that needs to complete before this executes
+                               probe.Event()); // Event object to return on completion (when profiled or traced)
+    OpenCL_Test_Success(err, "clEnqueueWriteBuffer()");
+    probe.Record(transfer_record, device, command_queue);
+    device_is_dirty = false;
+    host_is_dirty   = false;
+    Validate_Transfer();
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Array<T>::Device_to_Host()
+{
+    // An evicted array was already copied back to the host.
+    if (residency_manager != NULL && !is_resident)
+        return;
+    // The host array is already current.
+    if (coherent && !device_is_dirty)
+        return;
+
+    OpenCL_Assert(device_array != NULL);
+    OpenCL_Transfer_Probe probe(OPENCL_TRANSFER_DEVICE_TO_HOST, new_array_size_bytes);
+    err = clEnqueueReadBuffer(command_queue,        // Command queue
+                              device_array,         // Memory buffer to read from
+                              CL_FALSE,             // Non-Blocking read
+                              0,                    // Offset in the buffer object to read from
+                              new_array_size_bytes, // Size in bytes of data being read
+                              host_array,           // Pointer to buffer in RAM to store read data
+                              0,                    // Number of event in the event list
+                              NULL,                 // List of events that needs to complete before this executes
+                              probe.Event()); // Event object to return on completion (when profiled or traced)
+    OpenCL_Test_Success(err, "clEnqueueReadBuffer()");
+    probe.Record(transfer_record, device, command_queue);
+    device_is_dirty     = false;
+    host_is_dirty       = false;
+    host_read_pending   = true;
+    Validate_Transfer();
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Transfer_Statistics OpenCL_Array<T>::Transfer_Statistics(const OpenCL_Transfer_Direction direction) const
+{
+    return Transfer_Record_Statistics(transfer_record, direction);
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Sharded_Array<T>::OpenCL_Sharded_Array()
+{
+    N                           = 0;
+    sizeof_element              = 0;
+    max_shard_size_bytes        = 0;
+    N_per_shard                 = 0;
+    host_array                  = NULL;
+    residency_manager           = NULL;
+    coherent                    = false;
+    err                         = 0;
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Sharded_Array<T>::Set_Coherent(const bool _coherent)
+/**
+ * See OpenCL_Array::Set_Coherent(). Applies to the existing and future shards.
+ */
+{
+    coherent = _coherent;
+    for (size_t i = 0 ; i < shards.size() ; i++)
+        shards[i].Set_Coherent(coherent);
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Sharded_Array<T>::Initialize(uint64_t _N, const size_t _sizeof_element,
+                                         T *_host_array,
+                                         cl_context &_context, cl_mem_flags flags,
+                                         std::string _platform,
+                                         cl_command_queue &_command_queue,
+                                         cl_device_id &_device,
+                                         const uint64_t _max_shard_size_bytes)
+/**
+ * @param _max_shard_size_bytes: Maximum size of a single shard. If 0 (default),
+ *                               the device's CL_DEVICE_MAX_MEM_ALLOC_SIZE is used.
+ */
+{
+    OpenCL_Assert(_host_array != NULL);
+    OpenCL_Assert(_N > 0);
+
+    N               = _N;
+    sizeof_element  = _sizeof_element;
+    host_array      = _host_array;
+
+    max_shard_size_bytes = _max_shard_size_bytes;
+    if (max_shard_size_bytes == 0)
+        max_shard_size_bytes = Get_Device_Info<cl_ulong>(_device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, "clGetDeviceInfo (CL_DEVICE_MAX_MEM_ALLOC_SIZE)");
+
+    // OpenCL_Array stores its number of elements as an int.
+    N_per_shard = std::min(max_shard_size_bytes / sizeof_element, uint64_t(INT_MAX));
+    OpenCL_Assert(N_per_shard > 0);
+
+    const int nb_shards = int((N + N_per_shard - 1) / N_per_shard);
+
+    OpenCL_Log_Debug(
+        "OpenCL: Sharding array of " << Bytes_in_String(N * sizeof_element) << " into "
+        << nb_shards << " buffer(s) of at most " << Bytes_in_String(N_per_shard * sizeof_element));
+
+    // Resize before initializing so the shards are never copied once they own device memory.
+    shards.clear();
+    shards.resize(nb_shards);
+    for (int i = 0 ; i < nb_shards ; i++)
+    {
+        T *shard_host_array = host_array + Shard_Offset(i);
+        if (residency_manager != NULL)
+            shards[i].Set_Residency_Manager(residency_manager);
+        shards[i].Set_Coherent(coherent);
+        shards[i].Initialize(int(Shard_Size(i)), sizeof_element, shard_host_array,
+                             _context, flags, _platform, _command_queue, _device,
+                             false); // Shards are validated as part of the whole array, if at all.
+    }
+}
+
+// *****************************************************************************
+template <class T>
+uint64_t OpenCL_Sharded_Array<T>::Shard_Size(const int i) const
+{
+    OpenCL_Assert(i >= 0 && i < Nb_Shards());
+    if (i == Nb_Shards() - 1)
+        return N - Shard_Offset(i);
+    else
+        return N_per_shard;
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Sharded_Array<T>::Release_Memory()
+{
+    for (int i = 0 ; i < Nb_Shards() ; i++)
+        shards[i].Release_Memory();
+    shards.clear();
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Sharded_Array<T>::Host_to_Device()
+{
+    for (int i = 0 ; i < Nb_Shards() ; i++)
+        shards[i].Host_to_Device();
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Sharded_Array<T>::Device_to_Host()
+{
+    for (int i = 0 ; i < Nb_Shards() ; i++)
+        shards[i].Device_to_Host();
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Sharded_Array<T>::Set_as_Kernel_Arguments(cl_kernel &kernel, const int first_order)
+/**
+ * Pass all shards to the kernel as consecutive arguments, starting at "first_order".
+ * The kernel must thus declare Nb_Shards() global pointers; element "i" of the
+ * logical array lives in shard "i / Shard_Size(0)".
+ */
+{
+    for (int i = 0 ; i < Nb_Shards() ; i++)
+        shards[i].Set_as_Kernel_Argument(kernel, first_order + i);
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Sharded_Array<T>::Launch_per_Shard(OpenCL_Kernel &kernel, const int order_array,
+                                               const int order_offset, const int order_size,
+                                               const cl_command_queue &command_queue)
+/**
+ * Launch "kernel" once per shard. Before each launch, the shard's buffer is set
+ * as argument "order_array", the shard's offset in the logical array (cl_ulong)
+ * as argument "order_offset" and its number of elements (cl_ulong) as argument
+ * "order_size". Pass -1 to skip setting the offset or the size.
+ * The global work size in x is adapted to each shard's size (multiple of the
+ * kernel's local work size); the y dimension is kept as is. The kernel's work
+ * size is restored afterwards.
+ */
+{
+    cl_kernel cl_kernel_object = kernel.Get_Kernel();
+    const size_t local_x  = kernel.Get_Local_Work_Size()[0];
+    const size_t local_y  = kernel.Get_Local_Work_Size()[1];
+    const size_t global_x = kernel.Get_Global_Work_Size()[0];
+    const size_t global_y = kernel.Get_Global_Work_Size()[1];
+
+    try
+    {
+        for (int i = 0 ; i < Nb_Shards() ; i++)
+        {
+            shards[i].Set_as_Kernel_Argument(cl_kernel_object, order_array);
+            if (order_offset >= 0)
+            {
+                const cl_ulong offset = Shard_Offset(i);
+                err = clSetKernelArg(cl_kernel_object, order_offset, sizeof(cl_ulong), &offset);
+                OpenCL_Test_Success(err, "clSetKernelArg()");
+            }
+            if (order_size >= 0)
+            {
+                const cl_ulong size = Shard_Size(i);
+                err = clSetKernelArg(cl_kernel_object, order_size, sizeof(cl_ulong), &size);
+                OpenCL_Test_Success(err, "clSetKernelArg()");
+            }
+
+            // Rounded up to a multiple of local_x (at least one work-group), in
+            // 64 bits like Get_Multiple() cannot.
+            const uint64_t shard_global_x = std::max<uint64_t>(1, (Shard_Size(i) + local_x - 1) / local_x) * local_x;
+            kernel.Compute_Work_Size(size_t(shard_global_x), global_y, local_x, local_y);
+            kernel.Launch(command_queue);
+        }
+    }
+    catch (...)
+    {
+        kernel.Compute_Work_Size(global_x, global_y, local_x, local_y);
+        throw;
+    }
+    kernel.Compute_Work_Size(global_x, global_y, local_x, local_y);
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Image_Array<T>::OpenCL_Image_Array()
+{
+    width                       = 0;
+    height                      = 0;
+    depth                       = 0;
+    nb_channels                 = 0;
+    host_array                  = NULL;
+    context                     = NULL;
+    command_queue               = NULL;
+    device                      = NULL;
+    flags                       = 0;
+    err                         = 0;
+    device_image                = NULL;
+    sampler                     = NULL;
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Image_Array<T>::Initialize(const int _width, const int _height, const int _depth,
+                                       const int _nb_channels, T *_host_array,
+                                       cl_context &_context, cl_mem_flags _flags,
+                                       cl_command_queue &_command_queue,
+                                       cl_device_id &_device)
+/**
+ * @param _depth:       Use 1 for a 2D image.
+ * @param _nb_channels: Number of consecutive host elements per pixel (1, 2 or 4).
+ * The host array must contain width*height*depth*nb_channels elements.
+ */
+{
+    OpenCL_Assert(_host_array != NULL);
+
+    width           = _width;
+    height          = _height;
+    depth           = _depth;
+    nb_channels     = _nb_channels;
+    host_array      = _host_array;
+    context         = _context;
+    command_queue   = _command_queue;
+    device          = _device;
+    flags           = _flags;
+
+    if      (nb_channels == 1)
+        format.image_channel_order = CL_R;
+    else if (nb_channels == 2)
+        format.image_channel_order = CL_RG;
+    else if (nb_channels == 4)
+        format.image_channel_order = CL_RGBA;
+    else
+    {
+        std::ostringstream message;
+        message << "Images with " << nb_channels << " channels are unsupported (use 1, 2 or 4)";
+        OpenCL_Throw(CL_IMAGE_FORMAT_NOT_SUPPORTED, "OpenCL_Image_Array::Initialize", message.str());
+    }
+    format.image_channel_data_type = OpenCL_Image_Channel_Type<T>::value;
+
+    Validate_Size();
+
+    // Allocate memory on the device
+    if (Device_Supports_OpenCL_1_2(device))
+    {
+#ifdef CL_VERSION_1_2
+        cl_image_desc description;
+        memset(&description, 0, sizeof(description));
+        description.image_type      = (Is_3D() ? CL_MEM_OBJECT_IMAGE3D : CL_MEM_OBJECT_IMAGE2D);
+        description.image_width     = width;
+        description.image_height    = height;
+        description.image_depth     = (Is_3D() ? depth : 0);
+        device_image = clCreateImage(context, flags, &format, &description, NULL, &err);
+        OpenCL_Test_Success(err, "clCreateImage()");
+        OpenCL_Memory::Track(device_image);
+#endif // #ifdef CL_VERSION_1_2
+    }
+    else if (Is_3D())
+    {
+        device_image = clCreateImage3D(context, flags, &format, width, height, depth, 0, 0, NULL, &err);
+        OpenCL_Test_Success(err, "clCreateImage3D()");
+        OpenCL_Memory::Track(device_image);
+    }
+    else
+    {
+        device_image = clCreateImage2D(context, flags, &format, width, height, 0, NULL, &err);
+        OpenCL_Test_Success(err, "clCreateImage2D()");
+        OpenCL_Memory::Track(device_image);
+    }
+
+    // Transfer data from host to device (cpu to gpu)
+    Host_to_Device();
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Image_Array<T>::Validate_Size()
+/**
+ * Verify the image against the limits reported by clGetDeviceInfo() (the same
+ * values OpenCL_device::Set_Information() records) and the formats supported
+ * by the context.
+ */
+{
+    if (!Get_Device_Info<cl_bool>(device, CL_DEVICE_IMAGE_SUPPORT, "clGetDeviceInfo (CL_DEVICE_IMAGE_SUPPORT)"))
+    {
+        OpenCL_Throw(CL_INVALID_OPERATION, "OpenCL_Image_Array::Validate_Size", "Device does not support images");
+    }
+
+    OpenCL_Assert(width >= 1 && height >= 1 && depth >= 1);
+    size_t max_width, max_height, max_depth = 1;
+    if (Is_3D())
+    {
+        max_width   = Get_Device_Info<size_t>(device, CL_DEVICE_IMAGE3D_MAX_WIDTH,  "clGetDeviceInfo (CL_DEVICE_IMAGE3D_MAX_WIDTH)");
+        max_height  = Get_Device_Info<size_t>(device, CL_DEVICE_IMAGE3D_MAX_HEIGHT, "clGetDeviceInfo (CL_DEVICE_IMAGE3D_MAX_HEIGHT)");
+        max_depth   = Get_Device_Info<size_t>(device, CL_DEVICE_IMAGE3D_MAX_DEPTH,  "clGetDeviceInfo (CL_DEVICE_IMAGE3D_MAX_DEPTH)");
+    }
+    else
+    {
+        max_width   = Get_Device_Info<size_t>(device, CL_DEVICE_IMAGE2D_MAX_WIDTH,  "clGetDeviceInfo (CL_DEVICE_IMAGE2D_MAX_WIDTH)");
+        max_height  = Get_Device_Info<size_t>(device, CL_DEVICE_IMAGE2D_MAX_HEIGHT, "clGetDeviceInfo (CL_DEVICE_IMAGE2D_MAX_HEIGHT)");
+    }
+
+    if (size_t(width) > max_width || size_t(height) > max_height || size_t(depth) > max_depth)
+    {
+        std::ostringstream message;
+        message
+            << "Image of size (" << width << ", " << height << ", " << depth << ") exceeds the device's maximum ("
+            << max_width << ", " << max_height << ", " << max_depth << ")";
+        OpenCL_Throw(CL_INVALID_IMAGE_SIZE, "OpenCL_Image_Array::Validate_Size", message.str());
+    }
+
+    // Verify that the format is supported
+    const cl_mem_object_type type = (Is_3D() ? CL_MEM_OBJECT_IMAGE3D : CL_MEM_OBJECT_IMAGE2D);
+    cl_uint nb_formats = 0;
+    err = clGetSupportedImageFormats(context, flags, type, 0, NULL, &nb_formats);
+    OpenCL_Test_Success(err, "clGetSupportedImageFormats()");
+    std::vector<cl_image_format> formats(nb_formats);
+    if (nb_formats > 0)
+    {
+        err = clGetSupportedImageFormats(context, flags, type, nb_formats, &formats[0], NULL);
+        OpenCL_Test_Success(err, "clGetSupportedImageFormats()");
+    }
+    bool format_is_supported = false;
+    for (cl_uint i = 0 ; i < nb_formats ; i++)
+    {
+        if (formats[i].image_channel_order     == format.image_channel_order &&
+            formats[i].image_channel_data_type == format.image_channel_data_type)
+        {
+            format_is_supported = true;
+            break;
+        }
+    }
+    if (!format_is_supported)
+    {
+        std::ostringstream message;
+        message
+            << "Image format (channel order " << format.image_channel_order
+            << ", channel type " << format.image_channel_data_type << ") is not supported by the device";
+        OpenCL_Throw(CL_IMAGE_FORMAT_NOT_SUPPORTED, "OpenCL_Image_Array::Validate_Size", message.str());
+    }
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Image_Array<T>::Create_Sampler(const bool normalized_coordinates,
+                                           const cl_addressing_mode addressing_mode,
+                                           const cl_filter_mode filter_mode)
+/**
+ * Create a sampler to pass to kernels along with the image.
+ * NOTE: Linear filtering is only available for floating point images.
+ */
+{
+    if (sampler)
+        clReleaseSampler(sampler);
+
+    sampler = clCreateSampler(context, (normalized_coordinates ? CL_TRUE : CL_FALSE),
+                              addressing_mode, filter_mode, &err);
+    OpenCL_Test_Success(err, "clCreateSampler()");
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Image_Array<T>::Release_Memory()
+{
+    if (sampler)
+        clReleaseSampler(sampler);
+    if (device_image)
+        OpenCL_Memory::Release(device_image);
+    sampler         = NULL;
+    device_image    = NULL;
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Image_Array<T>::Host_to_Device()
+{
+    const size_t origin[3] = {0, 0, 0};
+    const size_t region[3] = {size_t(width), size_t(height), size_t(depth)};
+    err = clEnqueueWriteImage(command_queue,        // Command queue
+                              device_image,         // Image to write to
+                              CL_TRUE,              // Blocking write
+                              origin,               // Origin of the region to write
+                              region,               // Size of the region (pixels)
+                              0,                    // Row pitch (0 == tightly packed)
+                              0,                    // Slice pitch (0 == tightly packed)
+                              host_array,           // Pointer to host data
+                              0,                    // Number of event in the event list
+                              NULL,                 // List of events that needs to complete before this executes
+                              NULL);                // Event object to return on completion
+    OpenCL_Test_Success(err, "clEnqueueWriteImage()");
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Image_Array<T>::Device_to_Host()
+{
+    OpenCL_Assert(device_image != NULL);
+    const size_t origin[3] = {0, 0, 0};
+    const size_t region[3] = {size_t(width), size_t(height), size_t(depth)};
+    err = clEnqueueReadImage(command_queue,         // Command queue
+                             device_image,          // Image to read from
+                             CL_FALSE,              // Non-Blocking read
+                             origin,                // Origin of the region to read
+                             region,                // Size of the region (pixels)
+                             0,                     // Row pitch (0 == tightly packed)
+                             0,                     // Slice pitch (0 == tightly packed)
+                             host_array,            // Pointer to buffer in RAM to store read data
+                             0,                     // Number of event in the event list
+                             NULL,                  // List of events that needs to complete before this executes
+                             NULL);                 // Event object to return on completion
+    OpenCL_Test_Success(err, "clEnqueueReadImage()");
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Image_Array<T>::Set_as_Kernel_Argument(cl_kernel &kernel, const int order)
+{
+    err = clSetKernelArg(kernel, order, sizeof(cl_mem), &device_image);
+    OpenCL_Test_Success(err, "clSetKernelArg()");
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Image_Array<T>::Set_Sampler_as_Kernel_Argument(cl_kernel &kernel, const int order)
+{
+    OpenCL_Assert(sampler != NULL);
+    err = clSetKernelArg(kernel, order, sizeof(cl_sampler), &sampler);
+    OpenCL_Test_Success(err, "clSetKernelArg()");
+}
+
+// *****************************************************************************
+// Structures of at most this size are converted with SSE2, 4 at a time.
+const size_t SoA_SIMD_Max_Struct_Size = 256;
+
+// *****************************************************************************
+template <size_t Size>
+void Gather_Field(const char *aos, const size_t stride, const int begin, const int end, char *soa)
+{
+    for (int i = begin ; i < end ; i++)
+        memcpy(soa + size_t(i) * Size, aos + size_t(i) * stride, Size);
+}
+
+// *****************************************************************************
+template <size_t Size>
+void Scatter_Field(const char *soa, const size_t stride, const int begin, const int end, char *aos)
+{
+    for (int i = begin ; i < end ; i++)
+        memcpy(aos + size_t(i) * stride, soa + size_t(i) * Size, Size);
+}
+
+// *****************************************************************************
+void Gather_Field(const char *aos, const size_t stride, const size_t size, const int begin, const int end, char *soa)
+/**
+ * Scalar conversion of elements [begin, end) of a field, aos being the
+ * address of the field in the first structure.
+ */
+{
+    switch (size)
+    {
+        case 1:  Gather_Field<1>(aos, stride, begin, end, soa);  break;
+        case 2:  Gather_Field<2>(aos, stride, begin, end, soa);  break;
+        case 4:  Gather_Field<4>(aos, stride, begin, end, soa);  break;
+        case 8:  Gather_Field<8>(aos, stride, begin, end, soa);  break;
+        case 16: Gather_Field<16>(aos, stride, begin, end, soa); break;
+        default:
+            for (int i = begin ; i < end ; i++)
+                memcpy(soa + size_t(i) * size, aos + size_t(i) * stride, size);
+    }
+}
+
+// *****************************************************************************
+void Scatter_Field(const char *soa, const size_t stride, const size_t size, const int begin, const int end, char *aos)
+{
+    switch (size)
+    {
+        case 1:  Scatter_Field<1>(soa, stride, begin, end, aos);  break;
+        case 2:  Scatter_Field<2>(soa, stride, begin, end, aos);  break;
+        case 4:  Scatter_Field<4>(soa, stride, begin, end, aos);  break;
+        case 8:  Scatter_Field<8>(soa, stride, begin, end, aos);  break;
+        case 16: Scatter_Field<16>(soa, stride, begin, end, aos); break;
+        default:
+            for (int i = begin ; i < end ; i++)
+                memcpy(aos + size_t(i) * stride, soa + size_t(i) * size, size);
+    }
+}
+
+// *****************************************************************************
+bool SoA_Field_is_SIMD(const OpenCL_SoA_Field &field, const size_t sizeof_struct)
+/**
+ * 32 and 64 bits fields aligned on 32 bits can be converted with SSE2.
+ */
+{
+#ifdef __SSE2__
+    return (sizeof_struct <= SoA_SIMD_Max_Struct_Size && field.offset % 4 == 0 &&
+            (field.size == 4 || field.size == 8));
+#else
+    return false;
+#endif // #ifdef __SSE2__
+}
+
+#ifdef __SSE2__
+// *****************************************************************************
+inline void Transpose_4x4(__m128i &r0, __m128i &r1, __m128i &r2, __m128i &r3)
+/**
+ * Transpose a 4x4 matrix of 32 bits words. Its own inverse.
+ */
+{
+    const __m128i t0 = _mm_unpacklo_epi32(r0, r1);     // a0 b0 a1 b1
+    const __m128i t1 = _mm_unpacklo_epi32(r2, r3);     // c0 d0 c1 d1
+    const __m128i t2 = _mm_unpackhi_epi32(r0, r1);     // a2 b2 a3 b3
+    const __m128i t3 = _mm_unpackhi_epi32(r2, r3);     // c2 d2 c3 d3
+    r0 = _mm_unpacklo_epi64(t0, t1);                    // a0 b0 c0 d0
+    r1 = _mm_unpackhi_epi64(t0, t1);                    // a1 b1 c1 d1
+    r2 = _mm_unpacklo_epi64(t2, t3);                    // a2 b2 c2 d2
+    r3 = _mm_unpackhi_epi64(t2, t3);                    // a3 b3 c3 d3
+}
+#endif // #ifdef __SSE2__
+
+// *****************************************************************************
+int AoS_SoA_SIMD(const char *aos, const size_t sizeof_struct, const int N,
+                 const std::vector<OpenCL_SoA_Field> &fields, std::vector<char *> &soa,
+                 const bool to_soa)
+/**
+ * Convert the SIMD capable fields (see SoA_Field_is_SIMD()), 4 structures at
+ * a time. Structures are loaded as rows of 32 bits words and transposed 4x4:
+ * "column" w then holds word w of the 4 structures, which is the SoA layout
+ * of a 32 bits field (64 bits fields interleave two columns).
+ * When scattering back, rows are blended so only the fields' words are written.
+ * @return Number of structures converted (the caller handles the remainder).
+ */
+{
+#ifdef __SSE2__
+    const int max_words = int(SoA_SIMD_Max_Struct_Size / 4);
+    bool word_is_field[max_words];
+    for (int w = 0 ; w < max_words ; w++)
+        word_is_field[w] = false;
+
+    // Number of 16 bytes groups covering the SIMD fields
+    size_t nb_groups = 0;
+    for (size_t f = 0 ; f < fields.size() ; f++)
+    {
+        if (!SoA_Field_is_SIMD(fields[f], sizeof_struct))
+            continue;
+        for (size_t w = fields[f].offset / 4 ; w < (fields[f].offset + fields[f].size) / 4 ; w++)
+            word_is_field[w] = true;
+        nb_groups = std::max(nb_groups, (fields[f].offset + fields[f].size + 15) / 16);
+    }
+    if (nb_groups == 0)
+        return 0;
+
+    // The last group of a row can extend past the structure, into the next one:
+    // stop before reading past the end of the array.
+    const uint64_t array_size = uint64_t(N) * sizeof_struct;
+    int nb_blocks = N / 4;
+    while (nb_blocks > 0 && (uint64_t(nb_blocks * 4 - 1) * sizeof_struct + nb_groups * 16) > array_size)
+        nb_blocks--;
+
+    // Blend masks (when scattering): all ones on words belonging to a field
+    __m128i masks[max_words / 4];
+    for (size_t g = 0 ; g < nb_groups ; g++)
+        masks[g] = _mm_set_epi32(word_is_field[4*g+3] ? -1 : 0, word_is_field[4*g+2] ? -1 : 0,
+                                 word_is_field[4*g+1] ? -1 : 0, word_is_field[4*g+0] ? -1 : 0);
+
+    __m128i columns[max_words];
+    for (int w = 0 ; w < max_words ; w++)
+        columns[w] = _mm_setzero_si128();
+
+    for (int b = 0 ; b < nb_blocks ; b++)
+    {
+        const int i0 = 4 * b;
+        const char *rows[4] = { aos + size_t(i0    ) * sizeof_struct, aos + size_t(i0 + 1) * sizeof_struct,
+                                aos + size_t(i0 + 2) * sizeof_struct, aos + size_t(i0 + 3) * sizeof_struct };
+        if (to_soa)
+        {
+            for (size_t g = 0 ; g < nb_groups ; g++)
+            {
+                __m128i *c = &columns[4 * g];
+                c[0] = _mm_loadu_si128((const __m128i *) (rows[0] + 16 * g));
+                c[1] = _mm_loadu_si128((const __m128i *) (rows[1] + 16 * g));
+                c[2] = _mm_loadu_si128((const __m128i *) (rows[2] + 16 * g));
+                c[3] = _mm_loadu_si128((const __m128i *) (rows[3] + 16 * g));
+                Transpose_4x4(c[0], c[1], c[2], c[3]);
+            }
+            for (size_t f = 0 ; f < fields.size() ; f++)
+            {
+                if (!SoA_Field_is_SIMD(fields[f], sizeof_struct))
+                    continue;
+                const size_t w = fields[f].offset / 4;
+                char *dst = soa[f] + size_t(i0) * fields[f].size;
+                if (fields[f].size == 4)
+                    _mm_storeu_si128((__m128i *) dst, columns[w]);
+                else
+                {
+                    _mm_storeu_si128((__m128i *) (dst     ), _mm_unpacklo_epi32(columns[w], columns[w+1]));
+                    _mm_storeu_si128((__m128i *) (dst + 16), _mm_unpackhi_epi32(columns[w], columns[w+1]));
+                }
+            }
+        }
+        else
+        {
+            for (size_t f = 0 ; f < fields.size() ; f++)
+            {
+                if (!SoA_Field_is_SIMD(fields[f], sizeof_struct))
+                    continue;
+                const size_t w = fields[f].offset / 4;
+                const char *src = soa[f] + size_t(i0) * fields[f].size;
+                if (fields[f].size == 4)
+                    columns[w] = _mm_loadu_si128((const __m128i *) src);
+                else
+                {
+                    const __m128i a  = _mm_loadu_si128((const __m128i *) (src     )); // lo0 hi0 lo1 hi1
+                    const __m128i b  = _mm_loadu_si128((const __m128i *) (src + 16)); // lo2 hi2 lo3 hi3
+                    const __m128i t0 = _mm_unpacklo_epi32(a, b);                      // lo0 lo2 hi0 hi2
+                    const __m128i t1 = _mm_unpackhi_epi32(a, b);                      // lo1 lo3 hi1 hi3
+                    columns[w  ] = _mm_unpacklo_epi32(t0, t1);                        // lo0 lo1 lo2 lo3
+                    columns[w+1] = _mm_unpackhi_epi32(t0, t1);                        // hi0 hi1 hi2 hi3
+                }
+            }
+            for (size_t g = 0 ; g < nb_groups ; g++)
+            {
+                __m128i r[4] = { columns[4*g], columns[4*g+1], columns[4*g+2], columns[4*g+3] };
+                Transpose_4x4(r[0], r[1], r[2], r[3]);
+                for (int j = 0 ; j < 4 ; j++)
+                {
+                    __m128i *row = (__m128i *) (rows[j] + 16 * g);
+                    const __m128i old = _mm_loadu_si128(row);
+                    _mm_storeu_si128(row, _mm_or_si128(_mm_and_si128(masks[g], r[j]), _mm_andnot_si128(masks[g], old)));
+                }
+            }
+        }
+    }
+
+    return 4 * nb_blocks;
+#else
+    return 0;
+#endif // #ifdef __SSE2__
+}
+
+// *****************************************************************************
+void AoS_to_SoA(const char *aos, const size_t sizeof_struct, const int N,
+                const std::vector<OpenCL_SoA_Field> &fields, std::vector<char *> &soa)
+{
+    const int nb_simd = AoS_SoA_SIMD(aos, sizeof_struct, N, fields, soa, true);
+    for (size_t f = 0 ; f < fields.size() ; f++)
+    {
+        const int begin = (SoA_Field_is_SIMD(fields[f], sizeof_struct) ? nb_simd : 0);
+        Gather_Field(aos + fields[f].offset, sizeof_struct, fields[f].size, begin, N, soa[f]);
+    }
+}
+
+// *****************************************************************************
+void SoA_to_AoS(std::vector<char *> &soa, const std::vector<OpenCL_SoA_Field> &fields,
+                const size_t sizeof_struct, const int N, char *aos)
+{
+    const int nb_simd = AoS_SoA_SIMD(aos, sizeof_struct, N, fields, soa, false);
+    for (size_t f = 0 ; f < fields.size() ; f++)
+    {
+        const int begin = (SoA_Field_is_SIMD(fields[f], sizeof_struct) ? nb_simd : 0);
+        Scatter_Field(soa[f], sizeof_struct, fields[f].size, begin, N, aos + fields[f].offset);
+    }
+}
+
+// *****************************************************************************
+OpenCL_SoA_Array::OpenCL_SoA_Array()
+{
+    N                           = 0;
+    sizeof_struct               = 0;
+    aos_host_array              = NULL;
+    command_queue               = NULL;
+    residency_manager           = NULL;
+    err                         = 0;
+}
+
+// *****************************************************************************
+void OpenCL_SoA_Array::Add_Field(const std::string &name, const size_t offset, const size_t size)
+/**
+ * Must be called before Initialize(). See also OpenCL_SoA_Add_Field().
+ */
+{
+    OpenCL_Assert(field_arrays.empty());
+    OpenCL_Assert(size > 0);
+    OpenCL_Assert(Field_Index(name) == -1);
+    fields.push_back(OpenCL_SoA_Field(name, offset, size));
+}
+
+// *****************************************************************************
+void OpenCL_SoA_Array::Initialize(const int _N, const size_t _sizeof_struct, void *_aos_host_array,
+                                  cl_context &_context, cl_mem_flags flags,
+                                  std::string _platform,
+                                  cl_command_queue &_command_queue,
+                                  cl_device_id &_device)
+/**
+ * Allocate one device buffer per field and upload the structures.
+ */
+{
+    OpenCL_Assert(_aos_host_array != NULL);
+    OpenCL_Assert(_N > 0);
+    OpenCL_Assert(!fields.empty());
+
+    N               = _N;
+    sizeof_struct   = _sizeof_struct;
+    aos_host_array  = (char *) _aos_host_array;
+    command_queue   = _command_queue;
+
+    for (size_t f = 0 ; f < fields.size() ; f++)
+        OpenCL_Assert(fields[f].offset + fields[f].size <= sizeof_struct);
+
+    soa_host_arrays.resize(fields.size(), NULL);
+    for (size_t f = 0 ; f < fields.size() ; f++)
+        soa_host_arrays[f] = (char *) calloc_and_check(N, fields[f].size, "SoA field " + fields[f].name);
+    AoS_to_SoA(aos_host_array, sizeof_struct, N, fields, soa_host_arrays);
+
+    // Resize before initializing so the arrays are never copied once they own device memory.
+    field_arrays.clear();
+    field_arrays.resize(fields.size());
+    for (size_t f = 0 ; f < fields.size() ; f++)
+    {
+        if (residency_manager != NULL)
+            field_arrays[f].Set_Residency_Manager(residency_manager);
+        field_arrays[f].Initialize(N, fields[f].size, soa_host_arrays[f],
+                                   _context, flags, _platform, _command_queue, _device,
+                                   false);
+    }
+}
+
+// *****************************************************************************
+void OpenCL_SoA_Array::Release_Memory()
+{
+    for (size_t f = 0 ; f < field_arrays.size() ; f++)
+        field_arrays[f].Release_Memory();
+    for (size_t f = 0 ; f < soa_host_arrays.size() ; f++)
+        free(soa_host_arrays[f]);
+    field_arrays.clear();
+    soa_host_arrays.clear();
+}
+
+// *****************************************************************************
+void OpenCL_SoA_Array::Host_to_Device()
+{
+    AoS_to_SoA(aos_host_array, sizeof_struct, N, fields, soa_host_arrays);
+    for (size_t f = 0 ; f < field_arrays.size() ; f++)
+        field_arrays[f].Host_to_Device();
+}
+
+// *****************************************************************************
+void OpenCL_SoA_Array::Device_to_Host()
+{
+    for (size_t f = 0 ; f < field_arrays.size() ; f++)
+        field_arrays[f].Device_to_Host();
+    err = clFinish(command_queue);
+    OpenCL_Test_Success(err, "clFinish()");
+    SoA_to_AoS(soa_host_arrays, fields, sizeof_struct, N, aos_host_array);
+}
+
+// *****************************************************************************
+int OpenCL_SoA_Array::Field_Index(const std::string &name) const
+/**
+ * @return Index of the field called "name", -1 if there is none.
+ */
+{
+    for (size_t f = 0 ; f < fields.size() ; f++)
+    {
+        if (fields[f].name == name)
+            return int(f);
+    }
+    return -1;
+}
+
+// *****************************************************************************
+void OpenCL_SoA_Array::Set_as_Kernel_Arguments(cl_kernel &kernel, const int first_order)
+{
+    for (size_t f = 0 ; f < field_arrays.size() ; f++)
+        field_arrays[f].Set_as_Kernel_Argument(kernel, first_order + int(f));
+}
+
+// *****************************************************************************
+// Element types supported by OpenCL_Reducer and OpenCL_Scan: name and limits in OpenCL C.
+template <class T> struct OpenCL_Reduction_Type;
+template <> struct OpenCL_Reduction_Type<float>
+{
+    static const char *     Name()          { return "float";       }
+    static const char *     Lowest()        { return "-INFINITY";   }
+    static const char *     Highest()       { return "INFINITY";    }
+    static cl_device_info   Vector_Width()  { return CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT;  }
+};
+template <> struct OpenCL_Reduction_Type<double>
+{
+    static const char *     Name()          { return "double";      }
+    static const char *     Lowest()        { return "-INFINITY";   }
+    static const char *     Highest()       { return "INFINITY";    }
+    static cl_device_info   Vector_Width()  { return CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE; }
+};
+template <> struct OpenCL_Reduction_Type<int>
+{
+    static const char *     Name()          { return "int";         }
+    static const char *     Lowest()        { return "INT_MIN";     }
+    static const char *     Highest()       { return "INT_MAX";     }
+    static cl_device_info   Vector_Width()  { return CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT;    }
+};
+template <> struct OpenCL_Reduction_Type<unsigned int>
+{
+    static const char *     Name()          { return "uint";        }
+    static const char *     Lowest()        { return "0";           }
+    static const char *     Highest()       { return "UINT_MAX";    }
+    static cl_device_info   Vector_Width()  { return CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT;    }
+};
+template <> struct OpenCL_Reduction_Type<char>
+{
+    static const char *     Name()          { return "char";        }
+    static const char *     Lowest()        { return "CHAR_MIN";    }
+    static const char *     Highest()       { return "CHAR_MAX";    }
+    static cl_device_info   Vector_Width()  { return CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR;   }
+};
+
+// *****************************************************************************
+template <class T>
+T Reduction_Combine(const OpenCL_Reduction_Operation operation, const T &x, const T &y)
+{
+    switch (operation)
+    {
+        case OPENCL_REDUCTION_MIN:  return std::min(x, y);
+        case OPENCL_REDUCTION_MAX:  return std::max(x, y);
+        default:                    return T(x + y);
+    }
+}
+
+// *****************************************************************************
+template <class T>
+T Reduction_Identity(const OpenCL_Reduction_Operation operation)
+{
+    switch (operation)
+    {
+        case OPENCL_REDUCTION_MIN:
+            return (std::numeric_limits<T>::has_infinity ?  std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max());
+        case OPENCL_REDUCTION_MAX:
+            return (std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::min());
+        default:
+            return T(0);
+    }
+}
+
+// *****************************************************************************
+// Host backend
+// *****************************************************************************
+int OpenCL_Host_Backend::nb_threads = 0;
+std::map<cl_device_id, std::vector<uint64_t> > OpenCL_Host_Backend::thresholds;
+const uint64_t OpenCL_Host_Backend::default_threshold;
+
+// Host ranges below this many bytes are not split over threads.
+const uint64_t host_backend_min_chunk_bytes = 64 * 1024;
+
+// *****************************************************************************
+struct OpenCL_Host_Job
+{
+    void      (*function)(void *, const int, const uint64_t, const uint64_t);
+    void       *argument;
+    uint64_t    n;
+    uint64_t    chunk_size;
+    int         nb_chunks;
+    int         next_chunk;             // Next chunk to process (atomic)
+    int         nb_done;                // Chunks processed (protected by the pool's mutex)
+    int         nb_workers;             // Worker threads still using the job (idem)
+};
+
+// *****************************************************************************
+class OpenCL_Host_Thread_Pool
+/**
+ * Worker threads waiting for OpenCL_Host_Backend::Parallel_For() jobs. The
+ * calling thread processes chunks too. Jobs from different threads run one
+ * after the other.
+ */
+{
+private:
+    pthread_mutex_t     run_mutex;      // One job at a time
+    pthread_mutex_t     mutex;
+    pthread_cond_t      job_available;
+    pthread_cond_t      job_done;
+    OpenCL_Host_Job    *job;
+    uint64_t            generation;     // Incremented for each job
+
+    static void *       Worker(void *pool);
+    static void         Process(OpenCL_Host_Thread_Pool *pool, OpenCL_Host_Job *job);
+
+public:
+    OpenCL_Host_Thread_Pool(const int nb_workers);
+    void Run(OpenCL_Host_Job &job);
+};
+
+OpenCL_Host_Thread_Pool *host_thread_pool = NULL;
+pthread_once_t host_thread_pool_once = PTHREAD_ONCE_INIT;
+
+// *****************************************************************************
+void Create_Host_Thread_Pool()
+{
+    host_thread_pool = new OpenCL_Host_Thread_Pool(OpenCL_Host_Backend::Nb_Threads() - 1);
+}
+
+// *****************************************************************************
+OpenCL_Host_Thread_Pool::OpenCL_Host_Thread_Pool(const int nb_workers)
+{
+    pthread_mutex_init(&run_mutex, NULL);
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&job_available, NULL);
+    pthread_cond_init(&job_done, NULL);
+    job         = NULL;
+    generation  = 0;
+
+    // The workers live as long as the process. The caller processes chunks
+    // too, so the pool works (slower) with fewer workers than asked for.
+    for (int i = 0 ; i < nb_workers ; i++)
+    {
+        pthread_t thread;
+        const int ret = pthread_create(&thread, NULL, Worker, this);
+        if (ret != 0)
+        {
+            OpenCL_Log_Warning("OpenCL: WARNING: Cannot create host backend thread: " << strerror(ret) << " (using " << i << " workers)");
+            break;
+        }
+        pthread_detach(thread);
+    }
+}
+
+// *****************************************************************************
+void *OpenCL_Host_Thread_Pool::Worker(void *_pool)
+{
+    OpenCL_Host_Thread_Pool *pool = (OpenCL_Host_Thread_Pool *) _pool;
+    uint64_t seen = 0;
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->generation == seen || pool->job == NULL)
+            pthread_cond_wait(&pool->job_available, &pool->mutex);
+        seen = pool->generation;
+        OpenCL_Host_Job *job = pool->job;
+        job->nb_workers++;
+        pthread_mutex_unlock(&pool->mutex);
+
+        Process(pool, job);
+
+        // The job lives on the caller's stack: tell it when nobody uses it anymore.
+        pthread_mutex_lock(&pool->mutex);
+        job->nb_workers--;
+        pthread_cond_signal(&pool->job_done);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    return NULL;
+}
+
+// *****************************************************************************
+void OpenCL_Host_Thread_Pool::Process(OpenCL_Host_Thread_Pool *pool, OpenCL_Host_Job *job)
+{
+    int chunk;
+    while ((chunk = __sync_fetch_and_add(&job->next_chunk, 1)) < job->nb_chunks)
+    {
+        const uint64_t begin    = uint64_t(chunk) * job->chunk_size;
+        const uint64_t end      = std::min(begin + job->chunk_size, job->n);
+        job->function(job->argument, chunk, begin, end);
+
+        pthread_mutex_lock(&pool->mutex);
+        job->nb_done++;
+        pthread_cond_signal(&pool->job_done);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+// *****************************************************************************
+void OpenCL_Host_Thread_Pool::Run(OpenCL_Host_Job &_job)
+{
+    pthread_mutex_lock(&run_mutex);
+
+    pthread_mutex_lock(&mutex);
+    job = &_job;
+    generation++;
+    pthread_cond_broadcast(&job_available);
+    pthread_mutex_unlock(&mutex);
+
+    Process(this, &_job);
+
+    pthread_mutex_lock(&mutex);
+    while (_job.nb_done < _job.nb_chunks || _job.nb_workers > 0)
+        pthread_cond_wait(&job_done, &mutex);
+    job = NULL;
+    pthread_mutex_unlock(&mutex);
+
+    pthread_mutex_unlock(&run_mutex);
+}
+
+// *****************************************************************************
+int OpenCL_Host_Backend::Nb_Threads()
+{
+    if (nb_threads <= 0)
+        nb_threads = std::max(1, int(sysconf(_SC_NPROCESSORS_ONLN)));
+    return nb_threads;
+}
+
+// *****************************************************************************
+void OpenCL_Host_Backend::Set_Nb_Threads(const int _nb_threads)
+/**
+ * The pool is sized on first use: later calls only change how many chunks
+ * the work is split in.
+ */
+{
+    nb_threads = std::max(1, _nb_threads);
+}
+
+// *****************************************************************************
+uint64_t OpenCL_Host_Backend::Threshold(const cl_device_id device, const OpenCL_Backend_Operation operation)
+{
+    std::map<cl_device_id, std::vector<uint64_t> >::const_iterator it = thresholds.find(device);
+    if (it == thresholds.end())
+        return default_threshold;
+    return it->second[operation];
+}
+
+// *****************************************************************************
+void OpenCL_Host_Backend::Set_Threshold(const cl_device_id device, const OpenCL_Backend_Operation operation, const uint64_t bytes)
+{
+    std::map<cl_device_id, std::vector<uint64_t> >::iterator it = thresholds.find(device);
+    if (it == thresholds.end())
+        it = thresholds.insert(std::make_pair(device, std::vector<uint64_t>(OPENCL_NB_OPERATIONS, default_threshold))).first;
+    it->second[operation] = bytes;
+}
+
+// *****************************************************************************
+int OpenCL_Host_Backend::Nb_Chunks(const uint64_t n, const uint64_t min_chunk)
+{
+    // A few chunks per thread balance the load.
+    const uint64_t max_chunks = 4 * uint64_t(Nb_Threads());
+    uint64_t nb_chunks = std::max(std::min(max_chunks, n / std::max(min_chunk, uint64_t(1))), uint64_t(1));
+
+    // Chunks have ceil(n / nb_chunks) elements, so fewer of them may cover
+    // [0, n): 17 elements in chunks of 2 take 9 chunks, not 16. None must
+    // start past n.
+    const uint64_t chunk_size = (n + nb_chunks - 1) / nb_chunks;
+    if (chunk_size > 0)
+        nb_chunks = (n + chunk_size - 1) / chunk_size;
+    return int(nb_chunks);
+}
+
+// *****************************************************************************
+void OpenCL_Host_Backend::Parallel_For(const uint64_t n, const uint64_t min_chunk,
+                                       void (*function)(void *, const int, const uint64_t, const uint64_t),
+                                       void *argument)
+{
+    // Every chunk starts before n (see Nb_Chunks()).
+    const int nb_chunks = Nb_Chunks(n, min_chunk);
+    if (nb_chunks == 1 || Nb_Threads() == 1)
+    {
+        // Not worth waking up the pool. The chunks keep the same boundaries.
+        const uint64_t chunk_size = (n + nb_chunks - 1) / nb_chunks;
+        for (int c = 0 ; c < nb_chunks ; c++)
+            function(argument, c, uint64_t(c) * chunk_size, std::min(uint64_t(c + 1) * chunk_size, n));
+        return;
+    }
+
+    pthread_once(&host_thread_pool_once, Create_Host_Thread_Pool);
+
+    OpenCL_Host_Job job;
+    job.function    = function;
+    job.argument    = argument;
+    job.n           = n;
+    job.chunk_size  = (n + nb_chunks - 1) / nb_chunks;
+    job.nb_chunks   = nb_chunks;
+    job.next_chunk  = 0;
+    job.nb_done     = 0;
+    job.nb_workers  = 0;
+    host_thread_pool->Run(job);
+}
+
+// *****************************************************************************
+template <class T>
+inline T Reduction_Term(const OpenCL_Reduction_Operation operation, const T *a, const T *b, const uint64_t i)
+{
+    switch (operation)
+    {
+        case OPENCL_REDUCTION_DOT:  return T(a[i] * b[i]);
+        case OPENCL_REDUCTION_NORM: return T(a[i] * a[i]);
+        default:                    return a[i];
+    }
+}
+
+// *****************************************************************************
+template <class T>
+T Scalar_Reduce_Range(const OpenCL_Reduction_Operation operation, const T *a, const T *b,
+                      const uint64_t begin, const uint64_t end)
+/**
+ * Four independent accumulators break the dependency chain (and let the
+ * compiler vectorize).
+ */
+{
+    T acc[4];
+    for (int k = 0 ; k < 4 ; k++)
+        acc[k] = Reduction_Identity<T>(operation);
+
+    uint64_t i = begin;
+    for ( ; i + 4 <= end ; i += 4)
+    {
+        for (int k = 0 ; k < 4 ; k++)
+            acc[k] = Reduction_Combine(operation, acc[k], Reduction_Term(operation, a, b, i + k));
+    }
+    for ( ; i < end ; i++)
+        acc[0] = Reduction_Combine(operation, acc[0], Reduction_Term(operation, a, b, i));
+
+    return Reduction_Combine(operation, Reduction_Combine(operation, acc[0], acc[1]),
+                                        Reduction_Combine(operation, acc[2], acc[3]));
+}
+
+// *****************************************************************************
+template <class T>
+void Scalar_Elementwise_Range(const OpenCL_Elementwise_Operation operation, T *out, const T *a, const T *b,
+                              const T &alpha, const uint64_t begin, const uint64_t end)
+/**
+ * One loop per operation so each one can be vectorized by the compiler.
+ */
+{
+    switch (operation)
+    {
+        case OPENCL_ELEMENTWISE_ADD:  for (uint64_t i = begin ; i < end ; i++) out[i] = T(a[i] + b[i]);            break;
+        case OPENCL_ELEMENTWISE_SUB:  for (uint64_t i = begin ; i < end ; i++) out[i] = T(a[i] - b[i]);            break;
+        case OPENCL_ELEMENTWISE_MUL:  for (uint64_t i = begin ; i < end ; i++) out[i] = T(a[i] * b[i]);            break;
+        case OPENCL_ELEMENTWISE_DIV:  for (uint64_t i = begin ; i < end ; i++) out[i] = T(a[i] / b[i]);            break;
+        case OPENCL_ELEMENTWISE_MIN:  for (uint64_t i = begin ; i < end ; i++) out[i] = std::min(a[i], b[i]);      break;
+        case OPENCL_ELEMENTWISE_MAX:  for (uint64_t i = begin ; i < end ; i++) out[i] = std::max(a[i], b[i]);      break;
+        case OPENCL_ELEMENTWISE_AXPY: for (uint64_t i = begin ; i < end ; i++) out[i] = T(alpha * a[i] + b[i]);    break;
+    }
+}
+
+// *****************************************************************************
+template <class T>
+T Host_Reduce_Range(const OpenCL_Reduction_Operation operation, const T *a, const T *b,
+                    const uint64_t begin, const uint64_t end)
+{
+    return Scalar_Reduce_Range(operation, a, b, begin, end);
+}
+
+// *****************************************************************************
+template <class T>
+void Host_Elementwise_Range(const OpenCL_Elementwise_Operation operation, T *out, const T *a, const T *b,
+                            const T &alpha, const uint64_t begin, const uint64_t end)
+{
+    Scalar_Elementwise_Range(operation, out, a, b, alpha, begin, end);
+}
+
+#ifdef __SSE2__
+// *****************************************************************************
+// SSE2 versions for float (4 lanes) and double (2 lanes). The tails use the
+// scalar versions.
+// *****************************************************************************
+struct SSE2_float
+{
+    typedef float   T;
+    typedef __m128  V;
+    static const int W = 4;
+    static V    Load(const T *p)            { return _mm_loadu_ps(p);       }
+    static void Store(T *p, V x)            { _mm_storeu_ps(p, x);          }
+    static V    Set(T x)                    { return _mm_set1_ps(x);        }
+    static V    Add(V x, V y)               { return _mm_add_ps(x, y);      }
+    static V    Sub(V x, V y)               { return _mm_sub_ps(x, y);      }
+    static V    Mul(V x, V y)               { return _mm_mul_ps(x, y);      }
+    static V    Div(V x, V y)               { return _mm_div_ps(x, y);      }
+    static V    Min(V x, V y)               { return _mm_min_ps(x, y);      }
+    static V    Max(V x, V y)               { return _mm_max_ps(x, y);      }
+};
+struct SSE2_double
+{
+    typedef double  T;
+    typedef __m128d V;
+    static const int W = 2;
+    static V    Load(const T *p)            { return _mm_loadu_pd(p);       }
+    static void Store(T *p, V x)            { _mm_storeu_pd(p, x);          }
+    static V    Set(T x)                    { return _mm_set1_pd(x);        }
+    static V    Add(V x, V y)               { return _mm_add_pd(x, y);      }
+    static V    Sub(V x, V y)               { return _mm_sub_pd(x, y);      }
+    static V    Mul(V x, V y)               { return _mm_mul_pd(x, y);      }
+    static V    Div(V x, V y)               { return _mm_div_pd(x, y);      }
+    static V    Min(V x, V y)               { return _mm_min_pd(x, y);      }
+    static V    Max(V x, V y)               { return _mm_max_pd(x, y);      }
+};
+
+// *****************************************************************************
+template <class S>
+typename S::T SSE2_Reduce_Range(const OpenCL_Reduction_Operation operation, const typename S::T *a,
+                                const typename S::T *b, const uint64_t begin, const uint64_t end)
+{
+    typedef typename S::T T;
+    typedef typename S::V V;
+
+    // Two vector accumulators hide the latency of the additions.
+    V acc0 = S::Set(Reduction_Identity<T>(operation));
+    V acc1 = acc0;
+    uint64_t i = begin;
+    for ( ; i + 2 * S::W <= end ; i += 2 * S::W)
+    {
+        V x0 = S::Load(a + i);
+        V x1 = S::Load(a + i + S::W);
+        if (operation == OPENCL_REDUCTION_DOT)
+        {
+            x0 = S::Mul(x0, S::Load(b + i));
+            x1 = S::Mul(x1, S::Load(b + i + S::W));
+        }
+        else if (operation == OPENCL_REDUCTION_NORM)
+        {
+            x0 = S::Mul(x0, x0);
+            x1 = S::Mul(x1, x1);
+        }
+        if (operation == OPENCL_REDUCTION_MIN)
+        {
+            acc0 = S::Min(acc0, x0);
+            acc1 = S::Min(acc1, x1);
+        }
+        else if (operation == OPENCL_REDUCTION_MAX)
+        {
+            acc0 = S::Max(acc0, x0);
+            acc1 = S::Max(acc1, x1);
+        }
+        else
+        {
+            acc0 = S::Add(acc0, x0);
+            acc1 = S::Add(acc1, x1);
+        }
+    }
+
+    T lanes[2 * S::W];
+    S::Store(lanes, acc0);
+    S::Store(lanes + S::W, acc1);
+    T result = Scalar_Reduce_Range(operation, a, b, i, end);
+    for (int k = 0 ; k < 2 * S::W ; k++)
+        result = Reduction_Combine(operation, result, lanes[k]);
+    return result;
+}
+
+// *****************************************************************************
+template <class S>
+void SSE2_Elementwise_Range(const OpenCL_Elementwise_Operation operation, typename S::T *out,
+                            const typename S::T *a, const typename S::T *b,
+                            const typename S::T &alpha, const uint64_t begin, const uint64_t end)
+{
+    typedef typename S::V V;
+
+    const V valpha = S::Set(alpha);
+    uint64_t i = begin;
+    for ( ; i + S::W <= end ; i += S::W)
+    {
+        const V x = S::Load(a + i);
+        const V y = S::Load(b + i);
+        V r;
+        switch (operation)
+        {
+            case OPENCL_ELEMENTWISE_ADD:    r = S::Add(x, y);                   break;
+            case OPENCL_ELEMENTWISE_SUB:    r = S::Sub(x, y);                   break;
+            case OPENCL_ELEMENTWISE_MUL:    r = S::Mul(x, y);                   break;
+            case OPENCL_ELEMENTWISE_DIV:    r = S::Div(x, y);                   break;
+            case OPENCL_ELEMENTWISE_MIN:    r = S::Min(x, y);                   break;
+            case OPENCL_ELEMENTWISE_MAX:    r = S::Max(x, y);                   break;
+            default:                        r = S::Add(S::Mul(valpha, x), y);   break;
+        }
+        S::Store(out + i, r);
+    }
+    Scalar_Elementwise_Range(operation, out, a, b, alpha, i, end);
+}
+
+// *****************************************************************************
+template <>
+float Host_Reduce_Range<float>(const OpenCL_Reduction_Operation operation, const float *a, const float *b,
+                               const uint64_t begin, const uint64_t end)
+{
+    return SSE2_Reduce_Range<SSE2_float>(operation, a, b, begin, end);
+}
+template <>
+double Host_Reduce_Range<double>(const OpenCL_Reduction_Operation operation, const double *a, const double *b,
+                                 const uint64_t begin, const uint64_t end)
+{
+    return SSE2_Reduce_Range<SSE2_double>(operation, a, b, begin, end);
+}
+template <>
+void Host_Elementwise_Range<float>(const OpenCL_Elementwise_Operation operation, float *out, const float *a,
+                                   const float *b, const float &alpha, const uint64_t begin, const uint64_t end)
+{
+    SSE2_Elementwise_Range<SSE2_float>(operation, out, a, b, alpha, begin, end);
+}
+template <>
+void Host_Elementwise_Range<double>(const OpenCL_Elementwise_Operation operation, double *out, const double *a,
+                                    const double *b, const double &alpha, const uint64_t begin, const uint64_t end)
+{
+    SSE2_Elementwise_Range<SSE2_double>(operation, out, a, b, alpha, begin, end);
+}
+#endif // #ifdef __SSE2__
+
+// *****************************************************************************
+// Arguments of the Parallel_For() chunk functions below.
+template <class T>
+struct Host_Backend_Arguments
+{
+    OpenCL_Reduction_Operation      reduction;
+    OpenCL_Elementwise_Operation    elementwise;
+    T                              *out;
+    const T                        *a;
+    const T                        *b;
+    T                               value;      // Fill value or alpha
+    std::vector<T>                  partials;   // One per chunk (reductions)
+};
+
+// *****************************************************************************
+template <class T>
+void Host_Fill_Chunk(void *_args, const int, const uint64_t begin, const uint64_t end)
+{
+    Host_Backend_Arguments<T> *args = (Host_Backend_Arguments<T> *) _args;
+    std::fill(args->out + begin, args->out + end, args->value);
+}
+
+// *****************************************************************************
+template <class T>
+void Host_Copy_Chunk(void *_args, const int, const uint64_t begin, const uint64_t end)
+{
+    Host_Backend_Arguments<T> *args = (Host_Backend_Arguments<T> *) _args;
+    memcpy(args->out + begin, args->a + begin, size_t(end - begin) * sizeof(T));
+}
+
+// *****************************************************************************
+template <class T>
+void Host_Reduce_Chunk(void *_args, const int chunk, const uint64_t begin, const uint64_t end)
+{
+    Host_Backend_Arguments<T> *args = (Host_Backend_Arguments<T> *) _args;
+    args->partials[chunk] = Host_Reduce_Range(args->reduction, args->a, args->b, begin, end);
+}
+
+// *****************************************************************************
+template <class T>
+void Host_Elementwise_Chunk(void *_args, const int, const uint64_t begin, const uint64_t end)
+{
+    Host_Backend_Arguments<T> *args = (Host_Backend_Arguments<T> *) _args;
+    Host_Elementwise_Range(args->elementwise, args->out, args->a, args->b, args->value, begin, end);
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Host_Backend::Fill(T *array, const uint64_t n, const T &value)
+{
+    Host_Backend_Arguments<T> args;
+    args.out    = array;
+    args.value  = value;
+    Parallel_For(n, host_backend_min_chunk_bytes / sizeof(T), Host_Fill_Chunk<T>, &args);
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Host_Backend::Copy(T *destination, const T *source, const uint64_t n)
+/**
+ * The ranges must not overlap (as for clEnqueueCopyBuffer()).
+ */
+{
+    Host_Backend_Arguments<T> args;
+    args.out    = destination;
+    args.a      = source;
+    Parallel_For(n, host_backend_min_chunk_bytes / sizeof(T), Host_Copy_Chunk<T>, &args);
+}
+
+// *****************************************************************************
+template <class T>
+T OpenCL_Host_Backend::Reduce(const OpenCL_Reduction_Operation operation, const T *a, const T *b, const uint64_t n)
+{
+    const uint64_t min_chunk = host_backend_min_chunk_bytes / sizeof(T);
+
+    Host_Backend_Arguments<T> args;
+    args.reduction  = operation;
+    args.a          = a;
+    args.b          = b;
+    args.partials.resize(Nb_Chunks(n, min_chunk));
+    Parallel_For(n, min_chunk, Host_Reduce_Chunk<T>, &args);
+
+    // Combined in chunk order: the result does not depend on the scheduling.
+    T value = Reduction_Identity<T>(operation);
+    for (size_t i = 0 ; i < args.partials.size() ; i++)
+        value = Reduction_Combine(operation, value, args.partials[i]);
+    if (operation == OPENCL_REDUCTION_NORM)
+        value = T(std::sqrt(double(value)));
+    return value;
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Host_Backend::Elementwise(const OpenCL_Elementwise_Operation operation, T *out,
+                                      const T *a, const T *b, const T &alpha, const uint64_t n)
+{
+    Host_Backend_Arguments<T> args;
+    args.elementwise    = operation;
+    args.out            = out;
+    args.a              = a;
+    args.b              = b;
+    args.value          = alpha;
+    Parallel_For(n, host_backend_min_chunk_bytes / sizeof(T), Host_Elementwise_Chunk<T>, &args);
+}
+
+// *****************************************************************************
+inline bool Use_Host_Backend(const OpenCL_Backend backend, const bool host_is_preferred)
+{
+    return (backend == OPENCL_BACKEND_HOST || (backend == OPENCL_BACKEND_AUTO && host_is_preferred));
+}
+
+// *****************************************************************************
+cl_event Completed_Event(cl_context context)
+/**
+ * Event returned by operations run by the host backend: they are done.
+ */
+{
+    cl_int err;
+    cl_event event = clCreateUserEvent(context, &err);
+    OpenCL_Test_Success(err, "clCreateUserEvent()");
+    err = clSetUserEventStatus(event, CL_COMPLETE);
+    OpenCL_Test_Success(err, "clSetUserEventStatus()");
+    return event;
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Reduction_Result<T>::OpenCL_Reduction_Result(const OpenCL_Reduction_Result<T> &other)
+{
+    state = other.state;
+    if (state != NULL)
+        state->references++;
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Reduction_Result<T> & OpenCL_Reduction_Result<T>::operator=(const OpenCL_Reduction_Result<T> &other)
+{
+    if (state != other.state)
+    {
+        Release();
+        state = other.state;
+        if (state != NULL)
+            state->references++;
+    }
+    return *this;
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Reduction_Result<T>::Release()
+{
+    if (state != NULL && --state->references == 0)
+    {
+        if (state->event != NULL)
+        {
+            // The partial results are still being written to.
+            clWaitForEvents(1, &state->event);
+            clReleaseEvent(state->event);
+        }
+        delete state;
+    }
+    state = NULL;
+}
+
+// *****************************************************************************
+template <class T>
+bool OpenCL_Reduction_Result<T>::Is_Ready() const
+{
+    OpenCL_Assert(state != NULL);
+    if (state->done)
+        return true;
+
+    cl_int status;
+    cl_int err = clGetEventInfo(state->event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+    OpenCL_Test_Success(err, "clGetEventInfo()");
+    return (status == CL_COMPLETE);
+}
+
+// *****************************************************************************
+template <class T>
+T OpenCL_Reduction_Result<T>::Get()
+{
+    OpenCL_Assert(state != NULL);
+    if (!state->done)
+    {
+        cl_int err = clWaitForEvents(1, &state->event);
+        OpenCL_Test_Success(err, "clWaitForEvents()");
+        err = clReleaseEvent(state->event);
+        OpenCL_Test_Success(err, "clReleaseEvent()");
+        state->event = NULL;
+
+        T value = Reduction_Identity<T>(state->operation);
+        for (size_t i = 0 ; i < state->partials.size() ; i++)
+            value = Reduction_Combine(state->operation, value, state->partials[i]);
+        if (state->operation == OPENCL_REDUCTION_NORM)
+            value = T(std::sqrt(double(value)));
+
+        state->value = value;
+        state->done  = true;
+    }
+    return state->value;
+}
+
+// *****************************************************************************
+template <class T>
+cl_event OpenCL_Reduction_Result<T>::Get_Event() const
+/**
+ * @return NULL once Get() was called, or if the host backend computed the result.
+ */
+{
+    OpenCL_Assert(state != NULL);
+    return state->event;
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Reducer<T>::OpenCL_Reducer()
+{
+    context                     = NULL;
+    command_queue               = NULL;
+    device                      = NULL;
+    device_is_cpu               = false;
+    vector_width                = 1;
+    max_local_size              = 1;
+    max_nb_groups               = 1;
+    partials                    = NULL;
+    err                         = 0;
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Reducer<T>::~OpenCL_Reducer()
+{
+    try
+    {
+        Release_Memory();
+    }
+    catch (const OpenCL_Exception &exception)
+    {
+        Report_Exception_in_Destructor(exception);
+    }
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Reducer<T>::Initialize(cl_context &_context, cl_command_queue &_command_queue, cl_device_id &_device)
+{
+    context         = _context;
+    command_queue   = _command_queue;
+    device          = _device;
+
+    const cl_device_type type   = Get_Device_Info<cl_device_type>(device, CL_DEVICE_TYPE, "clGetDeviceInfo (CL_DEVICE_TYPE)");
+    const cl_uint compute_units = Get_Device_Info<cl_uint>(device, CL_DEVICE_MAX_COMPUTE_UNITS, "clGetDeviceInfo (CL_DEVICE_MAX_COMPUTE_UNITS)");
+    const cl_uint preferred     = Get_Device_Info<cl_uint>(device, OpenCL_Reduction_Type<T>::Vector_Width(), "clGetDeviceInfo (CL_DEVICE_PREFERRED_VECTOR_WIDTH)");
+    device_is_cpu = ((type & CL_DEVICE_TYPE_CPU) != 0);
+
+    // A preferred vector width of 0 means the type is not supported (double without cl_khr_fp64).
+    if (preferred == 0)
+    {
+        OpenCL_Throw(CL_INVALID_DEVICE, "OpenCL_Reducer::Initialize",
+                     std::string("Device does not support ") + OpenCL_Reduction_Type<T>::Name() + " reductions");
+    }
+    vector_width = 1;
+    while (vector_width * 2 <= preferred && vector_width < 16)
+        vector_width *= 2;
+
+    if (device_is_cpu)
+    {
+        // Single pass: one work item per compute unit, no local memory.
+        max_local_size  = 1;
+        max_nb_groups   = compute_units;
+    }
+    else
+    {
+        const size_t   max_work_group_size  = Get_Device_Info<size_t>(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, "clGetDeviceInfo (CL_DEVICE_MAX_WORK_GROUP_SIZE)");
+        const cl_ulong local_mem_size       = Get_Device_Info<cl_ulong>(device, CL_DEVICE_LOCAL_MEM_SIZE, "clGetDeviceInfo (CL_DEVICE_LOCAL_MEM_SIZE)");
+        max_local_size  = std::min(std::min(size_t(256), max_work_group_size), size_t(local_mem_size / sizeof(T)));
+        // Enough work-groups per compute unit to hide the memory latency.
+        max_nb_groups   = 8 * size_t(compute_units);
+    }
+    OpenCL_Assert(max_local_size > 0 && max_nb_groups > 0);
+
+    partials = OpenCL_Memory::Create_Buffer(context, CL_MEM_WRITE_ONLY, max_nb_groups * sizeof(T), NULL, &err);
+    OpenCL_Test_Success(err, "clCreateBuffer()");
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Reducer<T>::Release_Memory()
+{
+    for (std::map<int, OpenCL_Kernel *>::iterator it = kernels.begin() ; it != kernels.end() ; ++it)
+        delete it->second;
+    kernels.clear();
+    local_sizes.clear();
+
+    if (partials != NULL)
+        OpenCL_Memory::Release(partials);
+    partials = NULL;
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Kernel & OpenCL_Reducer<T>::Kernel(const OpenCL_Reduction_Operation operation, size_t &local_size)
+/**
+ * Build the kernel for "operation" on first use and choose its work-group size.
+ * The tree reduction in local memory needs a power of two: the largest one
+ * within the device's and the kernel's limits. It is then a multiple of the
+ * kernel's preferred work-group size multiple (warp or wavefront size) as
+ * long as that multiple is a power of two within the limits, which is
+ * checked: otherwise partial warps leave SIMD lanes idle.
+ */
+{
+    std::map<int, OpenCL_Kernel *>::iterator it = kernels.find(operation);
+    if (it == kernels.end())
+    {
+        const char *operation_names[] = { "SUM", "MIN", "MAX", "DOT", "NORM" };
+        const char *identity = "0";
+        if      (operation == OPENCL_REDUCTION_MIN) identity = OpenCL_Reduction_Type<T>::Highest();
+        else if (operation == OPENCL_REDUCTION_MAX) identity = OpenCL_Reduction_Type<T>::Lowest();
+
+        std::ostringstream options;
+        options
+            << "-DT=" << OpenCL_Reduction_Type<T>::Name() << " -DW=" << vector_width
+            << " -DIDENTITY=" << identity << " -DOP_" << operation_names[operation];
+        if (device_is_cpu)
+            options << " -DCONTIGUOUS";
+        if (sizeof(T) == sizeof(double) && !std::numeric_limits<T>::is_integer)
+            options << " -DOCLUTILS_FP64";
+
+        OpenCL_Kernel *kernel = new OpenCL_Kernel;
+        kernel->Initialize(kernel_Reduce_source, context, device);
+        kernel->Append_Compiler_Option(options.str());
+        kernel->Build("OclUtils_Reduce");
+
+        size_t kernel_max_size = 1;
+        size_t preferred_multiple = 1;
+        if (!device_is_cpu)
+        {
+            err  = clGetKernelWorkGroupInfo(kernel->Get_Kernel(), device, CL_KERNEL_WORK_GROUP_SIZE,
+                                            sizeof(kernel_max_size), &kernel_max_size, NULL);
+            err |= clGetKernelWorkGroupInfo(kernel->Get_Kernel(), device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+                                            sizeof(preferred_multiple), &preferred_multiple, NULL);
+            OpenCL_Test_Success(err, "clGetKernelWorkGroupInfo()");
+        }
+        const size_t limit = std::min(max_local_size, kernel_max_size);
+        size_t size = 1;
+        while (size * 2 <= limit)
+            size *= 2;
+
+        if (preferred_multiple > 0 && size % preferred_multiple != 0)
+            OpenCL_Log_Debug("OpenCL: Reduction work-group size " << size << " is not a multiple of the preferred "
+                             << preferred_multiple << " (limit " << limit << ")");
+
+        it = kernels.insert(std::make_pair(int(operation), kernel)).first;
+        local_sizes[operation] = size;
+    }
+
+    local_size = local_sizes[operation];
+    return *it->second;
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Reduction_Result<T> OpenCL_Reducer<T>::Reduce(const OpenCL_Reduction_Operation operation,
+                                                     OpenCL_Array<T> &a, OpenCL_Array<T> *b,
+                                                     const OpenCL_Backend backend)
+/**
+ * Enqueue the reduction and a non-blocking read of the partial results.
+ * The arrays are only read: they are not marked dirty on the device.
+ */
+{
+    OpenCL_Assert(partials != NULL);
+
+    const uint64_t n = uint64_t(a.Get_N()) * a.Get_Sizeof_Element() / sizeof(T);
+    if (b != NULL)
+        OpenCL_Assert(uint64_t(b->Get_N()) * b->Get_Sizeof_Element() / sizeof(T) == n);
+
+    if (Use_Host_Backend(backend, a.Host_Is_Preferred(OPENCL_OPERATION_REDUCE) &&
+                                  (b == NULL || b->Host_Is_Preferred(OPENCL_OPERATION_REDUCE))))
+    {
+        typename OpenCL_Reduction_Result<T>::State *state = new typename OpenCL_Reduction_Result<T>::State;
+        state->references   = 1;
+        state->event        = NULL;
+        state->operation    = operation;
+        state->done         = true;
+        state->value        = OpenCL_Host_Backend::Reduce(operation, a.Host_Read(),
+                                                          (b != NULL ? b->Host_Read() : (const T *) NULL), n);
+        return OpenCL_Reduction_Result<T>(state);
+    }
+
+    size_t local_size;
+    OpenCL_Kernel &kernel = Kernel(operation, local_size);
+
+    const uint64_t nb_vectors = n / vector_width;
+    const size_t nb_groups = size_t(std::max(uint64_t(1), std::min(uint64_t(max_nb_groups),
+                                                                   (nb_vectors + local_size - 1) / local_size)));
+
+    // Pin both arrays so faulting in one does not evict the other.
+    OpenCL_Pin_Guard pins;
+    pins.Pin(a);
+    if (b != NULL)
+        pins.Pin(*b);
+    a.Make_Resident();
+    if (b != NULL)
+        b->Make_Resident();
+
+    cl_mem memory_a = a.Resident_Device_Memory();
+    cl_mem memory_b = (b != NULL ? b->Resident_Device_Memory() : memory_a);
+    const cl_ulong n_ulong = n;
+
+    cl_kernel k = kernel.Get_Kernel();
+    err  = clSetKernelArg(k, 0, sizeof(cl_mem),     &memory_a);
+    err |= clSetKernelArg(k, 1, sizeof(cl_mem),     &memory_b);
+    err |= clSetKernelArg(k, 2, sizeof(cl_ulong),   &n_ulong);
+    err |= clSetKernelArg(k, 3, sizeof(cl_mem),     &partials);
+    err |= clSetKernelArg(k, 4, local_size * sizeof(T), NULL);
+    OpenCL_Test_Success(err, "clSetKernelArg()");
+
+    kernel.Compute_Work_Size(nb_groups * local_size, 1, local_size, 1);
+    kernel.Launch(command_queue);
+
+    // Enqueued commands keep their memory objects alive: unpinning is safe.
+    pins.Unpin_All();
+
+    typename OpenCL_Reduction_Result<T>::State *state = new typename OpenCL_Reduction_Result<T>::State;
+    state->references   = 1;
+    state->event        = NULL;
+    state->partials.resize(nb_groups);
+    state->operation    = operation;
+    state->done         = false;
+    state->value        = T(0);
+
+    err = clEnqueueReadBuffer(command_queue, partials, CL_FALSE, 0, nb_groups * sizeof(T),
+                              &state->partials[0], 0, NULL, &state->event);
+    OpenCL_Test_Success(err, "clEnqueueReadBuffer()");
+    err = clFlush(command_queue);
+    OpenCL_Test_Success(err, "clFlush()");
+
+    return OpenCL_Reduction_Result<T>(state);
+}
+
+// *****************************************************************************
+inline size_t Scan_Scratch_Elements(const size_t local_size, const cl_uint log_nb_banks)
+/**
+ * Local memory (in elements) used by OclUtils_Scan_Blocks: two elements per
+ * work item plus the padding (PAD() of the last index, plus one).
+ */
+{
+    return 2 * local_size + ((2 * local_size - 1) >> log_nb_banks);
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Scan<T>::OpenCL_Scan()
+{
+    context                     = NULL;
+    command_queue               = NULL;
+    device                      = NULL;
+    device_is_cpu               = false;
+    local_size                  = 1;
+    log_nb_banks                = 0;
+    nb_chunks                   = 1;
+    err                         = 0;
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Scan<T>::~OpenCL_Scan()
+{
+    try
+    {
+        Release_Memory();
+    }
+    catch (const OpenCL_Exception &exception)
+    {
+        Report_Exception_in_Destructor(exception);
+    }
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Scan<T>::Initialize(cl_context &_context, cl_command_queue &_command_queue, cl_device_id &_device)
+{
+    context         = _context;
+    command_queue   = _command_queue;
+    device          = _device;
+
+    const cl_device_type type   = Get_Device_Info<cl_device_type>(device, CL_DEVICE_TYPE, "clGetDeviceInfo (CL_DEVICE_TYPE)");
+    const cl_uint compute_units = Get_Device_Info<cl_uint>(device, CL_DEVICE_MAX_COMPUTE_UNITS, "clGetDeviceInfo (CL_DEVICE_MAX_COMPUTE_UNITS)");
+    device_is_cpu = ((type & CL_DEVICE_TYPE_CPU) != 0);
+
+    std::ostringstream options;
+    options << "-DT=" << OpenCL_Reduction_Type<T>::Name();
+    if (sizeof(T) == sizeof(double) && !std::numeric_limits<T>::is_integer)
+        options << " -DOCLUTILS_FP64";
+    if (device_is_cpu)
+    {
+        // A few chunks per compute unit balance the load.
+        nb_chunks = 4 * size_t(compute_units);
+        options << " -DCONTIGUOUS";
+    }
+    else
+    {
+        // GPU local memory is interleaved over 32 banks of 4 bytes: pad
+        // every 32 (16 for 8 bytes types) elements.
+        log_nb_banks = (sizeof(T) >= 8 ? 4 : 5);
+        options << " -DLOG_NB_BANKS=" << log_nb_banks;
+    }
+
+    kernel_blocks.Initialize(kernel_Scan_source, context, device);
+    kernel_blocks.Append_Compiler_Option(options.str());
+    kernel_blocks.Build(device_is_cpu ? "OclUtils_Scan_Chunks" : "OclUtils_Scan_Blocks");
+
+    kernel_add.Initialize(kernel_Scan_source, context, device);
+    kernel_add.Append_Compiler_Option(options.str());
+    kernel_add.Build("OclUtils_Scan_Add");
+
+    local_size = 1;
+    if (!device_is_cpu)
+    {
+        const size_t   max_work_group_size  = Get_Device_Info<size_t>(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, "clGetDeviceInfo (CL_DEVICE_MAX_WORK_GROUP_SIZE)");
+        const cl_ulong local_mem_size       = Get_Device_Info<cl_ulong>(device, CL_DEVICE_LOCAL_MEM_SIZE, "clGetDeviceInfo (CL_DEVICE_LOCAL_MEM_SIZE)");
+        size_t kernel_max_size[2] = { 1, 1 };
+        err  = clGetKernelWorkGroupInfo(kernel_blocks.Get_Kernel(), device, CL_KERNEL_WORK_GROUP_SIZE,
+                                        sizeof(size_t), &kernel_max_size[0], NULL);
+        err |= clGetKernelWorkGroupInfo(kernel_add.Get_Kernel(), device, CL_KERNEL_WORK_GROUP_SIZE,
+                                        sizeof(size_t), &kernel_max_size[1], NULL);
+        OpenCL_Test_Success(err, "clGetKernelWorkGroupInfo()");
+
+        // Largest power of two (so a multiple of the warp or wavefront size
+        // whenever possible) within the limits and the local memory.
+        const size_t limit = std::min(std::min(size_t(256), max_work_group_size),
+                                      std::min(kernel_max_size[0], kernel_max_size[1]));
+        while (local_size * 2 <= limit &&
+               Scan_Scratch_Elements(local_size * 2, log_nb_banks) * sizeof(T) <= local_mem_size)
+        {
+            local_size *= 2;
+        }
+    }
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Scan<T>::Release_Memory()
+{
+    for (size_t i = 0 ; i < level_sums.size() ; i++)
+    {
+        if (level_sums[i] != NULL)
+            OpenCL_Memory::Release(level_sums[i]);
+    }
+    level_sums.clear();
+    level_capacities.clear();
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Scan<T>::Enqueue(cl_mem in, cl_mem out, const uint64_t n, const bool inclusive)
+{
+    if (n > 0)
+        Enqueue_Level(in, out, n, inclusive, 0);
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Scan<T>::Enqueue_Level(cl_mem in, cl_mem out, const uint64_t n, const bool inclusive, const size_t level)
+/**
+ * Scan the blocks of "in" into "out" and their totals into level_sums[level],
+ * then scan these totals (exclusive) and add them back to the blocks.
+ */
+{
+    uint64_t block_size;
+    if (device_is_cpu)
+    {
+        // Small scans are not worth splitting over work items.
+        block_size = std::max((n + nb_chunks - 1) / nb_chunks, uint64_t(4096));
+    }
+    else
+        block_size = 2 * local_size;
+    const uint64_t nb_blocks = (n + block_size - 1) / block_size;
+
+    if (level >= level_sums.size())
+    {
+        level_sums.push_back(NULL);
+        level_capacities.push_back(0);
+    }
+    if (level_capacities[level] < nb_blocks)
+    {
+        if (level_sums[level] != NULL)
+            OpenCL_Memory::Release(level_sums[level]);
+        level_sums[level] = OpenCL_Memory::Create_Buffer(context, CL_MEM_READ_WRITE, nb_blocks * sizeof(T), NULL, &err);
+        OpenCL_Test_Success(err, "clCreateBuffer()");
+        level_capacities[level] = nb_blocks;
+    }
+    cl_mem sums = level_sums[level];
+
+    const cl_ulong n_ulong          = n;
+    const cl_ulong block_size_ulong = block_size;
+    const cl_uint  inclusive_uint   = (inclusive ? 1 : 0);
+
+    cl_kernel k = kernel_blocks.Get_Kernel();
+    err  = clSetKernelArg(k, 0, sizeof(cl_mem),     &in);
+    err |= clSetKernelArg(k, 1, sizeof(cl_mem),     &out);
+    err |= clSetKernelArg(k, 2, sizeof(cl_mem),     &sums);
+    err |= clSetKernelArg(k, 3, sizeof(cl_ulong),   &n_ulong);
+    err |= clSetKernelArg(k, 4, sizeof(cl_uint),    &inclusive_uint);
+    if (device_is_cpu)
+        err |= clSetKernelArg(k, 5, sizeof(cl_ulong), &block_size_ulong);
+    else
+        err |= clSetKernelArg(k, 5, Scan_Scratch_Elements(local_size, log_nb_banks) * sizeof(T), NULL);
+    OpenCL_Test_Success(err, "clSetKernelArg()");
+
+    if (device_is_cpu)
+        kernel_blocks.Compute_Work_Size(size_t(nb_blocks), 1, 1, 1);
+    else
+        kernel_blocks.Compute_Work_Size(size_t(nb_blocks) * local_size, 1, local_size, 1);
+    kernel_blocks.Launch(command_queue);
+
+    if (nb_blocks > 1)
+    {
+        Enqueue_Level(sums, sums, nb_blocks, false, level + 1);
+
+        k = kernel_add.Get_Kernel();
+        err  = clSetKernelArg(k, 0, sizeof(cl_mem),     &out);
+        err |= clSetKernelArg(k, 1, sizeof(cl_mem),     &sums);
+        err |= clSetKernelArg(k, 2, sizeof(cl_ulong),   &n_ulong);
+        err |= clSetKernelArg(k, 3, sizeof(cl_ulong),   &block_size_ulong);
+        OpenCL_Test_Success(err, "clSetKernelArg()");
+
+        if (device_is_cpu)
+            kernel_add.Compute_Work_Size(size_t(nb_blocks), 1, 1, 1);
+        else
+            kernel_add.Compute_Work_Size(size_t(nb_blocks * block_size), 1, local_size, 1);
+        kernel_add.Launch(command_queue);
+    }
+}
+
+// *****************************************************************************
+template <class T>
+cl_event OpenCL_Scan<T>::Scan(OpenCL_Array<T> &in, OpenCL_Array<T> &out, const bool inclusive)
+{
+    const uint64_t n = uint64_t(in.Get_N()) * in.Get_Sizeof_Element() / sizeof(T);
+    OpenCL_Assert(uint64_t(out.Get_N()) * out.Get_Sizeof_Element() / sizeof(T) == n);
+
+    // Pin both arrays so faulting in one does not evict the other.
+    OpenCL_Pin_Guard pins;
+    pins.Pin(in);
+    pins.Pin(out);
+    in.Make_Resident();
+    out.Make_Resident();
+
+    Enqueue(in.Resident_Device_Memory(), out.Resident_Device_Memory(), n, inclusive);
+    out.Mark_Device_Dirty();
+
+    pins.Unpin_All();
+
+    // A marker completes when all previously enqueued commands are done.
+    cl_event event = NULL;
+    err = clEnqueueMarker(command_queue, &event);
+    OpenCL_Test_Success(err, "clEnqueueMarker()");
+
+    return event;
+}
+
+// *****************************************************************************
+// Key types supported by OpenCL_Radix_Sort: size and mapping to unsigned integers.
+template <class K> struct OpenCL_Radix_Sort_Key;
+template <> struct OpenCL_Radix_Sort_Key<unsigned int>  { static const char * Option() { return "-DKEY_BITS=32";               } };
+template <> struct OpenCL_Radix_Sort_Key<int>           { static const char * Option() { return "-DKEY_BITS=32 -DKEY_SIGNED";  } };
+template <> struct OpenCL_Radix_Sort_Key<float>         { static const char * Option() { return "-DKEY_BITS=32 -DKEY_FLOAT";   } };
+template <> struct OpenCL_Radix_Sort_Key<cl_ulong>      { static const char * Option() { return "-DKEY_BITS=64";               } };
+template <> struct OpenCL_Radix_Sort_Key<double>        { static const char * Option() { return "-DKEY_BITS=64 -DKEY_FLOAT";   } };
+
+// *****************************************************************************
+template <class K>
+OpenCL_Radix_Sort<K>::OpenCL_Radix_Sort()
+{
+    context                     = NULL;
+    command_queue               = NULL;
+    device                      = NULL;
+    device_is_cpu               = false;
+    radix_bits                  = 4;
+    local_size                  = 1;
+    max_nb_items                = 1;
+    err                         = 0;
+    keys_tmp                    = NULL;
+    values_tmp                  = NULL;
+    histogram                   = NULL;
+    keys_tmp_capacity           = 0;
+    values_tmp_capacity         = 0;
+    histogram_capacity          = 0;
+}
+
+// *****************************************************************************
+template <class K>
+OpenCL_Radix_Sort<K>::~OpenCL_Radix_Sort()
+{
+    try
+    {
+        Release_Memory();
+    }
+    catch (const OpenCL_Exception &exception)
+    {
+        Report_Exception_in_Destructor(exception);
+    }
+}
+
+// *****************************************************************************
+template <class K>
+void OpenCL_Radix_Sort<K>::Initialize(cl_context &_context, cl_command_queue &_command_queue, cl_device_id &_device)
+{
+    context         = _context;
+    command_queue   = _command_queue;
+    device          = _device;
+
+    const cl_device_type type   = Get_Device_Info<cl_device_type>(device, CL_DEVICE_TYPE, "clGetDeviceInfo (CL_DEVICE_TYPE)");
+    const cl_uint compute_units = Get_Device_Info<cl_uint>(device, CL_DEVICE_MAX_COMPUTE_UNITS, "clGetDeviceInfo (CL_DEVICE_MAX_COMPUTE_UNITS)");
+    device_is_cpu = ((type & CL_DEVICE_TYPE_CPU) != 0);
+
+    // Both give an even number of passes for 32 and 64 bits keys.
+    radix_bits = (device_is_cpu ? 8 : 4);
+
+    scan.Initialize(context, command_queue, device);
+
+    std::ostringstream options;
+    options << OpenCL_Radix_Sort_Key<K>::Option() << " -DRADIX_BITS=" << radix_bits;
+    kernel_histogram.Initialize(kernel_Radix_Sort_source, context, device);
+    kernel_histogram.Append_Compiler_Option(options.str());
+    kernel_histogram.Build("OclUtils_Radix_Histogram");
+
+    if (device_is_cpu)
+    {
+        local_size      = 1;
+        max_nb_items    = compute_units;
+    }
+    else
+    {
+        size_t kernel_max_size = 1;
+        err = clGetKernelWorkGroupInfo(kernel_histogram.Get_Kernel(), device, CL_KERNEL_WORK_GROUP_SIZE,
+                                       sizeof(kernel_max_size), &kernel_max_size, NULL);
+        OpenCL_Test_Success(err, "clGetKernelWorkGroupInfo()");
+        local_size = 1;
+        while (local_size * 2 <= std::min(size_t(64), kernel_max_size))
+            local_size *= 2;
+        // Many small chunks per compute unit to hide the memory latency.
+        max_nb_items = 16 * size_t(compute_units) * local_size;
+    }
+}
+
+// *****************************************************************************
+template <class K>
+void OpenCL_Radix_Sort<K>::Release_Memory()
+{
+    for (std::map<size_t, OpenCL_Kernel *>::iterator it = kernels_scatter.begin() ; it != kernels_scatter.end() ; ++it)
+        delete it->second;
+    kernels_scatter.clear();
+
+    if (keys_tmp != NULL)
+        OpenCL_Memory::Release(keys_tmp);
+    if (values_tmp != NULL)
+        OpenCL_Memory::Release(values_tmp);
+    if (histogram != NULL)
+        OpenCL_Memory::Release(histogram);
+    keys_tmp            = NULL;
+    values_tmp          = NULL;
+    histogram           = NULL;
+    keys_tmp_capacity   = 0;
+    values_tmp_capacity = 0;
+    histogram_capacity  = 0;
+
+    scan.Release_Memory();
+}
+
+// *****************************************************************************
+template <class K>
+OpenCL_Kernel & OpenCL_Radix_Sort<K>::Kernel_Scatter(const size_t sizeof_value)
+/**
+ * Build the scatter kernel moving values of "sizeof_value" bytes (0 for
+ * keys only) on first use.
+ */
+{
+    std::map<size_t, OpenCL_Kernel *>::iterator it = kernels_scatter.find(sizeof_value);
+    if (it == kernels_scatter.end())
+    {
+        std::ostringstream options;
+        options << OpenCL_Radix_Sort_Key<K>::Option() << " -DRADIX_BITS=" << radix_bits;
+        if      (sizeof_value == 4)     options << " -DVALUE=uint";
+        else if (sizeof_value == 8)     options << " -DVALUE=ulong";
+        else if (sizeof_value == 16)    options << " -DVALUE=uint4";
+        else if (sizeof_value != 0)
+        {
+            std::ostringstream message;
+            message << "Radix sort values must be 4, 8 or 16 bytes (not " << sizeof_value << ")";
+            OpenCL_Throw(CL_INVALID_VALUE, "OpenCL_Radix_Sort::Kernel_Scatter", message.str());
+        }
+
+        OpenCL_Kernel *kernel = new OpenCL_Kernel;
+        kernel->Initialize(kernel_Radix_Sort_source, context, device);
+        kernel->Append_Compiler_Option(options.str());
+        kernel->Build("OclUtils_Radix_Scatter");
+
+        it = kernels_scatter.insert(std::make_pair(sizeof_value, kernel)).first;
+    }
+
+    return *it->second;
+}
+
+// *****************************************************************************
+template <class K>
+cl_mem OpenCL_Radix_Sort<K>::Buffer(cl_mem &buffer, uint64_t &capacity, const uint64_t size)
+/**
+ * Grow "buffer" to at least "size" bytes. Its content is not preserved.
+ */
+{
+    if (capacity < size)
+    {
+        if (buffer != NULL)
+            OpenCL_Memory::Release(buffer);
+        buffer = OpenCL_Memory::Create_Buffer(context, CL_MEM_READ_WRITE, size, NULL, &err);
+        OpenCL_Test_Success(err, "clCreateBuffer()");
+        capacity = size;
+    }
+    return buffer;
+}
+
+// *****************************************************************************
+template <class K>
+cl_event OpenCL_Radix_Sort<K>::Sort(OpenCL_Resident &keys, const int n, const size_t sizeof_key,
+                                    OpenCL_Resident *values, const int nb_values, const size_t sizeof_value)
+{
+    OpenCL_Assert(sizeof_key == sizeof(K));
+    OpenCL_Assert(values == NULL || nb_values == n);
+
+    OpenCL_Kernel &kernel_scatter = Kernel_Scatter(values != NULL ? sizeof_value : 0);
+
+    // Pin both arrays so faulting in one does not evict the other.
+    OpenCL_Pin_Guard pins;
+    pins.Pin(keys);
+    if (values != NULL)
+        pins.Pin(*values);
+    keys.Make_Resident();
+    if (values != NULL)
+        values->Make_Resident();
+
+    if (n > 1)
+    {
+        // At least a few keys per chunk.
+        uint64_t nb_items = std::min(uint64_t(max_nb_items), (uint64_t(n) + 15) / 16);
+        nb_items = (nb_items + local_size - 1) / local_size * local_size;
+        const uint64_t radix = uint64_t(1) << radix_bits;
+
+        cl_mem keys_src     = keys.Resident_Device_Memory();
+        cl_mem keys_dst     = Buffer(keys_tmp, keys_tmp_capacity, uint64_t(n) * sizeof(K));
+        cl_mem values_src   = keys_src;     // Unused without values
+        cl_mem values_dst   = keys_dst;
+        if (values != NULL)
+        {
+            values_src = values->Resident_Device_Memory();
+            values_dst = Buffer(values_tmp, values_tmp_capacity, uint64_t(n) * sizeof_value);
+        }
+        cl_mem counts = Buffer(histogram, histogram_capacity, radix * nb_items * sizeof(cl_uint));
+
+        const cl_ulong n_ulong  = n;
+        const int nb_passes     = int(8 * sizeof(K) / radix_bits);
+        // The keys (values) end up back in the arrays' buffers.
+        assert(nb_passes % 2 == 0);
+
+        cl_kernel kh = kernel_histogram.Get_Kernel();
+        cl_kernel ks = kernel_scatter.Get_Kernel();
+        kernel_histogram.Compute_Work_Size(size_t(nb_items), 1, local_size, 1);
+        kernel_scatter.Compute_Work_Size(size_t(nb_items), 1, local_size, 1);
+
+        for (int pass = 0 ; pass < nb_passes ; pass++)
+        {
+            const cl_uint shift = cl_uint(pass) * radix_bits;
+
+            err  = clSetKernelArg(kh, 0, sizeof(cl_mem),    &keys_src);
+            err |= clSetKernelArg(kh, 1, sizeof(cl_ulong),  &n_ulong);
+            err |= clSetKernelArg(kh, 2, sizeof(cl_uint),   &shift);
+            err |= clSetKernelArg(kh, 3, sizeof(cl_mem),    &counts);
+            OpenCL_Test_Success(err, "clSetKernelArg()");
+            kernel_histogram.Launch(command_queue);
+
+            scan.Enqueue(counts, counts, radix * nb_items, false);
+
+            err  = clSetKernelArg(ks, 0, sizeof(cl_mem),    &keys_src);
+            err |= clSetKernelArg(ks, 1, sizeof(cl_mem),    &keys_dst);
+            err |= clSetKernelArg(ks, 2, sizeof(cl_mem),    &values_src);
+            err |= clSetKernelArg(ks, 3, sizeof(cl_mem),    &values_dst);
+            err |= clSetKernelArg(ks, 4, sizeof(cl_ulong),  &n_ulong);
+            err |= clSetKernelArg(ks, 5, sizeof(cl_uint),   &shift);
+            err |= clSetKernelArg(ks, 6, sizeof(cl_mem),    &counts);
+            OpenCL_Test_Success(err, "clSetKernelArg()");
+            kernel_scatter.Launch(command_queue);
+
+            std::swap(keys_src, keys_dst);
+            std::swap(values_src, values_dst);
+        }
+
+        keys.Mark_Device_Dirty();
+        if (values != NULL)
+            values->Mark_Device_Dirty();
+    }
+
+    // Enqueued commands keep their memory objects alive: unpinning is safe.
+    pins.Unpin_All();
+
+    // A marker completes when all previously enqueued commands are done.
+    cl_event event = NULL;
+    err = clEnqueueMarker(command_queue, &event);
+    OpenCL_Test_Success(err, "clEnqueueMarker()");
+
+    return event;
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Elementwise<T>::OpenCL_Elementwise()
+{
+    context                     = NULL;
+    command_queue               = NULL;
+    device                      = NULL;
+    err                         = 0;
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Elementwise<T>::~OpenCL_Elementwise()
+{
+    try
+    {
+        Release_Memory();
+    }
+    catch (const OpenCL_Exception &exception)
+    {
+        Report_Exception_in_Destructor(exception);
+    }
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Elementwise<T>::Initialize(cl_context &_context, cl_command_queue &_command_queue, cl_device_id &_device)
+{
+    context         = _context;
+    command_queue   = _command_queue;
+    device          = _device;
+}
+
+// *****************************************************************************
+template <class T>
+void OpenCL_Elementwise<T>::Release_Memory()
+{
+    for (std::map<int, OpenCL_Kernel *>::iterator it = kernels.begin() ; it != kernels.end() ; ++it)
+        delete it->second;
+    kernels.clear();
+    local_sizes.clear();
+}
+
+// *****************************************************************************
+template <class T>
+OpenCL_Kernel & OpenCL_Elementwise<T>::Kernel(const OpenCL_Elementwise_Operation operation, size_t &local_size)
+/**
+ * Work-group size: 64, within the kernel's limit on the device.
+ */
+{
+    std::map<int, OpenCL_Kernel *>::iterator it = kernels.find(operation);
+    if (it == kernels.end())
+    {
+        const char *operation_names[] = { "ADD", "SUB", "MUL", "DIV", "MIN", "MAX", "AXPY" };
+
+        std::ostringstream options;
+        options << "-DT=" << OpenCL_Reduction_Type<T>::Name() << " -DOP_" << operation_names[operation];
+        if (sizeof(T) == sizeof(double) && !std::numeric_limits<T>::is_integer)
+            options << " -DOCLUTILS_FP64";
 
-    const int index = -error;
+        OpenCL_Kernel *kernel = new OpenCL_Kernel;
+        kernel->Initialize(kernel_Elementwise_source, context, device);
+        kernel->Append_Compiler_Option(options.str());
+        kernel->Build("OclUtils_Elementwise");
 
-    return (index >= 0 && index < errorCount) ? errorString[index] : "Unspecified Error";
+        size_t kernel_max_size = 1;
+        err = clGetKernelWorkGroupInfo(kernel->Get_Kernel(), device, CL_KERNEL_WORK_GROUP_SIZE,
+                                       sizeof(kernel_max_size), &kernel_max_size, NULL);
+        OpenCL_Test_Success(err, "clGetKernelWorkGroupInfo()");
+
+        it = kernels.insert(std::make_pair(int(operation), kernel)).first;
+        local_sizes[operation] = std::max(size_t(1), std::min(size_t(64), kernel_max_size));
+    }
+
+    local_size = local_sizes[operation];
+    return *it->second;
 }
 
 // *****************************************************************************
 template <class T>
-OpenCL_Array<T>::OpenCL_Array()
+cl_event OpenCL_Elementwise<T>::Apply(const OpenCL_Elementwise_Operation operation, OpenCL_Array<T> &out,
+                                      OpenCL_Array<T> &a, OpenCL_Array<T> &b, const T &alpha,
+                                      const OpenCL_Backend backend)
 {
-    array_is_padded             = false;
-    N                           = 0;
-    sizeof_element              = 0;
-    new_array_size_bytes        = 0;
-    host_array                  = NULL;
-    nb_1024bits_blocks          = 0;
-    device_array                = NULL;
-    context                     = NULL;
-    command_queue               = NULL;
+    const uint64_t n = uint64_t(out.Get_N()) * out.Get_Sizeof_Element() / sizeof(T);
+    OpenCL_Assert(uint64_t(a.Get_N()) * a.Get_Sizeof_Element() / sizeof(T) == n);
+    OpenCL_Assert(uint64_t(b.Get_N()) * b.Get_Sizeof_Element() / sizeof(T) == n);
+
+    // Nothing to do (an empty NDRange is invalid).
+    if (n == 0)
+        return Completed_Event(context);
+
+    if (Use_Host_Backend(backend, out.Host_Is_Preferred(OPENCL_OPERATION_ELEMENTWISE) &&
+                                  a.Host_Is_Preferred(OPENCL_OPERATION_ELEMENTWISE) &&
+                                  b.Host_Is_Preferred(OPENCL_OPERATION_ELEMENTWISE)))
+    {
+        const T *host_a = a.Host_Read();
+        const T *host_b = b.Host_Read();
+        // "out" is entirely overwritten, unless it is also an input.
+        T *host_out = ((&out == &a || &out == &b) ? out.Host_Write() : out.Host_Overwrite());
+        OpenCL_Host_Backend::Elementwise(operation, host_out, host_a, host_b, alpha, n);
+        return Completed_Event(context);
+    }
+
+    size_t local_x;
+    OpenCL_Kernel &kernel = Kernel(operation, local_x);
+
+    // Pin the arrays so faulting in one does not evict another.
+    OpenCL_Pin_Guard pins;
+    pins.Pin(out);
+    pins.Pin(a);
+    pins.Pin(b);
+    out.Make_Resident();
+    a.Make_Resident();
+    b.Make_Resident();
+
+    cl_mem memory_out   = out.Resident_Device_Memory();
+    cl_mem memory_a     = a.Resident_Device_Memory();
+    cl_mem memory_b     = b.Resident_Device_Memory();
+    const cl_ulong n_ulong = n;
+
+    cl_kernel k = kernel.Get_Kernel();
+    err  = clSetKernelArg(k, 0, sizeof(cl_mem),     &memory_out);
+    err |= clSetKernelArg(k, 1, sizeof(cl_mem),     &memory_a);
+    err |= clSetKernelArg(k, 2, sizeof(cl_mem),     &memory_b);
+    err |= clSetKernelArg(k, 3, sizeof(T),          &alpha);
+    err |= clSetKernelArg(k, 4, sizeof(cl_ulong),   &n_ulong);
+    OpenCL_Test_Success(err, "clSetKernelArg()");
+
+    cl_event event = NULL;
+    kernel.Compute_Work_Size(size_t((n + local_x - 1) / local_x * local_x), 1, local_x, 1);
+    kernel.Launch(command_queue, &event);
+    out.Mark_Device_Dirty();
+
+    // Enqueued commands keep their memory objects alive: unpinning is safe.
+    pins.Unpin_All();
+
+    return event;
 }
 
 // *****************************************************************************
-template <class T>
-void OpenCL_Array<T>::Initialize(int _N, const size_t _sizeof_element,
-                                 T *&_host_array,
-                                 cl_context &_context, cl_mem_flags flags,
-                                 std::string _platform,
-                                 cl_command_queue &_command_queue,
-                                 cl_device_id &_device,
-                                 const bool _checksum_array)
+double Calibration_Time(const OpenCL_Backend_Operation operation, const OpenCL_Backend backend,
+                        OpenCL_Array<float> &a, OpenCL_Array<float> &b, OpenCL_Array<float> &c,
+                        OpenCL_Reducer<float> &reducer, OpenCL_Elementwise<float> &elementwise)
+/**
+ * Best of a few runs of "operation" (seconds), including the wait for completion.
+ * The host side works directly on the host arrays so no transfer is timed.
+ */
 {
-    assert(_host_array != NULL);
+    const uint64_t n = uint64_t(a.Get_N());
+    double best = std::numeric_limits<double>::max();
+    for (int run = 0 ; run < 3 ; run++)
+    {
+        timeval start, end;
+        gettimeofday(&start, NULL);
+        if (backend == OPENCL_BACKEND_HOST)
+        {
+            switch (operation)
+            {
+                case OPENCL_OPERATION_FILL:         OpenCL_Host_Backend::Fill(c.Get_Host_Pointer(), n, 1.0f);                       break;
+                case OPENCL_OPERATION_COPY:         OpenCL_Host_Backend::Copy(c.Get_Host_Pointer(), a.Get_Host_Pointer(), n);       break;
+                case OPENCL_OPERATION_REDUCE:       OpenCL_Host_Backend::Reduce(OPENCL_REDUCTION_SUM, a.Get_Host_Pointer(),
+                                                                                (const float *) NULL, n);                           break;
+                default:                            OpenCL_Host_Backend::Elementwise(OPENCL_ELEMENTWISE_ADD, c.Get_Host_Pointer(),
+                                                                                     a.Get_Host_Pointer(), b.Get_Host_Pointer(),
+                                                                                     0.0f, n);                                      break;
+            }
+        }
+        else
+        {
+            cl_event event = NULL;
+            switch (operation)
+            {
+                case OPENCL_OPERATION_FILL:         event = c.Fill(1.0f, 0, -1, OPENCL_BACKEND_DEVICE);                                 break;
+                case OPENCL_OPERATION_COPY:         event = c.Copy_From(a, 0, 0, -1, OPENCL_BACKEND_DEVICE);                            break;
+                case OPENCL_OPERATION_REDUCE:       reducer.Sum(a, OPENCL_BACKEND_DEVICE).Get();                                        break;
+                default:                            event = elementwise.Add(c, a, b, OPENCL_BACKEND_DEVICE);                            break;
+            }
+            if (event != NULL)
+            {
+                cl_int err = clWaitForEvents(1, &event);
+                OpenCL_Test_Success(err, "clWaitForEvents()");
+                clReleaseEvent(event);
+            }
+        }
+        gettimeofday(&end, NULL);
+        best = std::min(best, double(end.tv_sec - start.tv_sec) + 1.0e-6 * double(end.tv_usec - start.tv_usec));
+    }
+    return best;
+}
 
-    N               = _N;
-    sizeof_element  = _sizeof_element;
-    context         = _context;
-    command_queue   = _command_queue;
-    device          = _device;
-    host_array      = _host_array;
-    platform        = _platform;
-    new_array_size_bytes = N * sizeof_element;
+// *****************************************************************************
+void OpenCL_Host_Backend::Calibrate(cl_context &context, cl_command_queue &command_queue, cl_device_id &device)
+/**
+ * Time every operation on both sides for float arrays from 4 KiB to 64 MiB
+ * (or the maximum allocation size). The threshold is the first size where
+ * the device (enqueue and wait included) beats the host, or four times the
+ * largest size tried if it never does.
+ */
+{
+    const cl_ulong max_alloc    = Get_Device_Info<cl_ulong>(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, "clGetDeviceInfo (CL_DEVICE_MAX_MEM_ALLOC_SIZE)");
+    const uint64_t max_bytes    = std::min(uint64_t(64) * 1024 * 1024, uint64_t(max_alloc));
 
-    memset(host_checksum,   0, 64);
-    memset(device_checksum, 0, 64);
+    OpenCL_Reducer<float> reducer;
+    OpenCL_Elementwise<float> elementwise;
+    reducer.Initialize(context, command_queue, device);
+    elementwise.Initialize(context, command_queue, device);
 
-#ifdef OpenCLSHA512Checksum
-    if (_checksum_array)
+    std::vector<bool> found(OPENCL_NB_OPERATIONS, false);
+    uint64_t bytes = 4096;
+    for ( ; bytes <= max_bytes ; bytes *= 4)
     {
-        array_is_padded = true;
+        const int n = int(bytes / sizeof(float));
+        std::vector<float> host_a(n, 1.0f), host_b(n, 2.0f), host_c(n, 0.0f);
+        float *pa = &host_a[0], *pb = &host_b[0], *pc = &host_c[0];
+        OpenCL_Array<float> a, b, c;
+        a.Initialize(n, sizeof(float), pa, context, CL_MEM_READ_WRITE, "", command_queue, device, false);
+        b.Initialize(n, sizeof(float), pb, context, CL_MEM_READ_WRITE, "", command_queue, device, false);
+        c.Initialize(n, sizeof(float), pc, context, CL_MEM_READ_WRITE, "", command_queue, device, false);
+        a.Host_to_Device();
+        b.Host_to_Device();
+        cl_int err = clFinish(command_queue);
+        OpenCL_Test_Success(err, "clFinish()");
+
+        for (int operation = 0 ; operation < OPENCL_NB_OPERATIONS ; operation++)
+        {
+            if (found[operation])
+                continue;
+            const OpenCL_Backend_Operation op = OpenCL_Backend_Operation(operation);
+            // The first device run also builds the kernel: warm up.
+            Calibration_Time(op, OPENCL_BACKEND_DEVICE, a, b, c, reducer, elementwise);
+            const double host_time      = Calibration_Time(op, OPENCL_BACKEND_HOST,   a, b, c, reducer, elementwise);
+            const double device_time    = Calibration_Time(op, OPENCL_BACKEND_DEVICE, a, b, c, reducer, elementwise);
+            if (device_time < host_time)
+            {
+                Set_Threshold(device, op, bytes);
+                found[operation] = true;
+            }
+        }
 
-        void * array = (void *) _host_array;
-        uint64_t new_array_size_bits = new_array_size_bytes*CHAR_BIT;
-        OpenCL_SHA512::Prepare_Array_for_Checksuming(&array, sizeof_element, new_array_size_bits);
-        new_array_size_bytes = new_array_size_bits / CHAR_BIT;
-        _host_array = (T *)array;
-        host_array  = (T *)array;
+        a.Release_Memory();
+        b.Release_Memory();
+        c.Release_Memory();
+    }
 
-        std::string kernel_source = reinterpret_cast<const char*>(kernel_SHA512_Checksum);
-        kernel_checksum.Initialize(kernel_source, context, device);
+    for (int operation = 0 ; operation < OPENCL_NB_OPERATIONS ; operation++)
+    {
+        if (!found[operation])
+            Set_Threshold(device, OpenCL_Backend_Operation(operation), bytes);
+    }
+}
 
+// *****************************************************************************
+class OpenCL_File_Reader
+/**
+ * Asynchronous positional reads. Each read carries a "tag" (the index of the
+ * staging buffer it fills) returned on completion. A read can complete with
+ * fewer bytes than requested: the caller submits the remainder.
+ */
+{
+public:
+    virtual ~OpenCL_File_Reader() {}
+    virtual void        Submit(const int fd, void *buffer, const size_t size, const uint64_t offset, const int tag) = 0;
+    virtual int         Wait_Completion(int64_t &result) = 0;    // Returns the tag, result is bytes read or -errno
+    virtual const char *Name() const = 0;
+};
+
+#ifdef OCLUTILS_HAVE_IO_URING
+// *****************************************************************************
+class OpenCL_File_Reader_io_uring : public OpenCL_File_Reader
+/**
+ * Reads submitted through an io_uring (Linux >= 5.1), using the raw system
+ * calls so liburing is not required.
+ */
+{
+private:
+    int                         ring_fd;
+    void                       *sq_ring;
+    size_t                      sq_ring_size;
+    void                       *cq_ring;
+    size_t                      cq_ring_size;
+    struct io_uring_sqe        *sqes;
+    size_t                      sqes_size;
+    unsigned                   *sq_tail;
+    unsigned                   *sq_mask;
+    unsigned                   *sq_array;
+    unsigned                   *cq_head;
+    unsigned                   *cq_tail;
+    unsigned                   *cq_mask;
+    struct io_uring_cqe        *cqes;
+    std::vector<struct iovec>   iovecs;         // One per tag, must outlive the read
+
+public:
+    OpenCL_File_Reader_io_uring()
+    {
+        ring_fd = -1;
+        sq_ring = cq_ring = NULL;
+        sqes = NULL;
+        sq_ring_size = cq_ring_size = sqes_size = 0;
+    }
 
-        kernel_checksum.Append_Compiler_Option("-DYDEBUG");
-        // Include debugging symbols in kernel compilation
-#ifndef MACOSX
-        if (platform != OPENCL_PLATFORMS_NVIDIA)
+    // *************************************************************************
+    bool Setup(const int nb_tags)
+    /**
+     * Returns false if io_uring is not usable (old kernel, seccomp, ...).
+     */
+    {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ring_fd = int(syscall(__NR_io_uring_setup, unsigned(nb_tags), &params));
+        if (ring_fd < 0)
+            return false;
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
+        const bool single_mmap = ((params.features & IORING_FEAT_SINGLE_MMAP) != 0);
+        if (single_mmap)
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+        sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED)
+        {
+            sq_ring = NULL;
+            return false;
+        }
+        if (single_mmap)
+            cq_ring = sq_ring;
+        else
+        {
+            cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+            if (cq_ring == MAP_FAILED)
+            {
+                cq_ring = NULL;
+                return false;
+            }
+        }
+        sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = (struct io_uring_sqe *) mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
         {
-            kernel_checksum.Append_Compiler_Option("-g");
+            sqes = NULL;
+            return false;
         }
-#endif // #ifndef MACOSX
 
-        if      (platform == OPENCL_PLATFORMS_AMD)
+        sq_tail  = (unsigned *) ((char *) sq_ring + params.sq_off.tail);
+        sq_mask  = (unsigned *) ((char *) sq_ring + params.sq_off.ring_mask);
+        sq_array = (unsigned *) ((char *) sq_ring + params.sq_off.array);
+        cq_head  = (unsigned *) ((char *) cq_ring + params.cq_off.head);
+        cq_tail  = (unsigned *) ((char *) cq_ring + params.cq_off.tail);
+        cq_mask  = (unsigned *) ((char *) cq_ring + params.cq_off.ring_mask);
+        cqes     = (struct io_uring_cqe *) ((char *) cq_ring + params.cq_off.cqes);
+
+        iovecs.resize(nb_tags);
+        return true;
+    }
+
+    // *************************************************************************
+    ~OpenCL_File_Reader_io_uring()
+    {
+        if (sqes != NULL)
+            munmap(sqes, sqes_size);
+        if (cq_ring != NULL && cq_ring != sq_ring)
+            munmap(cq_ring, cq_ring_size);
+        if (sq_ring != NULL)
+            munmap(sq_ring, sq_ring_size);
+        if (ring_fd >= 0)
+            close(ring_fd);
+    }
+
+    // *************************************************************************
+    void Submit(const int fd, void *buffer, const size_t size, const uint64_t offset, const int tag)
+    {
+        // At most one read per tag is in flight and the ring has one entry
+        // per tag, so the submission queue is never full.
+        iovecs[tag].iov_base = buffer;
+        iovecs[tag].iov_len  = size;
+
+        const unsigned tail  = *sq_tail;
+        const unsigned index = tail & *sq_mask;
+        struct io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode     = IORING_OP_READV;
+        sqe->fd         = fd;
+        sqe->addr       = uint64_t(uintptr_t(&iovecs[tag]));
+        sqe->len        = 1;
+        sqe->off        = offset;
+        sqe->user_data  = uint64_t(tag);
+        sq_array[index] = index;
+
+        // The entry must be visible before the kernel sees the new tail.
+        __sync_synchronize();
+        *sq_tail = tail + 1;
+        __sync_synchronize();
+
+        int ret;
+        do
+        {
+            ret = int(syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, NULL, 0));
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0)
         {
-            kernel_checksum.Append_Compiler_Option("-DOPENCL_AMD");
+            OpenCL_Throw(CL_OUT_OF_RESOURCES, "io_uring_enter", strerror(errno));
         }
-        else if (platform == OPENCL_PLATFORMS_INTEL)
+    }
+
+    // *************************************************************************
+    int Wait_Completion(int64_t &result)
+    {
+        while (true)
         {
-            kernel_checksum.Append_Compiler_Option("-DOPENCL_INTEL");
+            const unsigned head = *cq_head;
+            __sync_synchronize();
+            if (head != *cq_tail)
+            {
+                const struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+                const int tag   = int(cqe->user_data);
+                result          = cqe->res;
+                __sync_synchronize();
+                *cq_head = head + 1;
+                return tag;
+            }
+
+            const int ret = int(syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0));
+            if (ret < 0 && errno != EINTR)
+            {
+                OpenCL_Throw(CL_OUT_OF_RESOURCES, "io_uring_enter", strerror(errno));
+            }
         }
-        else if (platform == OPENCL_PLATFORMS_NVIDIA)
+    }
+
+    const char *Name() const { return "io_uring"; }
+};
+#endif // #ifdef OCLUTILS_HAVE_IO_URING
+
+// *****************************************************************************
+class OpenCL_File_Reader_Threads : public OpenCL_File_Reader
+/**
+ * Reads done with pread() by a pool of threads, one per tag.
+ */
+{
+private:
+    struct Request
+    {
+        int         fd;
+        void       *buffer;
+        size_t      size;
+        uint64_t    offset;
+        int         tag;
+    };
+
+    std::vector<pthread_t>                  threads;
+    pthread_mutex_t                         mutex;
+    pthread_cond_t                          request_available;
+    pthread_cond_t                          completion_available;
+    std::list<Request>                      requests;
+    std::list<std::pair<int, int64_t> >     completions;
+    bool                                    quit;
+
+    // *************************************************************************
+    static void *Worker(void *arg)
+    {
+        OpenCL_File_Reader_Threads *self = (OpenCL_File_Reader_Threads *) arg;
+
+        pthread_mutex_lock(&self->mutex);
+        while (true)
         {
-            kernel_checksum.Append_Compiler_Option("-DOPENCL_NVIDIA");
-            // Verbose compilation? Does not do much... And it may break kernel compilation
-            // with invalid kernel name error.
-            kernel_checksum.Append_Compiler_Option("-cl-nv-verbose");
+            while (self->requests.empty() && !self->quit)
+                pthread_cond_wait(&self->request_available, &self->mutex);
+            if (self->quit)
+                break;
+
+            const Request request = self->requests.front();
+            self->requests.pop_front();
+            pthread_mutex_unlock(&self->mutex);
+
+            ssize_t ret;
+            do
+            {
+                ret = pread(request.fd, request.buffer, request.size, off_t(request.offset));
+            } while (ret < 0 && errno == EINTR);
+            const int64_t result = (ret < 0 ? -int64_t(errno) : int64_t(ret));
+
+            pthread_mutex_lock(&self->mutex);
+            self->completions.push_back(std::make_pair(request.tag, result));
+            pthread_cond_signal(&self->completion_available);
         }
-        else if (platform == OPENCL_PLATFORMS_APPLE)
+        pthread_mutex_unlock(&self->mutex);
+
+        return NULL;
+    }
+
+public:
+    // *************************************************************************
+    OpenCL_File_Reader_Threads(const int nb_threads)
+    {
+        quit = false;
+        pthread_mutex_init(&mutex, NULL);
+        pthread_cond_init(&request_available, NULL);
+        pthread_cond_init(&completion_available, NULL);
+
+        // Any number of threads (at least one) serves the requests.
+        threads.reserve(nb_threads);
+        for (int i = 0 ; i < nb_threads ; i++)
         {
-            kernel_checksum.Append_Compiler_Option("-DOPENCL_APPLE");
+            pthread_t thread;
+            const int ret = pthread_create(&thread, NULL, Worker, this);
+            if (ret != 0)
+            {
+                if (i == 0)
+                {
+                    pthread_cond_destroy(&completion_available);
+                    pthread_cond_destroy(&request_available);
+                    pthread_mutex_destroy(&mutex);
+                    OpenCL_Throw(CL_OUT_OF_HOST_MEMORY, "pthread_create", strerror(ret));
+                }
+                break;
+            }
+            threads.push_back(thread);
         }
+    }
+
+    // *************************************************************************
+    ~OpenCL_File_Reader_Threads()
+    {
+        pthread_mutex_lock(&mutex);
+        quit = true;
+        pthread_cond_broadcast(&request_available);
+        pthread_mutex_unlock(&mutex);
 
-        kernel_checksum.Build("SHA512_Checksum");
-        kernel_checksum.Compute_Work_Size(1, 1, 1, 1);
+        for (size_t i = 0 ; i < threads.size() ; i++)
+            pthread_join(threads[i], NULL);
 
-        // Allocate memory on device
-        device_array      = clCreateBuffer(context, flags,           new_array_size_bytes, NULL, &err); OpenCL_Test_Success(err, "clCreateBuffer()");
-        //cl_array_size_bit = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(int),         NULL, &err); OpenCL_Test_Success(err, "clCreateBuffer()");
-        cl_sha512sum      = clCreateBuffer(context, CL_MEM_READ_WRITE, buff_size_checksum, NULL, &err); OpenCL_Test_Success(err, "clCreateBuffer()");
+        pthread_cond_destroy(&completion_available);
+        pthread_cond_destroy(&request_available);
+        pthread_mutex_destroy(&mutex);
+    }
 
-        // Set kernel arguments
-        err  = clSetKernelArg(kernel_checksum.Get_Kernel(), 0, sizeof(cl_mem), (void *) &device_array);
-        //err |= clSetKernelArg(kernel_checksum.Get_Kernel(), 1, sizeof(cl_mem), (void *) &cl_array_size_bit);
-        err |= clSetKernelArg(kernel_checksum.Get_Kernel(), 1, sizeof(int),    (void *) &new_array_size_bits);
-        err |= clSetKernelArg(kernel_checksum.Get_Kernel(), 2, sizeof(cl_mem), (void *) &cl_sha512sum);
-        OpenCL_Test_Success(err, "clSetKernelArg()");
+    // *************************************************************************
+    void Submit(const int fd, void *buffer, const size_t size, const uint64_t offset, const int tag)
+    {
+        Request request;
+        request.fd      = fd;
+        request.buffer  = buffer;
+        request.size    = size;
+        request.offset  = offset;
+        request.tag     = tag;
+
+        pthread_mutex_lock(&mutex);
+        requests.push_back(request);
+        pthread_cond_signal(&request_available);
+        pthread_mutex_unlock(&mutex);
+    }
 
+    // *************************************************************************
+    int Wait_Completion(int64_t &result)
+    {
+        pthread_mutex_lock(&mutex);
+        while (completions.empty())
+            pthread_cond_wait(&completion_available, &mutex);
+        const std::pair<int, int64_t> completion = completions.front();
+        completions.pop_front();
+        pthread_mutex_unlock(&mutex);
+
+        result = completion.second;
+        return completion.first;
     }
-    else
-#endif // #ifdef OpenCLSHA512Checksum
+
+    const char *Name() const { return "pread threads"; }
+};
+
+// *****************************************************************************
+OpenCL_File_Loader::OpenCL_File_Loader()
+{
+    context                     = NULL;
+    command_queue               = NULL;
+    nb_buffers                  = 0;
+    buffer_size                 = 0;
+    err                         = 0;
+    reader                      = NULL;
+}
+
+// *****************************************************************************
+OpenCL_File_Loader::~OpenCL_File_Loader()
+{
+    try
     {
-        // Allocate memory on the device
-        device_array = clCreateBuffer(context, flags, new_array_size_bytes, NULL, &err);
+        Release_Memory();
+    }
+    catch (const OpenCL_Exception &exception)
+    {
+        Report_Exception_in_Destructor(exception);
+    }
+}
+
+// *****************************************************************************
+void OpenCL_File_Loader::Initialize(cl_context &_context, cl_command_queue &_command_queue,
+                                    const size_t _buffer_size, const int _nb_buffers,
+                                    const bool use_io_uring)
+/**
+ * Allocate and map the staging buffers and start the reader.
+ * @param _buffer_size: Size (bytes) of each staging buffer: the granularity
+ *                      of both the reads and the uploads.
+ * @param _nb_buffers:  Number of staging buffers, and so the maximum number
+ *                      of reads in flight.
+ * @param use_io_uring: Try io_uring first. The pread() thread pool is used
+ *                      if false or if io_uring is not available.
+ */
+{
+    OpenCL_Assert(reader == NULL);
+    OpenCL_Assert(_buffer_size > 0);
+    OpenCL_Assert(_nb_buffers > 0);
+
+    context         = _context;
+    command_queue   = _command_queue;
+    buffer_size     = _buffer_size;
+    nb_buffers      = _nb_buffers;
+
+    staging_buffers.resize(nb_buffers, NULL);
+    staging_pointers.resize(nb_buffers, NULL);
+    upload_events.resize(nb_buffers, NULL);
+    for (int b = 0 ; b < nb_buffers ; b++)
+    {
+        // CL_MEM_ALLOC_HOST_PTR gives page locked memory on most platforms:
+        // transfers from it are done by DMA without an intermediate copy.
+        staging_buffers[b] = OpenCL_Memory::Create_Buffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                                                          buffer_size, NULL, &err);
         OpenCL_Test_Success(err, "clCreateBuffer()");
+        staging_pointers[b] = (char *) clEnqueueMapBuffer(command_queue, staging_buffers[b], CL_TRUE, CL_MAP_WRITE,
+                                                          0, buffer_size, 0, NULL, NULL, &err);
+        OpenCL_Test_Success(err, "clEnqueueMapBuffer()");
     }
 
-    // Transfer data from host to device (cpu to gpu)
-    Host_to_Device();
+#ifdef OCLUTILS_HAVE_IO_URING
+    if (use_io_uring)
+    {
+        OpenCL_File_Reader_io_uring *ring = new OpenCL_File_Reader_io_uring;
+        if (ring->Setup(nb_buffers))
+            reader = ring;
+        else
+            delete ring;
+    }
+#endif // #ifdef OCLUTILS_HAVE_IO_URING
+    if (reader == NULL)
+        reader = new OpenCL_File_Reader_Threads(nb_buffers);
+}
 
-    if (_checksum_array)
-        Validate_Data();
+// *****************************************************************************
+void OpenCL_File_Loader::Release_Memory()
+{
+    delete reader;
+    reader = NULL;
 
-    err = clFinish(command_queue);
-    OpenCL_Test_Success(err, "clFinish");
+    for (size_t b = 0 ; b < staging_buffers.size() ; b++)
+    {
+        if (upload_events[b] != NULL)
+        {
+            clWaitForEvents(1, &upload_events[b]);
+            clReleaseEvent(upload_events[b]);
+        }
+        if (staging_pointers[b] != NULL)
+            clEnqueueUnmapMemObject(command_queue, staging_buffers[b], staging_pointers[b], 0, NULL, NULL);
+        if (staging_buffers[b] != NULL)
+            OpenCL_Memory::Release(staging_buffers[b]);
+    }
+    if (command_queue != NULL)
+        clFinish(command_queue);
+
+    staging_buffers.clear();
+    staging_pointers.clear();
+    upload_events.clear();
 }
 
 // *****************************************************************************
-template <class T>
-void OpenCL_Array<T>::Set_as_Kernel_Argument(cl_kernel &kernel, const int order)
+cl_event OpenCL_File_Loader::Load(const std::string &filename, const uint64_t file_offset, const uint64_t size,
+                                  cl_mem destination, const uint64_t destination_offset)
+/**
+ * Copy "size" bytes of the file, starting at "file_offset", to the device
+ * buffer "destination" at "destination_offset". The file is read in chunks
+ * of the staging buffer size; a chunk is uploaded (non-blocking) as soon as
+ * it is read and its staging buffer is reused once that upload completes.
+ * Returns when everything is read and all uploads are enqueued.
+ */
 {
-    err = clSetKernelArg(kernel, order, sizeof(cl_mem), &device_array);
-    OpenCL_Test_Success(err, "clSetKernelArg()");
+    OpenCL_Assert(reader != NULL);
+
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        OpenCL_Throw(CL_INVALID_VALUE, "open", "Unable to open " + filename + " (" + strerror(errno) + ")");
+    posix_fadvise(fd, off_t(file_offset), off_t(size), POSIX_FADV_SEQUENTIAL);
+
+    const uint64_t nb_chunks = (size + buffer_size - 1) / buffer_size;
+    std::vector<uint64_t> chunk_of_buffer(nb_buffers, 0);   // Chunk being read in each buffer
+    std::vector<uint64_t> bytes_read(nb_buffers, 0);        // Progress of that read
+    std::vector<bool>     reading(nb_buffers, false);
+
+    uint64_t next_chunk  = 0;
+    uint64_t nb_uploaded = 0;
+    try
+    {
+        while (nb_uploaded < nb_chunks)
+        {
+            // Start reading the next chunks into the staging buffers that are free.
+            while (next_chunk < nb_chunks && !reading[next_chunk % nb_buffers])
+            {
+                const int b = int(next_chunk % nb_buffers);
+                if (upload_events[b] != NULL)
+                {
+                    // The previous upload from this buffer must be done before overwriting it.
+                    err  = clWaitForEvents(1, &upload_events[b]);
+                    err |= clReleaseEvent(upload_events[b]);
+                    OpenCL_Test_Success(err, "clWaitForEvents()");
+                    upload_events[b] = NULL;
+                }
+
+                const uint64_t chunk_offset = next_chunk * buffer_size;
+                const size_t   chunk_size   = size_t(std::min(uint64_t(buffer_size), size - chunk_offset));
+                chunk_of_buffer[b]  = next_chunk;
+                bytes_read[b]       = 0;
+                reader->Submit(fd, staging_pointers[b], chunk_size, file_offset + chunk_offset, b);
+                reading[b]          = true;
+                next_chunk++;
+            }
+
+            int64_t result = 0;
+            const int b = reader->Wait_Completion(result);
+            assert(b >= 0 && b < nb_buffers && reading[b]);
+            reading[b] = false;
+
+            const uint64_t chunk_offset = chunk_of_buffer[b] * buffer_size;
+            const size_t   chunk_size   = size_t(std::min(uint64_t(buffer_size), size - chunk_offset));
+            if (result <= 0)
+            {
+                std::ostringstream message;
+                if (result == 0)
+                    message << "Unexpected end of file " << filename << " at " << (file_offset + chunk_offset + bytes_read[b]);
+                else
+                    message << "Unable to read " << filename << " (" << strerror(int(-result)) << ")";
+                OpenCL_Throw(CL_OUT_OF_RESOURCES, "OpenCL_File_Loader::Load", message.str());
+            }
+
+            bytes_read[b] += uint64_t(result);
+            if (bytes_read[b] < chunk_size)
+            {
+                // Short read: read the rest of the chunk.
+                reader->Submit(fd, staging_pointers[b] + bytes_read[b], size_t(chunk_size - bytes_read[b]),
+                               file_offset + chunk_offset + bytes_read[b], b);
+                reading[b] = true;
+                continue;
+            }
+
+            err = clEnqueueWriteBuffer(command_queue, destination, CL_FALSE,
+                                       size_t(destination_offset + chunk_offset), chunk_size,
+                                       staging_pointers[b], 0, NULL, &upload_events[b]);
+            OpenCL_Test_Success(err, "clEnqueueWriteBuffer()");
+            // Start the upload now rather than when the queue is next flushed.
+            err = clFlush(command_queue);
+            OpenCL_Test_Success(err, "clFlush()");
+
+            nb_uploaded++;
+        }
+    }
+    catch (...)
+    {
+        // Let the reads in flight complete before closing the file, so none
+        // lands in a reused descriptor or staging buffer and the loader can
+        // be used again.
+        try
+        {
+            while (std::find(reading.begin(), reading.end(), true) != reading.end())
+            {
+                int64_t ignored;
+                reading[reader->Wait_Completion(ignored)] = false;
+            }
+        }
+        catch (...)
+        {
+        }
+        close(fd);
+        throw;
+    }
+
+    close(fd);
+
+    // A marker completes when all previously enqueued commands are done.
+    cl_event event = NULL;
+    err = clEnqueueMarker(command_queue, &event);
+    OpenCL_Test_Success(err, "clEnqueueMarker()");
+
+    return event;
 }
 
 // *****************************************************************************
 template <class T>
-void OpenCL_Array<T>::Release_Memory()
+cl_event OpenCL_File_Loader::Load(const std::string &filename, const uint64_t file_offset,
+                                  OpenCL_Array<T> &array, const int offset, const int count)
+/**
+ * Load elements [offset, offset+count) of "array" from the file (the first
+ * one being at "file_offset"). A negative "count" loads up to the end of the
+ * array. Only the device array is written: the host array is NOT modified
+ * (call array.Device_to_Host() if needed).
+ */
 {
-    if (device_array)
-        clReleaseMemObject(device_array);
+    const int N = array.Get_N();
+    const int nb_elements = (count < 0 ? N - offset : count);
+    OpenCL_Assert(offset >= 0 && nb_elements >= 0 && offset + nb_elements <= N);
+
+    const uint64_t sizeof_element = array.Get_Sizeof_Element();
+
+    array.Make_Resident();
+    array.Mark_Device_Written();
+
+    return Load(filename, file_offset, uint64_t(nb_elements) * sizeof_element,
+                *array.Get_Device_Array(), uint64_t(offset) * sizeof_element);
+}
+
+// *****************************************************************************
+const char *OpenCL_File_Loader::Backend() const
+{
+    return (reader == NULL ? "none" : reader->Name());
+}
+
+// *****************************************************************************
+OpenCL_Peer_Copier::OpenCL_Peer_Copier()
+{
+    source_queue                = NULL;
+    destination_queue           = NULL;
+    source_context              = NULL;
+    direct                      = false;
+    nb_buffers                  = 0;
+    buffer_size                 = 0;
+    err                         = 0;
+}
+
+// *****************************************************************************
+OpenCL_Peer_Copier::~OpenCL_Peer_Copier()
+{
+    try
+    {
+        Release_Memory();
+    }
+    catch (const OpenCL_Exception &exception)
+    {
+        Report_Exception_in_Destructor(exception);
+    }
+}
+
+// *****************************************************************************
+void OpenCL_Peer_Copier::Initialize(cl_command_queue &_source_queue, cl_command_queue &_destination_queue,
+                                    const size_t _buffer_size, const int _nb_buffers)
+/**
+ * Find out if both queues share a context and, if not, allocate and map the
+ * staging buffers in the source context.
+ * @param _buffer_size: Size (bytes) of each staging buffer: the granularity
+ *                      of the downloads and uploads.
+ * @param _nb_buffers:  Number of staging buffers (at least 2 for the
+ *                      downloads and uploads to overlap).
+ */
+{
+    OpenCL_Assert(source_queue == NULL);
+    OpenCL_Assert(_buffer_size > 0);
+    OpenCL_Assert(_nb_buffers >= 2);
+
+    source_queue        = _source_queue;
+    destination_queue   = _destination_queue;
+    buffer_size         = _buffer_size;
+    nb_buffers          = _nb_buffers;
+
+    cl_context destination_context = NULL;
+    err  = clGetCommandQueueInfo(source_queue, CL_QUEUE_CONTEXT, sizeof(cl_context), &source_context, NULL);
+    err |= clGetCommandQueueInfo(destination_queue, CL_QUEUE_CONTEXT, sizeof(cl_context), &destination_context, NULL);
+    OpenCL_Test_Success(err, "clGetCommandQueueInfo()");
+
+    direct = (source_context == destination_context);
+    if (direct)
+        return;
+
+    staging_buffers.resize(nb_buffers, NULL);
+    staging_pointers.resize(nb_buffers, NULL);
+    download_events.resize(nb_buffers, NULL);
+    upload_events.resize(nb_buffers, NULL);
+    for (int b = 0 ; b < nb_buffers ; b++)
+    {
+        // Page locked memory of the source device's platform: the downloads
+        // are done by DMA. The uploads read it as plain host memory.
+        staging_buffers[b] = OpenCL_Memory::Create_Buffer(source_context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                                          buffer_size, NULL, &err);
+        OpenCL_Test_Success(err, "clCreateBuffer()");
+        staging_pointers[b] = (char *) clEnqueueMapBuffer(source_queue, staging_buffers[b], CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                                                          0, buffer_size, 0, NULL, NULL, &err);
+        OpenCL_Test_Success(err, "clEnqueueMapBuffer()");
+    }
 }
 
 // *****************************************************************************
-template <class T>
-std::string OpenCL_Array<T>::Host_Checksum()
+void OpenCL_Peer_Copier::Release_Memory()
 {
-    return OpenCL_SHA512::Checksum_to_String(host_checksum);
+    for (size_t b = 0 ; b < staging_buffers.size() ; b++)
+    {
+        if (download_events[b] != NULL)
+            Wait_and_Release(download_events[b]);
+        if (upload_events[b] != NULL)
+            Wait_and_Release(upload_events[b]);
+        if (staging_pointers[b] != NULL)
+            clEnqueueUnmapMemObject(source_queue, staging_buffers[b], staging_pointers[b], 0, NULL, NULL);
+        if (staging_buffers[b] != NULL)
+            OpenCL_Memory::Release(staging_buffers[b]);
+    }
+    if (!staging_buffers.empty())
+        clFinish(source_queue);
+
+    staging_buffers.clear();
+    staging_pointers.clear();
+    download_events.clear();
+    upload_events.clear();
+
+    source_queue        = NULL;
+    destination_queue   = NULL;
+    source_context      = NULL;
+    direct              = false;
 }
 
 // *****************************************************************************
-template <class T>
-std::string OpenCL_Array<T>::Device_Checksum()
+void OpenCL_Peer_Copier::Wait_and_Release(cl_event &event)
 {
-    return OpenCL_SHA512::Checksum_to_String(device_checksum);
+    err  = clWaitForEvents(1, &event);
+    err |= clReleaseEvent(event);
+    OpenCL_Test_Success(err, "clWaitForEvents()");
+    event = NULL;
 }
 
 // *****************************************************************************
-template <class T>
-void OpenCL_Array<T>::Validate_Data()
+cl_event OpenCL_Peer_Copier::Copy(cl_mem source, const uint64_t source_offset,
+                                  cl_mem destination, const uint64_t destination_offset, const uint64_t size)
+/**
+ * Copy "size" bytes of "source" (on the source queue's device), starting at
+ * "source_offset", to "destination" at "destination_offset". The copy starts
+ * after the commands already enqueued on both queues.
+ * Through the staging ring, chunk i is uploaded as soon as its download is
+ * done, and its buffer is refilled (download of chunk i+nb_buffers) once
+ * chunk i+1's upload is enqueued: both devices always have work queued.
+ * Returns when all uploads are enqueued.
+ */
 {
-#ifdef OpenCLSHA512Checksum
-    /*
-    std_cout << "Array in binary:\n" << OpenCL_SHA512::String_Binary(host_array, new_array_size_bytes*CHAR_BIT) << "\n";
-    std_cout << "Array in hexa:\n"   << OpenCL_SHA512::String_Hexadecimal(host_array, new_array_size_bytes*CHAR_BIT) << "\n";
-    */
+    OpenCL_Assert(source_queue != NULL);
 
-    // Wait for queue to finish
-    err = clFinish(command_queue);
-    OpenCL_Test_Success(err, "clFinish()");
+    cl_event event = NULL;
 
-    // Calculate checksum of host memory
-    OpenCL_SHA512::Calculate_Checksum(host_array, new_array_size_bytes*CHAR_BIT, host_checksum);
+    // Nothing to do (OpenCL rejects empty copies): an event of the
+    // destination's context, like the others.
+    if (size == 0)
+    {
+        cl_context destination_context = NULL;
+        err = clGetCommandQueueInfo(destination_queue, CL_QUEUE_CONTEXT, sizeof(cl_context), &destination_context, NULL);
+        OpenCL_Test_Success(err, "clGetCommandQueueInfo()");
+        return Completed_Event(destination_context);
+    }
 
-    // Calculate checksum of device memory
-    kernel_checksum.Launch(command_queue);
-    // Wait for kernel to finish
-    err = clFinish(command_queue);
-    OpenCL_Test_Success(err, "clFinish()");
+    if (direct)
+    {
+        // Same context: events are shared, the copy waits for the source queue.
+        cl_event source_ready = NULL;
+        err = clEnqueueMarker(source_queue, &source_ready);
+        OpenCL_Test_Success(err, "clEnqueueMarker()");
+        err = clEnqueueCopyBuffer(destination_queue, source, destination,
+                                  size_t(source_offset), size_t(destination_offset), size_t(size),
+                                  1, &source_ready, &event);
+        OpenCL_Test_Success(err, "clEnqueueCopyBuffer()");
+        err = clReleaseEvent(source_ready);
+        OpenCL_Test_Success(err, "clReleaseEvent()");
+        return event;
+    }
 
-    // Transfer back checksum
-    err = clEnqueueReadBuffer(command_queue, cl_sha512sum, CL_FALSE, 0, buff_size_checksum, device_checksum, 0, NULL, NULL);
-    OpenCL_Test_Success(err, "clEnqueueReadBuffer");
-    err = clFinish(command_queue);
-    OpenCL_Test_Success(err, "clFinish()");
+    const uint64_t nb_chunks = (size + buffer_size - 1) / buffer_size;
 
-    /*
-    std_cout << "Host_Checksum()   = " << Host_Checksum() << "\n";
-    std_cout << "Device_Checksum() = " << Device_Checksum() << "\n";
-    */
+    // Events cannot cross contexts: the host waits on each download before
+    // enqueuing the matching upload.
+    for (uint64_t chunk = 0 ; chunk < std::min(nb_chunks, uint64_t(nb_buffers)) ; chunk++)
+    {
+        const int b = int(chunk % nb_buffers);
+        if (upload_events[b] != NULL)
+            Wait_and_Release(upload_events[b]); // From a previous Copy()
+        const uint64_t chunk_offset = chunk * buffer_size;
+        err = clEnqueueReadBuffer(source_queue, source, CL_FALSE, size_t(source_offset + chunk_offset),
+                                  size_t(std::min(uint64_t(buffer_size), size - chunk_offset)),
+                                  staging_pointers[b], 0, NULL, &download_events[b]);
+        OpenCL_Test_Success(err, "clEnqueueReadBuffer()");
+    }
+    err = clFlush(source_queue);
+    OpenCL_Test_Success(err, "clFlush()");
 
-    if (Host_Checksum() != Device_Checksum())
+    for (uint64_t chunk = 0 ; chunk < nb_chunks ; chunk++)
     {
-        std_cout << "ERROR: Checksums don't match!\n";
-        std_cout << "Host_Checksum()   = " << Host_Checksum() << "\n";
-        std_cout << "Device_Checksum() = " << Device_Checksum() << "\n";
-        std_cout << "Array in hexa:\n"   << OpenCL_SHA512::String_Hexadecimal(host_array, new_array_size_bytes*CHAR_BIT) << "\n";
+        const int b = int(chunk % nb_buffers);
+        const uint64_t chunk_offset = chunk * buffer_size;
+        Wait_and_Release(download_events[b]);
+        err = clEnqueueWriteBuffer(destination_queue, destination, CL_FALSE, size_t(destination_offset + chunk_offset),
+                                   size_t(std::min(uint64_t(buffer_size), size - chunk_offset)),
+                                   staging_pointers[b], 0, NULL, &upload_events[b]);
+        OpenCL_Test_Success(err, "clEnqueueWriteBuffer()");
+        err = clFlush(destination_queue);
+        OpenCL_Test_Success(err, "clFlush()");
+
+        // Refill the previous chunk's buffer now that the destination has this upload queued.
+        const uint64_t next_download = chunk - 1 + nb_buffers;
+        if (chunk > 0 && next_download < nb_chunks)
+        {
+            const int p = int(next_download % nb_buffers);
+            const uint64_t next_offset = next_download * buffer_size;
+            Wait_and_Release(upload_events[p]);
+            err = clEnqueueReadBuffer(source_queue, source, CL_FALSE, size_t(source_offset + next_offset),
+                                      size_t(std::min(uint64_t(buffer_size), size - next_offset)),
+                                      staging_pointers[p], 0, NULL, &download_events[p]);
+            OpenCL_Test_Success(err, "clEnqueueReadBuffer()");
+            err = clFlush(source_queue);
+            OpenCL_Test_Success(err, "clFlush()");
+        }
     }
-//     else
-//     {
-//         std_cout << "Checksums do match.\n";
-//         std_cout << "Host_Checksum()   = " << Host_Checksum() << "\n";
-//         std_cout << "Device_Checksum() = " << Device_Checksum() << "\n";
-//         std_cout << "Array in hexa:\n"   << OpenCL_SHA512::String_Hexadecimal(host_array, new_array_size_bytes*CHAR_BIT) << "\n";
-//     }
-    assert(Host_Checksum() == Device_Checksum());
 
-#endif // #ifdef OpenCLSHA512Checksum
-}
+    // A marker completes when all previously enqueued commands are done.
+    err = clEnqueueMarker(destination_queue, &event);
+    OpenCL_Test_Success(err, "clEnqueueMarker()");
 
-// *****************************************************************************
-template <class T>
-void OpenCL_Array<T>::Host_to_Device()
-{
-    err = clEnqueueWriteBuffer(command_queue,       // Command queue
-                               device_array,        // Memory buffer to write to
-                               CL_TRUE,             // Non-Blocking read
-                               0,                   // Offset in the buffer object to read from
-                               new_array_size_bytes,// Size in bytes of data being read
-                               host_array,          // Pointer to buffer on device to store write data
-                               0,                   // Number of event in the event list
-                               NULL,                // List of events that needs to complete before this executes
-                               NULL);               // Event object to return on completion
-    OpenCL_Test_Success(err, "clEnqueueWriteBuffer()");
+    return event;
 }
 
 // *****************************************************************************
 template <class T>
-void OpenCL_Array<T>::Device_to_Host()
+cl_event OpenCL_Peer_Copier::Copy(OpenCL_Array<T> &source, OpenCL_Array<T> &destination,
+                                  const int src_offset, const int dst_offset, const int count)
+/**
+ * Copy elements [src_offset, src_offset+count) of "source" to "destination"
+ * starting at "dst_offset". A negative "count" copies up to the end of
+ * "source". The arrays must belong to the contexts of the source and
+ * destination queues. The host arrays are NOT modified.
+ */
 {
-    assert(device_array != NULL);
-    err = clEnqueueReadBuffer(command_queue,        // Command queue
-                              device_array,         // Memory buffer to read from
-                              CL_FALSE,             // Non-Blocking read
-                              0,                    // Offset in the buffer object to read from
-                              new_array_size_bytes, // Size in bytes of data being read
-                              host_array,           // Pointer to buffer in RAM to store read data
-                              0,                    // Number of event in the event list
-                              NULL,                 // List of events that needs to complete before this executes
-                              NULL);                // Event object to return on completion
-    OpenCL_Test_Success(err, "clEnqueueReadBuffer()");
+    const int nb_elements = (count < 0 ? source.Get_N() - src_offset : count);
+    const uint64_t sizeof_element = source.Get_Sizeof_Element();
+    OpenCL_Assert(destination.Get_Sizeof_Element() == sizeof_element);
+    OpenCL_Assert(src_offset >= 0 && nb_elements >= 0 && src_offset + nb_elements <= source.Get_N());
+    OpenCL_Assert(dst_offset >= 0 && dst_offset + nb_elements <= destination.Get_N());
+
+    // Pin both arrays so faulting in one does not evict the other.
+    OpenCL_Pin_Guard pins;
+    pins.Pin(source);
+    pins.Pin(destination);
+    source.Make_Resident();
+    destination.Make_Resident();
+    destination.Mark_Device_Written();
+
+    cl_event event = Copy(source.Resident_Device_Memory(), uint64_t(src_offset) * sizeof_element,
+                          destination.Resident_Device_Memory(), uint64_t(dst_offset) * sizeof_element,
+                          uint64_t(nb_elements) * sizeof_element);
+
+    pins.Unpin_All();
+
+    return event;
 }
 
 // *****************************************************************************
@@ -1755,8 +8379,10 @@ namespace OpenCL_SHA512
             ((uint64_t *)new_array)[N] = 0x8000000000000000; // 64 bits (double)
         else
         {
-            std_cout << "ERROR: sizeof(array) == " << sizeof_element << " unsupported! Aborting.\n" << std::flush;
-            abort();
+            std::ostringstream message;
+            message << "sizeof(array) == " << sizeof_element << " unsupported";
+            free(new_array);
+            OpenCL_Throw(CL_INVALID_VALUE, "OpenCL_SHA512::Prepare_Array_for_Checksuming", message.str());
         }
 
         // Because calloc_and_check() is used to allocate the new array, it is filled with 0.
@@ -1802,7 +8428,43 @@ namespace OpenCL_SHA512
     }
 
     // *************************************************************************
-    void Calculate_Checksum(const void *_array, uint64_t size_bits, uint8_t *sha512sum)
+    // Round constants (FIPS 180-2, section 4.2.3), shared by all implementations.
+    static const uint64_t K[80] =
+    {
+        0x428A2F98D728AE22ll, 0x7137449123EF65CDll, 0xB5C0FBCFEC4D3B2Fll,
+        0xE9B5DBA58189DBBCll, 0x3956C25BF348B538ll, 0x59F111F1B605D019ll,
+        0x923F82A4AF194F9Bll, 0xAB1C5ED5DA6D8118ll, 0xD807AA98A3030242ll,
+        0x12835B0145706FBEll, 0x243185BE4EE4B28Cll, 0x550C7DC3D5FFB4E2ll,
+        0x72BE5D74F27B896Fll, 0x80DEB1FE3B1696B1ll, 0x9BDC06A725C71235ll,
+        0xC19BF174CF692694ll, 0xE49B69C19EF14AD2ll, 0xEFBE4786384F25E3ll,
+        0x0FC19DC68B8CD5B5ll, 0x240CA1CC77AC9C65ll, 0x2DE92C6F592B0275ll,
+        0x4A7484AA6EA6E483ll, 0x5CB0A9DCBD41FBD4ll, 0x76F988DA831153B5ll,
+        0x983E5152EE66DFABll, 0xA831C66D2DB43210ll, 0xB00327C898FB213Fll,
+        0xBF597FC7BEEF0EE4ll, 0xC6E00BF33DA88FC2ll, 0xD5A79147930AA725ll,
+        0x06CA6351E003826Fll, 0x142929670A0E6E70ll, 0x27B70A8546D22FFCll,
+        0x2E1B21385C26C926ll, 0x4D2C6DFC5AC42AEDll, 0x53380D139D95B3DFll,
+        0x650A73548BAF63DEll, 0x766A0ABB3C77B2A8ll, 0x81C2C92E47EDAEE6ll,
+        0x92722C851482353Bll, 0xA2BFE8A14CF10364ll, 0xA81A664BBC423001ll,
+        0xC24B8B70D0F89791ll, 0xC76C51A30654BE30ll, 0xD192E819D6EF5218ll,
+        0xD69906245565A910ll, 0xF40E35855771202All, 0x106AA07032BBD1B8ll,
+        0x19A4C116B8D2D0C8ll, 0x1E376C085141AB53ll, 0x2748774CDF8EEB99ll,
+        0x34B0BCB5E19B48A8ll, 0x391C0CB3C5C95A63ll, 0x4ED8AA4AE3418ACBll,
+        0x5B9CCA4F7763E373ll, 0x682E6FF3D6B2B8A3ll, 0x748F82EE5DEFB2FCll,
+        0x78A5636F43172F60ll, 0x84C87814A1F0AB72ll, 0x8CC702081A6439ECll,
+        0x90BEFFFA23631E28ll, 0xA4506CEBDE82BDE9ll, 0xBEF9A3F7B2C67915ll,
+        0xC67178F2E372532Bll, 0xCA273ECEEA26619Cll, 0xD186B8C721C0C207ll,
+        0xEADA7DD6CDE0EB1Ell, 0xF57D4F7FEE6ED178ll, 0x06F067AA72176FBAll,
+        0x0A637DC5A2C898A6ll, 0x113F9804BEF90DAEll, 0x1B710B35131C471Bll,
+        0x28DB77F523047D84ll, 0x32CAAB7B40C72493ll, 0x3C9EBE0A15C9BEBCll,
+        0x431D67C49C100D4Cll, 0x4CC5D4BECB3E42B6ll, 0x597F299CFC657E2All,
+        0x5FCB6FAB3AD6FAECll, 0x6C44198C4A475817ll
+    };
+
+    // *************************************************************************
+    void Calculate_Checksum_Reference(const void *_array, uint64_t size_bits, uint8_t *sha512sum)
+    /**
+     * Original RFC 4634 implementation: the other ones are checked against it.
+     */
     {
         const uint8_t *array = (uint8_t *) _array;
 
@@ -1818,37 +8480,6 @@ namespace OpenCL_SHA512
         H[6] = 0x1F83D9ABFB41BD6Bll;
         H[7] = 0x5BE0CD19137E2179ll;
 
-        static const uint64_t K[80] =
-        {
-            0x428A2F98D728AE22ll, 0x7137449123EF65CDll, 0xB5C0FBCFEC4D3B2Fll,
-            0xE9B5DBA58189DBBCll, 0x3956C25BF348B538ll, 0x59F111F1B605D019ll,
-            0x923F82A4AF194F9Bll, 0xAB1C5ED5DA6D8118ll, 0xD807AA98A3030242ll,
-            0x12835B0145706FBEll, 0x243185BE4EE4B28Cll, 0x550C7DC3D5FFB4E2ll,
-            0x72BE5D74F27B896Fll, 0x80DEB1FE3B1696B1ll, 0x9BDC06A725C71235ll,
-            0xC19BF174CF692694ll, 0xE49B69C19EF14AD2ll, 0xEFBE4786384F25E3ll,
-            0x0FC19DC68B8CD5B5ll, 0x240CA1CC77AC9C65ll, 0x2DE92C6F592B0275ll,
-            0x4A7484AA6EA6E483ll, 0x5CB0A9DCBD41FBD4ll, 0x76F988DA831153B5ll,
-            0x983E5152EE66DFABll, 0xA831C66D2DB43210ll, 0xB00327C898FB213Fll,
-            0xBF597FC7BEEF0EE4ll, 0xC6E00BF33DA88FC2ll, 0xD5A79147930AA725ll,
-            0x06CA6351E003826Fll, 0x142929670A0E6E70ll, 0x27B70A8546D22FFCll,
-            0x2E1B21385C26C926ll, 0x4D2C6DFC5AC42AEDll, 0x53380D139D95B3DFll,
-            0x650A73548BAF63DEll, 0x766A0ABB3C77B2A8ll, 0x81C2C92E47EDAEE6ll,
-            0x92722C851482353Bll, 0xA2BFE8A14CF10364ll, 0xA81A664BBC423001ll,
-            0xC24B8B70D0F89791ll, 0xC76C51A30654BE30ll, 0xD192E819D6EF5218ll,
-            0xD69906245565A910ll, 0xF40E35855771202All, 0x106AA07032BBD1B8ll,
-            0x19A4C116B8D2D0C8ll, 0x1E376C085141AB53ll, 0x2748774CDF8EEB99ll,
-            0x34B0BCB5E19B48A8ll, 0x391C0CB3C5C95A63ll, 0x4ED8AA4AE3418ACBll,
-            0x5B9CCA4F7763E373ll, 0x682E6FF3D6B2B8A3ll, 0x748F82EE5DEFB2FCll,
-            0x78A5636F43172F60ll, 0x84C87814A1F0AB72ll, 0x8CC702081A6439ECll,
-            0x90BEFFFA23631E28ll, 0xA4506CEBDE82BDE9ll, 0xBEF9A3F7B2C67915ll,
-            0xC67178F2E372532Bll, 0xCA273ECEEA26619Cll, 0xD186B8C721C0C207ll,
-            0xEADA7DD6CDE0EB1Ell, 0xF57D4F7FEE6ED178ll, 0x06F067AA72176FBAll,
-            0x0A637DC5A2C898A6ll, 0x113F9804BEF90DAEll, 0x1B710B35131C471Bll,
-            0x28DB77F523047D84ll, 0x32CAAB7B40C72493ll, 0x3C9EBE0A15C9BEBCll,
-            0x431D67C49C100D4Cll, 0x4CC5D4BECB3E42B6ll, 0x597F299CFC657E2All,
-            0x5FCB6FAB3AD6FAECll, 0x6C44198C4A475817ll
-        };
-
         int t8 = 0;
 
         for (uint64_t i = 0 ; i < N ; i++)
@@ -1865,54 +8496,511 @@ namespace OpenCL_SHA512
                     ((uint64_t)(array[t8 + 6]) << 8) |
                     ((uint64_t)(array[t8 + 7]));
 
-            for (int t = 16 ; t < 80 ; t++)
-                W[t] = SHA512_sigma1(W[t-2]) + W[t-7] + SHA512_sigma0(W[t-15]) + W[t-16];
+            for (int t = 16 ; t < 80 ; t++)
+                W[t] = SHA512_sigma1(W[t-2]) + W[t-7] + SHA512_sigma0(W[t-15]) + W[t-16];
+
+            uint64_t a = H[0];
+            uint64_t b = H[1];
+            uint64_t c = H[2];
+            uint64_t d = H[3];
+            uint64_t e = H[4];
+            uint64_t f = H[5];
+            uint64_t g = H[6];
+            uint64_t h = H[7];
+
+            for(int t = 0 ; t < 80 ; t++)
+            {
+                uint64_t T1 = h + SHA512_SIGMA1(e) + SHA_Ch(e,f,g) + K[t] + W[t];
+                uint64_t T2 = SHA512_SIGMA0(a) + SHA_Maj(a,b,c);
+
+                h = g;
+                g = f;
+                f = e;
+                e = d + T1;
+                d = c;
+                c = b;
+                b = a;
+                a = T1 + T2;
+            }
+
+            H[0] += a;
+            H[1] += b;
+            H[2] += c;
+            H[3] += d;
+            H[4] += e;
+            H[5] += f;
+            H[6] += g;
+            H[7] += h;
+        }
+
+        uint8_t message_digest[64];
+
+        for (int i = 0 ; i < 64 ; ++i)
+            message_digest[i] = (uint8_t)(H[i>>3] >> 8 * ( 7 - ( i % 8 ) ));
+
+        for(int i = 0 ; i < 64 ; i++)
+        {
+            sha512sum[i] = message_digest[i];
+        }
+    }
+
+    // *************************************************************************
+    // Initial hash value (FIPS 180-2, section 5.3.4).
+    static const uint64_t H0[8] =
+    {
+        0x6A09E667F3BCC908ll, 0xBB67AE8584CAA73Bll, 0x3C6EF372FE94F82Bll, 0xA54FF53A5F1D36F1ll,
+        0x510E527FADE682D1ll, 0x9B05688C2B3E6C1Fll, 0x1F83D9ABFB41BD6Bll, 0x5BE0CD19137E2179ll
+    };
+
+    // *************************************************************************
+    inline uint64_t Load_Big_Endian(const uint8_t *bytes)
+    {
+        // Compilers turn this into a single load and byte swap.
+        return ((uint64_t)(bytes[0]) << 56) | ((uint64_t)(bytes[1]) << 48) |
+               ((uint64_t)(bytes[2]) << 40) | ((uint64_t)(bytes[3]) << 32) |
+               ((uint64_t)(bytes[4]) << 24) | ((uint64_t)(bytes[5]) << 16) |
+               ((uint64_t)(bytes[6]) <<  8) |  (uint64_t)(bytes[7]);
+    }
+
+    // *************************************************************************
+    void Hash_to_Digest(const uint64_t H[8], uint8_t *sha512sum)
+    {
+        for (int i = 0 ; i < 64 ; ++i)
+            sha512sum[i] = (uint8_t)(H[i>>3] >> 8 * ( 7 - ( i % 8 ) ));
+    }
+
+    // *************************************************************************
+    void Compress_Scalar(uint64_t H[8], const uint8_t *blocks, const uint64_t nb_blocks)
+    /**
+     * Process "nb_blocks" consecutive 1024 bits blocks. Only the last 16 words
+     * of the message schedule are kept (W[t & 15] holds W[t-16] before update).
+     */
+    {
+        for (uint64_t i = 0 ; i < nb_blocks ; i++, blocks += 128)
+        {
+            uint64_t W[16];
+            for (int t = 0 ; t < 16 ; t++)
+                W[t] = Load_Big_Endian(blocks + 8*t);
+
+            uint64_t a = H[0], b = H[1], c = H[2], d = H[3];
+            uint64_t e = H[4], f = H[5], g = H[6], h = H[7];
+
+            for (int t = 0 ; t < 80 ; t++)
+            {
+                if (t >= 16)
+                    W[t & 15] += SHA512_sigma1(W[(t-2) & 15]) + W[(t-7) & 15] + SHA512_sigma0(W[(t-15) & 15]);
+
+                const uint64_t T1 = h + SHA512_SIGMA1(e) + SHA_Ch(e,f,g) + K[t] + W[t & 15];
+                const uint64_t T2 = SHA512_SIGMA0(a) + SHA_Maj(a,b,c);
+                h = g; g = f; f = e; e = d + T1;
+                d = c; c = b; b = a; a = T1 + T2;
+            }
+
+            H[0] += a; H[1] += b; H[2] += c; H[3] += d;
+            H[4] += e; H[5] += f; H[6] += g; H[7] += h;
+        }
+    }
+
+    // *************************************************************************
+    void Calculate_Checksum(const void *_array, uint64_t size_bits, uint8_t *sha512sum)
+    /**
+     * A single message is a sequential chain of blocks: SIMD lanes only help
+     * when hashing several messages (see Calculate_Checksums()).
+     */
+    {
+        assert(size_bits % 1024 == 0);
+
+        uint64_t H[8];
+        memcpy(H, H0, sizeof(H));
+        Compress_Scalar(H, (const uint8_t *) _array, size_bits / 1024);
+        Hash_to_Digest(H, sha512sum);
+    }
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OCLUTILS_SHA512_SIMD
+
+    // *************************************************************************
+    // Multi-buffer compression: lane l of every vector belongs to message l.
+    // Written with GCC vector extensions and inlined into functions compiled
+    // for each instruction set, so the same code gives SSE2, AVX2 and AVX-512.
+    typedef uint64_t SHA512_x2 __attribute__((vector_size(16)));
+    typedef uint64_t SHA512_x4 __attribute__((vector_size(32)));
+    typedef uint64_t SHA512_x8 __attribute__((vector_size(64)));
+
+    #define SHA512_VROTR(bits,vector) (((vector) >> (bits)) | ((vector) << (64-(bits))))
+
+    template <class V, int L>
+    inline __attribute__((always_inline)) void Compress_Lanes(uint64_t (*H)[8], const uint8_t *const *messages,
+                                                              const uint64_t nb_blocks)
+    /**
+     * Process the first "nb_blocks" blocks of "L" messages, whose states are H[0..L-1].
+     */
+    {
+        V state[8];
+        for (int j = 0 ; j < 8 ; j++)
+            for (int l = 0 ; l < L ; l++)
+                state[j][l] = H[l][j];
+
+        for (uint64_t i = 0 ; i < nb_blocks ; i++)
+        {
+            V W[16];
+            for (int t = 0 ; t < 16 ; t++)
+                for (int l = 0 ; l < L ; l++)
+                    W[t][l] = Load_Big_Endian(messages[l] + i*128 + 8*t);
+
+            V a = state[0], b = state[1], c = state[2], d = state[3];
+            V e = state[4], f = state[5], g = state[6], h = state[7];
+
+            for (int t = 0 ; t < 80 ; t++)
+            {
+                if (t >= 16)
+                {
+                    const V w2  = W[(t-2) & 15];
+                    const V w15 = W[(t-15) & 15];
+                    W[t & 15] += (SHA512_VROTR(19,w2) ^ SHA512_VROTR(61,w2) ^ (w2 >> 6)) + W[(t-7) & 15]
+                               + (SHA512_VROTR(1,w15) ^ SHA512_VROTR(8,w15) ^ (w15 >> 7));
+                }
+
+                V k;
+                for (int l = 0 ; l < L ; l++)
+                    k[l] = K[t];
+
+                const V T1 = h + (SHA512_VROTR(14,e) ^ SHA512_VROTR(18,e) ^ SHA512_VROTR(41,e)) + ((e & f) ^ (~e & g)) + k + W[t & 15];
+                const V T2 = (SHA512_VROTR(28,a) ^ SHA512_VROTR(34,a) ^ SHA512_VROTR(39,a)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g; g = f; f = e; e = d + T1;
+                d = c; c = b; b = a; a = T1 + T2;
+            }
+
+            state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+            state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+        }
+
+        for (int j = 0 ; j < 8 ; j++)
+            for (int l = 0 ; l < L ; l++)
+                H[l][j] = state[j][l];
+    }
+
+    // *************************************************************************
+    __attribute__((target("sse2")))
+    void Compress_SSE2(uint64_t (*H)[8], const uint8_t *const *messages, const uint64_t nb_blocks)
+    {
+        Compress_Lanes<SHA512_x2, 2>(H, messages, nb_blocks);
+    }
+
+    __attribute__((target("avx2")))
+    void Compress_AVX2(uint64_t (*H)[8], const uint8_t *const *messages, const uint64_t nb_blocks)
+    {
+        Compress_Lanes<SHA512_x4, 4>(H, messages, nb_blocks);
+    }
+
+    __attribute__((target("avx512f")))
+    void Compress_AVX512(uint64_t (*H)[8], const uint8_t *const *messages, const uint64_t nb_blocks)
+    {
+        Compress_Lanes<SHA512_x8, 8>(H, messages, nb_blocks);
+    }
+#endif // #if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+    // *************************************************************************
+    void Compress(const Implementation implementation, uint64_t (*H)[8], const uint8_t *const *messages,
+                  const uint64_t nb_blocks)
+    /**
+     * Process the first "nb_blocks" blocks of Nb_Lanes(implementation) messages.
+     */
+    {
+        switch (implementation)
+        {
+#ifdef OCLUTILS_SHA512_SIMD
+            case IMPLEMENTATION_AVX512:
+                Compress_AVX512(H, messages, nb_blocks);
+                break;
+            case IMPLEMENTATION_AVX2:
+                Compress_AVX2(H, messages, nb_blocks);
+                break;
+            case IMPLEMENTATION_SSE2:
+                Compress_SSE2(H, messages, nb_blocks);
+                break;
+#endif // #ifdef OCLUTILS_SHA512_SIMD
+            default:
+                for (int l = 0 ; l < Nb_Lanes(implementation) ; l++)
+                    Compress_Scalar(H[l], messages[l], nb_blocks);
+                break;
+        }
+    }
+
+    // *************************************************************************
+    bool Implementation_Is_Supported(const Implementation implementation)
+    {
+        switch (implementation)
+        {
+            case IMPLEMENTATION_REFERENCE:
+            case IMPLEMENTATION_SCALAR:
+                return true;
+#ifdef OCLUTILS_SHA512_SIMD
+            case IMPLEMENTATION_SSE2:
+                return __builtin_cpu_supports("sse2");
+            case IMPLEMENTATION_AVX2:
+                return __builtin_cpu_supports("avx2");
+            case IMPLEMENTATION_AVX512:
+                return __builtin_cpu_supports("avx512f");
+#endif // #ifdef OCLUTILS_SHA512_SIMD
+            default:
+                return false;
+        }
+    }
+
+    // *************************************************************************
+    Implementation Best_Implementation()
+    {
+        for (int i = NB_IMPLEMENTATIONS - 1 ; i > IMPLEMENTATION_SCALAR ; i--)
+        {
+            if (Implementation_Is_Supported(Implementation(i)))
+                return Implementation(i);
+        }
+        return IMPLEMENTATION_SCALAR;
+    }
+
+    // *************************************************************************
+    const char *Implementation_Name(const Implementation implementation)
+    {
+        static const char *names[NB_IMPLEMENTATIONS] = {"reference", "scalar", "SSE2", "AVX2", "AVX-512"};
+        OpenCL_Assert(implementation >= 0 && implementation < NB_IMPLEMENTATIONS);
+        return names[implementation];
+    }
+
+    // *************************************************************************
+    int Nb_Lanes(const Implementation implementation)
+    {
+        static const int nb_lanes[NB_IMPLEMENTATIONS] = {1, 1, 2, 4, 8};
+        OpenCL_Assert(implementation >= 0 && implementation < NB_IMPLEMENTATIONS);
+        return nb_lanes[implementation];
+    }
+
+    // *************************************************************************
+    void Calculate_Checksums(const int nb_messages, const void *const *messages, const uint64_t *lengths,
+                             uint8_t *message_digests, const Implementation implementation)
+    /**
+     * Hash "nb_messages" independent messages; digest i is written at
+     * message_digests + 64*i. Messages are taken in groups of the widest
+     * supported lane count not above "implementation"'s, the remainder going
+     * to narrower ones. Within a group, the blocks common to all messages
+     * are hashed together and the tails of the longer ones one by one.
+     */
+    {
+        OpenCL_Assert(Implementation_Is_Supported(implementation));
+
+        int m = 0;
+        if (implementation == IMPLEMENTATION_REFERENCE)
+        {
+            for ( ; m < nb_messages ; m++)
+                Calculate_Checksum_Reference(messages[m], lengths[m], message_digests + 64*m);
+            return;
+        }
+
+#ifdef OCLUTILS_SHA512_SIMD
+        for (int i = implementation ; i >= IMPLEMENTATION_SSE2 ; i--)
+        {
+            if (!Implementation_Is_Supported(Implementation(i)))
+                continue;
+            const int L = Nb_Lanes(Implementation(i));
+            for ( ; m + L <= nb_messages ; m += L)
+            {
+                uint64_t H[8][8];
+                uint64_t nb_common_blocks = std::numeric_limits<uint64_t>::max();
+                for (int l = 0 ; l < L ; l++)
+                {
+                    assert(lengths[m+l] % 1024 == 0);
+                    memcpy(H[l], H0, sizeof(H0));
+                    nb_common_blocks = std::min(nb_common_blocks, lengths[m+l] / 1024);
+                }
+
+                const uint8_t *const *group = (const uint8_t *const *) (messages + m);
+                Compress(Implementation(i), H, group, nb_common_blocks);
+
+                for (int l = 0 ; l < L ; l++)
+                {
+                    Compress_Scalar(H[l], group[l] + nb_common_blocks*128, lengths[m+l] / 1024 - nb_common_blocks);
+                    Hash_to_Digest(H[l], message_digests + 64*(m+l));
+                }
+            }
+        }
+#endif // #ifdef OCLUTILS_SHA512_SIMD
+
+        for ( ; m < nb_messages ; m++)
+            Calculate_Checksum(messages[m], lengths[m], message_digests + 64*m);
+    }
+
+    // *************************************************************************
+    void Compress_Final(uint64_t H[8], const uint8_t *tail, const uint64_t tail_bytes, const uint64_t size_bytes)
+    /**
+     * Process the last "tail_bytes" (< 128) bytes of a "size_bytes" message
+     * with the padding: one or two blocks.
+     */
+    {
+        assert(tail_bytes < 128);
+
+        uint8_t blocks[256];
+        memset(blocks, 0, sizeof(blocks));
+        memcpy(blocks, tail, size_t(tail_bytes));
+        blocks[tail_bytes] = 0x80;
+
+        // The 128 bits big-endian length in bits ends the last block.
+        const uint64_t nb_blocks = (tail_bytes + 1 + 16 <= 128 ? 1 : 2);
+        uint8_t *length = blocks + nb_blocks * 128 - 16;
+        const uint64_t size_bits_high = size_bytes >> 61;
+        const uint64_t size_bits_low  = size_bytes << 3;
+        for (int i = 0 ; i < 8 ; i++)
+        {
+            length[i]     = uint8_t(size_bits_high >> (56 - 8*i));
+            length[8 + i] = uint8_t(size_bits_low  >> (56 - 8*i));
+        }
+
+        Compress_Scalar(H, blocks, nb_blocks);
+    }
+
+    // *************************************************************************
+    void Context::Initialize()
+    {
+        memcpy(H, H0, sizeof(H));
+        size_bytes = 0;
+    }
+
+    // *************************************************************************
+    void Context::Update(const void *_message, const uint64_t bytes)
+    /**
+     * Complete the buffered block first, then hash the full blocks in place
+     * and keep the rest for the next call.
+     */
+    {
+        const uint8_t *message = (const uint8_t *) _message;
+        uint64_t remaining = bytes;
+
+        const uint64_t buffered = size_bytes % 128;
+        size_bytes += bytes;
+        if (buffered > 0)
+        {
+            const uint64_t fill = std::min(128 - buffered, remaining);
+            memcpy(buffer + buffered, message, size_t(fill));
+            message   += fill;
+            remaining -= fill;
+            if (buffered + fill < 128)
+                return;
+            Compress_Scalar(H, buffer, 1);
+        }
 
-            uint64_t a = H[0];
-            uint64_t b = H[1];
-            uint64_t c = H[2];
-            uint64_t d = H[3];
-            uint64_t e = H[4];
-            uint64_t f = H[5];
-            uint64_t g = H[6];
-            uint64_t h = H[7];
+        Compress_Scalar(H, message, remaining / 128);
+        memcpy(buffer, message + (remaining / 128) * 128, size_t(remaining % 128));
+    }
 
-            for(int t = 0 ; t < 80 ; t++)
-            {
-                uint64_t T1 = h + SHA512_SIGMA1(e) + SHA_Ch(e,f,g) + K[t] + W[t];
-                uint64_t T2 = SHA512_SIGMA0(a) + SHA_Maj(a,b,c);
+    // *************************************************************************
+    void Context::Finalize(uint8_t *sha512sum)
+    {
+        Compress_Final(H, buffer, size_bytes % 128, size_bytes);
+        Hash_to_Digest(H, sha512sum);
+    }
 
-                h = g;
-                g = f;
-                f = e;
-                e = d + T1;
-                d = c;
-                c = b;
-                b = a;
-                a = T1 + T2;
-            }
+    // *************************************************************************
+    void Calculate_Message_Checksum(const void *message, const uint64_t size_bytes, uint8_t *sha512sum)
+    {
+        Context context;
+        context.Update(message, size_bytes);
+        context.Finalize(sha512sum);
+    }
 
-            H[0] += a;
-            H[1] += b;
-            H[2] += c;
-            H[3] += d;
-            H[4] += e;
-            H[5] += f;
-            H[6] += g;
-            H[7] += h;
-        }
+    // *************************************************************************
+    uint64_t Nb_Leaves(const uint64_t size_bytes, const uint64_t leaf_size)
+    {
+        // An empty message still has one (empty) leaf.
+        return std::max(uint64_t(1), (size_bytes + leaf_size - 1) / leaf_size);
+    }
 
-        uint8_t message_digest[64];
+    // *************************************************************************
+    // Arguments of Leaf_Checksums_Chunk().
+    struct Leaf_Arguments
+    {
+        const uint8_t  *message;
+        uint64_t        size_bytes;
+        uint64_t        leaf_size;
+        uint8_t        *leaf_digests;
+        Implementation  implementation;
+    };
 
-        for (int i = 0 ; i < 64 ; ++i)
-            message_digest[i] = (uint8_t)(H[i>>3] >> 8 * ( 7 - ( i % 8 ) ));
+    // *************************************************************************
+    void Leaf_Checksums_Chunk(void *_args, const int, const uint64_t begin, const uint64_t end)
+    /**
+     * Hash leaves [begin, end). Full leaves have the same number of blocks and
+     * the same final padding block, so they go through the SIMD lanes
+     * together; a shorter last leaf is hashed alone.
+     */
+    {
+        const Leaf_Arguments *args = (const Leaf_Arguments *) _args;
+        const uint64_t leaf_size = args->leaf_size;
+        const int L = Nb_Lanes(args->implementation);
+
+        uint8_t padding[128];
+        const uint8_t *paddings[8];
+        memset(padding, 0, sizeof(padding));
+        padding[0] = 0x80;
+        for (int i = 0 ; i < 8 ; i++)
+            padding[120 + i] = uint8_t((leaf_size << 3) >> (56 - 8*i));
+        for (int l = 0 ; l < L ; l++)
+            paddings[l] = padding;
+
+        const uint64_t nb_full_leaves = args->size_bytes / leaf_size;
+        uint64_t leaf = begin;
+        for ( ; L > 1 && leaf + L <= std::min(end, nb_full_leaves) ; leaf += L)
+        {
+            uint64_t H[8][8];
+            const uint8_t *leaves[8];
+            for (int l = 0 ; l < L ; l++)
+            {
+                memcpy(H[l], H0, sizeof(H0));
+                leaves[l] = args->message + (leaf + l) * leaf_size;
+            }
+            Compress(args->implementation, H, leaves, leaf_size / 128);
+            Compress(args->implementation, H, paddings, 1);
+            for (int l = 0 ; l < L ; l++)
+                Hash_to_Digest(H[l], args->leaf_digests + 64 * (leaf + l));
+        }
 
-        for(int i = 0 ; i < 64 ; i++)
+        for ( ; leaf < end ; leaf++)
         {
-            sha512sum[i] = message_digest[i];
+            const uint64_t start = leaf * leaf_size;
+            Calculate_Message_Checksum(args->message + start, std::min(leaf_size, args->size_bytes - start),
+                                       args->leaf_digests + 64 * leaf);
         }
     }
 
+    // *************************************************************************
+    void Calculate_Leaf_Checksums(const void *message, const uint64_t size_bytes, const uint64_t leaf_size,
+                                  uint8_t *leaf_digests, const Implementation implementation)
+    /**
+     * Leaf i's checksum is written at leaf_digests + 64*i.
+     */
+    {
+        OpenCL_Assert(leaf_size > 0 && leaf_size % 128 == 0);
+        OpenCL_Assert(Implementation_Is_Supported(implementation));
+
+        Leaf_Arguments args;
+        args.message        = (const uint8_t *) message;
+        args.size_bytes     = size_bytes;
+        args.leaf_size      = leaf_size;
+        args.leaf_digests   = leaf_digests;
+        args.implementation = implementation;
+
+        // Chunks of whole SIMD groups.
+        OpenCL_Host_Backend::Parallel_For(Nb_Leaves(size_bytes, leaf_size), uint64_t(Nb_Lanes(IMPLEMENTATION_AVX512)),
+                                          Leaf_Checksums_Chunk, &args);
+    }
+
+    // *************************************************************************
+    void Calculate_Tree_Checksum(const void *message, const uint64_t size_bytes, const uint64_t leaf_size,
+                                 uint8_t *sha512sum)
+    {
+        std::vector<uint8_t> leaf_digests(64 * Nb_Leaves(size_bytes, leaf_size));
+        Calculate_Leaf_Checksums(message, size_bytes, leaf_size, &leaf_digests[0]);
+        Calculate_Message_Checksum(&leaf_digests[0], leaf_digests.size(), sha512sum);
+    }
+
     // *************************************************************************
     void Print_Checksum(const uint8_t checksum[64])
     {
@@ -1922,12 +9010,12 @@ namespace OpenCL_SHA512
     }
 
     // *************************************************************************
-    std::string Checksum_to_String(const uint8_t checksum[64])
+    std::string Checksum_to_String(const uint8_t checksum[64], const int nb_bytes)
     {
         std::string string_checksum("");
         char two_char[3];
         memset(two_char, 0, 3*sizeof(char));
-        for(int i = 0 ; i < 64 ; i++)
+        for(int i = 0 ; i < nb_bytes ; i++)
         {
             sprintf(two_char, "%02x", checksum[i] & 0xff);
             string_checksum += two_char;
@@ -1979,6 +9067,123 @@ namespace OpenCL_SHA512
         return array_in_binary;
     }
 
+    // *************************************************************************
+    void Check_Implementations(const void *array, const uint64_t size_bits, const std::string &expected)
+    /**
+     * Every supported implementation must give "expected". The multi-buffer
+     * ones get enough copies for full groups of each lane count plus a remainder.
+     */
+    {
+        uint8_t checksum[64];
+        Calculate_Checksum_Reference(array, size_bits, checksum);
+        OpenCL_Assert(expected == Checksum_to_String(checksum));
+        Calculate_Checksum(array, size_bits, checksum);
+        OpenCL_Assert(expected == Checksum_to_String(checksum));
+
+        for (int i = 0 ; i < NB_IMPLEMENTATIONS ; i++)
+        {
+            if (!Implementation_Is_Supported(Implementation(i)))
+                continue;
+            const int nb = 2 * Nb_Lanes(Implementation(i)) + 1;
+            std::vector<const void *> messages(nb, array);
+            std::vector<uint64_t> lengths(nb, size_bits);
+            std::vector<uint8_t> digests(64 * nb);
+            Calculate_Checksums(nb, &messages[0], &lengths[0], &digests[0], Implementation(i));
+            for (int m = 0 ; m < nb ; m++)
+                OpenCL_Assert(expected == Checksum_to_String(&digests[64 * m]));
+        }
+    }
+
+    // *************************************************************************
+    void Check_Mixed_Lengths()
+    /**
+     * Messages of different lengths in the same multi-buffer groups.
+     */
+    {
+        const int nb = 19;
+        std::vector<void *> arrays(nb);
+        std::vector<uint64_t> lengths(nb);
+        std::vector<uint8_t> expected(64 * nb), digests(64 * nb);
+        for (int m = 0 ; m < nb ; m++)
+        {
+            const uint64_t size = uint64_t((m * 7919) % 1500);
+            char *array = (char *) calloc_and_check(size + 1, sizeof(char));
+            for (uint64_t i = 0 ; i < size ; i++)
+                array[i] = char((i * 31 + m) & 0xff);
+            lengths[m] = size * CHAR_BIT;
+            Prepare_Array_for_Checksuming((void **) &array, sizeof(char), lengths[m]);
+            arrays[m] = array;
+            Calculate_Checksum_Reference(arrays[m], lengths[m], &expected[64 * m]);
+        }
+
+        for (int i = 0 ; i < NB_IMPLEMENTATIONS ; i++)
+        {
+            if (!Implementation_Is_Supported(Implementation(i)))
+                continue;
+            Calculate_Checksums(nb, (const void *const *) &arrays[0], &lengths[0], &digests[0], Implementation(i));
+            OpenCL_Assert(digests == expected);
+        }
+
+        for (int m = 0 ; m < nb ; m++)
+            OclUtils::free_me(arrays[m]);
+    }
+
+    // *************************************************************************
+    void Check_Tree()
+    /**
+     * Unpadded, streamed and tree checksums against the reference, with a
+     * last leaf that is full, partial or alone.
+     */
+    {
+        const uint64_t leaf_size = 1024;
+        const uint64_t sizes[] = {0, 111, 1024, 5*1024, 19*1024 + 777};
+        for (size_t s = 0 ; s < sizeof(sizes) / sizeof(sizes[0]) ; s++)
+        {
+            const uint64_t size = sizes[s];
+            char *array = (char *) calloc_and_check(size + 1, sizeof(char));
+            for (uint64_t i = 0 ; i < size ; i++)
+                array[i] = char((i * 131 + s) & 0xff);
+
+            // Unpadded message
+            uint8_t expected[64], checksum[64];
+            char *padded = (char *) calloc_and_check(size + 1, sizeof(char));
+            memcpy(padded, array, size_t(size));
+            uint64_t padded_size_bits = size * CHAR_BIT;
+            Prepare_Array_for_Checksuming((void **) &padded, sizeof(char), padded_size_bits);
+            Calculate_Checksum_Reference(padded, padded_size_bits, expected);
+            Calculate_Message_Checksum(array, size, checksum);
+            OpenCL_Assert(memcmp(expected, checksum, 64) == 0);
+            OclUtils::free_me(padded);
+
+            // Streamed in parts of varying sizes
+            Context context;
+            for (uint64_t offset = 0, part = 1 ; offset < size ; offset += part, part = (part * 7 + 3) % 300)
+                context.Update(array + offset, std::min(part, size - offset));
+            context.Finalize(checksum);
+            OpenCL_Assert(memcmp(expected, checksum, 64) == 0);
+
+            // Leaves
+            const uint64_t nb_leaves = Nb_Leaves(size, leaf_size);
+            std::vector<uint8_t> expected_leaves(64 * nb_leaves), leaves(64 * nb_leaves);
+            for (uint64_t l = 0 ; l < nb_leaves ; l++)
+                Calculate_Message_Checksum(array + l * leaf_size, std::min(leaf_size, size - l * leaf_size),
+                                           &expected_leaves[64 * l]);
+            for (int i = 0 ; i < NB_IMPLEMENTATIONS ; i++)
+            {
+                if (!Implementation_Is_Supported(Implementation(i)))
+                    continue;
+                Calculate_Leaf_Checksums(array, size, leaf_size, &leaves[0], Implementation(i));
+                OpenCL_Assert(leaves == expected_leaves);
+            }
+
+            Calculate_Message_Checksum(&expected_leaves[0], expected_leaves.size(), expected);
+            Calculate_Tree_Checksum(array, size, leaf_size, checksum);
+            OpenCL_Assert(memcmp(expected, checksum, 64) == 0);
+
+            OclUtils::free_me(array);
+        }
+    }
+
     // *************************************************************************
     void Validation()
     {
@@ -1986,7 +9191,6 @@ namespace OpenCL_SHA512
         char *char_array;
         std::string precalculated_checksum, calculated_checksum;
         uint64_t array_size_bit;
-        uint8_t checksum[64];
 
         // *********************************************************************
         // Examples from http://www.iwar.org.uk/comsec/resources/cipher/sha256-384-512.pdf
@@ -1996,10 +9200,9 @@ namespace OpenCL_SHA512
         //std_cout << "Validation() String: " << char_array << "\n";
         Prepare_Array_for_Checksuming((void **)&char_array, sizeof(char), array_size_bit);
         precalculated_checksum = "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f";
-        Calculate_Checksum(char_array, array_size_bit, checksum);
+        Check_Implementations(char_array, array_size_bit, precalculated_checksum);
         //std_cout << "Validation() Pre-calculate checksum: " << precalculated_checksum << "\n";
         //std_cout << "Validation() Calculate checksum:     " << Checksum_to_String(checksum) << "\n";
-        assert(precalculated_checksum == Checksum_to_String(checksum));
         OclUtils::free_me(char_array);
 
         // *********************************************************************
@@ -2011,10 +9214,9 @@ namespace OpenCL_SHA512
         array_size_bit = strlen(char_array)*CHAR_BIT;
         Prepare_Array_for_Checksuming((void **)&char_array, sizeof(char), array_size_bit);
         precalculated_checksum = "07e547d9586f6a73f73fbac0435ed76951218fb7d0c8d788a309d785436bbb642e93a252a954f23912547d1e8a3b5ed6e1bfd7097821233fa0538f3db854fee6";
-        Calculate_Checksum(char_array, array_size_bit, checksum);
+        Check_Implementations(char_array, array_size_bit, precalculated_checksum);
         //std_cout << "Pre-calculate checksum: " << precalculated_checksum << "\n";
         //std_cout << "Calculate checksum:     " << Checksum_to_String(checksum) << "\n";
-        assert(precalculated_checksum == Checksum_to_String(checksum));
         OclUtils::free_me(char_array);
 
         char_array = (char *) calloc_and_check(l, sizeof(char));
@@ -2023,10 +9225,9 @@ namespace OpenCL_SHA512
         array_size_bit = strlen(char_array)*CHAR_BIT;
         Prepare_Array_for_Checksuming((void **)&char_array, sizeof(char), array_size_bit);
         precalculated_checksum = "91ea1245f20d46ae9a037a989f54f1f790f0a47607eeb8a14d12890cea77a1bbc6c7ed9cf205e67b7f2b8fd4c7dfd3a7a8617e45f3c463d481c7e586c39ac1ed";
-        Calculate_Checksum(char_array, array_size_bit, checksum);
+        Check_Implementations(char_array, array_size_bit, precalculated_checksum);
         //std_cout << "Pre-calculate checksum: " << precalculated_checksum << "\n";
         //std_cout << "Calculate checksum:     " << Checksum_to_String(checksum) << "\n";
-        assert(precalculated_checksum == Checksum_to_String(checksum));
         OclUtils::free_me(char_array);
 
         // *********************************************************************
@@ -2038,10 +9239,9 @@ namespace OpenCL_SHA512
         array_size_bit = strlen(char_array)*CHAR_BIT;
         Prepare_Array_for_Checksuming((void **)&char_array, sizeof(char), array_size_bit);
         precalculated_checksum = "8e959b75dae313da8cf4f72814fc143f8f7779c6eb9f7fa17299aeadb6889018501d289e4900f7e4331b99dec4b5433ac7d329eeb6dd26545e96e55b874be909";
-        Calculate_Checksum(char_array, array_size_bit, checksum);
+        Check_Implementations(char_array, array_size_bit, precalculated_checksum);
         //std_cout << "Pre-calculate checksum: " << precalculated_checksum << "\n";
         //std_cout << "Calculate checksum:     " << Checksum_to_String(checksum) << "\n";
-        assert(precalculated_checksum == Checksum_to_String(checksum));
         OclUtils::free_me(char_array);
 
         // Example C.3
@@ -2053,11 +9253,402 @@ namespace OpenCL_SHA512
         array_size_bit = strlen(char_array)*CHAR_BIT;
         Prepare_Array_for_Checksuming((void **)&char_array, sizeof(char), array_size_bit);
         precalculated_checksum = "e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973ebde0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b";
-        Calculate_Checksum(char_array, array_size_bit, checksum);
+        Check_Implementations(char_array, array_size_bit, precalculated_checksum);
         //std_cout << "Pre-calculate checksum: " << precalculated_checksum << "\n";
         //std_cout << "Calculate checksum:     " << Checksum_to_String(checksum) << "\n";
-        assert(precalculated_checksum == Checksum_to_String(checksum));
         OclUtils::free_me(char_array);
+
+        Check_Mixed_Lengths();
+        Check_Tree();
+    }
+}
+
+// *****************************************************************************
+namespace OpenCL_CRC32C
+{
+    const uint32_t Polynomial = 0x82F63B78;     // Reflected Castagnoli polynomial
+
+    uint32_t Table[8][256];                     // Slicing by 8
+    uint32_t X_Power_2n[32];                    // x^(2^n) modulo the polynomial
+    pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+    // *************************************************************************
+    uint32_t Multiply_Modulo(uint32_t a, uint32_t b)
+    /**
+     * a * b modulo the polynomial, both reflected. "a" must not be zero.
+     */
+    {
+        uint32_t m = uint32_t(1) << 31;
+        uint32_t product = 0;
+        for (;;)
+        {
+            if (a & m)
+            {
+                product ^= b;
+                if ((a & (m - 1)) == 0)
+                    break;
+            }
+            m >>= 1;
+            b = (b & 1) ? (b >> 1) ^ Polynomial : b >> 1;
+        }
+        return product;
+    }
+
+    // *************************************************************************
+    void Initialize_Tables()
+    {
+        for (uint32_t i = 0 ; i < 256 ; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0 ; k < 8 ; k++)
+                c = (c & 1) ? (c >> 1) ^ Polynomial : c >> 1;
+            Table[0][i] = c;
+        }
+        for (int t = 1 ; t < 8 ; t++)
+            for (int i = 0 ; i < 256 ; i++)
+                Table[t][i] = (Table[t - 1][i] >> 8) ^ Table[0][Table[t - 1][i] & 0xFF];
+
+        X_Power_2n[0] = uint32_t(1) << 30;      // x^1
+        for (int n = 1 ; n < 32 ; n++)
+            X_Power_2n[n] = Multiply_Modulo(X_Power_2n[n - 1], X_Power_2n[n - 1]);
+    }
+
+    // *************************************************************************
+    uint32_t Shift_Operator(const uint64_t size_bytes)
+    /**
+     * x^(8 * size_bytes) modulo the polynomial: multiplying a CRC by it
+     * appends "size_bytes" zeros to its message.
+     */
+    {
+        pthread_once(&tables_once, Initialize_Tables);
+        uint32_t p = uint32_t(1) << 31;         // x^0
+        uint64_t n = size_bytes;
+        for (int k = 3 ; n != 0 ; n >>= 1, k++)
+            if (n & 1)
+                p = Multiply_Modulo(X_Power_2n[k & 31], p);
+        return p;
+    }
+
+    // *************************************************************************
+    uint32_t Update_Table(uint32_t crc, const uint8_t *p, uint64_t size_bytes)
+    {
+        pthread_once(&tables_once, Initialize_Tables);
+        for ( ; size_bytes >= 8 ; size_bytes -= 8, p += 8)
+        {
+            const uint32_t lo = (uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24) ^ crc;
+            const uint32_t hi =  uint32_t(p[4]) | uint32_t(p[5]) << 8 | uint32_t(p[6]) << 16 | uint32_t(p[7]) << 24;
+            crc = Table[7][lo & 0xFF] ^ Table[6][(lo >> 8) & 0xFF] ^ Table[5][(lo >> 16) & 0xFF] ^ Table[4][lo >> 24] ^
+                  Table[3][hi & 0xFF] ^ Table[2][(hi >> 8) & 0xFF] ^ Table[1][(hi >> 16) & 0xFF] ^ Table[0][hi >> 24];
+        }
+        for ( ; size_bytes > 0 ; size_bytes--, p++)
+            crc = (crc >> 8) ^ Table[0][(crc ^ *p) & 0xFF];
+        return crc;
+    }
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define OCLUTILS_CRC32C_SSE42
+    // *************************************************************************
+    __attribute__((target("sse4.2")))
+    uint32_t Update_SSE42(uint32_t crc, const uint8_t *p, uint64_t size_bytes)
+    {
+        unsigned long long crc64 = crc;
+        for ( ; size_bytes >= 8 ; size_bytes -= 8, p += 8)
+        {
+            unsigned long long word;
+            memcpy(&word, p, 8);
+            crc64 = __builtin_ia32_crc32di(crc64, word);
+        }
+        crc = uint32_t(crc64);
+        for ( ; size_bytes > 0 ; size_bytes--, p++)
+            crc = __builtin_ia32_crc32qi(crc, *p);
+        return crc;
+    }
+#endif // #if defined(__GNUC__) && defined(__x86_64__)
+
+    // *************************************************************************
+    bool SSE42_Is_Supported()
+    {
+#ifdef OCLUTILS_CRC32C_SSE42
+        return __builtin_cpu_supports("sse4.2");
+#else // #ifdef OCLUTILS_CRC32C_SSE42
+        return false;
+#endif // #ifdef OCLUTILS_CRC32C_SSE42
+    }
+
+    // *************************************************************************
+    uint32_t Calculate(const void *message, const uint64_t size_bytes, const uint32_t crc)
+    {
+#ifdef OCLUTILS_CRC32C_SSE42
+        static const bool sse42 = SSE42_Is_Supported();
+        if (sse42)
+            return ~Update_SSE42(~crc, (const uint8_t *) message, size_bytes);
+#endif // #ifdef OCLUTILS_CRC32C_SSE42
+        return ~Update_Table(~crc, (const uint8_t *) message, size_bytes);
+    }
+
+    // *************************************************************************
+    uint32_t Combine(const uint32_t crc1, const uint32_t crc2, const uint64_t size2_bytes)
+    {
+        return Multiply_Modulo(Shift_Operator(size2_bytes), crc1) ^ crc2;
+    }
+
+    // *************************************************************************
+    // Arguments of Leaf_Checksums_Chunk().
+    struct Leaf_Arguments
+    {
+        const uint8_t  *message;
+        uint64_t        size_bytes;
+        uint64_t        leaf_size;
+        uint32_t       *leaf_crcs;
+    };
+
+    // *************************************************************************
+    void Leaf_Checksums_Chunk(void *_args, const int, const uint64_t begin, const uint64_t end)
+    {
+        const Leaf_Arguments *args = (const Leaf_Arguments *) _args;
+        for (uint64_t leaf = begin ; leaf < end ; leaf++)
+        {
+            const uint64_t start = leaf * args->leaf_size;
+            args->leaf_crcs[leaf] = Calculate(args->message + start, std::min(args->leaf_size, args->size_bytes - start));
+        }
+    }
+
+    // *************************************************************************
+    void Calculate_Leaf_Checksums(const void *message, const uint64_t size_bytes, const uint64_t leaf_size,
+                                  uint32_t *leaf_crcs)
+    {
+        OpenCL_Assert(leaf_size > 0);
+
+        Leaf_Arguments args;
+        args.message    = (const uint8_t *) message;
+        args.size_bytes = size_bytes;
+        args.leaf_size  = leaf_size;
+        args.leaf_crcs  = leaf_crcs;
+        OpenCL_Host_Backend::Parallel_For(OpenCL_SHA512::Nb_Leaves(size_bytes, leaf_size), 1,
+                                          Leaf_Checksums_Chunk, &args);
+    }
+
+    // *************************************************************************
+    uint32_t Combine_Leaf_Checksums(const uint32_t *leaf_crcs, const uint64_t size_bytes, const uint64_t leaf_size)
+    /**
+     * All leaves but the last have the same size, so they share the operator
+     * appending a leaf of zeros.
+     */
+    {
+        const uint64_t nb_leaves = OpenCL_SHA512::Nb_Leaves(size_bytes, leaf_size);
+        const uint32_t full_leaf_shift = Shift_Operator(leaf_size);
+        uint32_t crc = leaf_crcs[0];
+        for (uint64_t leaf = 1 ; leaf < nb_leaves ; leaf++)
+        {
+            const uint64_t length = std::min(leaf_size, size_bytes - leaf * leaf_size);
+            const uint32_t shift = (length == leaf_size ? full_leaf_shift : Shift_Operator(length));
+            crc = Multiply_Modulo(shift, crc) ^ leaf_crcs[leaf];
+        }
+        return crc;
+    }
+
+    // *************************************************************************
+    void Validation()
+    {
+        const char *check = "123456789";
+        OpenCL_Assert(Calculate("", 0) == 0x00000000);
+        OpenCL_Assert(Calculate(check, 9) == 0xE3069283);
+        OpenCL_Assert(~Update_Table(~uint32_t(0), (const uint8_t *) check, 9) == 0xE3069283);
+        OpenCL_Assert(Calculate(check + 4, 5, Calculate(check, 4)) == 0xE3069283);
+        OpenCL_Assert(Combine(Calculate(check, 4), Calculate(check + 4, 5), 5) == 0xE3069283);
+
+        // Every split of a message, and leaves of all sizes, against both
+        // implementations.
+        std::vector<uint8_t> message(1792);
+        for (size_t i = 0 ; i < message.size() ; i++)
+            message[i] = uint8_t(i);
+        const uint32_t expected = 0x4B9592F2;
+        OpenCL_Assert(Calculate(&message[0], message.size()) == expected);
+        OpenCL_Assert(~Update_Table(~uint32_t(0), &message[0], message.size()) == expected);
+        for (size_t split = 0 ; split <= message.size() ; split += 7)
+        {
+            const uint32_t crc1 = Calculate(&message[0], split);
+            const uint32_t crc2 = Calculate(&message[split], message.size() - split);
+            OpenCL_Assert(Combine(crc1, crc2, message.size() - split) == expected);
+            OpenCL_Assert(Calculate(&message[split], message.size() - split, crc1) == expected);
+        }
+        const uint64_t leaf_sizes[] = {1, 8, 13, 128, 1000, 1792, 4096};
+        for (size_t l = 0 ; l < sizeof(leaf_sizes) / sizeof(leaf_sizes[0]) ; l++)
+        {
+            std::vector<uint32_t> leaf_crcs(OpenCL_SHA512::Nb_Leaves(message.size(), leaf_sizes[l]));
+            Calculate_Leaf_Checksums(&message[0], message.size(), leaf_sizes[l], &leaf_crcs[0]);
+            OpenCL_Assert(Combine_Leaf_Checksums(&leaf_crcs[0], message.size(), leaf_sizes[l]) == expected);
+        }
+    }
+}
+
+// *****************************************************************************
+namespace OpenCL_XXH64
+{
+    const uint64_t Prime_1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t Prime_2 = 0xC2B2AE3D27D4EB4FULL;
+    const uint64_t Prime_3 = 0x165667B19E3779F9ULL;
+    const uint64_t Prime_4 = 0x85EBCA77C2B2AE63ULL;
+    const uint64_t Prime_5 = 0x27D4EB2F165667C5ULL;
+
+    // *************************************************************************
+    inline uint64_t Rotl(const uint64_t x, const int n)
+    {
+        return (x << n) | (x >> (64 - n));
+    }
+
+    // *************************************************************************
+    inline uint64_t Read_32(const uint8_t *p)
+    {
+        return uint64_t(p[0]) | uint64_t(p[1]) << 8 | uint64_t(p[2]) << 16 | uint64_t(p[3]) << 24;
+    }
+
+    // *************************************************************************
+    inline uint64_t Read_64(const uint8_t *p)
+    {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        uint64_t word;
+        memcpy(&word, p, 8);
+        return word;
+#else
+        return Read_32(p) | Read_32(p + 4) << 32;
+#endif
+    }
+
+    // *************************************************************************
+    inline uint64_t Round(uint64_t accumulator, const uint64_t input)
+    {
+        accumulator += input * Prime_2;
+        return Rotl(accumulator, 31) * Prime_1;
+    }
+
+    // *************************************************************************
+    inline uint64_t Merge_Round(uint64_t hash, const uint64_t accumulator)
+    {
+        hash ^= Round(0, accumulator);
+        return hash * Prime_1 + Prime_4;
+    }
+
+    // *************************************************************************
+    uint64_t Calculate(const void *message, const uint64_t size_bytes, const uint64_t seed)
+    {
+        const uint8_t *p = (const uint8_t *) message;
+        uint64_t remaining = size_bytes;
+        uint64_t h;
+        if (size_bytes >= 32)
+        {
+            uint64_t v1 = seed + Prime_1 + Prime_2;
+            uint64_t v2 = seed + Prime_2;
+            uint64_t v3 = seed;
+            uint64_t v4 = seed - Prime_1;
+            for ( ; remaining >= 32 ; remaining -= 32, p += 32)
+            {
+                v1 = Round(v1, Read_64(p));
+                v2 = Round(v2, Read_64(p + 8));
+                v3 = Round(v3, Read_64(p + 16));
+                v4 = Round(v4, Read_64(p + 24));
+            }
+            h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+            h = Merge_Round(h, v1);
+            h = Merge_Round(h, v2);
+            h = Merge_Round(h, v3);
+            h = Merge_Round(h, v4);
+        }
+        else
+            h = seed + Prime_5;
+        h += size_bytes;
+
+        for ( ; remaining >= 8 ; remaining -= 8, p += 8)
+            h = Rotl(h ^ Round(0, Read_64(p)), 27) * Prime_1 + Prime_4;
+        if (remaining >= 4)
+        {
+            h = Rotl(h ^ (Read_32(p) * Prime_1), 23) * Prime_2 + Prime_3;
+            remaining -= 4;
+            p += 4;
+        }
+        for ( ; remaining > 0 ; remaining--, p++)
+            h = Rotl(h ^ (uint64_t(*p) * Prime_5), 11) * Prime_1;
+
+        h ^= h >> 33;
+        h *= Prime_2;
+        h ^= h >> 29;
+        h *= Prime_3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    // *************************************************************************
+    // Arguments of Leaf_Checksums_Chunk().
+    struct Leaf_Arguments
+    {
+        const uint8_t  *message;
+        uint64_t        size_bytes;
+        uint64_t        leaf_size;
+        uint64_t       *leaf_hashes;
+    };
+
+    // *************************************************************************
+    void Leaf_Checksums_Chunk(void *_args, const int, const uint64_t begin, const uint64_t end)
+    {
+        const Leaf_Arguments *args = (const Leaf_Arguments *) _args;
+        for (uint64_t leaf = begin ; leaf < end ; leaf++)
+        {
+            const uint64_t start = leaf * args->leaf_size;
+            args->leaf_hashes[leaf] = Calculate(args->message + start, std::min(args->leaf_size, args->size_bytes - start));
+        }
+    }
+
+    // *************************************************************************
+    void Calculate_Leaf_Checksums(const void *message, const uint64_t size_bytes, const uint64_t leaf_size,
+                                  uint64_t *leaf_hashes)
+    {
+        OpenCL_Assert(leaf_size > 0);
+
+        Leaf_Arguments args;
+        args.message        = (const uint8_t *) message;
+        args.size_bytes     = size_bytes;
+        args.leaf_size      = leaf_size;
+        args.leaf_hashes    = leaf_hashes;
+        OpenCL_Host_Backend::Parallel_For(OpenCL_SHA512::Nb_Leaves(size_bytes, leaf_size), 1,
+                                          Leaf_Checksums_Chunk, &args);
+    }
+
+    // *************************************************************************
+    uint64_t Calculate_Tree_Checksum(const uint64_t *leaf_hashes, const uint64_t nb_leaves)
+    {
+        std::vector<uint8_t> canonical(8 * nb_leaves);
+        for (uint64_t leaf = 0 ; leaf < nb_leaves ; leaf++)
+            for (int j = 0 ; j < 8 ; j++)
+                canonical[8 * leaf + j] = uint8_t(leaf_hashes[leaf] >> (56 - 8 * j));
+        return Calculate(&canonical[0], canonical.size());
+    }
+
+    // *************************************************************************
+    void Validation()
+    {
+        OpenCL_Assert(Calculate("", 0)             == 0xEF46DB3751D8E999ULL);
+        OpenCL_Assert(Calculate("a", 1)            == 0xD24EC4F1A98C6E5BULL);
+        OpenCL_Assert(Calculate("abc", 3)          == 0x44BC2CF5AD770999ULL);
+        OpenCL_Assert(Calculate("123456789", 9)    == 0x8CB841DB40E6AE83ULL);
+
+        std::vector<uint8_t> message(1792);
+        for (size_t i = 0 ; i < message.size() ; i++)
+            message[i] = uint8_t(i);
+        OpenCL_Assert(Calculate(&message[0], message.size()) == 0x553AAFFE2E89A7A7ULL);
+
+        const uint64_t leaf_sizes[] = {1, 13, 128, 1000, 4096};
+        for (size_t l = 0 ; l < sizeof(leaf_sizes) / sizeof(leaf_sizes[0]) ; l++)
+        {
+            const uint64_t leaf_size = leaf_sizes[l];
+            const uint64_t nb_leaves = OpenCL_SHA512::Nb_Leaves(message.size(), leaf_size);
+            std::vector<uint64_t> leaf_hashes(nb_leaves);
+            Calculate_Leaf_Checksums(&message[0], message.size(), leaf_size, &leaf_hashes[0]);
+            for (uint64_t leaf = 0 ; leaf < nb_leaves ; leaf++)
+            {
+                const uint64_t start = leaf * leaf_size;
+                OpenCL_Assert(leaf_hashes[leaf] == Calculate(&message[start], std::min(leaf_size, message.size() - start)));
+            }
+        }
     }
 }
 
@@ -2065,6 +9656,72 @@ template class OpenCL_Array<float>;
 template class OpenCL_Array<double>;
 template class OpenCL_Array<int>;
 template class OpenCL_Array<char>;
+template class OpenCL_Array<unsigned int>;
+template class OpenCL_Array<cl_ulong>;
+
+template class OpenCL_Sharded_Array<float>;
+template class OpenCL_Sharded_Array<double>;
+template class OpenCL_Sharded_Array<int>;
+template class OpenCL_Sharded_Array<char>;
+
+template class OpenCL_Image_Array<float>;
+template class OpenCL_Image_Array<int>;
+template class OpenCL_Image_Array<unsigned int>;
+template class OpenCL_Image_Array<char>;
+template class OpenCL_Image_Array<unsigned char>;
+
+template class OpenCL_Reduction_Result<float>;
+template class OpenCL_Reduction_Result<double>;
+template class OpenCL_Reduction_Result<int>;
+template class OpenCL_Reduction_Result<char>;
+
+template class OpenCL_Reducer<float>;
+template class OpenCL_Reducer<double>;
+template class OpenCL_Reducer<int>;
+template class OpenCL_Reducer<char>;
+
+template class OpenCL_Scan<int>;
+template class OpenCL_Scan<unsigned int>;
+template class OpenCL_Scan<float>;
+template class OpenCL_Scan<double>;
+
+template class OpenCL_Radix_Sort<unsigned int>;
+template class OpenCL_Radix_Sort<int>;
+template class OpenCL_Radix_Sort<float>;
+template class OpenCL_Radix_Sort<cl_ulong>;
+template class OpenCL_Radix_Sort<double>;
+
+template class OpenCL_Elementwise<float>;
+template class OpenCL_Elementwise<double>;
+template class OpenCL_Elementwise<int>;
+template class OpenCL_Elementwise<char>;
+
+template void     OpenCL_Host_Backend::Fill<float>(float *, const uint64_t, const float &);
+template void     OpenCL_Host_Backend::Fill<double>(double *, const uint64_t, const double &);
+template void     OpenCL_Host_Backend::Fill<int>(int *, const uint64_t, const int &);
+template void     OpenCL_Host_Backend::Fill<char>(char *, const uint64_t, const char &);
+template void     OpenCL_Host_Backend::Copy<float>(float *, const float *, const uint64_t);
+template void     OpenCL_Host_Backend::Copy<double>(double *, const double *, const uint64_t);
+template void     OpenCL_Host_Backend::Copy<int>(int *, const int *, const uint64_t);
+template void     OpenCL_Host_Backend::Copy<char>(char *, const char *, const uint64_t);
+template float    OpenCL_Host_Backend::Reduce<float>(const OpenCL_Reduction_Operation, const float *, const float *, const uint64_t);
+template double   OpenCL_Host_Backend::Reduce<double>(const OpenCL_Reduction_Operation, const double *, const double *, const uint64_t);
+template int      OpenCL_Host_Backend::Reduce<int>(const OpenCL_Reduction_Operation, const int *, const int *, const uint64_t);
+template char     OpenCL_Host_Backend::Reduce<char>(const OpenCL_Reduction_Operation, const char *, const char *, const uint64_t);
+template void     OpenCL_Host_Backend::Elementwise<float>(const OpenCL_Elementwise_Operation, float *, const float *, const float *, const float &, const uint64_t);
+template void     OpenCL_Host_Backend::Elementwise<double>(const OpenCL_Elementwise_Operation, double *, const double *, const double *, const double &, const uint64_t);
+template void     OpenCL_Host_Backend::Elementwise<int>(const OpenCL_Elementwise_Operation, int *, const int *, const int *, const int &, const uint64_t);
+template void     OpenCL_Host_Backend::Elementwise<char>(const OpenCL_Elementwise_Operation, char *, const char *, const char *, const char &, const uint64_t);
+
+template cl_event OpenCL_File_Loader::Load<float>(const std::string &, const uint64_t, OpenCL_Array<float> &, const int, const int);
+template cl_event OpenCL_File_Loader::Load<double>(const std::string &, const uint64_t, OpenCL_Array<double> &, const int, const int);
+template cl_event OpenCL_File_Loader::Load<int>(const std::string &, const uint64_t, OpenCL_Array<int> &, const int, const int);
+template cl_event OpenCL_File_Loader::Load<char>(const std::string &, const uint64_t, OpenCL_Array<char> &, const int, const int);
+
+template cl_event OpenCL_Peer_Copier::Copy<float>(OpenCL_Array<float> &, OpenCL_Array<float> &, const int, const int, const int);
+template cl_event OpenCL_Peer_Copier::Copy<double>(OpenCL_Array<double> &, OpenCL_Array<double> &, const int, const int, const int);
+template cl_event OpenCL_Peer_Copier::Copy<int>(OpenCL_Array<int> &, OpenCL_Array<int> &, const int, const int, const int);
+template cl_event OpenCL_Peer_Copier::Copy<char>(OpenCL_Array<char> &, OpenCL_Array<char> &, const int, const int, const int);
 
 
 // ********** End of file ******************************************************
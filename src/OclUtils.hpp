@@ -22,7 +22,11 @@
 #include <string>
 #include <list>
 #include <map>
+#include <vector>
 #include <climits>
+#include <cstddef>  // offsetof()
+#include <stdexcept>
+#include <sstream>
 
 #include <CL/cl.hpp>
 
@@ -38,15 +42,112 @@ const std::string OPENCL_PLATFORMS_AMD("amd");
 const std::string OPENCL_PLATFORMS_INTEL("intel");
 const std::string OPENCL_PLATFORMS_APPLE("apple");
 
+// *****************************************************************************
+enum OpenCL_Log_Level
+/**
+ * Severity of the library's messages (see OpenCL_Log).
+ */
+{
+    OPENCL_LOG_DEBUG,                   // Lock attempts, program builds and their logs
+    OPENCL_LOG_INFO,                    // Initialization progress
+    OPENCL_LOG_WARNING,                 // Problems the library recovers from
+    OPENCL_LOG_ERROR,                   // Details of an error being thrown
+    OPENCL_LOG_NONE,
+    OPENCL_LOG_DEFAULT                  // Not set yet (see OpenCL_Log::Level())
+};
+
+// Messages below this level are compiled out, formatting included
+// (e.g. -DOCLUTILS_LOG_MIN_LEVEL=OPENCL_LOG_WARNING for release builds).
+#ifndef OCLUTILS_LOG_MIN_LEVEL
+#define OCLUTILS_LOG_MIN_LEVEL OPENCL_LOG_DEBUG
+#endif // #ifndef OCLUTILS_LOG_MIN_LEVEL
+
+// *****************************************************************************
+class OpenCL_Log
+/**
+ * Destination of the library's messages. The level is read on first use from
+ * the OCLUTILS_LOG environment variable: "debug", "info" (default),
+ * "warning", "error" or "none". Messages go to std_cout (flushed from
+ * warnings up) unless a sink is set. A sink gets whole messages, without
+ * trailing newline, from any thread. The Print*() methods are not messages:
+ * they always write to std_cout.
+ */
+{
+public:
+    typedef void (*Sink)(const OpenCL_Log_Level level, const std::string &message, void *argument);
+
+private:
+    static OpenCL_Log_Level level;
+    static Sink             sink;
+    static void *           sink_argument;
+
+    static void Read_Environment();
+
+public:
+    static OpenCL_Log_Level Level();
+    static void Set_Level(const OpenCL_Log_Level _level);
+    static void Set_Sink(Sink _sink, void *_argument = NULL);   // NULL: back to std_cout
+    static bool Is_Enabled(const OpenCL_Log_Level _level)       { return _level >= Level(); }
+    static void Write(const OpenCL_Log_Level _level, const std::string &message);
+};
+
+// *****************************************************************************
+// "message" is anything that can be streamed, e.g.:
+//     OpenCL_Log_Info("OpenCL: Found " << nb << " devices");
+// It is only formatted if the level is enabled.
+#define OpenCL_Log_Message(log_level, message)                      \
+do                                                                  \
+{                                                                   \
+    if ((log_level) >= OCLUTILS_LOG_MIN_LEVEL &&                    \
+        OpenCL_Log::Is_Enabled(log_level))                          \
+    {                                                               \
+        std::ostringstream oclutils_log_stream;                     \
+        oclutils_log_stream << message;                             \
+        OpenCL_Log::Write((log_level), oclutils_log_stream.str());  \
+    }                                                               \
+} while (0)
+
+#define OpenCL_Log_Debug(message)   OpenCL_Log_Message(OPENCL_LOG_DEBUG,   message)
+#define OpenCL_Log_Info(message)    OpenCL_Log_Message(OPENCL_LOG_INFO,    message)
+#define OpenCL_Log_Warning(message) OpenCL_Log_Message(OPENCL_LOG_WARNING, message)
+#define OpenCL_Log_Error(message)   OpenCL_Log_Message(OPENCL_LOG_ERROR,   message)
+
+// *****************************************************************************
+class OpenCL_Exception : public std::runtime_error
+/**
+ * Thrown by the library instead of aborting, so that a caller can retry,
+ * fall back to another device or shed load without restarting the process.
+ * Failures that are not OpenCL errors (invalid arguments, files, host memory
+ * or threads) carry the nearest OpenCL error code; what() has the details.
+ * Destructors never throw: they report the error and carry on.
+ */
+{
+private:
+    cl_int      error;          // OpenCL error code
+    std::string call;           // Failing function (OpenCL or library)
+    std::string file;
+    int         line;
+
+public:
+    OpenCL_Exception(const cl_int _error, const std::string &_call, const std::string &message,
+                     const char *_file, const int _line);
+    ~OpenCL_Exception() throw() {}
+
+    cl_int              Error() const   { return error; }
+    const std::string & Call() const    { return call; }
+    const std::string & File() const    { return file; }
+    int                 Line() const    { return line; }
+};
+
+// *****************************************************************************
+#define OpenCL_Throw(err, fct_name, message)                        \
+    throw OpenCL_Exception((err), (fct_name), (message), __FILE__, __LINE__)
+
 // *****************************************************************************
 #define OpenCL_Test_Success(err, fct_name)                          \
 if ((err) != CL_SUCCESS)                                            \
 {                                                                   \
-    std_cout                                                        \
-        << "ERROR calling " << fct_name << "() ("                   \
-        << __FILE__ << " line " << __LINE__ << "): "                \
-        << OpenCL_Error_to_String(err) << "\n" << std::flush;               \
-    abort();                                                        \
+    OpenCL_Throw((err), (fct_name), "");                            \
 }
 
 // *****************************************************************************
@@ -89,6 +190,7 @@ class OpenCL_platforms_list;
 class OpenCL_device;
 class OpenCL_devices_list;
 class OpenCL_Kernel;
+class OpenCL_Residency_Manager;
 
 // *****************************************************************************
 // Nvidia extensions. On non-nvidia, needs to define those.
@@ -365,7 +467,7 @@ class OpenCL_platform
         OpenCL_platforms_list *         Platform_List() const               { return platform_list; }
         void                            Print_Preferred() const;
         std::string                     Key() const                         { return key; }
-        std::string   const             Name() const                        { return name; }
+        const std::string &             Name() const                        { return name; }
         cl_platform_id                  Id() const                          { return id; }
         int                             Id_Offset() const                   { return id_offset; }
         void                            Lock_Best_Device();
@@ -390,7 +492,129 @@ class OpenCL_platforms_list
         void                            Set_Preferred_OpenCL(const int _preferred_device = -1);
 };
 
-// **************************************************************
+// *****************************************************************************
+struct OpenCL_Kernel_Statistics
+/**
+ * Device timing of a kernel's launches (see OpenCL_Profiler), in nanoseconds.
+ * Percentiles come from histograms of 8 buckets per power of two (within 6%)
+ * and are never below the profiling timer resolution of the device.
+ */
+{
+    std::string                     name;                   // Kernel name
+    uint64_t                        count;                  // Launches recorded
+    uint64_t                        total_ns;               // Execution (start to end)
+    uint64_t                        mean_ns;
+    uint64_t                        p50_ns;
+    uint64_t                        p99_ns;
+    uint64_t                        max_ns;
+    uint64_t                        submit_delay_mean_ns;   // Queued to submitted to the device
+    uint64_t                        queue_delay_mean_ns;    // Queued to start
+    uint64_t                        queue_delay_p99_ns;
+    uint64_t                        resolution_ns;          // CL_DEVICE_PROFILING_TIMER_RESOLUTION
+};
+
+// *****************************************************************************
+enum OpenCL_Transfer_Direction
+{
+    OPENCL_TRANSFER_HOST_TO_DEVICE,
+    OPENCL_TRANSFER_DEVICE_TO_HOST
+};
+
+// *****************************************************************************
+struct OpenCL_Transfer_Statistics
+/**
+ * Device timing of the transfers of an array, or of all arrays of a device
+ * (see OpenCL_Profiler), in one direction. GB/s are 1e9 bytes per second.
+ */
+{
+    uint64_t                        count;                  // Transfers recorded
+    uint64_t                        bytes;
+    uint64_t                        total_ns;               // Start to end
+    double                          mean_gbps;              // bytes / total_ns
+    double                          last_gbps;
+    double                          best_gbps;
+    double                          peak_gbps;              // Calibrated peak of the device, 0 if unknown
+    uint64_t                        nb_slow;                // Below the slow fraction of the peak
+};
+
+struct OpenCL_Profile_Entry;
+struct OpenCL_Transfer_Record;
+
+// *****************************************************************************
+class OpenCL_Profiler
+/**
+ * Per kernel name statistics of OpenCL_Kernel::Launch(). Off unless enabled
+ * with Enable() or the OCLUTILS_PROFILE environment variable set to "1".
+ * Each launch on a queue created with CL_QUEUE_PROFILING_ENABLE then gets an
+ * event whose timestamps are recorded on completion, from the OpenCL
+ * runtime's callback, without locks. Launches on other queues are skipped
+ * (with a warning). Statistics can be read at any time.
+ * OpenCL_Array::Host_to_Device() and Device_to_Host() are timed the same way,
+ * per array and per device. Once a device's peak is calibrated (or set),
+ * transfers of at least a minimum size running below a fraction of it are
+ * counted as slow and reported: pageable host memory or a degraded link.
+ */
+{
+private:
+    static int enabled;                 // -1 until known
+
+    static void Read_Environment();
+    static OpenCL_Profile_Entry *Entry(const std::string &kernel_name, const cl_device_id device);
+    static void Profile_Launch(OpenCL_Profile_Entry *entry, const cl_command_queue command_queue, cl_event *event);
+
+    friend class OpenCL_Kernel;
+
+public:
+    static bool Is_Enabled();
+    static void Enable(const bool _enabled);
+
+    static std::vector<OpenCL_Kernel_Statistics> Kernel_Statistics();   // Sorted by total time
+    static void Reset();                // Launches completing meanwhile may be partly counted
+    static void Print();
+
+    // Best of "nb_repeats" transfers of "size_bytes" from and to pinned host
+    // memory, on a queue of its own. Sets and returns the peak of "direction".
+    static double Calibrate_Transfers(const cl_context context, const cl_device_id device,
+                                      const OpenCL_Transfer_Direction direction,
+                                      const uint64_t size_bytes = 64 * 1024 * 1024, const int nb_repeats = 5);
+    static void Set_Transfer_Peak(const cl_device_id device, const OpenCL_Transfer_Direction direction, const double gbps);
+    // Transfers of at least "min_size_bytes" below "fraction" of the peak are slow (default 0.5 and 1 MiB).
+    static void Set_Slow_Transfer_Threshold(const double fraction, const uint64_t min_size_bytes = 1024 * 1024);
+    static OpenCL_Transfer_Statistics Transfer_Statistics(const cl_device_id device, const OpenCL_Transfer_Direction direction);
+    static void Reset_Transfers();      // Per device counters only
+};
+
+// *****************************************************************************
+class OpenCL_Trace
+/**
+ * Timeline of the library's activity: platform and device initialization,
+ * lock file waits, context creation, program builds, kernel launches and
+ * array transfers. Host spans are recorded by the calling thread; launches
+ * and transfers on queues created with CL_QUEUE_PROFILING_ENABLE also get
+ * their device span, on a lane per device and queue, placed on the host
+ * clock relative to their enqueue.
+ * Each thread records in a ring buffer of its own, without locks: the oldest
+ * events are overwritten when it is full.
+ * Off unless enabled with Enable() or the OCLUTILS_TRACE environment variable
+ * set to a file name, where the trace is then written at exit. Write() can be
+ * called at any time. The file is in the Chrome trace event format (JSON),
+ * opened by chrome://tracing and https://ui.perfetto.dev.
+ */
+{
+private:
+    static int enabled;                 // -1 until known
+
+    static void Read_Environment();
+
+public:
+    static bool Is_Enabled();
+    // "events_per_thread" applies to the buffers of threads recording for the first time.
+    static void Enable(const bool _enabled, const size_t events_per_thread = 64 * 1024);
+    static void Write(const std::string &filename);     // Recording continues
+    static void Clear();
+};
+
+// *****************************************************************************
 class OpenCL_Kernel
 {
     public:
@@ -411,11 +635,13 @@ class OpenCL_Kernel
 
         size_t *Get_Global_Work_Size() const;
         size_t *Get_Local_Work_Size() const;
+        // CL_KERNEL_WORK_GROUP_SIZE on the device, once built
+        size_t Get_Max_Work_Group_Size() const;
 
         int Get_Dimension() const;
         void Append_Compiler_Option(const std::string option);
 
-        void Launch(const cl_command_queue &command_queue);
+        void Launch(const cl_command_queue &command_queue, cl_event *event = NULL);
 
         static int Get_Multiple(int n, int base);
 
@@ -437,11 +663,14 @@ class OpenCL_Kernel
         cl_kernel kernel;
         size_t *global_work_size;
         size_t *local_work_size;
+        size_t max_work_group_size;
 
         // Debugging variables
         cl_int err;
         cl_event event;
 
+        OpenCL_Profile_Entry *profile;  // Created on the first profiled launch
+
         // Load an OpenCL program from a file
         void Load_Program_From_File();
 
@@ -450,36 +679,363 @@ class OpenCL_Kernel
 };
 
 
+// *****************************************************************************
+struct OpenCL_Memory_Statistics
+/**
+ * Device memory allocated by this process through the library.
+ */
+{
+    uint64_t                        live_bytes;             // Currently allocated
+    uint64_t                        peak_bytes;             // High-water mark of live_bytes
+    uint64_t                        nb_allocations;         // Number of allocations
+    uint64_t                        nb_releases;            // Number of releases
+
+    OpenCL_Memory_Statistics() : live_bytes(0), peak_bytes(0), nb_allocations(0), nb_releases(0) {}
+};
+
+// *****************************************************************************
+namespace OpenCL_Memory
+{
+    // Allocate a buffer and account for it. Same arguments as clCreateBuffer().
+    cl_mem Create_Buffer(cl_context context, cl_mem_flags flags, size_t size,
+                         void *host_ptr, cl_int *err);
+    // Account for a memory object allocated elsewhere (images, for example).
+    void Track(cl_mem memory);
+    // Release a memory object, tracked or not.
+    cl_int Release(cl_mem memory);
+
+    OpenCL_Memory_Statistics Device_Statistics(const cl_device_id device);
+    OpenCL_Memory_Statistics Context_Statistics(const cl_context context);
+    void Print_Statistics();
+}
+
+// *****************************************************************************
+class OpenCL_Resident
+/**
+ * Interface of an object whose device memory can be managed by an
+ * OpenCL_Residency_Manager: released ("evicted") when device memory is
+ * needed elsewhere and re-allocated ("faulted in") when used again.
+ * The host copy is the backing store while the object is not resident.
+ */
+{
+protected:
+    OpenCL_Residency_Manager       *residency_manager;     // NULL if not managed
+    bool                            is_resident;            // Device memory is allocated
+    bool                            device_is_dirty;        // Device holds data newer than the host
+    bool                            host_is_dirty;          // Host holds data newer than the device
+    bool                            device_is_read_only;    // Kernels cannot modify the device memory
+
+    friend class OpenCL_Residency_Manager;                  // Forgets itself when destroyed first
+
+public:
+    OpenCL_Resident() : residency_manager(NULL), is_resident(false), device_is_dirty(false), host_is_dirty(false), device_is_read_only(false) {}
+    virtual ~OpenCL_Resident() {}
+
+    inline bool                     Is_Resident() const                 { return is_resident; }
+    inline bool                     Device_Is_Dirty() const             { return device_is_dirty; }
+    inline bool                     Host_Is_Dirty() const               { return host_is_dirty; }
+    inline void                     Mark_Device_Dirty()                 { if (!device_is_read_only) device_is_dirty = true; }
+    // The device memory was written from the host side without going through
+    // the host copy (OpenCL_File_Loader for example), even if read-only to kernels.
+    inline void                     Mark_Device_Written()               { device_is_dirty = true; }
+    // Prevent (allow) eviction by the residency manager, if any.
+    void                            Pin();
+    void                            Unpin();
+
+    virtual uint64_t                Resident_Size_Bytes() const = 0;    // Device memory used when resident
+    virtual cl_mem                  Resident_Device_Memory() = 0;       // Device memory (NULL if not resident)
+    virtual void                    Evict() = 0;                        // Write back if dirty, release device memory
+    virtual void                    Make_Resident() = 0;                // Allocate device memory and upload host copy if needed
+};
+
+// *****************************************************************************
+class OpenCL_Residency_Manager
+/**
+ * Keep the device memory used by registered arrays under a budget (for
+ * example a fraction of CL_DEVICE_GLOBAL_MEM_SIZE) by evicting the least
+ * recently used arrays to host memory. Arrays bound to a kernel through
+ * Set_as_Kernel_Argument() are faulted back in by OpenCL_Kernel::Launch().
+ * Auxiliary buffers of the arrays (checksums) count against the budget
+ * but are never evicted.
+ * NOTE: Kernel arguments set directly with clSetKernelArg() are not tracked.
+ */
+{
+    private:
+        struct Entry
+        {
+            uint64_t                last_use;               // Logical time of last use
+            int                     pin_count;              // Pinned entries are never evicted
+            bool                    evicted;                // Next allocation is a fault
+        };
+
+        uint64_t                                        budget_bytes;
+        uint64_t                                        resident_bytes;
+        uint64_t                                        clock;
+        uint64_t                                        nb_evictions;
+        uint64_t                                        nb_faults;
+        std::map<OpenCL_Resident *, Entry>              entries;
+        std::map<cl_kernel, std::map<int, std::pair<OpenCL_Resident *, bool> > > bindings; // Array and whether the kernel writes it
+
+        static std::list<OpenCL_Residency_Manager *>    managers;
+
+    public:
+        OpenCL_Residency_Manager();
+        ~OpenCL_Residency_Manager();
+
+        void                            Initialize(const cl_device_id device, const double fraction = 0.9);
+        void                            Set_Budget(const uint64_t _budget_bytes)   { budget_bytes = _budget_bytes; }
+        uint64_t                        Budget() const                          { return budget_bytes; }
+        uint64_t                        Resident_Bytes() const                  { return resident_bytes; }
+
+        void                            Register(OpenCL_Resident *array);
+        void                            Unregister(OpenCL_Resident *array);
+        void                            Touch(OpenCL_Resident *array);
+        void                            Pin(OpenCL_Resident *array);
+        void                            Unpin(OpenCL_Resident *array);
+        void                            Allocated(OpenCL_Resident *array);
+        void                            Released(OpenCL_Resident *array);
+        void                            Reserve(const uint64_t bytes, const OpenCL_Resident *requester);
+        void                            Allocated_Auxiliary(const uint64_t bytes);
+        void                            Released_Auxiliary(const uint64_t bytes);
+        bool                            Evict_Least_Recently_Used(const OpenCL_Resident *requester);
+        void                            Bind(cl_kernel kernel, const int order, OpenCL_Resident *array, const bool kernel_writes = true);
+        void                            Unbind(cl_kernel kernel, const int order);
+        void                            Prepare_Launch(cl_kernel kernel);
+        void                            Print() const;
+
+        static void                     Prepare_Launch_All(cl_kernel kernel);
+        static void                     Unbind_All(cl_kernel kernel, const int order);
+};
+
+// *****************************************************************************
+enum OpenCL_Reduction_Operation
+{
+    OPENCL_REDUCTION_SUM,
+    OPENCL_REDUCTION_MIN,
+    OPENCL_REDUCTION_MAX,
+    OPENCL_REDUCTION_DOT,               // Sum of a[i]*b[i]
+    OPENCL_REDUCTION_NORM               // Euclidean norm: sqrt of the sum of a[i]*a[i]
+};
+
+// *****************************************************************************
+enum OpenCL_Elementwise_Operation
+{
+    OPENCL_ELEMENTWISE_ADD,             // a[i] + b[i]
+    OPENCL_ELEMENTWISE_SUB,             // a[i] - b[i]
+    OPENCL_ELEMENTWISE_MUL,             // a[i] * b[i]
+    OPENCL_ELEMENTWISE_DIV,             // a[i] / b[i]
+    OPENCL_ELEMENTWISE_MIN,             // min(a[i], b[i])
+    OPENCL_ELEMENTWISE_MAX,             // max(a[i], b[i])
+    OPENCL_ELEMENTWISE_AXPY             // alpha * a[i] + b[i]
+};
+
+// *****************************************************************************
+enum OpenCL_Backend
+/**
+ * Where an array operation runs.
+ */
+{
+    OPENCL_BACKEND_AUTO,                // Host if the arrays are small enough (see OpenCL_Host_Backend) and their host copies current
+    OPENCL_BACKEND_DEVICE,              // Enqueued on the command queue
+    OPENCL_BACKEND_HOST                 // On the host arrays, by OpenCL_Host_Backend
+};
+
+// *****************************************************************************
+enum OpenCL_Backend_Operation
+{
+    OPENCL_OPERATION_FILL,
+    OPENCL_OPERATION_COPY,
+    OPENCL_OPERATION_REDUCE,
+    OPENCL_OPERATION_ELEMENTWISE,
+    OPENCL_NB_OPERATIONS
+};
+
+// *****************************************************************************
+class OpenCL_Host_Backend
+/**
+ * Host implementation of the array operations (fill, copy, reductions and
+ * element-wise operations) on plain host memory: large ranges are split in
+ * contiguous chunks processed by a pool of threads (started on first use),
+ * with SSE2 for float and double. Usable without any OpenCL device.
+ *
+ * With OPENCL_BACKEND_AUTO, arrays run an operation on the host when their
+ * host copy is current (coherent arrays whose device is not dirty, or
+ * evicted arrays) and their size is below the device's threshold for that
+ * operation. Calibrate() measures the thresholds by timing both sides;
+ * default_threshold is used until then.
+ */
+{
+private:
+    static int nb_threads;
+    static std::map<cl_device_id, std::vector<uint64_t> > thresholds;     // Bytes, per operation
+
+public:
+    static const uint64_t default_threshold = 256 * 1024;
+
+    static int          Nb_Threads();
+    static void         Set_Nb_Threads(const int _nb_threads);  // Before first use (default: online processors)
+    static uint64_t     Threshold(const cl_device_id device, const OpenCL_Backend_Operation operation);
+    static void         Set_Threshold(const cl_device_id device, const OpenCL_Backend_Operation operation, const uint64_t bytes);
+    static void         Calibrate(cl_context &context, cl_command_queue &command_queue, cl_device_id &device);
+
+    // Run function(argument, chunk, begin, end) over contiguous chunks of [0, n)
+    // of at least min_chunk elements, in parallel. Nb_Chunks() tells how many.
+    static int          Nb_Chunks(const uint64_t n, const uint64_t min_chunk);
+    static void         Parallel_For(const uint64_t n, const uint64_t min_chunk,
+                                     void (*function)(void *, const int, const uint64_t, const uint64_t),
+                                     void *argument);
+
+    template <class T> static void  Fill(T *array, const uint64_t n, const T &value);
+    template <class T> static void  Copy(T *destination, const T *source, const uint64_t n);
+    // "b" is only read by OPENCL_REDUCTION_DOT.
+    template <class T> static T     Reduce(const OpenCL_Reduction_Operation operation,
+                                           const T *a, const T *b, const uint64_t n);
+    // out[i] = a[i] op b[i] ("alpha" is only used by OPENCL_ELEMENTWISE_AXPY).
+    template <class T> static void  Elementwise(const OpenCL_Elementwise_Operation operation, T *out,
+                                                const T *a, const T *b, const T &alpha, const uint64_t n);
+};
+
+// *****************************************************************************
+enum OpenCL_Checksum_Mode
+/**
+ * How a checksummed OpenCL_Array hashes its data (see Validate_Data()).
+ */
+{
+    OPENCL_CHECKSUM_FLAT,               // Hash of the whole array: a single work item on the device
+    OPENCL_CHECKSUM_TREE                // Hash of the hashes of fixed size leaves, hashed in parallel
+};
+
+// *****************************************************************************
+enum OpenCL_Checksum_Algorithm
+/**
+ * Hash used by a checksummed OpenCL_Array. CRC32C and XXH64 catch transfer
+ * corruption at a fraction of the cost of SHA-512, but not tampering.
+ */
+{
+    OPENCL_CHECKSUM_SHA512,
+    OPENCL_CHECKSUM_CRC32C,             // CRC32C of the whole array in both modes (leaf CRCs combine exactly)
+    OPENCL_CHECKSUM_XXH64               // XXH64 (seed 0) of the array, or of the leaf XXH64s in tree mode
+};
+int OpenCL_Checksum_Size(const OpenCL_Checksum_Algorithm algorithm);    // Bytes
+
+// *****************************************************************************
+enum OpenCL_Validation_Policy
+/**
+ * When an OpenCL_Array checks its device copy against its host copy (see
+ * Validate_Data()).
+ */
+{
+    OPENCL_VALIDATE_DEFAULT,            // Arrays only: follow the process policy (see OpenCL_Validation)
+    OPENCL_VALIDATE_OFF,
+    OPENCL_VALIDATE_ON_INITIALIZE,      // Once, after Initialize() uploads the array
+    OPENCL_VALIDATE_EVERY_TRANSFER,     // After every Host_to_Device() and Device_to_Host()
+    OPENCL_VALIDATE_SAMPLED             // After the first transfer and every Nth one
+};
+
+// *****************************************************************************
+class OpenCL_Validation
+/**
+ * Process policy, used by arrays initialized with checksumming requested and
+ * no policy of their own. Read on first use from the OCLUTILS_VALIDATE
+ * environment variable: "off" (default), "initialize", "transfer", or a
+ * number N to validate every Nth transfer. Costs nothing when off: the
+ * checksum kernel is only built on an array's first validation.
+ */
+{
+private:
+    static OpenCL_Validation_Policy policy;
+    static uint64_t period;
+
+    static void Read_Environment();
+
+public:
+    static OpenCL_Validation_Policy Policy();
+    static uint64_t Period();
+    static void Set_Policy(const OpenCL_Validation_Policy _policy, const uint64_t _period = 1);
+};
+
+// *****************************************************************************
+struct OpenCL_Copy_Range
+/**
+ * Range of elements to copy between two arrays (see OpenCL_Array::Copy_From()).
+ */
+{
+    int src_offset;                     // First element to read in the source array
+    int dst_offset;                     // First element to write in the destination array
+    int count;                          // Number of elements to copy
+
+    OpenCL_Copy_Range(const int _src_offset, const int _dst_offset, const int _count)
+        : src_offset(_src_offset), dst_offset(_dst_offset), count(_count) {}
+};
+
 // *****************************************************************************
 template <class T>
-class OpenCL_Array
+class OpenCL_Array : public OpenCL_Resident
 {
 private:
-    bool array_is_padded;               // Will the array need to be padded for checksumming?
     int N;                              // Number of elements in array
     size_t sizeof_element;              // Size of each array elements
-    uint64_t new_array_size_bytes;      // Size (bytes) of new padded array
-    T     *host_array;                  // Pointer to start of host array, INCLUDIǸG padding
+    uint64_t new_array_size_bytes;      // Size (bytes) of the array
+    T     *host_array;                  // Pointer to start of host array
     uint64_t nb_1024bits_blocks;        // Number of 1024 bits blocks in padded array
     std::string platform;               // OpenCL platform
     cl_context context;                 // OpenCL context
     cl_command_queue command_queue;     // OpenCL command queue
     cl_device_id device;                // OpenCL device
+    cl_mem_flags flags;                 // Flags used to allocate the device buffer
     cl_int err;                         // Error code
 
-    uint8_t host_checksum[64];          // SHA512 checksum on host memory (512 bits)
-    uint8_t device_checksum[64];        // SHA512 checksum on device memory (512 bits)
-    static const int buff_size_checksum = sizeof(uint8_t) * 64;
+    uint8_t host_checksum[64];          // Checksum on host memory (big-endian, OpenCL_Checksum_Size() bytes)
+    uint8_t device_checksum[64];        // Checksum on device memory
 
     OpenCL_Kernel kernel_checksum;      // Kernel for checksum calculation
+    OpenCL_Checksum_Mode checksum_mode; // See Set_Checksum_Mode()
+    OpenCL_Checksum_Algorithm checksum_algorithm; // See Set_Checksum_Algorithm()
+    uint64_t checksum_leaf_size;        // Size (bytes) of the leaves in tree mode
+    OpenCL_Validation_Policy validation_policy; // See Set_Validation_Policy()
+    uint64_t validation_period;         // N of OPENCL_VALIDATE_SAMPLED
+    uint64_t nb_transfers;              // Transfers since Initialize(), for OPENCL_VALIDATE_SAMPLED
+    bool checksum_requested;            // Initialize()'s _checksum_array
+    uint64_t mismatch_block_size;       // See Set_Mismatch_Report()
+    std::string mismatch_dump_filename; // Bad blocks are written there if not empty
+    OpenCL_Kernel kernel_fill;          // Kernel for Fill() on OpenCL 1.1 devices (built on first use)
 
     // Allocated memory on device
     cl_mem device_array;                // Memory of device
     cl_mem cl_array_size_bit;
-    cl_mem cl_sha512sum;
+    cl_mem cl_sha512sum;                // Leaf checksums (a single one in flat mode, except for CRC32C)
+
+    // File mapped as host array (see Initialize_From_File())
+    void *mapped_address;               // Start of the mapping (page aligned), NULL if not mapped
+    size_t mapped_length;               // Length of the mapping
+    bool mapped_write_back;             // Mapping is shared: host modifications reach the file
+
+    bool coherent;                      // Coherence mode (see Set_Coherent())
+    bool host_read_pending;             // A non-blocking Device_to_Host() might still be running
+    OpenCL_Transfer_Record *transfer_record; // Created on the first profiled transfer
+
+    void Allocate_Device_Memory();
+    uint64_t Checksum_Leaf_Size() const;
+    void Initialize_Checksum();
+    void Launch_Leaf_Checksums(const cl_ulong leaf_size, cl_mem leaf_checksums);
+    void Validate_Transfer();
+    void Report_Mismatch();
 
 public:
     OpenCL_Array();
+    ~OpenCL_Array();
+    void Set_Residency_Manager(OpenCL_Residency_Manager *manager);
+    void Set_Coherent(const bool _coherent = true);
+    inline bool Is_Coherent() const     { return coherent; }
+    // Before the first validation. "leaf_size" must be a multiple of 128 bytes.
+    void Set_Checksum_Mode(const OpenCL_Checksum_Mode mode, const uint64_t leaf_size = 64 * 1024);
+    void Set_Checksum_Algorithm(const OpenCL_Checksum_Algorithm algorithm);   // Before the first validation
+    void Set_Validation_Policy(const OpenCL_Validation_Policy policy, const uint64_t period = 1);
+    OpenCL_Validation_Policy Validation_Policy() const; // Never OPENCL_VALIDATE_DEFAULT
+    // How Validate_Data() localizes a mismatch. "block_size" must be a multiple of 128 bytes.
+    void Set_Mismatch_Report(const uint64_t block_size = 64 * 1024, const std::string &dump_filename = "");
+    // OPENCL_BACKEND_AUTO would run "operation" on the host for this array.
+    bool Host_Is_Preferred(const OpenCL_Backend_Operation operation) const;
     void Initialize(int _N, const size_t _sizeof_element,
                     T *&host_array,
                     cl_context &_context, cl_mem_flags flags,
@@ -487,16 +1043,576 @@ public:
                     cl_command_queue &_command_queue,
                     cl_device_id &_device,
                     const bool _checksum_array);
+    void Initialize_From_File(const std::string &filename, const uint64_t offset, int _N,
+                              const size_t _sizeof_element,
+                              cl_context &_context, cl_mem_flags _flags,
+                              std::string _platform,
+                              cl_command_queue &_command_queue,
+                              cl_device_id &_device,
+                              const bool write_back = false);
+    void Sync_to_File();
     void Release_Memory();
     void Host_to_Device();
     void Device_to_Host();
+    // Transfers timed while OpenCL_Profiler is enabled (the last ones might still be running).
+    OpenCL_Transfer_Statistics Transfer_Statistics(const OpenCL_Transfer_Direction direction) const;
     std::string Host_Checksum();
     std::string Device_Checksum();
     void Validate_Data();
 
+    // Device side operations. They are enqueued on the array's command queue
+    // and return an event the caller must release (clReleaseEvent()).
+    // With the host backend, the host array is modified instead and the
+    // returned event is already complete.
+    cl_event Fill(const T &value, const int offset = 0, const int count = -1,
+                  const OpenCL_Backend backend = OPENCL_BACKEND_AUTO);
+    cl_event Copy_From(OpenCL_Array<T> &other, const int src_offset = 0,
+                       const int dst_offset = 0, const int count = -1,
+                       const OpenCL_Backend backend = OPENCL_BACKEND_AUTO);
+    cl_event Copy_From(OpenCL_Array<T> &other, const std::vector<OpenCL_Copy_Range> &ranges,
+                       const OpenCL_Backend backend = OPENCL_BACKEND_AUTO);
+    cl_event Clone(OpenCL_Array<T> &clone, T *clone_host_array);
+
+    // Host accessors for coherence mode. They wait for (or start) the
+    // transfers needed for the host array to be current.
+    T *      Host_Read();               // Host array will only be read
+    T *      Host_Write();              // Host array will be modified
+    T *      Host_Overwrite();          // Host array will be entirely overwritten: no transfer
+
+    inline int      Get_N() const      { return N; }
+    inline size_t   Get_Sizeof_Element() const { return sizeof_element; }
     inline cl_mem * Get_Device_Array() { return &device_array; }
-    inline T *      Get_Host_Pointer() { return  host_array;   }
+    inline T *      Get_Host_Pointer() { return  host_array;   }   // Not tracked in coherence mode: see Set_Coherent()
+    void Set_as_Kernel_Argument(cl_kernel &kernel, const int order, const bool kernel_writes = true);
+
+    // OpenCL_Resident interface
+    uint64_t Resident_Size_Bytes() const    { return new_array_size_bytes; }
+    cl_mem   Resident_Device_Memory()       { return device_array; }
+    void     Evict();
+    void     Make_Resident();
+};
+
+// *****************************************************************************
+template <class T>
+class OpenCL_Sharded_Array
+/**
+ * Array spanning multiple device buffers ("shards"), each one smaller than
+ * the device's CL_DEVICE_MAX_MEM_ALLOC_SIZE. This allows a single logical
+ * array to use more than the per-allocation limit (often only a quarter of
+ * the global memory).
+ * Kernels can receive either all the shards as consecutive arguments
+ * (Set_as_Kernel_Arguments()) or be launched once per shard (Launch_per_Shard()).
+ */
+{
+private:
+    uint64_t N;                         // Total number of elements in array
+    size_t sizeof_element;              // Size of each array elements
+    uint64_t max_shard_size_bytes;      // Maximum size (bytes) of a single shard
+    uint64_t N_per_shard;               // Number of elements per shard (last shard might be smaller)
+    T     *host_array;                  // Pointer to start of host array
+    OpenCL_Residency_Manager *residency_manager; // Passed to every shard (optional)
+    bool coherent;                      // Passed to every shard
+    cl_int err;                         // Error code
+
+    std::vector<OpenCL_Array<T> > shards;
+
+public:
+    OpenCL_Sharded_Array();
+    void Set_Residency_Manager(OpenCL_Residency_Manager *manager) { residency_manager = manager; }
+    void Set_Coherent(const bool _coherent = true);
+    void Initialize(uint64_t _N, const size_t _sizeof_element,
+                    T *_host_array,
+                    cl_context &_context, cl_mem_flags flags,
+                    std::string _platform,
+                    cl_command_queue &_command_queue,
+                    cl_device_id &_device,
+                    const uint64_t _max_shard_size_bytes = 0);
+    void Release_Memory();
+    void Host_to_Device();
+    void Device_to_Host();
+
+    inline int              Nb_Shards() const               { return int(shards.size()); }
+    inline uint64_t         Shard_Offset(const int i) const { return uint64_t(i) * N_per_shard; }
+    uint64_t                Shard_Size(const int i) const;
+    inline OpenCL_Array<T> &Shard(const int i)              { return shards[i]; }
+    inline T *              Get_Host_Pointer()              { return host_array; }
+
+    void Set_as_Kernel_Arguments(cl_kernel &kernel, const int first_order);
+    void Launch_per_Shard(OpenCL_Kernel &kernel, const int order_array,
+                          const int order_offset, const int order_size,
+                          const cl_command_queue &command_queue);
+};
+
+// *****************************************************************************
+// Image channel data type matching a host type. Types without a matching
+// OpenCL image channel type (double, for example) are left undefined on purpose.
+template <class T> struct OpenCL_Image_Channel_Type;
+template <> struct OpenCL_Image_Channel_Type<float>             { static const cl_channel_type value = CL_FLOAT;            };
+template <> struct OpenCL_Image_Channel_Type<int>               { static const cl_channel_type value = CL_SIGNED_INT32;     };
+template <> struct OpenCL_Image_Channel_Type<unsigned int>      { static const cl_channel_type value = CL_UNSIGNED_INT32;   };
+template <> struct OpenCL_Image_Channel_Type<short>             { static const cl_channel_type value = CL_SIGNED_INT16;     };
+template <> struct OpenCL_Image_Channel_Type<unsigned short>    { static const cl_channel_type value = CL_UNSIGNED_INT16;   };
+template <> struct OpenCL_Image_Channel_Type<char>              { static const cl_channel_type value = CL_SIGNED_INT8;      };
+template <> struct OpenCL_Image_Channel_Type<unsigned char>     { static const cl_channel_type value = CL_UNSIGNED_INT8;    };
+
+// *****************************************************************************
+template <class T>
+class OpenCL_Image_Array
+/**
+ * Array stored on the device as a 2D (depth == 1) or 3D image instead of a
+ * buffer, so kernels can read it through the texture path (read_imagef(), ...)
+ * with an optional sampler. Each pixel holds "nb_channels" (1, 2 or 4)
+ * consecutive elements of the host array.
+ */
+{
+private:
+    int width;                          // Image width (pixels)
+    int height;                         // Image height (pixels)
+    int depth;                          // Image depth (pixels), 1 for 2D images
+    int nb_channels;                    // Number of elements per pixel (1, 2 or 4)
+    T     *host_array;                  // Pointer to start of host array
+    cl_image_format format;             // Image format (derived from T and nb_channels)
+    cl_context context;                 // OpenCL context
+    cl_command_queue command_queue;     // OpenCL command queue
+    cl_device_id device;                // OpenCL device
+    cl_mem_flags flags;                 // Flags used to allocate the image
+    cl_int err;                         // Error code
+
+    // Allocated memory on device
+    cl_mem device_image;                // Image on device
+    cl_sampler sampler;                 // Sampler (optional, see Create_Sampler())
+
+    void Validate_Size();
+
+public:
+    OpenCL_Image_Array();
+    void Initialize(const int _width, const int _height, const int _depth,
+                    const int _nb_channels, T *_host_array,
+                    cl_context &_context, cl_mem_flags _flags,
+                    cl_command_queue &_command_queue,
+                    cl_device_id &_device);
+    void Create_Sampler(const bool normalized_coordinates = false,
+                        const cl_addressing_mode addressing_mode = CL_ADDRESS_CLAMP_TO_EDGE,
+                        const cl_filter_mode filter_mode = CL_FILTER_LINEAR);
+    void Release_Memory();
+    void Host_to_Device();
+    void Device_to_Host();
+
+    inline bool     Is_3D() const       { return depth > 1; }
+    inline cl_mem * Get_Device_Image()  { return &device_image; }
+    inline T *      Get_Host_Pointer()  { return  host_array;   }
     void Set_as_Kernel_Argument(cl_kernel &kernel, const int order);
+    void Set_Sampler_as_Kernel_Argument(cl_kernel &kernel, const int order);
+};
+
+// *****************************************************************************
+struct OpenCL_SoA_Field
+/**
+ * Member of a structure stored in its own device buffer by OpenCL_SoA_Array.
+ */
+{
+    std::string name;
+    size_t offset;                      // offsetof() the member in the structure
+    size_t size;                        // sizeof() the member
+
+    OpenCL_SoA_Field(const std::string &_name, const size_t _offset, const size_t _size)
+        : name(_name), offset(_offset), size(_size) {}
+};
+
+// Add a structure's member as a field, for example:
+//     OpenCL_SoA_Add_Field(particles, Particle, position_x);
+#define OpenCL_SoA_Add_Field(soa, Struct, member)                   \
+    (soa).Add_Field(#member, offsetof(Struct, member), sizeof(((Struct *) 0)->member))
+
+// *****************************************************************************
+class OpenCL_SoA_Array
+/**
+ * Array of structures (AoS) on the host stored as a structure of arrays (SoA)
+ * on the device: one buffer per field. Work items reading the same field of
+ * consecutive elements then access consecutive addresses (coalesced) instead
+ * of addresses sizeof(struct) apart.
+ * The layout is converted on the host (SSE2 when available) when uploading
+ * and downloading; the structure array itself is never modified otherwise.
+ */
+{
+private:
+    int N;                              // Number of structures
+    size_t sizeof_struct;               // Size (bytes) of a structure (its stride)
+    char *aos_host_array;               // User's array of structures
+    cl_command_queue command_queue;     // OpenCL command queue
+    OpenCL_Residency_Manager *residency_manager; // Passed to every field (optional)
+    cl_int err;                         // Error code
+
+    std::vector<OpenCL_SoA_Field>       fields;
+    std::vector<char *>                 soa_host_arrays;    // Host copy of each field (SoA layout)
+    std::vector<OpenCL_Array<char> >    field_arrays;       // Device buffer of each field
+
+public:
+    OpenCL_SoA_Array();
+    void Set_Residency_Manager(OpenCL_Residency_Manager *manager) { residency_manager = manager; }
+    void Add_Field(const std::string &name, const size_t offset, const size_t size);
+    void Initialize(const int _N, const size_t _sizeof_struct, void *_aos_host_array,
+                    cl_context &_context, cl_mem_flags flags,
+                    std::string _platform,
+                    cl_command_queue &_command_queue,
+                    cl_device_id &_device);
+    void Release_Memory();
+    void Host_to_Device();
+    void Device_to_Host();              // Blocking: the structures are updated on return
+
+    inline int                  Nb_Fields() const               { return int(fields.size()); }
+    int                         Field_Index(const std::string &name) const;
+    inline OpenCL_Array<char> & Field(const int i)              { return field_arrays[i]; }
+
+    // Fields are passed as consecutive arguments, in the order they were added.
+    void Set_as_Kernel_Arguments(cl_kernel &kernel, const int first_order);
+};
+
+template <class T> class OpenCL_Reducer;
+
+// *****************************************************************************
+template <class T>
+class OpenCL_Reduction_Result
+/**
+ * Result of an asynchronous reduction (see OpenCL_Reducer). The per work-group
+ * partial results are read back without blocking; Get() waits for them and
+ * finishes the reduction on the host. Copies share the same result.
+ */
+{
+private:
+    struct State
+    {
+        int                         references;
+        cl_event                    event;          // Read of the partial results
+        std::vector<T>              partials;
+        OpenCL_Reduction_Operation  operation;
+        bool                        done;
+        T                           value;
+    };
+    State *state;
+
+    OpenCL_Reduction_Result(State *_state) : state(_state) {}
+    void Release();
+
+    friend class OpenCL_Reducer<T>;
+
+public:
+    OpenCL_Reduction_Result() : state(NULL) {}
+    OpenCL_Reduction_Result(const OpenCL_Reduction_Result<T> &other);
+    OpenCL_Reduction_Result<T> & operator=(const OpenCL_Reduction_Result<T> &other);
+    ~OpenCL_Reduction_Result() { Release(); }
+
+    bool        Is_Ready() const;       // Get() would not block
+    T           Get();                  // Wait for and return the result
+    cl_event    Get_Event() const;      // Completes when the partial results are on the host
+};
+
+// *****************************************************************************
+template <class T>
+class OpenCL_Reducer
+/**
+ * Reductions (sum, min, max, dot product, norm) over OpenCL_Array, built from
+ * an embedded kernel source and tuned for the device:
+ *   - GPUs: work-groups of up to 256 work items (limited by the local memory
+ *     size and the kernel's maximum work-group size, a multiple of the
+ *     preferred work-group size multiple) accumulate with vector loads of
+ *     the device's preferred vector width, then reduce in local memory;
+ *   - CPUs: a single pass where one work item per compute unit reduces a
+ *     contiguous chunk, without local memory or barriers.
+ * The few partial results are combined on the host when the result is read.
+ * Reductions on the same reducer must be enqueued on an in-order queue.
+ */
+{
+private:
+    cl_context context;                 // OpenCL context
+    cl_command_queue command_queue;     // OpenCL command queue
+    cl_device_id device;                // OpenCL device
+    bool device_is_cpu;                 // Use the single pass variant
+    cl_uint vector_width;               // Elements per vector load (1, 2, 4, 8 or 16)
+    size_t max_local_size;              // Work-group size limit from the device
+    size_t max_nb_groups;               // Maximum number of work-groups (and partial results)
+    cl_mem partials;                    // Partial results (one per work-group)
+    cl_int err;                         // Error code
+
+    std::map<int, OpenCL_Kernel *> kernels;     // One per operation, built on first use
+    std::map<int, size_t> local_sizes;          // Work-group size of each kernel
+
+    OpenCL_Kernel &                 Kernel(const OpenCL_Reduction_Operation operation, size_t &local_size);
+    OpenCL_Reduction_Result<T>      Reduce(const OpenCL_Reduction_Operation operation,
+                                           OpenCL_Array<T> &a, OpenCL_Array<T> *b,
+                                           const OpenCL_Backend backend);
+
+public:
+    OpenCL_Reducer();
+    ~OpenCL_Reducer();
+    void Initialize(cl_context &_context, cl_command_queue &_command_queue, cl_device_id &_device);
+    void Release_Memory();
+
+    // With the host backend, the result is computed before returning.
+    OpenCL_Reduction_Result<T>      Sum(OpenCL_Array<T> &a, const OpenCL_Backend backend = OPENCL_BACKEND_AUTO)
+                                        { return Reduce(OPENCL_REDUCTION_SUM,  a, NULL, backend); }
+    OpenCL_Reduction_Result<T>      Min(OpenCL_Array<T> &a, const OpenCL_Backend backend = OPENCL_BACKEND_AUTO)
+                                        { return Reduce(OPENCL_REDUCTION_MIN,  a, NULL, backend); }
+    OpenCL_Reduction_Result<T>      Max(OpenCL_Array<T> &a, const OpenCL_Backend backend = OPENCL_BACKEND_AUTO)
+                                        { return Reduce(OPENCL_REDUCTION_MAX,  a, NULL, backend); }
+    OpenCL_Reduction_Result<T>      Dot(OpenCL_Array<T> &a, OpenCL_Array<T> &b, const OpenCL_Backend backend = OPENCL_BACKEND_AUTO)
+                                        { return Reduce(OPENCL_REDUCTION_DOT,  a, &b,   backend); }
+    OpenCL_Reduction_Result<T>      Norm(OpenCL_Array<T> &a, const OpenCL_Backend backend = OPENCL_BACKEND_AUTO)
+                                        { return Reduce(OPENCL_REDUCTION_NORM, a, NULL, backend); }
+};
+
+// *****************************************************************************
+template <class T>
+class OpenCL_Elementwise
+/**
+ * Element-wise operations out = a op b over OpenCL_Array, on the device
+ * (one kernel per operation, built on first use from an embedded source) or
+ * on the host (OpenCL_Host_Backend). "out" can be "a" or "b".
+ */
+{
+private:
+    cl_context context;                 // OpenCL context
+    cl_command_queue command_queue;     // OpenCL command queue
+    cl_device_id device;                // OpenCL device
+    cl_int err;                         // Error code
+
+    std::map<int, OpenCL_Kernel *> kernels;     // One per operation, built on first use
+    std::map<int, size_t> local_sizes;          // Work-group size of each kernel
+
+    OpenCL_Kernel & Kernel(const OpenCL_Elementwise_Operation operation, size_t &local_size);
+
+public:
+    OpenCL_Elementwise();
+    ~OpenCL_Elementwise();
+    void Initialize(cl_context &_context, cl_command_queue &_command_queue, cl_device_id &_device);
+    void Release_Memory();
+
+    // Returns an event the caller must release (clReleaseEvent()), already
+    // complete with the host backend.
+    cl_event Apply(const OpenCL_Elementwise_Operation operation, OpenCL_Array<T> &out,
+                   OpenCL_Array<T> &a, OpenCL_Array<T> &b, const T &alpha = T(0),
+                   const OpenCL_Backend backend = OPENCL_BACKEND_AUTO);
+
+    cl_event Add(OpenCL_Array<T> &out, OpenCL_Array<T> &a, OpenCL_Array<T> &b, const OpenCL_Backend backend = OPENCL_BACKEND_AUTO)
+                    { return Apply(OPENCL_ELEMENTWISE_ADD, out, a, b, T(0), backend); }
+    cl_event Sub(OpenCL_Array<T> &out, OpenCL_Array<T> &a, OpenCL_Array<T> &b, const OpenCL_Backend backend = OPENCL_BACKEND_AUTO)
+                    { return Apply(OPENCL_ELEMENTWISE_SUB, out, a, b, T(0), backend); }
+    cl_event Mul(OpenCL_Array<T> &out, OpenCL_Array<T> &a, OpenCL_Array<T> &b, const OpenCL_Backend backend = OPENCL_BACKEND_AUTO)
+                    { return Apply(OPENCL_ELEMENTWISE_MUL, out, a, b, T(0), backend); }
+    cl_event Div(OpenCL_Array<T> &out, OpenCL_Array<T> &a, OpenCL_Array<T> &b, const OpenCL_Backend backend = OPENCL_BACKEND_AUTO)
+                    { return Apply(OPENCL_ELEMENTWISE_DIV, out, a, b, T(0), backend); }
+    cl_event Min(OpenCL_Array<T> &out, OpenCL_Array<T> &a, OpenCL_Array<T> &b, const OpenCL_Backend backend = OPENCL_BACKEND_AUTO)
+                    { return Apply(OPENCL_ELEMENTWISE_MIN, out, a, b, T(0), backend); }
+    cl_event Max(OpenCL_Array<T> &out, OpenCL_Array<T> &a, OpenCL_Array<T> &b, const OpenCL_Backend backend = OPENCL_BACKEND_AUTO)
+                    { return Apply(OPENCL_ELEMENTWISE_MAX, out, a, b, T(0), backend); }
+    // out = alpha * x + y
+    cl_event Axpy(OpenCL_Array<T> &out, const T &alpha, OpenCL_Array<T> &x, OpenCL_Array<T> &y, const OpenCL_Backend backend = OPENCL_BACKEND_AUTO)
+                    { return Apply(OPENCL_ELEMENTWISE_AXPY, out, x, y, alpha, backend); }
+};
+
+// *****************************************************************************
+template <class T>
+class OpenCL_Scan
+/**
+ * Exclusive and inclusive prefix sums over OpenCL_Array, in three phases:
+ * each block is scanned and its total recorded, the block totals are
+ * scanned (recursively), then added back to the blocks.
+ *   - GPUs: blocks of twice the work-group size are scanned in local memory
+ *     with the work-efficient (Blelloch) up-sweep/down-sweep, padded against
+ *     local memory bank conflicts;
+ *   - CPUs: one work item per chunk scans sequentially, about four chunks
+ *     per compute unit.
+ * Scans on the same object must be enqueued on an in-order queue.
+ */
+{
+private:
+    cl_context context;                 // OpenCL context
+    cl_command_queue command_queue;     // OpenCL command queue
+    cl_device_id device;                // OpenCL device
+    bool device_is_cpu;                 // Use the sequential chunks variant
+    size_t local_size;                  // Work-group size (GPUs: blocks of 2 x local_size elements)
+    cl_uint log_nb_banks;               // Local memory padding (GPUs)
+    size_t nb_chunks;                   // Work items per pass (CPUs)
+    cl_int err;                         // Error code
+
+    OpenCL_Kernel kernel_blocks;        // Scan of the blocks (or chunks)
+    OpenCL_Kernel kernel_add;           // Add the scanned block totals
+
+    std::vector<cl_mem>     level_sums;         // Block totals of each recursion level
+    std::vector<uint64_t>   level_capacities;   // Number of elements of each level_sums buffer
+
+    void Enqueue_Level(cl_mem in, cl_mem out, const uint64_t n, const bool inclusive, const size_t level);
+    cl_event Scan(OpenCL_Array<T> &in, OpenCL_Array<T> &out, const bool inclusive);
+
+public:
+    OpenCL_Scan();
+    ~OpenCL_Scan();
+    void Initialize(cl_context &_context, cl_command_queue &_command_queue, cl_device_id &_device);
+    void Release_Memory();
+
+    // "in" and "out" can be the same array. They return an event the
+    // caller must release (clReleaseEvent()).
+    cl_event Exclusive(OpenCL_Array<T> &in, OpenCL_Array<T> &out)     { return Scan(in, out, false); }
+    cl_event Inclusive(OpenCL_Array<T> &in, OpenCL_Array<T> &out)     { return Scan(in, out, true);  }
+    cl_event Exclusive(OpenCL_Array<T> &array)                          { return Scan(array, array, false); }
+    cl_event Inclusive(OpenCL_Array<T> &array)                          { return Scan(array, array, true);  }
+
+    // Scan "n" elements of raw buffers (can be the same), without an event.
+    void Enqueue(cl_mem in, cl_mem out, const uint64_t n, const bool inclusive);
+};
+
+// *****************************************************************************
+template <class K>
+class OpenCL_Radix_Sort
+/**
+ * Stable least significant digit radix sort of 32 bits (unsigned int, int,
+ * float) or 64 bits (cl_ulong, double) keys, optionally moving values
+ * (elements of 4, 8 or 16 bytes) along. Each pass counts the digits of
+ * contiguous chunks (one per work item), scans the counts (OpenCL_Scan) and
+ * scatters every chunk in order, which keeps the sort stable without any
+ * ranking in local memory. Signed and floating point keys are made
+ * order-preserving on the fly (negative zero sorts before zero).
+ *   - GPUs: 4 bits digits, so the per work item counters stay in registers,
+ *     and enough work items to fill the compute units;
+ *   - CPUs: 8 bits digits (half the passes) and one work item per compute unit.
+ * The sorted keys (values) end up in the given arrays, which must be
+ * writable by kernels. Sorts must be enqueued on an in-order queue.
+ */
+{
+private:
+    cl_context context;                 // OpenCL context
+    cl_command_queue command_queue;     // OpenCL command queue
+    cl_device_id device;                // OpenCL device
+    bool device_is_cpu;                 // Tuning for CPUs
+    cl_uint radix_bits;                 // Bits per digit (4 or 8)
+    size_t local_size;                  // Work-group size
+    size_t max_nb_items;                // Maximum number of work items (chunks) per pass
+    cl_int err;                         // Error code
+
+    OpenCL_Scan<cl_uint> scan;          // Scan of the digit counts
+    OpenCL_Kernel kernel_histogram;     // Digit counts of each chunk
+    std::map<size_t, OpenCL_Kernel *> kernels_scatter;  // By size of the values (0: keys only)
+
+    cl_mem keys_tmp;                    // Ping-pong buffers
+    cl_mem values_tmp;
+    cl_mem histogram;                   // Digit counts, digit major
+    uint64_t keys_tmp_capacity;         // Sizes (bytes) of the above
+    uint64_t values_tmp_capacity;
+    uint64_t histogram_capacity;
+
+    OpenCL_Kernel & Kernel_Scatter(const size_t sizeof_value);
+    cl_mem          Buffer(cl_mem &buffer, uint64_t &capacity, const uint64_t size);
+    cl_event        Sort(OpenCL_Resident &keys, const int n, const size_t sizeof_key,
+                         OpenCL_Resident *values, const int nb_values, const size_t sizeof_value);
+
+public:
+    OpenCL_Radix_Sort();
+    ~OpenCL_Radix_Sort();
+    void Initialize(cl_context &_context, cl_command_queue &_command_queue, cl_device_id &_device);
+    void Release_Memory();
+
+    // Both return an event the caller must release (clReleaseEvent()).
+    cl_event Sort(OpenCL_Array<K> &keys)
+    {
+        return Sort(keys, keys.Get_N(), keys.Get_Sizeof_Element(), NULL, 0, 0);
+    }
+    template <class V>
+    cl_event Sort(OpenCL_Array<K> &keys, OpenCL_Array<V> &values)
+    {
+        return Sort(keys, keys.Get_N(), keys.Get_Sizeof_Element(),
+                    &values, values.Get_N(), values.Get_Sizeof_Element());
+    }
+};
+
+// *****************************************************************************
+class OpenCL_File_Reader; // Defined in OclUtils.cpp (io_uring or thread pool)
+
+// *****************************************************************************
+class OpenCL_File_Loader
+/**
+ * Load file ranges into device memory through a ring of pinned host staging
+ * buffers. While some buffers are being filled from the file (io_uring when
+ * available, a pool of pread() threads otherwise), the filled ones are
+ * uploaded asynchronously: disk reads and host to device transfers overlap.
+ * Give the loader its own command queue to also overlap kernels running on
+ * previously loaded data.
+ */
+{
+private:
+    cl_context context;                 // OpenCL context
+    cl_command_queue command_queue;     // Queue used for the uploads
+    int nb_buffers;                     // Number of staging buffers in the ring
+    size_t buffer_size;                 // Size (bytes) of each staging buffer
+    cl_int err;                         // Error code
+
+    std::vector<cl_mem>   staging_buffers;  // Pinned (CL_MEM_ALLOC_HOST_PTR) buffers
+    std::vector<char *>   staging_pointers; // Host mappings of the staging buffers
+    std::vector<cl_event> upload_events;    // Last upload from each staging buffer (NULL if none)
+
+    OpenCL_File_Reader *reader;
+
+public:
+    OpenCL_File_Loader();
+    ~OpenCL_File_Loader();
+    void Initialize(cl_context &_context, cl_command_queue &_command_queue,
+                    const size_t _buffer_size = 16 * 1024 * 1024,
+                    const int _nb_buffers = 4, const bool use_io_uring = true);
+    void Release_Memory();
+
+    // Both return an event (to be released by the caller) that completes
+    // when all the uploads are done.
+    cl_event Load(const std::string &filename, const uint64_t file_offset, const uint64_t size,
+                  cl_mem destination, const uint64_t destination_offset = 0);
+    template <class T>
+    cl_event Load(const std::string &filename, const uint64_t file_offset,
+                  OpenCL_Array<T> &array, const int offset = 0, const int count = -1);
+
+    const char *Backend() const;
+};
+
+// *****************************************************************************
+class OpenCL_Peer_Copier
+/**
+ * Copy device memory from one device to another. When both command queues
+ * share a context, a single clEnqueueCopyBuffer() is used. Otherwise (each
+ * OpenCL_device has its own context) the data goes through a ring of pinned
+ * host staging buffers, chunk by chunk: the download of the next chunks
+ * from the source device overlaps the upload of the current one to the
+ * destination device.
+ */
+{
+private:
+    cl_command_queue source_queue;      // Queue of the source device (downloads)
+    cl_command_queue destination_queue; // Queue of the destination device (uploads, direct copies)
+    cl_context source_context;          // Context of the source queue, owning the staging buffers
+    bool direct;                        // Both queues share a context
+    int nb_buffers;                     // Number of staging buffers in the ring
+    size_t buffer_size;                 // Size (bytes) of each staging buffer
+    cl_int err;                         // Error code
+
+    std::vector<cl_mem>   staging_buffers;  // Pinned (CL_MEM_ALLOC_HOST_PTR) buffers
+    std::vector<char *>   staging_pointers; // Host mappings of the staging buffers
+    std::vector<cl_event> download_events;  // Download into each staging buffer (NULL if none)
+    std::vector<cl_event> upload_events;    // Last upload from each staging buffer (NULL if none)
+
+    void Wait_and_Release(cl_event &event);
+
+public:
+    OpenCL_Peer_Copier();
+    ~OpenCL_Peer_Copier();
+    void Initialize(cl_command_queue &_source_queue, cl_command_queue &_destination_queue,
+                    const size_t _buffer_size = 8 * 1024 * 1024, const int _nb_buffers = 4);
+    void Release_Memory();
+
+    // Both return an event (to be released by the caller) that completes
+    // when the destination holds the data.
+    cl_event Copy(cl_mem source, const uint64_t source_offset,
+                  cl_mem destination, const uint64_t destination_offset, const uint64_t size);
+    template <class T>
+    cl_event Copy(OpenCL_Array<T> &source, OpenCL_Array<T> &destination,
+                  const int src_offset = 0, const int dst_offset = 0, const int count = -1);
+
+    inline bool Is_Direct() const       { return direct; }
 };
 
 // *****************************************************************************
@@ -528,17 +1644,99 @@ namespace OpenCL_SHA512
     #define SHA512_sigma0(word)     (SHA512_ROTR( 1,word) ^ SHA512_ROTR( 8,word) ^ SHA512_SHR( 7,word))
     #define SHA512_sigma1(word)     (SHA512_ROTR(19,word) ^ SHA512_ROTR(61,word) ^ SHA512_SHR( 6,word))
 
+    // Host implementations, selected at runtime from the CPU features.
+    // The SIMD ones hash several messages at once, one per 64 bits lane.
+    enum Implementation
+    {
+        IMPLEMENTATION_REFERENCE,       // RFC 4634 code, byte at a time
+        IMPLEMENTATION_SCALAR,          // Word loads, rolling message schedule
+        IMPLEMENTATION_SSE2,            // 2 messages at once
+        IMPLEMENTATION_AVX2,            // 4 messages at once
+        IMPLEMENTATION_AVX512,          // 8 messages at once
+        NB_IMPLEMENTATIONS
+    };
+    bool Implementation_Is_Supported(const Implementation implementation);
+    Implementation Best_Implementation();
+    const char *Implementation_Name(const Implementation implementation);
+    int Nb_Lanes(const Implementation implementation);
+
     void Prepare_Array_for_Checksuming(void **array, const uint64_t sizeof_element,
                                        uint64_t &array_size_bit);
+    // Messages must already be padded (see Prepare_Array_for_Checksuming()).
     void Calculate_Checksum(const void *_message, uint64_t length, uint8_t *_message_digest);
+    void Calculate_Checksum_Reference(const void *_message, uint64_t length, uint8_t *_message_digest);
+    void Calculate_Checksums(const int nb_messages, const void *const *messages, const uint64_t *lengths,
+                             uint8_t *message_digests, const Implementation implementation = Best_Implementation());
+    class Context
+    /**
+     * Incremental SHA-512: Initialize(), Update() with consecutive parts of
+     * the message (of any size), then Finalize(). The padding is added to the
+     * last block by Finalize(): the message is neither copied nor padded.
+     */
+    {
+    private:
+        uint64_t H[8];                  // Intermediate hash value
+        uint8_t  buffer[128];           // Start of an incomplete block
+        uint64_t size_bytes;            // Bytes given to Update() so far
+
+    public:
+        Context()                       { Initialize(); }
+        void Initialize();
+        void Update(const void *message, const uint64_t bytes);
+        void Finalize(uint8_t *message_digest);
+    };
+
+    // Unpadded message of "size_bytes" bytes (through a Context).
+    void Calculate_Message_Checksum(const void *message, const uint64_t size_bytes, uint8_t *message_digest);
+
+    // Tree mode: the message is cut in leaves of "leaf_size" bytes (a multiple
+    // of 128, the last leaf may be shorter). The checksum is the SHA-512 of
+    // the concatenated leaf checksums. Leaves are hashed by all cores.
+    uint64_t Nb_Leaves(const uint64_t size_bytes, const uint64_t leaf_size);
+    void Calculate_Leaf_Checksums(const void *message, const uint64_t size_bytes, const uint64_t leaf_size,
+                                  uint8_t *leaf_digests, const Implementation implementation = Best_Implementation());
+    void Calculate_Tree_Checksum(const void *message, const uint64_t size_bytes, const uint64_t leaf_size,
+                                 uint8_t *message_digest);
     void Print_Checksum(const uint8_t checksum[64]);
-    std::string Checksum_to_String(const uint8_t checksum[64]);
+    std::string Checksum_to_String(const uint8_t checksum[64], const int nb_bytes = 64);
     std::string String_Hexadecimal(const void *array, uint64_t size_bits);
     std::string String_Binary(const void *array, uint64_t size_bits);
 
     void Validation();
 }
 
+// *****************************************************************************
+namespace OpenCL_CRC32C
+{
+    // CRC32C (Castagnoli), with SSE4.2 when available. "crc" is the CRC of
+    // the preceding data, to continue a checksum.
+    uint32_t Calculate(const void *message, const uint64_t size_bytes, const uint32_t crc = 0);
+    // CRC of the concatenation of messages of CRCs crc1 and crc2.
+    uint32_t Combine(const uint32_t crc1, const uint32_t crc2, const uint64_t size2_bytes);
+
+    // Leaves of "leaf_size" bytes hashed by all cores; their combination is
+    // the CRC of the whole message.
+    void Calculate_Leaf_Checksums(const void *message, const uint64_t size_bytes, const uint64_t leaf_size,
+                                  uint32_t *leaf_crcs);
+    uint32_t Combine_Leaf_Checksums(const uint32_t *leaf_crcs, const uint64_t size_bytes, const uint64_t leaf_size);
+
+    void Validation();
+}
+
+// *****************************************************************************
+namespace OpenCL_XXH64
+{
+    uint64_t Calculate(const void *message, const uint64_t size_bytes, const uint64_t seed = 0);
+
+    // Leaves of "leaf_size" bytes hashed by all cores. The tree hash is the
+    // XXH64 of the leaf hashes in canonical (big-endian) form.
+    void Calculate_Leaf_Checksums(const void *message, const uint64_t size_bytes, const uint64_t leaf_size,
+                                  uint64_t *leaf_hashes);
+    uint64_t Calculate_Tree_Checksum(const uint64_t *leaf_hashes, const uint64_t nb_leaves);
+
+    void Validation();
+}
+
 #endif // INC_OCLUTILS_hpp
 
 // ********** End of file ***************************************